@@ -59,8 +59,12 @@ typedef struct DepsNode DepsNode;
 /* Relationship/link (A -> B) type in Depsgraph between Nodes */
 typedef struct DepsRelation DepsRelation;
 
+/* State of an evaluation which runs separately from the graph it was started from */
+typedef struct DepsgraphEvalState DepsgraphEvalState;
+
 /* ------------------------------------------------ */
 
+struct ListBase;
 struct Main;
 struct Scene;
 
@@ -81,6 +85,11 @@ Depsgraph *DEG_graph_new(void);
 /* Free Depsgraph itself and all its data */
 void DEG_graph_free(Depsgraph *graph);
 
+/* Make an independent copy of Depsgraph (e.g. for handing over to render jobs) 
+ * NOTE: subgraphs aren't copied yet
+ */
+Depsgraph *DEG_graph_copy(Depsgraph *graph);
+
 
 /* Node Types Registry ---------------------------- */
 
@@ -95,10 +104,74 @@ void DEG_free_node_types(void);
 /* Rebuild dependency graph only for a given scene */
 void DEG_scene_relations_rebuild(Depsgraph *graph, struct Main *bmain, struct Scene *scene);
 
+/* Rebuild only the parts of a scene's dependency graph which are for the given ID-blocks
+ * (i.e. after their relations have changed), instead of rebuilding the whole graph.
+ * < ids: (LinkData : ID) ID-blocks whose relations have changed
+ */
+void DEG_scene_relations_rebuild_ids(Depsgraph *graph, struct Main *bmain, struct Scene *scene, struct ListBase *ids);
+
+/* Only build the parts of the graph needed for visible objects, with placeholders for the rest
+ * (which get built when they become visible, see DEG_on_visible_update()) 
+ */
+void DEG_graph_set_lazy_build(Depsgraph *graph, const bool lazy);
+
 /* Create dependency graph if it was cleared or didn't exist yet */
 void DEG_scene_relations_update(struct Main *bmain, struct Scene *scene);
 
 
+/* Graph Cache ----------------------------------- */
+
+/* Write graph out to a cache file, so that it doesn't need to be rebuilt when loading again
+ * < returns: whether cache file was written (graphs with subgraphs can't be cached yet)
+ */
+bool DEG_graph_cache_write(const Depsgraph *graph, struct Scene *scene, const char *filepath);
+
+/* Build graph for scene from cache file, falling back to building it from scratch 
+ * if the cache file is missing or outdated
+ * < returns: whether graph was loaded from the cache file
+ */
+bool DEG_graph_build_from_cache(Depsgraph *graph, struct Main *bmain, struct Scene *scene, const char *filepath);
+
+/* Memory Statistics ----------------------------- */
+
+/* Number of node types that per-type statistics can be kept for (indexed by eDepsNode_Type) */
+#define DEG_STATS_MAX_NODE_TYPES   128
+
+/* Summary of memory used by a Depsgraph 
+ * NOTE: all sizes are in bytes
+ */
+typedef struct DepsgraphMemoryStats {
+	/* nodes */
+	size_t node_count[DEG_STATS_MAX_NODE_TYPES];  /* number of nodes of each type */
+	size_t node_bytes[DEG_STATS_MAX_NODE_TYPES];  /* memory used by nodes of each type (using their typeinfo's size) */
+	
+	size_t total_nodes;                           /* total number of nodes in graph */
+	size_t total_node_bytes;                      /* total memory used by nodes */
+	
+	/* relations */
+	size_t num_relations;                         /* number of relations in graph */
+	size_t relation_bytes;                        /* memory used by relations themselves */
+	
+	size_t num_links;                             /* number of LinkData items (in/out links of nodes, and graph-level lists) */
+	size_t link_bytes;                            /* memory used by LinkData items */
+	
+	/* lookup + evaluation data */
+	size_t ghash_bytes;                           /* (estimated) memory used by id_hash, component_hash, op_hash, bone_hash, etc. */
+	size_t eval_context_bytes;                    /* memory used by evaluation contexts */
+	
+	/* totals */
+	size_t graph_bytes;                           /* memory used by the graph struct itself */
+	size_t total_bytes;                           /* sum of all of the above */
+	
+	size_t peak_build_bytes;                      /* high-water mark reached by nodes + relations while building the graph */
+} DepsgraphMemoryStats;
+
+/* Gather statistics about the memory used by the given graph */
+void DEG_graph_memory_stats(const Depsgraph *graph, DepsgraphMemoryStats *stats);
+
+/* Print summary of memory statistics to the console */
+void DEG_graph_memory_stats_print(const DepsgraphMemoryStats *stats);
+
 /* Update Tagging -------------------------------- */
 
 /* Tag a specific node as needing updates */
@@ -108,13 +181,25 @@ void DEG_node_tag_update(Depsgraph *graph, DepsNode *node);
 /* Tag node(s) associated with states such as time and visibility */
 // XXX: what are these for?
 void DEG_scene_update_flags(Depsgraph *graph, const bool do_time);
-void DEG_on_visible_update(Depsgraph *graph, const bool do_time);
+void DEG_on_visible_update(Depsgraph *graph, struct Main *bmain, const bool do_time);
 
 /* Tag node(s) associated with changed data for later updates */
 void DEG_id_tag_update(Depsgraph *graph, const ID *id);
 void DEG_data_tag_update(Depsgraph *graph, const struct PointerRNA *ptr);
 void DEG_property_tag_update(Depsgraph *graph, const struct PointerRNA *ptr, const struct PropertyRNA *prop);
 
+/* Tag node associated with the given RNA path (e.g. from a driver or F-Curve) for later updates
+ * NOTE: resolved paths are cached by the graph, so it's cheap to keep doing this for the same path
+ */
+void DEG_rna_path_tag_update(Depsgraph *graph, const ID *id, const char *path);
+
+/* Get handle for the node associated with the given RNA path, for passing to DEG_node_tag_update()
+ * (instead of resolving the path again each time)
+ * NOTE: handles are only valid until nodes get removed from the graph (i.e. it gets rebuilt)
+ * < returns: NULL if there's no such node
+ */
+DepsNode *DEG_find_node_from_rna_path(Depsgraph *graph, const ID *id, const char path[]);
+
 /* Update Flushing ------------------------------- */
 
 /* Flush updates */
@@ -148,11 +233,14 @@ typedef enum eEvaluationContextType {
 
 
 /* Intialise evaluation context 
+ * NOTE: the contexts for components only get made once they're needed during evaluation
  * < context_type: type of evaluation context to initialise
  */
 void DEG_evaluation_context_init(Depsgraph *graph, eEvaluationContextType context_type);
 
-/* Free evaluation context */
+/* Free evaluation context 
+ * NOTE: contexts are otherwise kept between evaluations, until the components they belong to are freed
+ */
 void DEG_evaluation_contexts_free(Depsgraph *graph);
 
 /* ----------------------------------------------- */
@@ -170,6 +258,25 @@ void DEG_evaluate_on_refresh(Depsgraph *graph, eEvaluationContextType context_ty
 
 /* ----------------------------------------------- */
 
+/* Prepare evaluation of graph as it is now, which can then be done without 
+ * blocking graph (e.g. renders, which can run while viewport keeps being updated)
+ * NOTE: the graph itself only gets copied when it has changed since last time
+ *
+ * < context_type: context to perform evaluation for
+ * > returns: state for evaluation (to be freed using DEG_eval_state_free())
+ */
+DepsgraphEvalState *DEG_eval_state_new(Depsgraph *graph, eEvaluationContextType context_type);
+
+/* Evaluate nodes which were tagged for updating when evaluation was prepared 
+ * (can be called from any thread)
+ */
+void DEG_evaluate_state(DepsgraphEvalState *state);
+
+/* Free evaluation state (can be called from any thread) */
+void DEG_eval_state_free(DepsgraphEvalState *state);
+
+/* ----------------------------------------------- */
+
 /* Initialise threading lock - called during application startup */
 void DEG_threaded_init(void);
 
@@ -57,22 +57,42 @@ typedef bool (*DEG_FilterPredicate)(const Depsgraph *graph, const DepsNode *node
  */
 typedef bool (*DEG_NodeOperation)(const Depsgraph *graph, DepsNode *node, void *userdata);
 
+
+/* Subgraph View
+ *
+ * A subset of the nodes in a graph, which just refers to the graph's own nodes
+ * (instead of being a copy of them). Views are only valid until the graph gets 
+ * changed, and should be freed using DEG_view_free() once they're no longer needed.
+ */
+typedef struct DepsgraphView DepsgraphView;
+
+/* Iterator for going over the nodes in a view */
+typedef struct DepsgraphViewIterator {
+	const DepsgraphView *view;
+	int word;           /* index of the part of the view's bitset being looked at */
+	uint64_t bits;      /* nodes from that part of the bitset which haven't been visited yet */
+} DepsgraphViewIterator;
+
 /* ************************************************ */
 /* Low-Level Filtering API */
 
-/* Create a filtered copy of the given graph which contains only the
- * nodes which fulfill the criteria specified using the FilterPredicate
- * passed in.
+/* Filter the given graph, to get the nodes which fulfill the criteria 
+ * specified using the FilterPredicate passed in.
+ *
+ * This doesn't copy anything - the result is a view of the matching nodes,
+ * along with the relations between them, so several filtered graphs (e.g. for
+ * different evaluation contexts) can be used at once without using much memory.
+ * Use DEG_view_materialise() to get a standalone copy instead.
  *
- * < graph: The graph to be copied and filtered
+ * < graph: The graph to be filtered
  * < filter: FilterPredicate used to check which nodes should be included
- *           (If null, full graph is copied as-is)
+ *           (If null, all nodes are included)
  * < userdata: State data for filter (as necessary)
  *
- * > returns: a full copy of all the relevant nodes - the matching subgraph
+ * > returns: view of all the relevant nodes - the matching subgraph (to be freed using DEG_view_free())
  */
 // XXX: is there any need for extra settings/options for how the filtering goes?
-Depsgraph *DEG_graph_filter(const Depsgraph *graph, DEG_FilterPredicate *filter, void *userdata);
+DepsgraphView *DEG_graph_filter(Depsgraph *graph, DEG_FilterPredicate filter, void *userdata);
 
 
 /* Traverse nodes in graph which are deemed relevant,
@@ -88,9 +108,21 @@ Depsgraph *DEG_graph_filter(const Depsgraph *graph, DEG_FilterPredicate *filter,
  * < op_data: Custom state data for NodeOperation
  *            (Note: This can be the same as filter_data, where appropriate)
  */
-void DEG_graph_traverse(const Depsgraph *graph,
-                        DEG_FilterPredicate *filter, void *filter_data,
-                        DEG_NodeOperation *op, void *op_data);
+void DEG_graph_traverse(Depsgraph *graph,
+                        DEG_FilterPredicate filter, void *filter_data,
+                        DEG_NodeOperation op, void *op_data);
+
+
+/* Traverse nodes in view (e.g. from DEG_graph_filter()) in evaluation order,
+ * performing the provided operation on the nodes.
+ * NOTE: only relations between nodes in the view are taken into account,
+ *       and nodes which are part of a cycle never get visited
+ *
+ * < view: The nodes to perform operations on
+ * < op: NodeOperation to perform on each node (traversal stops when this returns true)
+ * < op_data: Custom state data for NodeOperation
+ */
+void DEG_view_traverse(const DepsgraphView *view, DEG_NodeOperation op, void *op_data);
 
 /* ************************************************ */
 /* Node-Based Operations */
@@ -106,7 +138,37 @@ void DEG_graph_traverse(const Depsgraph *graph,
 
 /* Topology Queries (Direct) ---------------------- */
 
+/* Relation type to pass to DEG_node_relations_iter_begin() to get relations of any type */
+#define DEG_RELATION_TYPE_ANY  (-1)
+
+/* Cursor for going over the nodes directly linked to a node 
+ * NOTE: this doesn't allocate anything, so it's fine to use on every redraw
+ */
+typedef struct DepsNodeRelationsIterator {
+	struct LinkData *link;    /* next link to check */
+	bool outgoing;            /* going over nodes which depend on node (true), or which it depends on (false) */
+	int type;                 /* (eDepsRelation_Type) only nodes linked by this type of relation, or DEG_RELATION_TYPE_ANY */
+} DepsNodeRelationsIterator;
+
+/* Start going over nodes directly linked to node
+ * < outgoing: True = nodes which depend on node, False = nodes which node depends on
+ * < type: (eDepsRelation_Type) only nodes linked by this type of relation, or DEG_RELATION_TYPE_ANY
+ */
+void DEG_node_relations_iter_begin(DepsNodeRelationsIterator *iter, const DepsNode *node, 
+                                   const bool outgoing, const int type);
+
+/* Get next linked node
+ * > r_rel: (optional) relation linking the nodes
+ * > returns: NULL once all linked nodes have been visited
+ */
+DepsNode *DEG_node_relations_iter_next(DepsNodeRelationsIterator *iter, DepsRelation **r_rel);
+
+/* Stop going over linked nodes (there's nothing to free, so this can be skipped when breaking out early) */
+void DEG_node_relations_iter_end(DepsNodeRelationsIterator *iter);
+
+
 /* Get list of nodes which directly depend on given node  
+ * NOTE: this allocates a LinkData per node, so use DEG_node_relations_iter_begin() where possible
  *
  * > result: list to write results to
  * < node: the node to find the children/dependents of
@@ -115,6 +177,7 @@ void DEG_node_get_children(ListBase *result, const DepsNode *node);
 
 
 /* Get list of nodes which given node directly depends on 
+ * NOTE: this allocates a LinkData per node, so use DEG_node_relations_iter_begin() where possible
  *
  * > result: list to write results to
  * < node: the node to find the dependencies of
@@ -123,9 +186,10 @@ void DEG_node_get_dependencies(ListBase *result, const DepsNode *node);
 
 
 /* Topology Queries (Subgraph) -------------------- */
-// XXX: given that subgraphs potentially involve many interconnected nodes, we currently
-//      just spit out a copy of the subgraph which matches. This works well for the cases
-//      where these are used - mostly for efficient updating of subsets of the nodes.
+// XXX: given that subgraphs potentially involve many interconnected nodes, we 
+//      just return a view of the nodes which match. Most of the time, these just
+//      get iterated over once, so making a copy of them would cost more than finding
+//      them in the first place. Use DEG_view_materialise() if a copy really is needed.
 
 // XXX: allow supplying a filter predicate to provide further filtering/pruning?
 
@@ -134,36 +198,123 @@ void DEG_node_get_dependencies(ListBase *result, const DepsNode *node);
  *
  * That is, get the subgraph / subset of nodes which are dependent
  * on the results of the given node.
+ *
+ * > returns: view of the matching nodes (to be freed using DEG_view_free())
  */
-Depsgraph *DEG_node_get_descendents(const Depsgraph *graph, const DepsNode *node);
+DepsgraphView *DEG_node_get_descendents(Depsgraph *graph, const DepsNode *node);
 
 
 /* Get all ancestors of a node 
  *
  * That is, get the subgraph / subset of nodes which the given node
  * is dependent on in order to be evaluated.
+ *
+ * > returns: view of the matching nodes (to be freed using DEG_view_free())
+ */
+DepsgraphView *DEG_node_get_ancestors(Depsgraph *graph, const DepsNode *node);
+
+/* Subgraph Views --------------------------------- */
+
+/* Get number of nodes in view */
+size_t DEG_view_num_nodes(const DepsgraphView *view);
+
+/* Check if node is part of view */
+bool DEG_view_has_node(const DepsgraphView *view, const DepsNode *node);
+
+
+/* Start iterating over the nodes in view (in the order they're stored in the graph) */
+void DEG_view_iter_init(DepsgraphViewIterator *iter, const DepsgraphView *view);
+
+/* Get next node in view
+ * > returns: NULL once all nodes have been visited
  */
-Depsgraph *DEG_node_get_ancestors(const Depsgraph *graph, const DepsNode *node);
+DepsNode *DEG_view_iter_step(DepsgraphViewIterator *iter);
+
+/* Convenience macros for iterating over the nodes in a view */
+#define DEG_VIEW_ITER_BEGIN(view, node_)                                              \
+	{                                                                                \
+		DepsgraphViewIterator __view_iter;                                           \
+		DepsNode *node_;                                                             \
+		DEG_view_iter_init(&__view_iter, view);                                      \
+		while ((node_ = DEG_view_iter_step(&__view_iter))) {
+			
+			/* ... code for iterator body can be written here ... */
+
+#define DEG_VIEW_ITER_END                                                            \
+		}                                                                            \
+	}
+
+
+/* Make a standalone copy of the nodes in view
+ * NOTE: ID-blocks with nodes in the view get copied in full, but only the relations
+ *       between nodes in the view are kept
+ *
+ * > returns: a new graph (to be freed using DEG_graph_free())
+ */
+Depsgraph *DEG_view_materialise(const DepsgraphView *view);
+
+/* Free view */
+void DEG_view_free(DepsgraphView *view);
 
 /* ************************************************ */
 /* Higher-Level Queries */
 
 /* Get ID-blocks which would be affected if specified ID is modified 
+ * < graph: the graph to look at
  * < only_direct: True = Only ID-blocks with direct relationships to ID-block will be returned
  *
- * > result: (LinkData : ID) a list of ID-blocks matching the specified criteria
+ * > result: (LinkData : ID) a list of ID-blocks matching the specified criteria (in evaluation order)
  * > returns: number of matching ID-blocks
  */
-size_t DEG_query_affected_ids(ListBase *result, const ID *id, const bool only_direct);
+size_t DEG_query_affected_ids(Depsgraph *graph, ListBase *result, const ID *id, const bool only_direct);
 
 
 /* Get ID-blocks which are needed to update/evaluate specified ID 
+ * < graph: the graph to look at
  * < only_direct: True = Only ID-blocks with direct relationships to ID-block will be returned
  *
- * > result: (LinkData : ID) a list of ID-blocks mathcing the specified criteria
+ * > result: (LinkData : ID) a list of ID-blocks mathcing the specified criteria (in evaluation order)
  * > returns: number of matching ID-blocks
  */
-size_t DEG_query_required_ids(ListBase *result, const ID *id, const bool only_direct);
+size_t DEG_query_required_ids(Depsgraph *graph, ListBase *result, const ID *id, const bool only_direct);
+
+
+/* Batch Queries ---------------------------------- */
+/* These give the same results as calling the single-ID versions for each ID-block
+ * in turn, but are much faster when there are lots of ID-blocks to check, as all
+ * of them get handled in a single pass over the graph (per 64 ID-blocks).
+ */
+
+/* Get ID-blocks which would be affected if each of the specified ID's is modified 
+ * < graph: the graph to look at
+ * < ids: (num_ids) ID-blocks to find the affected ID-blocks for
+ * < only_direct: True = Only ID-blocks with direct relationships to ID-blocks will be returned
+ *
+ * > results: (num_ids) list of ID-blocks affected by each ID-block - (LinkData : ID) 
+ */
+void DEG_query_affected_ids_batch(Depsgraph *graph, ListBase *results, const ID **ids, const int num_ids,
+                                  const bool only_direct);
+
+/* Get ID-blocks which are needed to update/evaluate each of the specified ID's 
+ * < graph: the graph to look at
+ * < ids: (num_ids) ID-blocks to find the required ID-blocks for
+ * < only_direct: True = Only ID-blocks with direct relationships to ID-blocks will be returned
+ *
+ * > results: (num_ids) list of ID-blocks required by each ID-block - (LinkData : ID) 
+ */
+void DEG_query_required_ids_batch(Depsgraph *graph, ListBase *results, const ID **ids, const int num_ids,
+                                  const bool only_direct);
+
+
+/* Check whether an ID-block would be affected if another one is modified 
+ * NOTE: this is a constant-time lookup, once the graph's query index is up to date
+ *
+ * < graph: the graph to look at
+ * < id: the ID-block which may need updating
+ * < modified_id: the ID-block which gets modified
+ * > returns: True if id depends on modified_id (directly or not)
+ */
+bool DEG_query_id_is_affected_by(Depsgraph *graph, const ID *id, const ID *modified_id);
 
 /* ************************************************ */
 
@@ -40,18 +40,31 @@
  *
  * This contains standard information that most/all
  * operations will inevitably need at some point.
+ *
+ * Each evaluation has a single "master" context with the info which
+ * is the same for everything (i.e. Main, scene, frame). The contexts for
+ * components refer to this instead of having their own copies, so only the
+ * master context has these set (use DEG_CONTEXT_MASTER() to get to them).
  */
 typedef struct DEG_OperationsContext {
-	Main *bmain;          /* scene database to query data from (if needed) */
-	Scene *scene;         /* current scene we're working with */
+	const struct DEG_OperationsContext *master; /* shared context for whole evaluation (read-only) - NULL for master itself */
+	
+	Main *bmain;          /* scene database to query data from (if needed) - master only */
+	Scene *scene;         /* current scene we're working with - master only */
 	
-	double cfra;          /* current frame (including subframe offset stuff) */
+	double cfra;          /* current frame (including subframe offset stuff) - master only */
 	
 	int type;             /* (eDepsNode_Type.OuterNodes) component type <-> context type (for debug purposes) */
 	short utype;          /* (eDEG_OperationContext_UserType) evaluation user type */
 	short flag;           /* (eDEG_OperationContext_Flag) extra settings */
+	
+	const void *source;   /* data that context was set up for (i.e. object, pose) - if this changes, the context gets set up again */
 } DEG_OperationsContext;
 
+/* Get the master context that shared info (bmain, scene, cfra) can be read from */
+#define DEG_CONTEXT_MASTER(ctx) \
+	(((ctx)->master) ? (ctx)->master : (const DEG_OperationsContext *)(ctx))
+
 /* Settings */
 typedef enum eDEG_OperationContext_Flag {
 	/* we're dealing with an instanced item... */
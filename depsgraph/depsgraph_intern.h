@@ -33,6 +33,19 @@
 struct Main;
 struct Group;
 struct Scene;
+struct Object;
+struct bConstraint;
+struct ParticleSystem;
+
+struct DepsgraphView;
+struct MemArena;
+
+/* Storage for variables which each thread has its own copy of */
+#ifdef _MSC_VER
+#  define DEG_THREAD_LOCAL __declspec(thread)
+#else
+#  define DEG_THREAD_LOCAL __thread
+#endif
 
 /* Low-Level Querying ============================================== */
 
@@ -52,6 +65,21 @@ struct Scene;
 DepsNode *DEG_find_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME], 
                         eDepsNode_Type type, const char name[DEG_MAX_ID_NAME]);
 
+/* Find operation node which matches the specified description
+ * ! Arguments are as for DEG_find_node(), except that "type" must be an operation type
+ *
+ * < (handle): data item that operation was added for (see DEG_add_operation_ex())
+ */
+DepsNode *DEG_find_operation(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
+                             eDepsNode_Type type, const char name[DEG_MAX_ID_NAME],
+                             const void *handle);
+
+/* Find operation node within the given component 
+ * ! Passing one of the DEG_OPNAME_* names avoids having to hash the name string
+ */
+DepsNode *DEG_component_find_operation(const ComponentDepsNode *component, eDepsNode_Type type, 
+                                       const char name[DEG_MAX_ID_NAME], const void *handle);
+
 
 /* Determine node-querying criteria for finding a suitable node,
  * given a RNA Pointer (and optionally, a property too)
@@ -105,6 +133,9 @@ DepsNode *DEG_get_node_from_pointer(Depsgraph *graph, const PointerRNA *ptr, con
  */
 DepsNode *DEG_get_node_from_rna_path(Depsgraph *graph, const ID *id, const char path[]);
 
+/* Throw away cached results of resolving RNA paths (i.e. after nodes have been removed) */
+void DEG_graph_rna_path_cache_clear(Depsgraph *graph);
+
 /* Graph Building ===================================================== */
 /* Node Management ---------------------------------------------------- */
 
@@ -131,7 +162,9 @@ void DEG_add_node(Depsgraph *graph, DepsNode *node, const ID *id);
 DepsNode *DEG_add_new_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
                            eDepsNode_Type type, const char name[DEG_MAX_ID_NAME]);
 
-/* Remove node from graph, but don't free any of its data */
+/* Remove node from graph, but don't free any of its data 
+ * ! Relations linking to the node are freed though, as nothing else uses these
+ */
 void DEG_remove_node(Depsgraph *graph, DepsNode *node);
 
 /* Free node data but not node itself 
@@ -140,6 +173,22 @@ void DEG_remove_node(Depsgraph *graph, DepsNode *node);
  */
 void DEG_free_node(DepsNode *node);
 
+/* Free node itself, once DEG_free_node() has been used to free its data
+ * ! Nodes in a snapshot are left alone, as they get freed along with the graph
+ */
+void DEG_free_node_mem(DepsNode *node);
+
+/* Node Iteration -------------------------------------------------- */
+
+/* Callback for DEG_node_foreach_owned() */
+typedef void (*DEG_NodeCallback)(DepsNode *node, void *userdata);
+
+/* Perform callback on given node, and all the nodes that it owns 
+ * (i.e. time source for root, components for ID's, operations and bones for components).
+ * Owners are visited before the nodes they own.
+ */
+void DEG_node_foreach_owned(DepsNode *node, DEG_NodeCallback func, void *userdata);
+
 /* Convenience API ------------------------------------------------- */
 
 /* Create a new node for representing an operation and add this to graph
@@ -157,6 +206,17 @@ OperationDepsNode *DEG_add_operation(Depsgraph *graph, ID *id, const char subdat
                                      eDepsNode_Type type, eDepsOperation_Type optype, 
                                      DepsEvalOperationCb op, const char name[DEG_MAX_ID_NAME]);
 
+/* Create a new node for representing an operation on a specific data item, and add this to graph
+ * ! Arguments are as for DEG_add_operation()
+ *
+ * < (handle): data item that operation is for. This is used to tell apart several operations
+ *             which would otherwise have the same name (e.g. the drivers on an ID-block)
+ */
+OperationDepsNode *DEG_add_operation_ex(Depsgraph *graph, ID *id, const char subdata[MAX_NAME],
+                                        eDepsNode_Type type, eDepsOperation_Type optype, 
+                                        DepsEvalOperationCb op, const char name[DEG_MAX_ID_NAME],
+                                        const void *handle);
+
 /* Graph Validity -------------------------------------------------- */
 
 /* Ensure that all implicit constraints between nodes are satisfied 
@@ -164,12 +224,37 @@ OperationDepsNode *DEG_add_operation(Depsgraph *graph, ID *id, const char subdat
  */
 void DEG_graph_validate_links(Depsgraph *graph);
 
+/* Ensure that links are valid for the given ID nodes only (e.g. those affected by a partial rebuild) */
+void DEG_graph_validate_id_links(Depsgraph *graph, DepsNode **id_nodes, int num_id_nodes);
+
 
 /* Sort nodes to determine evaluation order for operation nodes
  * where dependency relationships won't get violated.
  */
 void DEG_graph_sort(Depsgraph *graph);
 
+/* Graph Contents -------------------------------------------------- */
+
+/* Move the contents of one graph into another, and free the emptied graph
+ * (i.e. for combining graphs which were built separately on different threads).
+ * Nodes in src which duplicate existing ones in graph get replaced by those.
+ */
+void DEG_graph_merge(Depsgraph *graph, Depsgraph *src);
+
+/* Splice subgraphs which are only used once into the graph, replacing the subgraph nodes
+ * (i.e. groups which are only instanced once, which can then be scheduled along with everything else)
+ * < returns: true if any subgraphs were inlined (so the links of their contents need validating)
+ */
+bool DEG_graph_inline_subgraphs(Depsgraph *graph);
+
+/* Remove instances of subgraphs which are made by the given object
+ * (i.e. when object is being removed from graph, or is being built again)
+ */
+void DEG_graph_remove_instances(Depsgraph *graph, const struct Object *ob);
+
+/* Remove and free all nodes and relations in graph, leaving it empty and ready to be built again */
+void DEG_graph_clear(Depsgraph *graph);
+
 
 /* Relationships Handling ============================================== */
 
@@ -207,16 +292,25 @@ DepsRelation *DEG_create_new_relation(DepsNode *from, DepsNode *to,
                                       eDepsRelation_Type type, 
                                       const char description[DEG_MAX_ID_NAME]);
 
-/* Add given relationship to the graph */
-void DEG_add_relation(DepsRelation *rel);
+/* Add given relationship to the graph 
+ * ! If an equivalent relationship (same from, to, and type) already exists,
+ *   the given one gets merged into it and freed; the existing one is returned instead
+ */
+DepsRelation *DEG_add_relation(Depsgraph *graph, DepsRelation *rel);
 
 
-/* Add new relationship between two nodes */
-DepsRelation *DEG_add_new_relation(DepsNode *from, DepsNode *to,
+/* Add new relationship between two nodes 
+ * ! Duplicates of existing relationships are merged (see DEG_add_relation())
+ */
+DepsRelation *DEG_add_new_relation(Depsgraph *graph, DepsNode *from, DepsNode *to,
                                    eDepsRelation_Type type, 
                                    const char description[DEG_MAX_ID_NAME]);
 
 
+/* Find existing relationship between two nodes, with the specified type */
+DepsRelation *DEG_find_relation(Depsgraph *graph, DepsNode *from, DepsNode *to,
+                                eDepsRelation_Type type);
+
 /* Remove relationship from graph, but don't free it yet */
 void DEG_remove_relation(Depsgraph *graph, DepsRelation *rel);
 
@@ -226,19 +320,60 @@ void DEG_remove_relation(Depsgraph *graph, DepsRelation *rel);
  */
 void DEG_free_relation(DepsRelation *rel);
 
+/* Statistics ============================================================ */
+
+/* Note that some memory was allocated for graph (i.e. for node or relation being added) */
+void DEG_stats_mem_alloc(Depsgraph *graph, size_t size);
+
+/* Note that some memory was released from graph (i.e. node or relation was removed) */
+void DEG_stats_mem_free(Depsgraph *graph, size_t size);
+
 /* Graph Building ======================================================== */
 
 /* Build depsgraph for the given group, and dump results in given graph container 
  * This is usually used for building subgraphs for groups to use...
  */
-void DEG_graph_build_from_group(Depsgraph *graph, struct Main *bmain, struct Group *group);
+void DEG_graph_build_from_group(Depsgraph *graph, struct Main *bmain, struct Scene *scene, struct Group *group);
 
-/* Build subgraph for group */
-DepsNode *DEG_graph_build_group_subgraph(Depsgraph *graph_main, struct Main *bmain, struct Group *group);
+/* Build subgraph for group, or get the existing one if it's been built already
+ * NOTE: instances of the group all share the same subgraph
+ */
+DepsNode *DEG_graph_build_group_subgraph(Depsgraph *graph_main, struct Main *bmain, struct Scene *scene, struct Group *group);
 
 /* Build depsgraph for the given scene, and dump results in given graph container */
 void DEG_graph_build_from_scene(Depsgraph *graph, struct Main *bmain, struct Scene *scene);
 
+/* Work out which CustomData layers each geometry component needs to evaluate,
+ * based on what the things using the geometry need (once all relations have been built)
+ */
+void DEG_graph_build_customdata_masks(Depsgraph *graph);
+
+/* Builder Inputs -------------------------------------------------------- 
+ * NOTE: these are also used when checking whether cached graphs are still valid,
+ *       so the settings that the builders depend on should be found through these
+ */
+
+/* Get the chain of bones that IK/Spline IK solver constraint affects
+ * > r_use_tip: bone with the constraint is part of the chain
+ * > r_chainlen: number of bones in chain (including the tip if used), or 0 for all of them
+ * < returns: false if constraint isn't a solver
+ */
+bool DEG_constraint_solver_chain(const struct bConstraint *con, bool *r_use_tip, int *r_chainlen);
+
+/* Callback for DEG_particle_system_foreach_target() 
+ * < target: object that particle system depends on
+ * < type: type of component on target that particle system depends on
+ * < rel_type, description: relation to add for this
+ */
+typedef void (*DEG_ParticleTargetCallback)(void *userdata, struct Object *target, eDepsNode_Type type,
+                                           eDepsRelation_Type rel_type, const char *description);
+
+/* Perform callback on each of the objects that particle system depends on (i.e. effectors, boid rules)
+ * NOTE: nothing is done for particle systems which aren't enabled
+ */
+void DEG_particle_system_foreach_target(struct Scene *scene, struct Object *ob, struct ParticleSystem *psys,
+                                        DEG_ParticleTargetCallback func, void *userdata);
+
 /* Graph Copying ========================================================= */
 /* (Part of the Filtering API) */
 
@@ -275,6 +410,280 @@ DepsNode *DEG_copy_node(DepsgraphCopyContext *dcc, const DepsNode *src);
 /* Make a copy of given relationship */
 DepsRelation *DEG_copy_relation(const DepsRelation *src);
 
+/* Make a standalone copy of graph, using several threads if there are enough nodes
+ * < view: (optional) only copy ID-blocks with nodes in this view, and relations between those nodes
+ * > r_nodes: (optional) copy of each node in graph's node table (or NULL where not copied) - to be freed by caller
+ * > r_rels: (optional) copy of each relation in node table's out_targets (or NULL where not copied) - to be freed by caller
+ */
+Depsgraph *DEG_graph_copy_ex(Depsgraph *graph, const struct DepsgraphView *view, 
+                             DepsNode ***r_nodes, DepsRelation ***r_rels);
+
+/* Bitsets ============================================================= */
+/* (Sets of nodes/ID-blocks, stored as arrays of 64-bit words) */
+
+#define DEG_BITSET_NUM_WORDS(num_bits)   (((num_bits) + 63) / 64)
+#define DEG_BITSET_TEST(bits, i)         (((bits)[(i) >> 6] & ((uint64_t)1 << ((i) & 63))) != 0)
+#define DEG_BITSET_ENABLE(bits, i)       ((bits)[(i) >> 6] |= ((uint64_t)1 << ((i) & 63)))
+
+/* Get index of the lowest bit set in a (non-zero) word */
+BLI_INLINE int DEG_bitset_lowest_bit(uint64_t word)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(word);
+#else
+	int i = 0;
+	
+	while ((word & 1) == 0) {
+		word >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+/* Reachability Index ================================================== */
+/* (Used for ID-level queries - see depsgraph_query_index.c) */
+
+/* Precomputed reachability between the ID-blocks in a graph
+ *
+ * ID-blocks which depend on each other (i.e. are part of a cycle) get grouped
+ * into a single "component", with components being numbered in topological 
+ * order (i.e. dependencies come first). Links between ID-blocks are stored as
+ * flat arrays, where the links for ID i are targets[offsets[i] ... offsets[i + 1] - 1].
+ */
+typedef struct DepsgraphReachability {
+	/* ID-blocks */
+	int num_ids;                 /* number of ID nodes indexed */
+	DepsNode **id_nodes;         /* (num_ids) ID nodes (or subgraphs) indexed */
+	GHash *id_index;             /* <ID : int> index of ID-block in id_nodes (+1, so that 0 means "not found") */
+	
+	int *out_offsets;            /* (num_ids + 1) start of each ID's links in out_targets */
+	int *out_targets;            /* IDs which depend on each ID */
+	int *in_offsets;             /* (num_ids + 1) start of each ID's links in in_targets */
+	int *in_targets;             /* IDs which each ID depends on */
+	
+	/* Components */
+	int num_comps;               /* number of components */
+	int *comp_of;                /* (num_ids) component that each ID belongs to */
+	int *comp_offsets;           /* (num_comps + 1) start of each component's members in comp_members */
+	int *comp_members;           /* (num_ids) IDs in each component */
+	
+	/* Transitive Closure
+	 * NOTE: this is only built for graphs with a limited number of components (since it takes up
+	 *       num_comps^2 bits), so these are NULL for bigger ones - use DEG_reachability_comp_bits()
+	 */
+	int num_words;               /* number of words used for each component's bitset */
+	uint64_t *descendants;       /* (num_comps * num_words) components which depend on each component (directly or not) */
+	uint64_t *ancestors;         /* (num_comps * num_words) components which each component depends on (directly or not) */
+} DepsgraphReachability;
+
+/* Get bitset for component c */
+#define DEG_REACH_COMP_BITS(reach, bitsets, c)   ((bitsets) + ((size_t)(c) * (reach)->num_words))
+
+/* Get reachability index for graph, (re)building it if the graph has changed since it was last used */
+DepsgraphReachability *DEG_graph_reachability_ensure(Depsgraph *graph);
+
+/* Tag query indices (i.e. reachability index and node table) as being out of date, 
+ * after relations/nodes have been added or removed 
+ */
+void DEG_graph_query_index_invalidate(Depsgraph *graph);
+
+/* Get index of ID-block in reachability index (or -1 if it isn't in the graph) */
+int DEG_reachability_id_index(const DepsgraphReachability *reach, const ID *id);
+
+/* Get ID-block at given index */
+ID *DEG_reachability_get_id(const DepsgraphReachability *reach, int index);
+
+/* Check if the ID at index "from" affects the ID at index "to" */
+bool DEG_reachability_test(const DepsgraphReachability *reach, int from, int to);
+
+/* Enable the components downstream (or upstream) of component c in the given (cleared) bitset */
+void DEG_reachability_comp_bits(const DepsgraphReachability *reach, bool downstream, int c, uint64_t *bits);
+
+/* Add the ID-blocks in the components set in the given bitset to the list, leaving out the one at index "skip" */
+size_t DEG_reachability_bits_to_list(const DepsgraphReachability *reach, const uint64_t *bits, int skip,
+                                     ListBase *result);
+
+/* Node Table ---------------------------------------------------------- */
+
+/* Flat snapshot of the nodes and relations in a graph
+ *
+ * Each node gets a dense index, so that sets of nodes can be stored as bitsets
+ * (see DepsgraphView), and so that the links between them can be followed without
+ * chasing LinkData pointers. As with the reachability index, the links for node i
+ * are targets[offsets[i] ... offsets[i + 1] - 1], with rels[] holding the relations
+ * they came from (for checking their flags).
+ */
+typedef struct DepsgraphNodeTable {
+	int num_nodes;               /* number of nodes in graph */
+	DepsNode **nodes;            /* (num_nodes) all nodes in graph - root first, then each ID-block's nodes */
+	GHash *node_index;           /* <DepsNode : int> index of node in nodes (+1, so that 0 means "not found") */
+	
+	int num_rels;                /* number of relations in graph */
+	int *out_offsets;            /* (num_nodes + 1) start of each node's links in out_targets */
+	int *out_targets;            /* (num_rels) nodes which depend on each node */
+	DepsRelation **out_rels;     /* (num_rels) relation for each link in out_targets */
+	int *in_offsets;             /* (num_nodes + 1) start of each node's links in in_targets */
+	int *in_targets;             /* (num_rels) nodes which each node depends on */
+	DepsRelation **in_rels;      /* (num_rels) relation for each link in in_targets */
+	int *in_links;               /* (num_rels) index of each link in in_targets within out_targets (i.e. where same relation is found) */
+} DepsgraphNodeTable;
+
+/* Get node table for graph, (re)building it if the graph has changed since it was last used */
+DepsgraphNodeTable *DEG_graph_node_table_ensure(Depsgraph *graph);
+
+/* Get index of node in node table (or -1 if it isn't in the graph) */
+int DEG_node_table_index(const DepsgraphNodeTable *table, const DepsNode *node);
+
+/* Free node table */
+void DEG_node_table_free(DepsgraphNodeTable *table);
+
+/* Subgraph View (see BKE_depsgraph_query.h) */
+struct DepsgraphView {
+	Depsgraph *graph;            /* graph that the nodes belong to */
+	DepsgraphNodeTable *table;   /* graph's node table - the bitset refers to the indices of the nodes in this */
+	
+	uint64_t *members;           /* (num_words) bitset of nodes in view */
+	int num_words;               /* number of words in bitset */
+	size_t num_nodes;            /* number of nodes in view */
+	
+	uint64_t *links;             /* bitset of links (in table's out_targets) that can be followed - only for filtered graphs.
+	                              * When NULL, all non-cyclic links between nodes in the view are used */
+};
+
+/* Snapshots =========================================================== */
+
+/* Copy of graph's nodes and relations, which several evaluations can share 
+ * (i.e. so that a render can be evaluated while the viewport keeps being updated)
+ *
+ * Everything here is indexed in the same way as the node table that the graph had when
+ * the snapshot was made. The snapshot must not be changed once it has been made, so
+ * the runtime state of each evaluation is stored separately (see DepsgraphEvalState).
+ */
+typedef struct DepsgraphSnapshot {
+	Depsgraph *graph;            /* copy of graph (see DEG_graph_copy()) */
+	DepsgraphNodeTable *table;   /* graph's node table - only the indices in this can be used, as the graph has probably changed since */
+	
+	DepsNode **nodes;            /* (table->num_nodes) copy of each node (or NULL if it wasn't copied) */
+	DepsRelation **rels;         /* (table->num_rels) copy of each relation in out_targets (or NULL if it wasn't copied) */
+	int *owners;                 /* (table->num_nodes) index of node which owns each node (or -1 for ID nodes, etc.) */
+	
+	int *order;                  /* (num_order) indices of nodes, in the order they can be evaluated in */
+	int num_order;               /* number of nodes in order - nodes which are part of cycles are left out */
+	
+	int users;                   /* number of evaluations using snapshot, +1 while it's still the graph's current snapshot */
+} DepsgraphSnapshot;
+
+/* Evaluation of instances of a subgraph node in snapshot, which belongs to one evaluation of the snapshot */
+typedef struct DepsgraphSubgraphEval {
+	ListBase instances;          /* (DepsgraphInstance) copies of subgraph node's instances, holding the states for this evaluation */
+	struct DepsgraphEvalState *base_state; /* evaluation of what is the same for all instances (see SubgraphDepsNode) */
+} DepsgraphSubgraphEval;
+
+/* Runtime state for an evaluation of a snapshot 
+ * NOTE: arrays are indexed in the same way as the snapshot
+ */
+struct DepsgraphEvalState {
+	DepsgraphSnapshot *snapshot; /* nodes + relations being evaluated */
+	int context_type;            /* (eEvaluationContextType) purpose of evaluation */
+	
+	short *flag;                 /* (eDepsNode_Flag) update tags for each node */
+	bool *only_nodes;            /* (optional) only the nodes which are set here get evaluated - NULL for all */
+	struct DEG_OperationsContext *master; /* info shared by all contexts (i.e. scene, frame) */
+	void **contexts;             /* (DEG_OperationsContext) evaluation context for each component node (NULL for others) */
+	struct DepsgraphSubgraphEval **subgraphs; /* evaluation of instances for each subgraph node (NULL for others, or until evaluated) */
+	
+	struct MemArena *arena;      /* scratch memory for operations - reset after each evaluation */
+};
+
+/* Get graph's current snapshot, making it first if graph has changed since the last one was made
+ * ! Release it using DEG_graph_snapshot_release() once it's no longer needed
+ */
+DepsgraphSnapshot *DEG_graph_snapshot_acquire(Depsgraph *graph);
+
+/* Stop using snapshot, freeing it if nothing else uses it anymore (can be called from any thread) */
+void DEG_graph_snapshot_release(DepsgraphSnapshot *snapshot);
+
+/* Evaluate subgraph once for each of its instances, with their own evaluation contexts
+ * < master: master context of the graph which subgraph is part of (subgraphs don't have a scene or frame of their own)
+ */
+void DEG_subgraph_evaluate_instances(SubgraphDepsNode *sgn, eEvaluationContextType context_type,
+                                     const struct DEG_OperationsContext *master);
+
+/* Free component's evaluation contexts (i.e. when component is being freed) */
+void DEG_node_evaluation_contexts_free(ComponentDepsNode *comp);
+
+/* Scratch Memory ====================================================== */
+
+/* Ensure that graph has scratch memory for the given number of workers */
+void DEG_evaluation_arenas_ensure(Depsgraph *graph, int num_workers);
+
+/* Reset scratch memory of all workers once evaluation is done (memory is kept for next time) */
+void DEG_evaluation_arenas_clear(Depsgraph *graph);
+
+/* Free scratch memory of all workers */
+void DEG_evaluation_arenas_free(Depsgraph *graph);
+
+/* Get temporary buffer for operation, which stays valid until evaluation is done
+ * NOTE: this must only be used from within the operation's evaluate() callback,
+ *       and the buffer must not be freed (or kept around after evaluation)
+ *
+ * < context: (DEG_OperationsContext) context that operation was given
+ *            (the memory comes from the thread that operation is being evaluated on, not the context)
+ * < size: (bytes) size of buffer needed
+ */
+void *DEG_context_scratch_alloc(void *context, size_t size);
+
+/* Operation Keys ====================================================== */
+
+/* Well-known operation names 
+ * NOTE: these are registered with the name registry on startup, so passing them
+ *       (instead of equivalent string literals) when adding/finding operations
+ *       means that the name doesn't need to be hashed at all
+ */
+extern const char DEG_OPNAME_CONSTRAINT_STACK[];
+extern const char DEG_OPNAME_IK_SOLVER[];
+extern const char DEG_OPNAME_SPLINE_IK_SOLVER[];
+extern const char DEG_OPNAME_BONE_TRANSFORMS[];
+
+extern const char DEG_OPNAME_POSE_REBUILD[];
+extern const char DEG_OPNAME_POSE_INIT[];
+extern const char DEG_OPNAME_POSE_FLUSH[];
+
+extern const char DEG_OPNAME_LOCAL_TRANSFORM[];
+extern const char DEG_OPNAME_PARENT[];
+extern const char DEG_OPNAME_GEOMETRY_EVAL[];
+extern const char DEG_OPNAME_PATH[];
+extern const char DEG_OPNAME_DRIVER[];
+extern const char DEG_OPNAME_PSYS_EVAL[];
+
+extern const char DEG_OPNAME_RIGIDBODY_REBUILD[];
+extern const char DEG_OPNAME_RIGIDBODY_SIM[];
+extern const char DEG_OPNAME_RIGIDBODY_OB_SYNC[];
+
+/* Name Registry ------------------------------------------------------- */
+
+/* Get the canonical (interned) copy of the given name, registering it if it doesn't exist yet
+ * ! Interned names are only freed on exit, so only use this for identifiers which
+ *   come from a limited set (i.e. not for arbitrary user-defined names)
+ */
+const char *DEG_name_intern(const char *name);
+
+/* Get the canonical (interned) copy of the given name if it has been registered already
+ * > returns: interned name, or NULL if nothing has been registered using this name
+ */
+const char *DEG_name_find_interned(const char *name);
+
+/* Key Handling -------------------------------------------------------- */
+
+/* Initialise operation key, interning the name used */
+void DEG_operation_key_init(DepsOperationKey *key, eDepsNode_Type type, 
+                            const char name[DEG_MAX_ID_NAME], const void *handle);
+
+/* Hash/Compare callbacks for using operation keys in GHash */
+unsigned int DEG_operation_key_hash(const void *key_p);
+int DEG_operation_key_cmp(const void *a_p, const void *b_p);
+
 /* Node Types Handling ================================================= */
 
 /* "Typeinfo" for Node Types ------------------------------------------- */
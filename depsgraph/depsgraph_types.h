@@ -212,6 +212,21 @@ typedef enum eDepsNode_Flag {
 	
 	/* node was visited/handled already in traversal... */
 	DEPSNODE_FLAG_TEMP_TAG           = (1 << 2),
+	
+	/* node is left over from before relations were rebuilt, and will be removed 
+	 * unless it gets requested again by the builders 
+	 */
+	DEPSNODE_FLAG_STALE              = (1 << 3),
+	
+	/* ID node only stands in for its ID-block, whose other nodes haven't been built yet
+	 * (i.e. as it is not visible, and nothing visible needs it) 
+	 */
+	DEPSNODE_FLAG_PLACEHOLDER        = (1 << 4),
+	
+	/* node was allocated along with the rest of the nodes in a snapshot (see DEG_graph_copy()),
+	 * so it can't be freed by itself
+	 */
+	DEPSNODE_FLAG_IN_ARENA           = (1 << 5),
 } eDepsNode_Flag;
 
 /* ************************************* */
@@ -235,6 +250,7 @@ typedef struct TimeSourceDepsNode {
 typedef struct RootDepsNode {
 	DepsNode nd;                     /* standard header */
 	
+	struct Main *bmain;              /* database that scene belongs to */
 	struct Scene *scene;             /* scene that this corresponds to */
 	TimeSourceDepsNode *time_source; /* entrypoint node for time-changed */
 } RootDepsNode;
@@ -259,10 +275,20 @@ typedef struct SubgraphDepsNode {
 	Depsgraph *graph;        /* instanced graph */
 	ID *root_id;             /* ID-block at root of subgraph (if applicable) */
 	
+	ListBase instances;      /* (DepsgraphInstance) things which instance the subgraph - it gets evaluated separately for each of these */
+	struct DepsgraphEvalState *base_state; /* evaluation of what is the same for all instances (i.e. transforms within group) */
 	size_t num_users;        /* number of nodes which use/reference this subgraph - if just 1, it may be possible to merge into main */
 	int flag;                /* (eSubgraphRef_Flag) assorted settings for subgraph node */
 } SubgraphDepsNode;
 
+/* Instance of subgraph (i.e. object instancing a dupli-group) */
+typedef struct DepsgraphInstance {
+	struct DepsgraphInstance *next, *prev;
+	
+	struct Object *instancer;            /* object which instances the subgraph - its transform gets applied to everything in it */
+	struct DepsgraphEvalState *state;    /* state of the last evaluation of subgraph for this instance (NULL until evaluated) */
+} DepsgraphInstance;
+
 /* Flags for subgraph node */
 typedef enum eSubgraphRef_Flag {
 	SUBGRAPH_FLAG_SHARED      = (1 << 0),   /* subgraph referenced is shared with another reference, so shouldn't free on exit */
@@ -277,7 +303,7 @@ typedef struct ComponentDepsNode {
 	DepsNode nd;             /* standard header */
 	
 	ListBase ops;            /* ([OperationDepsNode]) inner nodes for this component */
-	GHash *op_hash;          /* <String, OperationDepsNode> quicker lookups for inner nodes attached here by name/identifier */
+	GHash *op_hash;          /* <DepsOperationKey, OperationDepsNode> quicker lookups for inner nodes attached here by name/identifier */
 	
 	/* (DEG_OperationsContext) array of evaluation contexts to be passed to evaluation functions for this component. 
 	 *                         Only the requested context will be used during any particular evaluation
@@ -296,12 +322,12 @@ typedef struct PoseComponentDepsNode {
 	DepsNode nd;             /* standard header */
 	
 	ListBase ops;            /* ([OperationDepsNode]) inner nodes for this component */
-	GHash *op_hash;          /* <String, OperationDepsNode> quicker lookups for inner nodes attached here by name/identifier (pose-level) */
+	GHash *op_hash;          /* <DepsOperationKey, OperationDepsNode> quicker lookups for inner nodes attached here by name/identifier (pose-level) */
 	
 	void *contexts[DEG_MAX_EVALUATION_CONTEXTS];      /* (DEG_OperationsContext) */
 	
 	/* PoseComponentDepsNode */
-	GHash *bone_hash;        /* <String, BoneComponentDepsNode> hash for quickly finding bone components */
+	GHash *bone_hash;        /* <const char *, BoneComponentDepsNode> hash for quickly finding bone components by bone name (keys are the components' own names) */
 } PoseComponentDepsNode;
 
 /* Bone Component */
@@ -311,16 +337,48 @@ typedef struct BoneComponentDepsNode {
 	DepsNode nd;                    /* standard header */
 	
 	ListBase ops;                   /* ([OperationDepsNode]) inner nodes for this component */
-	GHash *op_hash;                 /* <String, OperationDepsNode> quicker lookups for inner nodes attached here by name/identifier (bone-level) */
+	GHash *op_hash;                 /* <DepsOperationKey, OperationDepsNode> quicker lookups for inner nodes attached here by name/identifier (bone-level) */
 	
 	void *contexts[DEG_MAX_EVALUATION_CONTEXTS];      /* (DEG_OperationsContext) */
 	
 	/* BoneComponentDepsNode */
-	struct bPoseChannel *pchan;     /* the bone that this component represents */
+	struct bPoseChannel *pchan;     /* the bone that this component represents (may be NULL until needed - it's found by name) */
 } BoneComponentDepsNode;
 
+/* ---------------------------------------- */
+
+/* Geometry Component */
+/* Super(ComponentDepsNode) */
+typedef struct GeometryComponentDepsNode {
+	/* ComponentDepsNode */
+	DepsNode nd;                    /* standard header */
+	
+	ListBase ops;                   /* ([OperationDepsNode]) inner nodes for this component */
+	GHash *op_hash;                 /* <DepsOperationKey, OperationDepsNode> quicker lookups for inner nodes attached here by name/identifier */
+	
+	void *contexts[DEG_MAX_EVALUATION_CONTEXTS];      /* (DEG_OperationsContext) */
+	
+	/* GeometryComponentDepsNode */
+	uint64_t customdata_mask;       /* (CustomDataMask) layers needed by things using the geometry (i.e. vertex groups for constraint targets) */
+	
+	/* (CustomDataMask) layers to evaluate for each type of evaluation - this includes the layers needed by
+	 *                  modifiers and geometry evaluated from this one (see DEG_graph_build_customdata_masks())
+	 */
+	uint64_t eval_masks[DEG_MAX_EVALUATION_CONTEXTS];
+} GeometryComponentDepsNode;
+
 /* Inner Nodes ========================= */
 
+/* Identifier for Operation within the component it belongs to 
+ * NOTE: names used here are interned (see DEG_name_intern()), so
+ *       keys can be hashed and compared using pointers only
+ */
+typedef struct DepsOperationKey {
+	const char *name;             /* interned name of operation */
+	const void *handle;           /* (optional) specific data item that operation is for - to tell apart several operations with the same name (e.g. drivers) */
+	int type;                     /* (eDepsNode_Type) type of operation node */
+} DepsOperationKey;
+
 /* Evaluation Operation for atomic operation 
  * < context: (ComponentEvalContext) context containing data necessary for performing this operation
  *            Results can generally be written to the context directly...
@@ -334,6 +392,8 @@ typedef void (*DepsEvalOperationCb)(void *context, void *item);
 typedef struct OperationDepsNode {
 	DepsNode nd;                  /* standard header */
 	
+	DepsOperationKey key;         /* identifier used to find operation within its component */
+	
 	DepsEvalOperationCb evaluate; /* callback for operation */
 	
 	PointerRNA ptr;               /* item that operation is to be performed on (optional) */
@@ -366,25 +426,74 @@ typedef enum eDepsOperation_Flag {
 /* ************************************* */
 /* Depsgraph */
 
+/* Changes to graph-level data which have been held back, to be applied later 
+ * NOTE: this is used when several threads work on the same graph at once
+ *       (see DEG_graph_validate_links()), so that they only ever touch the
+ *       nodes they've been given.
+ */
+typedef struct DepsgraphStaging {
+	ListBase relations;      /* (DepsRelation) new relations, which still need to be added to the graph */
+	
+	ListBase opnodes;        /* (LinkData : DepsNode) new operation nodes, to append to all_opnodes */
+	size_t num_nodes;        /* number of operation nodes in opnodes list */
+	
+	size_t mem_used;         /* (bytes) memory used by the nodes added */
+} DepsgraphStaging;
+
 /* Dependency Graph object */
 struct Depsgraph {
 	/* Core Graph Functionality ........... */
 	GHash *id_hash;          /* <ID : IDDepsNode> mapping from ID blocks to nodes representing these blocks (for quick lookups) */
 	DepsNode *root_node;     /* "root" node - the one where all evaluation enters from */
 	
+	GHash *relations_hash;   /* <DepsRelation : DepsRelation> set of all relations in graph, keyed by (from, to, type) - used to merge duplicates */
+	
 	ListBase subgraphs;      /* (SubgraphDepsNode) subgraphs referenced in tree... */
 	
 	/* Quick-Access Temp Data ............. */
 	ListBase entry_tags;     /* (LinkData : DepsNode) nodes which have been tagged as "directly modified" */
+	struct BLI_mempool *entry_tags_pool; /* (LinkData) links for entry_tags - these get reused, as tagging happens every frame */
 	size_t tagged_count;     /* number of nodes that have been tagged for updates/refresh - used for completion cross-checking */     
 	
 	/* Convenience Data ................... */
 	ListBase all_opnodes;    /* (LinkData : DepsNode) all operation nodes, sorted in order of single-thread traversal order */
 	size_t num_nodes;        /* number of operation nodes in all_opnodes list */
 	
+	/* Query Acceleration ................. */
+	struct DepsgraphReachability *reachability; /* index for ID-level queries (NULL if out of date - rebuilt when next needed) */
+	struct DepsgraphNodeTable *node_table;      /* flat snapshot of nodes + relations, for node-level queries (NULL if out of date) */
+	GHash *rna_path_cache;                      /* <DepsRNAPathEntry> nodes that (ID, RNA path) pairs resolve to (cleared when nodes are removed, and for each build) */
+	
+	/* Statistics ......................... */
+	size_t mem_used;         /* (bytes) memory used by nodes + relations currently in graph, as tracked while they get added/removed */
+	size_t mem_peak;         /* (bytes) high-water mark for mem_used - i.e. peak reached while building graph */
+	
+	/* Settings ........................... */
+	int flag;                /* (eDepsgraph_Flag) settings for how graph gets built */
+	
+	/* Threading .......................... */
+	DepsgraphStaging *staging; /* when set, changes to graph-level data (i.e. relations, all_opnodes, stats) get queued here instead */
+	struct DepsgraphSnapshot *snapshot; /* copy of graph as it is now, shared by evaluations which don't want to block it (NULL if out of date) */
+	
+	struct DEG_OperationsContext *master_contexts[DEG_MAX_EVALUATION_CONTEXTS]; /* info shared by all contexts for each type of evaluation (NULL until evaluated) */
+	
+	struct MemArena **eval_arenas; /* (num_eval_arenas) scratch memory for each worker during evaluation - reset once evaluation is done */
+	int num_eval_arenas;           /* number of workers that there is scratch memory for */
+	
+	/* Memory ............................. */
+	ListBase node_arenas;      /* (LinkData : block) blocks which nodes were allocated from in one go (i.e. for snapshots), freed along with graph */
+	
 	// XXX: additional stuff like eval contexts, mempools for allocating nodes from, etc.
 };
 
+/* Settings for Depsgraph */
+typedef enum eDepsgraph_Flag {
+	/* only build the nodes for objects which are visible (or needed by visible ones),
+	 * leaving placeholders for the rest until they are needed 
+	 */
+	DEPSGRAPH_FLAG_LAZY_BUILD    = (1 << 0),
+} eDepsgraph_Flag;
+
 /* ************************************* */
 
 #endif // __DEPSGRAPH_TYPES_H__
@@ -35,6 +35,7 @@
 #include "BLI_blenlib.h"
 #include "BLI_ghash.h"
 #include "BLI_string.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
 #include "DNA_action_types.h"
@@ -43,6 +44,7 @@
 #include "DNA_camera_types.h"
 #include "DNA_constraint_types.h"
 #include "DNA_curve_types.h"
+#include "DNA_customdata_types.h"
 #include "DNA_effect_types.h"
 #include "DNA_group_types.h"
 #include "DNA_key_types.h"
@@ -63,6 +65,7 @@
 #include "BKE_animsys.h"
 #include "BKE_constraint.h"
 #include "BKE_curve.h"
+#include "BKE_customdata.h"
 #include "BKE_depsgraph.h"
 #include "BKE_effect.h"
 #include "BKE_fcurve.h"
@@ -91,6 +94,80 @@
 
 #include "stubs.h" // XXX: REMOVE THIS INCLUDE ONCE DEPSGRAPH REFACTOR PROJECT IS DONE!!!
 
+/* ************************************************* */
+/* Build Context */
+
+/* State used while building a graph 
+ * NOTE: this is kept separate from the graph itself, since it is only needed while 
+ *       building, and so that each thread used for building can have its own 
+ */
+typedef struct DepsgraphBuildContext {
+	Depsgraph *graph;      /* graph that nodes are being added to */
+	Main *bmain;           /* database that the data being added comes from */
+	
+	GHash *visited;        /* <ID : ID> set of datablocks which have been handled already (and shouldn't be again) */
+	
+	bool lazy;             /* only build objects which are visible, or needed by visible ones */
+	unsigned int lay;      /* layers which are visible in the scene being built (for lazy building) */
+} DepsgraphBuildContext;
+
+/* Initialise build context for adding nodes to the given graph */
+static void deg_build_context_init(DepsgraphBuildContext *bcx, Depsgraph *graph, Main *bmain)
+{
+	bcx->graph = graph;
+	bcx->bmain = bmain;
+	
+	bcx->visited = BLI_ghash_ptr_new("DepsgraphBuildContext Visited Set");
+	
+	bcx->lazy = false;
+	bcx->lay = 0;
+	
+	/* paths resolved before may refer to nodes which are about to be rebuilt (or have been added since) */
+	DEG_graph_rna_path_cache_clear(graph);
+}
+
+/* Set up lazy building for the given scene, if graph uses it */
+static void deg_build_context_init_lazy(DepsgraphBuildContext *bcx, Scene *scene)
+{
+	bcx->lazy = (bcx->graph->flag & DEPSGRAPH_FLAG_LAZY_BUILD) != 0;
+	bcx->lay = scene->lay;
+}
+
+/* Free data used by build context */
+static void deg_build_context_free(DepsgraphBuildContext *bcx)
+{
+	BLI_ghash_free(bcx->visited, NULL, NULL);
+	bcx->visited = NULL;
+	
+	/* only keep cached paths for the build they were resolved in (failures may succeed later) */
+	DEG_graph_rna_path_cache_clear(bcx->graph);
+}
+
+/* Check whether ID-block has been visited already, marking it as visited if not
+ * - Used to prevent infinite recursion (and building the same subgraph several times)
+ *   when datablocks can refer to each other [#32017]
+ * < returns: true if datablock was visited already, so nothing more needs to be done for it
+ */
+static bool deg_build_id_visited(DepsgraphBuildContext *bcx, ID *id)
+{
+	if (BLI_ghash_haskey(bcx->visited, id))
+		return true;
+	
+	BLI_ghash_insert(bcx->visited, id, id);
+	return false;
+}
+
+/* Check whether object in base needs to be built now
+ * < returns: false if building it can be left until it is needed (i.e. for lazy building)
+ */
+static bool deg_build_base_is_visible(const DepsgraphBuildContext *bcx, const Base *base)
+{
+	if (bcx->lazy == false)
+		return true;
+	
+	return (base->lay & bcx->lay) && !(base->object->restrictflag & OB_RESTRICT_VIEW);
+}
+
 /* ************************************************* */
 /* AnimData */
 
@@ -102,7 +179,6 @@ static DepsNode *deg_build_driver_rel(Depsgraph *graph, ID *id, FCurve *fcu)
 {
 	ChannelDriver *driver = fcu->driver;
 	DriverVar *dvar;
-	char name_buf[DEG_MAX_ID_NAME];
 	
 	OperationDepsNode *driver_op = NULL;
 	DepsNode *driver_node = NULL; /* same as driver_op, just cast to the relevant type */
@@ -110,11 +186,10 @@ static DepsNode *deg_build_driver_rel(Depsgraph *graph, ID *id, FCurve *fcu)
 	
 	
 	/* create data node for this driver ..................................... */
-	BLI_snprintf(name_buf, DEG_MAX_ID_NAME, "Driver @ %p", driver);
-	
-	driver_op = DEG_add_operation(graph, id, NULL, DEPSNODE_TYPE_OP_DRIVER,
-	                              DEPSOP_TYPE_EXEC, BKE_animsys_eval_driver,
-	                              name_buf);
+	/* NOTE: all drivers share the same name - the F-Curve is used to tell them apart */
+	driver_op = DEG_add_operation_ex(graph, id, NULL, DEPSNODE_TYPE_OP_DRIVER,
+	                                 DEPSOP_TYPE_EXEC, BKE_animsys_eval_driver,
+	                                 DEG_OPNAME_DRIVER, fcu);
 	driver_node = (DepsNode *)driver_op;
 	
 	/* RNA pointer to driver, to provide as context for execution */
@@ -130,7 +205,7 @@ static DepsNode *deg_build_driver_rel(Depsgraph *graph, ID *id, FCurve *fcu)
 	affected_node = DEG_get_node_from_rna_path(graph, id, fcu->rna_path);
 	if (affected_node) {
 		/* make data dependent on driver */
-		DEG_add_new_relation(driver_node, affected_node, DEPSREL_TYPE_DRIVER, 
+		DEG_add_new_relation(graph, driver_node, affected_node, DEPSREL_TYPE_DRIVER, 
 		                     "[Driver -> Data] DepsRel");
 		
 		/* ensure that affected prop's update callbacks will be triggered once done */
@@ -160,7 +235,7 @@ static DepsNode *deg_build_driver_rel(Depsgraph *graph, ID *id, FCurve *fcu)
 				}
 				
 				/* make driver dependent on this node */
-				DEG_add_new_relation(target_node, driver_node, DEPSREL_TYPE_DRIVER_TARGET,
+				DEG_add_new_relation(graph, target_node, driver_node, DEPSREL_TYPE_DRIVER_TARGET,
 				                     "[Target -> Driver] DepsRel");
 			}
 		}
@@ -194,7 +269,7 @@ static void deg_build_animdata_graph(Depsgraph *graph, Scene *scene, ID *id)
 		/* wire up dependency to time source */
 		// NOTE: this assumes that timesource was already added as one of first steps!
 		time_src = DEG_find_node(graph, NULL, NULL, DEPSNODE_TYPE_TIMESOURCE, NULL);
-		DEG_add_new_relation(time_src, adt_node, DEPSREL_TYPE_TIME, 
+		DEG_add_new_relation(graph, time_src, adt_node, DEPSREL_TYPE_TIME, 
 		                     "[TimeSrc -> Animation] DepsRel");
 		                     
 		// XXX: Hook up specific update callbacks for special properties which may need it...
@@ -211,7 +286,7 @@ static void deg_build_animdata_graph(Depsgraph *graph, Scene *scene, ID *id)
 		/* prevent driver from occurring before own animation... */
 		// NOTE: probably not strictly needed (anim before parameters anyway)...
 		if (adt_node) {
-			DEG_add_new_relation(adt_node, driver_node, DEPSREL_TYPE_OPERATION, 
+			DEG_add_new_relation(graph, adt_node, driver_node, DEPSREL_TYPE_OPERATION, 
 			                     "[AnimData Before Drivers] DepsRel");
 		}
 	}
@@ -266,7 +341,7 @@ static void deg_build_constraints_graph(Depsgraph *graph, Scene *scene,
 	
 	constraintStackOp = DEG_add_operation(graph, &ob->id, subdata_name, stackNodeType,
 	                                      DEPSOP_TYPE_EXEC, BKE_constraints_evaluate,
-	                                      "Constraint Stack");
+	                                      DEG_OPNAME_CONSTRAINT_STACK);
 	constraintStackNode = (DepsNode *)constraintStackOp;
 	
 	/* add dependencies for each constraint in turn */
@@ -294,7 +369,7 @@ static void deg_build_constraints_graph(Depsgraph *graph, Scene *scene,
 				if (data->depth_ob) {
 					// DAG_RL_DATA_OB | DAG_RL_OB_OB
 					node2 = DEG_get_node(graph, (ID *)data->depth_ob, NULL, DEPSNODE_TYPE_TRANSFORM, NULL);
-					DEG_add_new_relation(node2, constraintStackNode, DEPSREL_TYPE_TRANSFORM, cti->name);
+					DEG_add_new_relation(graph, node2, constraintStackNode, DEPSREL_TYPE_TRANSFORM, cti->name);
 				}
 			}
 			else if (cti->type == CONSTRAINT_TYPE_OBJECTSOLVER) {
@@ -304,7 +379,7 @@ static void deg_build_constraints_graph(Depsgraph *graph, Scene *scene,
 			if (depends_on_camera && scene->camera) {
 				// DAG_RL_DATA_OB | DAG_RL_OB_OB
 				node2 = DEG_get_node(graph, (ID *)scene->camera, NULL, DEPSNODE_TYPE_TRANSFORM, NULL);
-				DEG_add_new_relation(node2, constraintStackNode, DEPSREL_TYPE_TRANSFORM, cti->name);
+				DEG_add_new_relation(graph, node2, constraintStackNode, DEPSREL_TYPE_TRANSFORM, cti->name);
 			}
 			
 			/* tracker <-> constraints */
@@ -324,28 +399,28 @@ static void deg_build_constraints_graph(Depsgraph *graph, Scene *scene,
 					else if (ELEM(con->type, CONSTRAINT_TYPE_FOLLOWPATH, CONSTRAINT_TYPE_CLAMPTO)) {
 						/* these constraints require path geometry data... */
 						node2 = DEG_get_node(graph, (ID *)ct->tar, NULL, DEPSNODE_TYPE_GEOMETRY, "Path");
-						DEG_add_new_relation(node2, constraintStackNode, DEPSREL_TYPE_GEOMETRY_EVAL, cti->name); // XXX: type = geom_transform
+						DEG_add_new_relation(graph, node2, constraintStackNode, DEPSREL_TYPE_GEOMETRY_EVAL, cti->name); // XXX: type = geom_transform
 					}
 					else if ((ct->tar->type == OB_ARMATURE) && (ct->subtarget[0])) {
 						/* bone */
 						node2 = DEG_get_node(graph, (ID *)ct->tar, &ct->subtarget[0], DEPSNODE_TYPE_BONE, NULL);
-						DEG_add_new_relation(node2, constraintStackNode, DEPSREL_TYPE_TRANSFORM, cti->name);
+						DEG_add_new_relation(graph, node2, constraintStackNode, DEPSREL_TYPE_TRANSFORM, cti->name);
 					}
 					else if (ELEM(ct->tar->type, OB_MESH, OB_LATTICE) && (ct->subtarget[0])) {
 						/* vertex group */
 						/* NOTE: for now, we don't need to represent vertex groups separately... */
 						node2 = DEG_get_node(graph, (ID *)ct->tar, NULL, DEPSNODE_TYPE_GEOMETRY, NULL);
-						DEG_add_new_relation(node2, constraintStackNode, DEPSREL_TYPE_GEOMETRY_EVAL, cti->name);
+						DEG_add_new_relation(graph, node2, constraintStackNode, DEPSREL_TYPE_GEOMETRY_EVAL, cti->name);
 						
 						if (ct->tar->type == OB_MESH) {
-							//node2->customdata_mask |= CD_MASK_MDEFORMVERT;
+							((GeometryComponentDepsNode *)node2)->customdata_mask |= CD_MASK_MDEFORMVERT;
 						}
 					}
 					else {
 						/* standard object relation */
 						// TODO: loc vs rot vs scale?
 						node2 = DEG_get_node(graph, (ID *)ct->tar, NULL, DEPSNODE_TYPE_TRANSFORM, NULL);
-						DEG_add_new_relation(node2, constraintStackNode, DEPSREL_TYPE_TRANSFORM, cti->name);
+						DEG_add_new_relation(graph, node2, constraintStackNode, DEPSREL_TYPE_TRANSFORM, cti->name);
 					}
 				}
 			}
@@ -358,15 +433,44 @@ static void deg_build_constraints_graph(Depsgraph *graph, Scene *scene,
 
 /* ------------------------------------------ */
 
+/* Get the chain of bones that IK/Spline IK solver constraint affects */
+bool DEG_constraint_solver_chain(const bConstraint *con, bool *r_use_tip, int *r_chainlen)
+{
+	switch (con->type) {
+		case CONSTRAINT_TYPE_KINEMATIC:
+		{
+			const bKinematicConstraint *data = (const bKinematicConstraint *)con->data;
+			
+			*r_use_tip = (data->flag & CONSTRAINT_IK_TIP) != 0;
+			*r_chainlen = data->rootbone;
+			return true;
+		}
+		case CONSTRAINT_TYPE_SPLINEIK:
+		{
+			const bSplineIKConstraint *data = (const bSplineIKConstraint *)con->data;
+			
+			/* tip always gets excluded - it only follows the spline */
+			*r_use_tip = false;
+			*r_chainlen = data->chainlen;
+			return true;
+		}
+		default:
+			*r_use_tip = false;
+			*r_chainlen = 0;
+			return false;
+	}
+}
+
 /* IK Solver Eval Steps */
 static void deg_build_ik_pose_graph(Depsgraph *graph, Scene *scene, 
                                     Object *ob, bPoseChannel *pchan,
                                     bConstraint *con)
 {
-	bKinematicConstraint *data = (bKinematicConstraint *)con->data;
 	bPoseChannel *rootchan = pchan;
 	bPoseChannel *parchan;
 	size_t segcount = 0;
+	bool use_tip;
+	int chainlen;
 	
 	OperationDepsNode *solver_op;
 	DepsNode *solver_node;
@@ -378,18 +482,20 @@ static void deg_build_ik_pose_graph(Depsgraph *graph, Scene *scene,
 	/* operation node for evaluating/running IK Solver */
 	solver_op = DEG_add_operation(graph, &ob->id, NULL, DEPSNODE_TYPE_OP_POSE,
 	                              DEPSOP_TYPE_SIM, BKE_pose_iktree_evaluate, 
-	                              "IK Solver");
+	                              DEG_OPNAME_IK_SOLVER);
 	solver_node = (DepsNode *)solver_op;
 	
 	/* attach owner to IK Solver too 
 	 * - assume that owner is always part of chain 
 	 * - see notes on direction of rel below...
 	 */
-	DEG_add_new_relation(owner_node, solver_node, DEPSREL_TYPE_TRANSFORM, "IK Solver Owner");
+	DEG_add_new_relation(graph, owner_node, solver_node, DEPSREL_TYPE_TRANSFORM, "IK Solver Owner");
 	
 	
 	/* exclude tip from chain? */
-	if ((data->flag & CONSTRAINT_IK_TIP) == 0)
+	DEG_constraint_solver_chain(con, &use_tip, &chainlen);
+	
+	if (use_tip == false)
 		parchan = pchan->parent;
 	else
 		parchan = pchan;
@@ -403,11 +509,11 @@ static void deg_build_ik_pose_graph(Depsgraph *graph, Scene *scene,
 		 * grab the result with IK solver results...
 		 */
 		DepsNode *parchan_node = DEG_get_node(graph, &ob->id, parchan->name, DEPSNODE_TYPE_BONE, NULL);
-		DEG_add_new_relation(parchan_node, solver_node, DEPSREL_TYPE_TRANSFORM, "IK Solver Update");
+		DEG_add_new_relation(graph, parchan_node, solver_node, DEPSREL_TYPE_TRANSFORM, "IK Solver Update");
 		
 		/* continue up chain, until we reach target number of items... */
 		segcount++;
-		if ((segcount == data->rootbone) || (segcount > 255)) break;  /* 255 is weak */
+		if ((segcount == chainlen) || (segcount > 255)) break;  /* 255 is weak */
 		
 		rootchan = parchan;
 		parchan  = parchan->parent;
@@ -425,11 +531,15 @@ static void deg_build_splineik_pose_graph(Depsgraph *graph, Scene *scene,
 	bSplineIKConstraint *data = (bSplineIKConstraint *)con->data;
 	bPoseChannel *parchan, *rootchan = pchan;
 	size_t segcount = 0;
+	bool use_tip;
+	int chainlen;
 	
 	OperationDepsNode *solver_op;
 	DepsNode *solver_node;
 	DepsNode *owner_node, *curve_node;
 	
+	DEG_constraint_solver_chain(con, &use_tip, &chainlen);
+	
 	/* component for bone holding the constraint */
 	owner_node = DEG_get_node(graph, &ob->id, pchan->name, DEPSNODE_TYPE_BONE, NULL);
 	
@@ -442,7 +552,7 @@ static void deg_build_splineik_pose_graph(Depsgraph *graph, Scene *scene,
 	/* operation node for evaluating/running IK Solver */
 	solver_op = DEG_add_operation(graph, &ob->id, NULL, DEPSNODE_TYPE_OP_POSE,
 	                              DEPSOP_TYPE_SIM, BKE_pose_splineik_evaluate, 
-	                              "Spline IK Solver");
+	                              DEG_OPNAME_SPLINE_IK_SOLVER);
 	solver_node = (DepsNode *)solver_op;
 	// XXX: what sort of ID-data is needed?
 	
@@ -450,10 +560,10 @@ static void deg_build_splineik_pose_graph(Depsgraph *graph, Scene *scene,
 	 * - assume that owner is always part of chain 
 	 * - see notes on direction of rel below...
 	 */
-	DEG_add_new_relation(owner_node, solver_node, DEPSREL_TYPE_TRANSFORM, "Spline IK Solver Owner");
+	DEG_add_new_relation(graph, owner_node, solver_node, DEPSREL_TYPE_TRANSFORM, "Spline IK Solver Owner");
 	
 	/* attach path dependency to solver */
-	DEG_add_new_relation(curve_node, solver_node, DEPSREL_TYPE_GEOMETRY_EVAL, "[Curve.Path -> Spline IK] DepsRel");
+	DEG_add_new_relation(graph, curve_node, solver_node, DEPSREL_TYPE_GEOMETRY_EVAL, "[Curve.Path -> Spline IK] DepsRel");
 	
 	/* --------------- */
 	
@@ -469,11 +579,11 @@ static void deg_build_splineik_pose_graph(Depsgraph *graph, Scene *scene,
 		 * grab the result with IK solver results...
 		 */
 		DepsNode *parchan_node = DEG_get_node(graph, &ob->id, parchan->name, DEPSNODE_TYPE_BONE, NULL);
-		DEG_add_new_relation(parchan_node, solver_node, DEPSREL_TYPE_TRANSFORM, "Spline IK Solver Update");
+		DEG_add_new_relation(graph, parchan_node, solver_node, DEPSREL_TYPE_TRANSFORM, "Spline IK Solver Update");
 		
 		/* continue up chain, until we reach target number of items... */
 		segcount++;
-		if ((segcount == data->chainlen) || (segcount > 255)) break;  /* 255 is weak */
+		if ((segcount == chainlen) || (segcount > 255)) break;  /* 255 is weak */
 	}
 	
 	/* store the "root bone" of this chain in the solver, so it knows where to start */
@@ -527,13 +637,13 @@ static void deg_build_rig_graph(Depsgraph *graph, Scene *scene, Object *ob)
 		/* node for bone eval */
 		bone_op = DEG_add_operation(graph, &ob->id, pchan->name, DEPSNODE_TYPE_OP_BONE, 
 		                            DEPSOP_TYPE_EXEC, BKE_pose_eval_bone,
-		                            "Bone Transforms");
+		                            DEG_OPNAME_BONE_TRANSFORMS);
 		RNA_pointer_create(&ob->id, &RNA_PoseBone, pchan, &bone_op->ptr);
 		
 		/* bone parent */
 		if (pchan->parent) {
 			DepsNode *par_bone = DEG_get_node(graph, &ob->id, pchan->parent->name, DEPSNODE_TYPE_BONE, NULL);
-			DEG_add_new_relation(par_bone, &bone_node->nd, DEPSREL_TYPE_TRANSFORM, "[Parent Bone -> Child Bone]");
+			DEG_add_new_relation(graph, par_bone, &bone_node->nd, DEPSREL_TYPE_TRANSFORM, "[Parent Bone -> Child Bone]");
 		}
 		
 		/* constraints */
@@ -594,13 +704,14 @@ static void deg_build_rig_graph(Depsgraph *graph, Scene *scene, Object *ob)
 // XXX: how to prevent duplication-problems?
 
 /* forward decl. */
-static void deg_build_material_graph(Depsgraph *graph, Scene *scene, DepsNode *owner_component, Material *ma);
-static void deg_build_texture_graph(Depsgraph *graph, Scene *scene, DepsNode *owner_component, Tex *tex);
+static void deg_build_material_graph(DepsgraphBuildContext *bcx, Scene *scene, DepsNode *owner_component, Material *ma);
+static void deg_build_texture_graph(DepsgraphBuildContext *bcx, Scene *scene, DepsNode *owner_component, Tex *tex);
 
 
 /* Recursively build graph for node-tree */
-static void deg_build_nodetree_graph(Depsgraph *graph, Scene *scene, DepsNode *owner_component, bNodeTree *ntree)
+static void deg_build_nodetree_graph(DepsgraphBuildContext *bcx, Scene *scene, DepsNode *owner_component, bNodeTree *ntree)
 {
+	Depsgraph *graph = bcx->graph;
 	bNode *n;
 	
 	/* nodetree itself */
@@ -612,13 +723,13 @@ static void deg_build_nodetree_graph(Depsgraph *graph, Scene *scene, DepsNode *o
 	for (n = ntree->nodes.first; n; n = n->next) {
 		if (n->id) {
 			if (GS(n->id->name) == ID_MA) {
-				deg_build_material_graph(graph, scene, owner_component, (Material *)n->id);
+				deg_build_material_graph(bcx, scene, owner_component, (Material *)n->id);
 			}
 			else if (n->type == ID_TE) {
-				deg_build_texture_graph(graph, scene, owner_component, (Tex *)n->id);
+				deg_build_texture_graph(bcx, scene, owner_component, (Tex *)n->id);
 			}
 			else if (n->type == NODE_GROUP) {
-				deg_build_nodetree_graph(graph, scene, owner_component, (bNodeTree *)n->id);
+				deg_build_nodetree_graph(bcx, scene, owner_component, (bNodeTree *)n->id);
 			}
 		}
 	}
@@ -627,16 +738,13 @@ static void deg_build_nodetree_graph(Depsgraph *graph, Scene *scene, DepsNode *o
 }
 
 /* Recursively build graph for texture */
-static void deg_build_texture_graph(Depsgraph *graph, Scene *scene, DepsNode *owner_component, Tex *tex)
+static void deg_build_texture_graph(DepsgraphBuildContext *bcx, Scene *scene, DepsNode *owner_component, Tex *tex)
 {
-	/* Prevent infinite recursion by checking (and tagging the texture) as having been visited 
-	 * already. This assumes tex->id.flag & LIB_DOIT isn't set by anything else
-	 * in the meantime... [#32017]
-	 */
-	if (tex->id.flag & LIB_DOIT)
-		return;
+	Depsgraph *graph = bcx->graph;
 	
-	tex->id.flag |= LIB_DOIT;
+	/* only need to build texture once, and this prevents infinite recursion too */
+	if (deg_build_id_visited(bcx, &tex->id))
+		return;
 	
 	/* texture itself */
 	if (tex->adt) {
@@ -645,35 +753,33 @@ static void deg_build_texture_graph(Depsgraph *graph, Scene *scene, DepsNode *ow
 	
 	/* texture's nodetree */
 	if (tex->nodetree) {
-		deg_build_nodetree_graph(graph, scene, owner_component, tex->nodetree);
+		deg_build_nodetree_graph(bcx, scene, owner_component, tex->nodetree);
 	}
-
-	tex->id.flag &= ~LIB_DOIT;
 }
 
 /* Texture-stack attached to some shading datablock */
-static void deg_build_texture_stack_graph(Depsgraph *graph, Scene *scene, DepsNode *owner_component, MTex **texture_stack)
+static void deg_build_texture_stack_graph(DepsgraphBuildContext *bcx, Scene *scene, DepsNode *owner_component, MTex **texture_stack)
 {
 	int i;
 	
 	/* for now assume that all texture-stacks have same number of max items */
 	for (i = 0; i < MAX_MTEX; i++) {
 		MTex *mtex = texture_stack[i];
-		deg_build_texture_graph(graph, scene, owner_component, mtex->tex);
+		
+		if (mtex && mtex->tex) {
+			deg_build_texture_graph(bcx, scene, owner_component, mtex->tex);
+		}
 	}
 }
 
 /* Recursively build graph for material */
-static void deg_build_material_graph(Depsgraph *graph, Scene *scene, DepsNode *owner_component, Material *ma)
+static void deg_build_material_graph(DepsgraphBuildContext *bcx, Scene *scene, DepsNode *owner_component, Material *ma)
 {
-	/* Prevent infinite recursion by checking (and tagging the material) as having been visited 
-	 * already. This assumes ma->id.flag & LIB_DOIT isn't set by anything else
-	 * in the meantime... [#32017]
-	 */
-	if (ma->id.flag & LIB_DOIT)
-		return;
+	Depsgraph *graph = bcx->graph;
 	
-	ma->id.flag |= LIB_DOIT;
+	/* only need to build material once, and this prevents infinite recursion too */
+	if (deg_build_id_visited(bcx, &ma->id))
+		return;
 	
 	/* material itself */
 	if (ma->adt) {
@@ -681,30 +787,24 @@ static void deg_build_material_graph(Depsgraph *graph, Scene *scene, DepsNode *o
 	}
 	
 	/* textures */
-	deg_build_texture_stack_graph(graph, scene, owner_component, ma->mtex);
+	deg_build_texture_stack_graph(bcx, scene, owner_component, ma->mtex);
 	
 	/* material's nodetree */
 	if (ma->nodetree) {
-		deg_build_nodetree_graph(graph, scene, owner_component, ma->nodetree);
+		deg_build_nodetree_graph(bcx, scene, owner_component, ma->nodetree);
 	}
-
-	ma->id.flag &= ~LIB_DOIT;
 }
 
 /* Recursively build graph for world */
-static void deg_build_world_graph(Depsgraph *graph, Scene *scene, World *wo)
+static void deg_build_world_graph(DepsgraphBuildContext *bcx, Scene *scene, World *wo)
 {
+	Depsgraph *graph = bcx->graph;
 	DepsNode *owner_component = NULL; /* world shading/params? */
 	
-	/* Prevent infinite recursion by checking (and tagging the world) as having been visited 
-	 * already. This assumes wo->id.flag & LIB_DOIT isn't set by anything else
-	 * in the meantime... [#32017]
-	 */
-	if (wo->id.flag & LIB_DOIT)
+	/* only need to build world once (i.e. if shared between scene and its set) */
+	if (deg_build_id_visited(bcx, &wo->id))
 		return;
 	
-	wo->id.flag |= LIB_DOIT;
-	
 	/* world itself */
 	if (wo->adt) {
 		deg_build_animdata_graph(graph, scene, &wo->id);
@@ -713,19 +813,19 @@ static void deg_build_world_graph(Depsgraph *graph, Scene *scene, World *wo)
 	/* TODO: other settings? */
 	
 	/* textures */
-	deg_build_texture_stack_graph(graph, scene, owner_component, wo->mtex);
+	deg_build_texture_stack_graph(bcx, scene, owner_component, wo->mtex);
 	
 	/* world's nodetree */
 	if (wo->nodetree) {
-		deg_build_nodetree_graph(graph, scene, owner_component, wo->nodetree);
+		deg_build_nodetree_graph(bcx, scene, owner_component, wo->nodetree);
 	}
-
-	wo->id.flag &= ~LIB_DOIT;
 }
 
 /* Compositing-related nodes */
-static void deg_build_compo_graph(Depsgraph *graph, Scene *scene)
+static void deg_build_compo_graph(DepsgraphBuildContext *bcx, Scene *scene)
 {
+	Depsgraph *graph = bcx->graph;
+	
 	/* For now, just a plain wrapper? */
 	if (scene->nodetree) {
 		DepsNode *owner_component;
@@ -736,13 +836,78 @@ static void deg_build_compo_graph(Depsgraph *graph, Scene *scene)
 		
 		/* for now, nodetrees are just parameters; compositing occurs in internals of renderer... */
 		owner_component = DEG_get_node(graph, &scene->id, NULL, DEPSNODE_TYPE_PARAMETERS, NULL);
-		deg_build_nodetree_graph(graph, scene, owner_component, scene->nodetree);
+		deg_build_nodetree_graph(bcx, scene, owner_component, scene->nodetree);
 	}
 }
 
 /* ************************************************* */
 /* Physics */
 
+/* Perform callback on each of the objects that particle system depends on */
+void DEG_particle_system_foreach_target(Scene *scene, Object *ob, ParticleSystem *psys,
+                                        DEG_ParticleTargetCallback func, void *userdata)
+{
+	ParticleSettings *part = psys->part;
+	ListBase *effectors = NULL;
+	EffectorCache *eff;
+	
+	/* XXX: if particle system is later re-enabled, we must do full rebuild? */
+	if (!psys_check_enabled(ob, psys))
+		return;
+	
+	/* effectors */
+	effectors = pdInitEffectors(scene, ob, psys, part->effector_weights);
+	
+	if (effectors) {
+		for (eff = effectors->first; eff; eff = eff->next) {
+			if (eff->psys) {
+				// XXX: DAG_RL_DATA_DATA | DAG_RL_OB_DATA
+				// xxx: particles instead?
+				func(userdata, eff->ob, DEPSNODE_TYPE_GEOMETRY, DEPSREL_TYPE_STANDARD, "Particle Field");
+			}
+		}
+	}
+	
+	pdEndEffectors(&effectors);
+	
+	/* boids */
+	if (part->boids) {
+		BoidRule *rule = NULL;
+		BoidState *state = NULL;
+		
+		for (state = part->boids->states.first; state; state = state->next) {
+			for (rule = state->rules.first; rule; rule = rule->next) {
+				Object *ruleob = NULL;
+				if (rule->type == eBoidRuleType_Avoid)
+					ruleob = ((BoidRuleGoalAvoid *)rule)->ob;
+				else if (rule->type == eBoidRuleType_FollowLeader)
+					ruleob = ((BoidRuleFollowLeader *)rule)->ob;
+				
+				if (ruleob) {
+					func(userdata, ruleob, DEPSNODE_TYPE_TRANSFORM, DEPSREL_TYPE_TRANSFORM, "Boid Rule");
+				}
+			}
+		}
+	}
+}
+
+/* Particle system that relations to its targets are being added for */
+typedef struct DepsParticleTargetData {
+	Depsgraph *graph;
+	DepsNode *psys_op;
+} DepsParticleTargetData;
+
+/* Add relation from particle system's target to the particle system */
+static void deg_build_particle_target_cb(void *data_p, Object *target, eDepsNode_Type type,
+                                         eDepsRelation_Type rel_type, const char *description)
+{
+	DepsParticleTargetData *data = (DepsParticleTargetData *)data_p;
+	DepsNode *node2;
+	
+	node2 = DEG_get_node(data->graph, &target->id, NULL, type, NULL);
+	DEG_add_new_relation(data->graph, node2, data->psys_op, rel_type, description);
+}
+
 /* Physics Systems */
 static void deg_build_particles_graph(Depsgraph *graph, Scene *scene, Object *ob)
 {
@@ -767,25 +932,22 @@ static void deg_build_particles_graph(Depsgraph *graph, Scene *scene, Object *ob
 	/* particle systems */
 	for (psys = ob->particlesystem.first; psys; psys = psys->next) {
 		ParticleSettings *part = psys->part;
-		ListBase *effectors = NULL;
-		EffectorCache *eff;
-		DepsNode *psys_op, *node2;
-		
-		/* this particle system */
-		psys_op = DEG_add_operation(graph, &ob->id, part->id.name+2, DEPSNODE_TYPE_OP_PARTICLE, 
-		                            DEPSOP_TYPE_EXEC, BKE_particle_system_eval, 
-		                            "PSys Eval");
+		DepsParticleTargetData target_data;
+		DepsNode *psys_op;
+		
+		/* this particle system 
+		 * NOTE: each particle system's operation has the same name, so the psys is used to tell them apart 
+		 */
+		psys_op = (DepsNode *)DEG_add_operation_ex(graph, &ob->id, part->id.name+2, DEPSNODE_TYPE_OP_PARTICLE, 
+		                                           DEPSOP_TYPE_EXEC, BKE_particle_system_eval, 
+		                                           DEG_OPNAME_PSYS_EVAL, psys);
 		                            
 		/* animation associated with this particle system */
 		// XXX: what if this is used more than once!
 		if (part->adt) {
 			deg_build_animdata_graph(graph, scene, (ID *)part);
 		}
-		
-		/* XXX: if particle system is later re-enabled, we must do full rebuild? */
-		if (!psys_check_enabled(ob, psys))
-			continue;
-		
+
 #if 0
 		if (ELEM(part->phystype, PART_PHYS_KEYED, PART_PHYS_BOIDS)) {
 			ParticleTarget *pt;
@@ -816,41 +978,11 @@ static void deg_build_particles_graph(Depsgraph *graph, Scene *scene, Object *ob
 		}
 #endif
 		
-		/* effectors */
-		effectors = pdInitEffectors(scene, ob, psys, part->effector_weights);
+		/* effectors and boid rules (only for enabled particle systems) */
+		target_data.graph = graph;
+		target_data.psys_op = psys_op;
 		
-		if (effectors) {
-			for (eff = effectors->first; eff; eff = eff->next) {
-				if (eff->psys) {
-					// XXX: DAG_RL_DATA_DATA | DAG_RL_OB_DATA
-					node2 = DEG_get_node(graph, (ID *)eff->ob, NULL, DEPSNODE_TYPE_GEOMETRY, NULL); // xxx: particles instead?
-					DEG_add_new_relation(node2, psys_op, DEPSREL_TYPE_STANDARD, "Particle Field");
-				}
-			}
-		}
-		
-		pdEndEffectors(&effectors);
-		
-		/* boids */
-		if (part->boids) {
-			BoidRule *rule = NULL;
-			BoidState *state = NULL;
-			
-			for (state = part->boids->states.first; state; state = state->next) {
-				for (rule = state->rules.first; rule; rule = rule->next) {
-					Object *ruleob = NULL;
-					if (rule->type == eBoidRuleType_Avoid)
-						ruleob = ((BoidRuleGoalAvoid *)rule)->ob;
-					else if (rule->type == eBoidRuleType_FollowLeader)
-						ruleob = ((BoidRuleFollowLeader *)rule)->ob;
-
-					if (ruleob) {
-						node2 = DEG_get_node(graph, &ruleob->id, NULL, DEPSNODE_TYPE_TRANSFORM, NULL);
-						DEG_add_new_relation(node2, psys_op, DEPSREL_TYPE_TRANSFORM, "Boid Rule");
-					}
-				}
-			}
-		}
+		DEG_particle_system_foreach_target(scene, ob, psys, deg_build_particle_target_cb, &target_data);
 	}
 	
 	/* pointcache */
@@ -882,16 +1014,16 @@ static void deg_build_rigidbody_graph(Depsgraph *graph, Scene *scene)
 	/* init/rebuild operation */
 	init_node = DEG_add_operation(graph, &scene->id, NULL, DEPSNODE_TYPE_OP_RIGIDBODY,
 	                              DEPSOP_TYPE_REBUILD, BKE_rigidbody_rebuild_sim,
-	                              "Rigidbody World Rebuild");
+	                              DEG_OPNAME_RIGIDBODY_REBUILD);
 	
 	/* do-sim operation */
 	sim_node = DEG_add_operation(graph, &scene->id, NULL, DEPSNODE_TYPE_OP_RIGIDBODY,
 	                             DEPSOP_TYPE_SIM, BKE_rigidbody_eval_simulation,
-	                             "Rigidbody World Do Simulation");
+	                             DEG_OPNAME_RIGIDBODY_SIM);
 	
 	
 	/* rel between the two sim-nodes */
-	DEG_add_new_relation(&init_node->nd, &sim_node->nd, DEPSREL_TYPE_OPERATION, "Rigidbody [Init -> SimStep]");
+	DEG_add_new_relation(graph, &init_node->nd, &sim_node->nd, DEPSREL_TYPE_OPERATION, "Rigidbody [Init -> SimStep]");
 	
 	/* set up dependencies between these operations and other builtin nodes --------------- */	
 	
@@ -902,10 +1034,10 @@ static void deg_build_rigidbody_graph(Depsgraph *graph, Scene *scene)
 		/* init node is only occasional (i.e. on certain frame values only), 
 		 * but we must still include this link 
 		 */
-		DEG_add_new_relation(time_src, &init_node->nd, DEPSREL_TYPE_TIME, "TimeSrc -> Rigidbody Reset/Rebuild (Optional)");
+		DEG_add_new_relation(graph, time_src, &init_node->nd, DEPSREL_TYPE_TIME, "TimeSrc -> Rigidbody Reset/Rebuild (Optional)");
 		
 		/* simulation step must always be performed */
-		DEG_add_new_relation(time_src, &sim_node->nd, DEPSREL_TYPE_TIME, "TimeSrc -> Rigidbody Sim Step");
+		DEG_add_new_relation(graph, time_src, &sim_node->nd, DEPSREL_TYPE_TIME, "TimeSrc -> Rigidbody Sim Step");
 	}
 	
 	/* objects - simulation participants */
@@ -931,21 +1063,21 @@ static void deg_build_rigidbody_graph(Depsgraph *graph, Scene *scene)
 				
 				/* get operation that rigidbody should follow */
 				// TODO: doesn't pre-simulation updates need this info too?
-				tbase_op = BLI_ghash_lookup(tcomp->op_hash, "BKE_object_eval_parent");
+				tbase_op = (OperationDepsNode *)DEG_component_find_operation(tcomp, DEPSNODE_TYPE_OP_TRANSFORM, DEG_OPNAME_PARENT, NULL);
 				if (tbase_op == NULL) {
-					tbase_op = BLI_ghash_lookup(tcomp->op_hash, "BKE_object_eval_local_transform");
+					tbase_op = (OperationDepsNode *)DEG_component_find_operation(tcomp, DEPSNODE_TYPE_OP_TRANSFORM, DEG_OPNAME_LOCAL_TRANSFORM, NULL);
 				}
 				
 				/* get operation for constraint stack
 				 * - it may or may not exist, but should follow rigidbody
 				 */
-				con_op = BLI_ghash_lookup(tcomp->op_hash, "Constraint Stack");
+				con_op = (OperationDepsNode *)DEG_component_find_operation(tcomp, DEPSNODE_TYPE_OP_TRANSFORM, DEG_OPNAME_CONSTRAINT_STACK, NULL);
 				
 				
 				/* 2) create operation for flushing results */
 				rbo_op = DEG_add_operation(graph, &ob->id, NULL, DEPSNODE_TYPE_OP_TRANSFORM,
 										   DEPSOP_TYPE_EXEC, BKE_rigidbody_object_sync_transforms, /* xxx: function name */
-										   "RigidBodyObject Sync");
+										   DEG_OPNAME_RIGIDBODY_OB_SYNC);
 				
 				
 				/* 3) hook up evaluation order... 
@@ -956,13 +1088,13 @@ static void deg_build_rigidbody_graph(Depsgraph *graph, Scene *scene)
 				 *      XXX: there's probably a difference between passive and active 
 				 *           - passive don't change, so may need to know full transform...
 				 */
-				DEG_add_new_relation(&tbase_op->nd, &rbo_op->nd,   DEPSREL_TYPE_OPERATION, "Base Ob Transform -> RBO Sync");
-				DEG_add_new_relation(&sim_node->nd, &rbo_op->nd,   DEPSREL_TYPE_COMPONENT_ORDER, "Rigidbody Sim Eval -> RBO Sync");
+				DEG_add_new_relation(graph, &tbase_op->nd, &rbo_op->nd,   DEPSREL_TYPE_OPERATION, "Base Ob Transform -> RBO Sync");
+				DEG_add_new_relation(graph, &sim_node->nd, &rbo_op->nd,   DEPSREL_TYPE_COMPONENT_ORDER, "Rigidbody Sim Eval -> RBO Sync");
 				
 				if (con_op)
-					DEG_add_new_relation(&rbo_op->nd, &con_op->nd,  DEPSREL_TYPE_COMPONENT_ORDER, "RBO Sync -> Ob Constraints");
+					DEG_add_new_relation(graph, &rbo_op->nd, &con_op->nd,  DEPSREL_TYPE_COMPONENT_ORDER, "RBO Sync -> Ob Constraints");
 				
-				DEG_add_new_relation(&tbase_op->nd, &sim_node->nd, DEPSREL_TYPE_OPERATION, "Base Ob Transform -> Rigidbody Sim Eval"); /* needed to get correct base values */
+				DEG_add_new_relation(graph, &tbase_op->nd, &sim_node->nd, DEPSREL_TYPE_OPERATION, "Base Ob Transform -> Rigidbody Sim Eval"); /* needed to get correct base values */
 			}
 		}
 	}
@@ -986,8 +1118,8 @@ static void deg_build_rigidbody_graph(Depsgraph *graph, Scene *scene)
 				 * - this ensures that, at the very least, the constraint will be done first 
 				 */
 				// XXX: rigidbody sync occurs after sim!
-				ob1 = DEG_get_node(graph, (ID *)rbc->ob1, NULL, DEPSNODE_TYPE_OP_TRANSFORM, "RigidBodyObject Sync");
-				ob2 = DEG_get_node(graph, (ID *)rbc->ob2, NULL, DEPSNODE_TYPE_OP_TRANSFORM, "RigidBodyObject Sync");
+				ob1 = DEG_get_node(graph, (ID *)rbc->ob1, NULL, DEPSNODE_TYPE_OP_TRANSFORM, DEG_OPNAME_RIGIDBODY_OB_SYNC);
+				ob2 = DEG_get_node(graph, (ID *)rbc->ob2, NULL, DEPSNODE_TYPE_OP_TRANSFORM, DEG_OPNAME_RIGIDBODY_OB_SYNC);
 				
 				/* node for this constraint's final transform */
 				tcomp = DEG_get_node(graph, &ob->id, NULL, DEPSNODE_TYPE_TRANSFORM, NULL);
@@ -995,11 +1127,11 @@ static void deg_build_rigidbody_graph(Depsgraph *graph, Scene *scene)
 				
 				/* create links */
 				/* - constrained-objects sync depends on the constraint-holder */
-				DEG_add_new_relation(tcomp, ob1, DEPSREL_TYPE_TRANSFORM, "RigidBodyConstraint -> RBC.Object_1");
-				DEG_add_new_relation(tcomp, ob2, DEPSREL_TYPE_TRANSFORM, "RigidBodyConstraint -> RBC.Object_2");
+				DEG_add_new_relation(graph, tcomp, ob1, DEPSREL_TYPE_TRANSFORM, "RigidBodyConstraint -> RBC.Object_1");
+				DEG_add_new_relation(graph, tcomp, ob2, DEPSREL_TYPE_TRANSFORM, "RigidBodyConstraint -> RBC.Object_2");
 				
 				/* - ensure that sim depends on this constraint's transform */
-				DEG_add_new_relation(tcomp, &sim_node->nd, DEPSREL_TYPE_TRANSFORM, "RigidBodyConstraint Transform -> RB Simulation");
+				DEG_add_new_relation(graph, tcomp, &sim_node->nd, DEPSREL_TYPE_TRANSFORM, "RigidBodyConstraint Transform -> RB Simulation");
 			}
 		}
 	}
@@ -1020,7 +1152,7 @@ static void deg_build_shapekeys_graph(Depsgraph *graph, Scene *scene, Object *ob
 	/* 1) attach to geometry */
 	// XXX: aren't shapekeys now done as a pseudo-modifier on object?
 	obdata_node = DEG_get_node(graph, (ID *)ob->data, NULL, DEPSNODE_TYPE_GEOMETRY, NULL);
-	DEG_add_new_relation(key_node, obdata_node, DEPSREL_TYPE_GEOMETRY_EVAL, "Shapekeys");
+	DEG_add_new_relation(graph, key_node, obdata_node, DEPSREL_TYPE_GEOMETRY_EVAL, "Shapekeys");
 	
 	/* 2) attach drivers, etc. */
 	if (key->adt) {
@@ -1028,25 +1160,27 @@ static void deg_build_shapekeys_graph(Depsgraph *graph, Scene *scene, Object *ob
 	}
 }
 
-/* ObData Geometry Evaluation */
-// XXX: what happens if the datablock is shared!
-static void deg_build_obdata_geom_graph(Depsgraph *graph, Scene *scene, Object *ob)
+/* ObData Geometry Evaluation - Shared Part
+ * Obdata may be used by several objects, so the evaluation of the obdata's geometry
+ * (and the things this depends on) only gets built once, with all the objects using
+ * it linking to its results instead of evaluating it themselves.
+ */
+static void deg_build_obdata_geom_shared_graph(DepsgraphBuildContext *bcx, Scene *scene, Object *ob)
 {
-	DepsNode *geom_node, *obdata_geom;
+	Depsgraph *graph = bcx->graph;
+	DepsNode *obdata_geom;
 	OperationDepsNode *op_eval = NULL;
 	DepsNode *node2;
 	
-	ID *ob_id     = (ID *)ob;
 	ID *obdata_id = (ID *)ob->data;
 	Key *key;
 	
-	/* get nodes for result of obdata's evaluation, and geometry evaluation on object */
-	geom_node = DEG_get_node(graph, ob_id, NULL, DEPSNODE_TYPE_GEOMETRY, "Ob Geometry Component");
-	obdata_geom = DEG_get_node(graph, obdata_id, NULL, DEPSNODE_TYPE_GEOMETRY, "ObData Geometry Component");
-	
-	/* link components to each other */
-	DEG_add_new_relation(obdata_geom, geom_node, DEPSREL_TYPE_DATABLOCK, "Object Geometry Base Data");
+	/* only needs to be built for the first object using it */
+	if (deg_build_id_visited(bcx, obdata_id))
+		return;
 	
+	/* get node for result of obdata's evaluation */
+	obdata_geom = DEG_get_node(graph, obdata_id, NULL, DEPSNODE_TYPE_GEOMETRY, "ObData Geometry Component");
 	
 	/* type-specific node/links */
 	switch (ob->type) {
@@ -1055,31 +1189,9 @@ static void deg_build_obdata_geom_graph(Depsgraph *graph, Scene *scene, Object *
 			//Mesh *me = (Mesh *)ob->data;
 			
 			/* evaluation operations */
-			op_eval = DEG_add_operation(graph, ob_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
+			op_eval = DEG_add_operation(graph, obdata_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
 			                            DEPSOP_TYPE_EXEC, BKE_mesh_eval_geometry, 
-			                            "Geometry Eval");
-			RNA_id_pointer_create(obdata_id, &op_eval->ptr);
-		}
-		break;
-		
-		case OB_MBALL: 
-		{
-			Object *mom = BKE_mball_basis_find(scene, ob);
-			
-			/* motherball - mom depends on children! */
-			if (mom != ob) {
-				/* non-motherball -> cannot be directly evaluated! */
-				node2 = DEG_get_node(graph, &mom->id, NULL, DEPSNODE_TYPE_GEOMETRY, "Meta-Motherball");
-				DEG_add_new_relation(geom_node, node2, DEPSREL_TYPE_GEOMETRY_EVAL, "Metaball Motherball");
-			}
-			else {
-				/* metaball evaluation operations */
-				/* NOTE: only the motherball gets evaluated! */
-				op_eval = DEG_add_operation(graph, ob_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
-			                                DEPSOP_TYPE_EXEC, BKE_mball_eval_geometry, 
-			                                "Geometry Eval");
-				RNA_id_pointer_create(obdata_id, &op_eval->ptr);
-			}
+			                            DEG_OPNAME_GEOMETRY_EVAL);
 		}
 		break;
 		
@@ -1093,59 +1205,103 @@ static void deg_build_obdata_geom_graph(Depsgraph *graph, Scene *scene, Object *
 			// XXX: these needs geom data, but where is geom stored?
 			if (cu->bevobj) {
 				node2 = DEG_get_node(graph, (ID *)cu->bevobj, NULL, DEPSNODE_TYPE_GEOMETRY, NULL);
-				DEG_add_new_relation(node2, geom_node, DEPSREL_TYPE_GEOMETRY_EVAL, "Curve Bevel");
+				DEG_add_new_relation(graph, node2, obdata_geom, DEPSREL_TYPE_GEOMETRY_EVAL, "Curve Bevel");
 			}
 			if (cu->taperobj) {
 				node2 = DEG_get_node(graph, (ID *)cu->taperobj, NULL, DEPSNODE_TYPE_GEOMETRY, NULL);
-				DEG_add_new_relation(node2, geom_node, DEPSREL_TYPE_GEOMETRY_EVAL, "Curve Taper");
+				DEG_add_new_relation(graph, node2, obdata_geom, DEPSREL_TYPE_GEOMETRY_EVAL, "Curve Taper");
 			}
 			if (ob->type == OB_FONT) {
 				if (cu->textoncurve) {
 					node2 = DEG_get_node(graph, (ID *)cu->textoncurve, NULL, DEPSNODE_TYPE_GEOMETRY, NULL);
-					DEG_add_new_relation(node2, geom_node, DEPSREL_TYPE_GEOMETRY_EVAL, "Text on Curve");
+					DEG_add_new_relation(graph, node2, obdata_geom, DEPSREL_TYPE_GEOMETRY_EVAL, "Text on Curve");
 				}
 			}
 			
 			/* curve evaluation operations */
 			/* - calculate curve geometry (including path) */
-			op_eval = DEG_add_operation(graph, ob_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
+			op_eval = DEG_add_operation(graph, obdata_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
 			                            DEPSOP_TYPE_EXEC, BKE_curve_eval_geometry, 
-			                            "Geometry Eval");
-			RNA_id_pointer_create(obdata_id, &op_eval->ptr);
+			                            DEG_OPNAME_GEOMETRY_EVAL);
 			
 			/* - calculate curve path - this is used by constraints, etc. */
 			op_path = DEG_add_operation(graph, obdata_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
 			                            DEPSOP_TYPE_EXEC, BKE_curve_eval_path,
-			                            "Path");
+			                            DEG_OPNAME_PATH);
 		}
 		break;
 		
 		case OB_SURF: /* Nurbs Surface */
 		{
 			/* nurbs evaluation operations */
-			op_eval = DEG_add_operation(graph, ob_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
+			op_eval = DEG_add_operation(graph, obdata_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
 			                            DEPSOP_TYPE_EXEC, BKE_curve_eval_geometry, 
-			                            "Geometry Eval");
-			RNA_id_pointer_create(obdata_id, &op_eval->ptr);
+			                            DEG_OPNAME_GEOMETRY_EVAL);
 		}
 		break;
 		
 		case OB_LATTICE: /* Lattice */
 		{
 			/* lattice evaluation operations */
-			op_eval = DEG_add_operation(graph, ob_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
+			op_eval = DEG_add_operation(graph, obdata_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
 			                            DEPSOP_TYPE_EXEC, BKE_lattice_eval_geometry, 
-			                            "Geometry Eval");
-			RNA_id_pointer_create(obdata_id, &op_eval->ptr);
+			                            DEG_OPNAME_GEOMETRY_EVAL);
 		}
 		break;
 	}
 	
+	if (op_eval) {
+		RNA_id_pointer_create(obdata_id, &op_eval->ptr);
+	}
+	
 	/* ShapeKeys */
 	key = BKE_key_from_object(ob);
 	if (key) {
 		deg_build_shapekeys_graph(graph, scene, ob, key);
 	}
+}
+
+/* ObData Geometry Evaluation - Per-Object Part */
+static void deg_build_obdata_geom_graph(DepsgraphBuildContext *bcx, Scene *scene, Object *ob)
+{
+	Depsgraph *graph = bcx->graph;
+	DepsNode *geom_node, *obdata_geom;
+	
+	ID *ob_id     = (ID *)ob;
+	ID *obdata_id = (ID *)ob->data;
+	
+	/* get nodes for result of obdata's evaluation, and geometry evaluation on object */
+	geom_node = DEG_get_node(graph, ob_id, NULL, DEPSNODE_TYPE_GEOMETRY, "Ob Geometry Component");
+	obdata_geom = DEG_get_node(graph, obdata_id, NULL, DEPSNODE_TYPE_GEOMETRY, "ObData Geometry Component");
+	
+	/* link components to each other */
+	DEG_add_new_relation(graph, obdata_geom, geom_node, DEPSREL_TYPE_DATABLOCK, "Object Geometry Base Data");
+	
+	
+	/* obdata evaluation */
+	if (ob->type == OB_MBALL) {
+		Object *mom = BKE_mball_basis_find(scene, ob);
+		
+		/* motherball - mom depends on children! 
+		 * NOTE: this is done per object, as the result depends on the objects too
+		 */
+		if (mom != ob) {
+			/* non-motherball -> cannot be directly evaluated! */
+			DepsNode *node2 = DEG_get_node(graph, &mom->id, NULL, DEPSNODE_TYPE_GEOMETRY, "Meta-Motherball");
+			DEG_add_new_relation(graph, geom_node, node2, DEPSREL_TYPE_GEOMETRY_EVAL, "Metaball Motherball");
+		}
+		else {
+			/* metaball evaluation operations */
+			/* NOTE: only the motherball gets evaluated! */
+			OperationDepsNode *op_eval = DEG_add_operation(graph, ob_id, NULL, DEPSNODE_TYPE_OP_GEOMETRY,
+			                                               DEPSOP_TYPE_EXEC, BKE_mball_eval_geometry, 
+			                                               DEG_OPNAME_GEOMETRY_EVAL);
+			RNA_id_pointer_create(obdata_id, &op_eval->ptr);
+		}
+	}
+	else {
+		deg_build_obdata_geom_shared_graph(bcx, scene, ob);
+	}
 	
 	/* Modifiers */
 	if (ob->modifiers.first) {
@@ -1169,7 +1325,7 @@ static void deg_build_obdata_geom_graph(Depsgraph *graph, Scene *scene, Object *
 			Material *ma = give_current_material(ob, a);
 			
 			if (ma) {
-				deg_build_material_graph(graph, scene, geom_node, ma);
+				deg_build_material_graph(bcx, scene, geom_node, ma);
 			}
 		}
 	}
@@ -1196,37 +1352,31 @@ static void deg_build_camera_graph(Depsgraph *graph, Scene *scene, Object *ob)
 	/* DOF */
 	if (cam->dof_ob) {
 		node2 = DEG_get_node(graph, (ID *)cam->dof_ob, NULL, DEPSNODE_TYPE_TRANSFORM, "Camera DOF Transform");
-		DEG_add_new_relation(node2, obdata_node, DEPSREL_TYPE_TRANSFORM, "Camera DOF");
+		DEG_add_new_relation(graph, node2, obdata_node, DEPSREL_TYPE_TRANSFORM, "Camera DOF");
 	}
 }
 
 /* Lamps */
-static void deg_build_lamp_graph(Depsgraph *graph, Scene *scene, Object *ob)
+static void deg_build_lamp_graph(DepsgraphBuildContext *bcx, Scene *scene, Object *ob)
 {
+	Depsgraph *graph = bcx->graph;
 	Lamp *la = (Lamp *)ob->data;
 	DepsNode *obdata_node;
 	
-	/* Prevent infinite recursion by checking (and tagging the lamp) as having been visited 
-	 * already. This assumes la->id.flag & LIB_DOIT isn't set by anything else
-	 * in the meantime... [#32017]
-	 */
-	if (la->id.flag & LIB_DOIT)
+	/* lamp data may be shared between several objects, but only needs to be built once */
+	if (deg_build_id_visited(bcx, &la->id))
 		return;
 	
-	la->id.flag |= LIB_DOIT;
-	
 	/* node for obdata */
 	obdata_node = DEG_get_node(graph, &la->id, NULL, DEPSNODE_TYPE_PARAMETERS, "Lamp Parameters");
 	
 	/* lamp's nodetree */
 	if (la->nodetree) {
-		deg_build_nodetree_graph(graph, scene, obdata_node, la->nodetree);
+		deg_build_nodetree_graph(bcx, scene, obdata_node, la->nodetree);
 	}
 	
 	/* textures */
-	deg_build_texture_stack_graph(graph, scene, obdata_node, la->mtex);
-	
-	la->id.flag &= ~LIB_DOIT;
+	deg_build_texture_stack_graph(bcx, scene, obdata_node, la->mtex);
 }
 
 /* ************************************************* */
@@ -1244,7 +1394,7 @@ static DepsNode *deg_build_object_transform(Depsgraph *graph, Object *ob)
 	/* init operation - to be hooked up later */
 	trans_op = DEG_add_operation(graph, &ob->id, NULL, DEPSNODE_TYPE_OP_TRANSFORM,
 	                             DEPSOP_TYPE_INIT, BKE_object_eval_local_transform,
-	                             "BKE_object_eval_local_transform");
+	                             DEG_OPNAME_LOCAL_TRANSFORM);
 	RNA_id_pointer_create(&ob->id, &trans_op->ptr);
 	
 	/* return component created */
@@ -1270,7 +1420,7 @@ static void deg_build_object_parents(Depsgraph *graph, Object *ob)
 	
 	par_op = DEG_add_operation(graph, &ob->id, NULL, DEPSNODE_TYPE_OP_TRANSFORM, 
 	                           DEPSOP_TYPE_EXEC, BKE_object_eval_parent,
-	                           "BKE_object_eval_parent");
+	                           DEG_OPNAME_PARENT);
 	RNA_id_pointer_create(&ob->id, &par_op->ptr);
 	
 	/* type-specific links */
@@ -1278,7 +1428,7 @@ static void deg_build_object_parents(Depsgraph *graph, Object *ob)
 		case PARSKEL:  /* Armature Deform (Virtual Modifier) */
 		{
 			parent_node = DEG_get_node(graph, parent_id, NULL, DEPSNODE_TYPE_TRANSFORM, "Par Armature Transform");
-			DEG_add_new_relation(parent_node, ob_node, DEPSREL_TYPE_STANDARD, "Armature Deform Parent");
+			DEG_add_new_relation(graph, parent_node, ob_node, DEPSREL_TYPE_STANDARD, "Armature Deform Parent");
 		}
 		break;
 			
@@ -1286,16 +1436,16 @@ static void deg_build_object_parents(Depsgraph *graph, Object *ob)
 		case PARVERT3:
 		{
 			parent_node = DEG_get_node(graph, parent_id, NULL, DEPSNODE_TYPE_GEOMETRY, "Vertex Parent Geometry Source");
-			DEG_add_new_relation(parent_node, ob_node, DEPSREL_TYPE_GEOMETRY_EVAL, "Vertex Parent");
+			DEG_add_new_relation(graph, parent_node, ob_node, DEPSREL_TYPE_GEOMETRY_EVAL, "Vertex Parent");
 			
-			//parent_node->customdata_mask |= CD_MASK_ORIGINDEX;
+			((GeometryComponentDepsNode *)parent_node)->customdata_mask |= CD_MASK_ORIGINDEX;
 		}
 		break;
 			
 		case PARBONE: /* Bone Parent */
 		{
 			parent_node = DEG_get_node(graph, &ob->id, ob->parsubstr, DEPSNODE_TYPE_BONE, NULL);
-			DEG_add_new_relation(parent_node, ob_node, DEPSREL_TYPE_TRANSFORM, "Bone Parent");
+			DEG_add_new_relation(graph, parent_node, ob_node, DEPSREL_TYPE_TRANSFORM, "Bone Parent");
 		}
 		break;
 			
@@ -1304,7 +1454,7 @@ static void deg_build_object_parents(Depsgraph *graph, Object *ob)
 			if (ob->parent->type == OB_LATTICE) {
 				/* Lattice Deform Parent - Virtual Modifier */
 				parent_node = DEG_get_node(graph, parent_id, NULL, DEPSNODE_TYPE_TRANSFORM, "Par Lattice Transform");
-				DEG_add_new_relation(parent_node, ob_node, DEPSREL_TYPE_STANDARD, "Lattice Deform Parent");
+				DEG_add_new_relation(graph, parent_node, ob_node, DEPSREL_TYPE_STANDARD, "Lattice Deform Parent");
 			}
 			else if (ob->parent->type == OB_CURVE) {
 				Curve *cu = ob->parent->data;
@@ -1312,20 +1462,20 @@ static void deg_build_object_parents(Depsgraph *graph, Object *ob)
 				if (cu->flag & CU_PATH) {
 					/* Follow Path */
 					parent_node = DEG_get_node(graph, parent_id, NULL, DEPSNODE_TYPE_GEOMETRY, "Curve Path");
-					DEG_add_new_relation(parent_node, ob_node, DEPSREL_TYPE_TRANSFORM, "Curve Follow Parent");
+					DEG_add_new_relation(graph, parent_node, ob_node, DEPSREL_TYPE_TRANSFORM, "Curve Follow Parent");
 					// XXX: link to geometry or object? both are needed?
 					// XXX: link to timesource too?
 				}
 				else {
 					/* Standard Parent */
 					parent_node = DEG_get_node(graph, parent_id, NULL, DEPSNODE_TYPE_TRANSFORM, "Parent Transform");
-					DEG_add_new_relation(parent_node, ob_node, DEPSREL_TYPE_TRANSFORM, "Curve Parent");
+					DEG_add_new_relation(graph, parent_node, ob_node, DEPSREL_TYPE_TRANSFORM, "Curve Parent");
 				}
 			}
 			else {
 				/* Standard Parent */
 				parent_node = DEG_get_node(graph, parent_id, NULL, DEPSNODE_TYPE_TRANSFORM, "Parent Transform");
-				DEG_add_new_relation(parent_node, ob_node, DEPSREL_TYPE_TRANSFORM, "Parent");
+				DEG_add_new_relation(graph, parent_node, ob_node, DEPSREL_TYPE_TRANSFORM, "Parent");
 			}
 		}
 		break;
@@ -1339,12 +1489,14 @@ static void deg_build_object_parents(Depsgraph *graph, Object *ob)
 
 
 /* build depsgraph nodes + links for object */
-static DepsNode *deg_build_object_graph(Depsgraph *graph, Scene *scene, Object *ob)
+static DepsNode *deg_build_object_graph(DepsgraphBuildContext *bcx, Scene *scene, Object *ob)
 {
+	Depsgraph *graph = bcx->graph;
 	DepsNode *ob_node, *params_node, *trans_node;
 	
-	/* create node for object itself */
+	/* create node for object itself - this is no longer just a placeholder now */
 	ob_node = DEG_get_node(graph, &ob->id, NULL, DEPSNODE_TYPE_ID_REF, ob->id.name);
+	ob_node->flag &= ~DEPSNODE_FLAG_PLACEHOLDER;
 	
 	/* standard components */
 	params_node = DEG_get_node(graph, &ob->id, NULL, DEPSNODE_TYPE_PARAMETERS, NULL);
@@ -1380,7 +1532,7 @@ static DepsNode *deg_build_object_graph(Depsgraph *graph, Scene *scene, Object *
 			case OB_MBALL:
 			case OB_LATTICE:
 			{
-				deg_build_obdata_geom_graph(graph, scene, ob);
+				deg_build_obdata_geom_graph(bcx, scene, ob);
 			}
 			break;
 			
@@ -1391,7 +1543,7 @@ static DepsNode *deg_build_object_graph(Depsgraph *graph, Scene *scene, Object *
 			
 			
 			case OB_LAMP:   /* Lamp */
-				deg_build_lamp_graph(graph, scene, ob);
+				deg_build_lamp_graph(bcx, scene, ob);
 				break;
 				
 			case OB_CAMERA: /* Camera */
@@ -1415,15 +1567,193 @@ static DepsNode *deg_build_object_graph(Depsgraph *graph, Scene *scene, Object *
 }
 
 
+/* ************************************************* */
+/* Scene Objects */
+
+/* Objects in a scene are independent enough that their nodes can be built
+ * in parallel. Each worker thread builds a chunk of the scene's bases into a
+ * graph of its own, and these are then merged into the main graph (in the order 
+ * that the chunks appear in the scene) once all workers have finished. 
+ *
+ * Any nodes that an object refers to (e.g. parents, constraint targets, etc.)
+ * simply get created in the worker's graph as usual, and end up getting mapped
+ * to the proper ones during the merge.
+ *
+ * Thread-safety notes:
+ * - Workers only read from the scene data. Each one has its own build context, 
+ *   so datablocks shared by objects in different chunks get built once per chunk,
+ *   with the duplicates getting merged away afterwards.
+ * - Operation names get interned in a shared registry, which has its own lock
+ */
+
+/* Minimum number of bases that each worker should get - it's not worth 
+ * starting extra threads for scenes which are smaller than this
+ */
+#define DEG_BUILD_MIN_BASES_PER_THREAD  32
+
+/* Work assigned to a worker thread */
+typedef struct DepsgraphBuildChunk {
+	DepsgraphBuildContext bcx;  /* context for building this chunk's graph - nodes get built into this graph */
+	Scene *scene;               /* scene that bases belong to */
+	
+	Base *first_base;           /* first base to build nodes for */
+	int num_bases;              /* number of bases (starting from first_base) to build nodes for */
+} DepsgraphBuildChunk;
+
+/* Create root node and "official" time source for a graph which is about to be built */
+static void deg_build_root_nodes(Depsgraph *graph)
+{
+	/* create root node for scene first
+	 * - this way it should be the first in the graph,
+	 *   reflecting its role as the entrypoint
+	 */
+	graph->root_node = DEG_get_node(graph, NULL, NULL, DEPSNODE_TYPE_ROOT, "Root (Scene)");
+	
+	/* time source used by everything that is animated */
+	DEG_get_node(graph, NULL, NULL, DEPSNODE_TYPE_TIMESOURCE, "Time Source");
+}
+
+/* Build nodes for the object in a scene base */
+static void deg_build_base_graph(DepsgraphBuildContext *bcx, Scene *scene, Base *base)
+{
+	Object *ob = base->object;
+	
+	/* object itself */
+	deg_build_object_graph(bcx, scene, ob);
+	
+	/* object that this is a proxy for */
+	// XXX: the way that proxies work needs to be completely reviewed!
+	if (ob->proxy) {
+		deg_build_object_graph(bcx, scene, ob->proxy);
+	}
+}
+
+/* Worker thread callback - builds nodes for a chunk of bases */
+static void *deg_build_scene_objects_thread(void *chunk_v)
+{
+	DepsgraphBuildChunk *chunk = (DepsgraphBuildChunk *)chunk_v;
+	Base *base;
+	int i;
+	
+	for (base = chunk->first_base, i = 0; base && (i < chunk->num_bases); base = base->next, i++) {
+		if (deg_build_base_is_visible(&chunk->bcx, base)) {
+			deg_build_base_graph(&chunk->bcx, chunk->scene, base);
+		}
+	}
+	
+	return NULL;
+}
+
+/* Build nodes for all objects in scene, using several threads if there are enough of them */
+static void deg_build_scene_objects(DepsgraphBuildContext *bcx, Scene *scene)
+{
+	DepsgraphBuildChunk *chunks;
+	ListBase threads;
+	Base *base;
+	int num_bases = BLI_countlist(&scene->base);
+	int tot_thread = MIN2(BLI_system_thread_count(), BLENDER_MAX_THREADS);
+	int chunk_size;
+	int i;
+	
+	/* not worth the overhead for small scenes, so just do these directly */
+	tot_thread = MIN2(tot_thread, num_bases / DEG_BUILD_MIN_BASES_PER_THREAD);
+	
+	if (tot_thread < 2) {
+		for (base = scene->base.first; base; base = base->next) {
+			if (deg_build_base_is_visible(bcx, base)) {
+				deg_build_base_graph(bcx, scene, base);
+			}
+		}
+		return;
+	}
+	
+	/* split bases into (contiguous) chunks - one per thread */
+	chunks = MEM_callocN(sizeof(DepsgraphBuildChunk) * tot_thread, "DepsgraphBuildChunks");
+	chunk_size = (num_bases + tot_thread - 1) / tot_thread;
+	
+	for (i = 0, base = scene->base.first; i < tot_thread; i++) {
+		DepsgraphBuildChunk *chunk = &chunks[i];
+		int j;
+		
+		deg_build_context_init(&chunk->bcx, DEG_graph_new(), bcx->bmain);
+		chunk->bcx.lazy = bcx->lazy;
+		chunk->bcx.lay = bcx->lay;
+		chunk->scene = scene;
+		
+		chunk->first_base = base;
+		for (j = 0; base && (j < chunk_size); j++, base = base->next) {
+			chunk->num_bases++;
+		}
+		
+		/* these will get mapped to the ones in the main graph */
+		deg_build_root_nodes(chunk->bcx.graph);
+	}
+	
+	/* build chunks */
+	BLI_init_threads(&threads, deg_build_scene_objects_thread, tot_thread);
+	
+	for (i = 0; i < tot_thread; i++) {
+		BLI_insert_thread(&threads, &chunks[i]);
+	}
+	
+	BLI_end_threads(&threads);
+	
+	/* merge results into main graph
+	 * NOTE: this is done in the order that the chunks were assigned, 
+	 *       so that the result doesn't depend on which threads finished first
+	 */
+	for (i = 0; i < tot_thread; i++) {
+		DEG_graph_merge(bcx->graph, chunks[i].bcx.graph);
+		deg_build_context_free(&chunks[i].bcx);
+	}
+	
+	MEM_freeN(chunks);
+}
+
+/* ************************************************* */
+/* Dupli-Groups */
+
+/* Add instance of object's dupli-group to graph 
+ * NOTE: the group's subgraph only gets built once, with all instances sharing it
+ */
+static void deg_build_dupli_group(DepsgraphBuildContext *bcx, Scene *scene, Object *ob)
+{
+	Depsgraph *graph = bcx->graph;
+	DepsNode *ob_node = BLI_ghash_lookup(graph->id_hash, ob);
+	SubgraphDepsNode *sgn;
+	DepsNode *trans_node;
+	
+	/* objects which only have placeholders (i.e. with lazy building) aren't drawn, so don't need instancing yet */
+	if ((ob->dup_group == NULL) || (ob_node == NULL) || (ob_node->flag & DEPSNODE_FLAG_PLACEHOLDER))
+		return;
+	
+	sgn = (SubgraphDepsNode *)DEG_graph_build_group_subgraph(graph, bcx->bmain, scene, ob->dup_group);
+	if (sgn == NULL)
+		return;
+	
+	/* add instance - objects may get built again (i.e. when rebuilding their relations), so check first */
+	if (BLI_findptr(&sgn->instances, ob, offsetof(DepsgraphInstance, instancer)) == NULL) {
+		DepsgraphInstance *inst = MEM_callocN(sizeof(DepsgraphInstance), "DepsgraphInstance");
+		
+		inst->instancer = ob;
+		BLI_addtail(&sgn->instances, inst);
+		sgn->num_users++;
+	}
+	
+	/* instances can only be evaluated once their instancer has been transformed */
+	trans_node = DEG_get_node(graph, &ob->id, NULL, DEPSNODE_TYPE_TRANSFORM, NULL);
+	DEG_add_new_relation(graph, trans_node, &sgn->nd, DEPSREL_TYPE_TRANSFORM, "Dupli-Group Instance");
+}
+
 /* ************************************************* */
 /* Scene */
 
 /* build depsgraph for specified scene - this is called recursively for sets... */
-static DepsNode *deg_build_scene_graph(Depsgraph *graph, Main *bmain, Scene *scene)
+static DepsNode *deg_build_scene_graph(DepsgraphBuildContext *bcx, Scene *scene)
 {
+	Depsgraph *graph = bcx->graph;
 	DepsNode *scene_node;
 	DepsNode *time_src;
-	Group *group;
 	Base *base;
 	
 	/* init own node */
@@ -1441,44 +1771,20 @@ static DepsNode *deg_build_scene_graph(Depsgraph *graph, Main *bmain, Scene *sce
 	// XXX: depending on how this goes, that scene itself could probably store its
 	//      own little partial depsgraph?
 	if (scene->set) {
-		DepsNode *set_node = deg_build_scene_graph(graph, bmain, scene->set);
+		DepsNode *set_node = deg_build_scene_graph(bcx, scene->set);
 		// TODO: link set to scene, especially our timesource...
 	}
 	
 	/* scene objects */
-	for (base = scene->base.first; base; base = base->next) {
-		Object *ob = base->object;
-		
-		/* object itself */
-		deg_build_object_graph(graph, scene, ob);
-		
-		/* object that this is a proxy for */
-		// XXX: the way that proxies work needs to be completely reviewed!
-		if (ob->proxy) {
-			deg_build_object_graph(graph, scene, ob->proxy);
-		}
-		
-		/* handled in next loop... 
-		 * NOTE: in most cases, setting dupli-group means that we may want
-		 *       to instance existing data and/or reuse it with very few
-		 *       modifications...
-		 */
-		if (ob->dup_group) {
-			ob->dup_group->id.flag |= LIB_DOIT;
-		}
-	}
+	deg_build_scene_objects(bcx, scene);
 	
-	/* tagged groups */
-	for (group = bmain->group.first; group; group = group->id.next) {
-		if (group->id.flag & LIB_DOIT) {
-			DepsNode *group_node;
-			
-			/* add group as a subgraph... */
-			// TODO: we need to make this group reliant on the object that spawned it...
-			group_node = DEG_graph_build_group_subgraph(graph, bmain, group);
-			
-			group->id.flag &= ~LIB_DOIT;
-		}
+	/* dupli-groups 
+	 * NOTE: in most cases, setting dupli-group means that we may want
+	 *       to instance existing data and/or reuse it with very few
+	 *       modifications...
+	 */
+	for (base = scene->base.first; base; base = base->next) {
+		deg_build_dupli_group(bcx, scene, base->object);
 	}
 	
 	/* rigidbody */
@@ -1493,12 +1799,12 @@ static DepsNode *deg_build_scene_graph(Depsgraph *graph, Main *bmain, Scene *sce
 	
 	/* world */
 	if (scene->world) {
-		deg_build_world_graph(graph, scene, scene->world);
+		deg_build_world_graph(bcx, scene, scene->world);
 	}
 	
 	/* compo nodes */
 	if (scene->nodetree) {
-		deg_build_compo_graph(graph, scene);
+		deg_build_compo_graph(bcx, scene);
 	}
 	
 	/* sequencer */
@@ -1509,28 +1815,330 @@ static DepsNode *deg_build_scene_graph(Depsgraph *graph, Main *bmain, Scene *sce
 }
 
 /* ************************************************* */
-/* Depsgraph Building Entrypoints */
+/* Lazy Building */
 
-/* Build depsgraph for the given group, and dump results in given graph container 
- * This is usually used for building subgraphs for groups to use...
+/* When building lazily, objects which aren't visible only get an ID node, which is tagged
+ * as being a placeholder. The rest of their nodes get built when they become visible, or
+ * once something which got built turns out to depend on them.
  */
-void DEG_graph_build_from_group(Depsgraph *graph, Main *bmain, Group *group)
+
+/* Add placeholder nodes for objects which don't need to be built yet
+ * NOTE: this is done before building anything else, so that any nodes which
+ *       other objects add to these can be found afterwards
+ */
+static void deg_build_lazy_placeholders(DepsgraphBuildContext *bcx, Scene *scene)
 {
-	GroupObject *go;
+	Depsgraph *graph = bcx->graph;
+	Scene *sce;
+	Base *base;
 	
-	/* add group objects */
-	for (go = group->gobject.first; go; go = go->next) {
-		Object *ob = go->ob;
-		
-		/* Each "group object" is effectively a separate instance of the underlying
-		 * object data. When the group is evaluated, the transform results and/or 
-		 * some other attributes end up getting overridden by the group
-		 */
+	for (sce = scene; sce; sce = sce->set) {
+		for (base = sce->base.first; base; base = base->next) {
+			if (deg_build_base_is_visible(bcx, base) == false) {
+				Object *ob = base->object;
+				IDDepsNode *ob_node;
+				
+				ob_node = (IDDepsNode *)DEG_get_node(graph, &ob->id, NULL, DEPSNODE_TYPE_ID_REF, ob->id.name);
+				if (BLI_ghash_size(ob_node->component_hash) == 0) {
+					ob_node->nd.flag |= DEPSNODE_FLAG_PLACEHOLDER;
+				}
+			}
+		}
 	}
 }
 
+/* Check whether placeholder node is needed by the nodes which have been built */
+static bool deg_build_placeholder_is_needed(const IDDepsNode *ob_node)
+{
+	return (BLI_ghash_size(ob_node->component_hash) != 0) || 
+	       (ob_node->nd.inlinks.first != NULL) || (ob_node->nd.outlinks.first != NULL);
+}
+
+/* Placeholder for object which may still need building */
+typedef struct DepsLazyPlaceholder {
+	Scene *scene;          /* scene (or set) that object's base is in */
+	Base *base;            /* base to build object from */
+	bool queued;           /* placeholder has been added to queue of objects to build */
+} DepsLazyPlaceholder;
+
+/* Queue of placeholders which need building */
+typedef struct DepsLazyQueue {
+	GHash *placeholders;   /* <Object, DepsLazyPlaceholder> placeholders which haven't been queued yet */
+	ListBase queue;        /* (LinkData : DepsLazyPlaceholder) placeholders to build, in the order they were found to be needed */
+} DepsLazyQueue;
+
+/* Add placeholder node's object to queue, if it's needed now */
+static void deg_build_lazy_queue_node(DepsLazyQueue *lq, DepsNode *node)
+{
+	DepsLazyPlaceholder *ph;
+	
+	/* get ID node that node belongs to */
+	while (node && (node->type != DEPSNODE_TYPE_ID_REF)) {
+		node = node->owner;
+	}
+	
+	if ((node == NULL) || !(node->flag & DEPSNODE_FLAG_PLACEHOLDER))
+		return;
+	
+	ph = BLI_ghash_lookup(lq->placeholders, ((IDDepsNode *)node)->id);
+	if (ph && (ph->queued == false) && deg_build_placeholder_is_needed((IDDepsNode *)node)) {
+		ph->queued = true;
+		BLI_addtail(&lq->queue, BLI_genericNodeN(ph));
+	}
+}
+
+/* Queue placeholders which node is now linked to (DEG_NodeCallback) */
+static void deg_build_lazy_queue_linked_cb(DepsNode *node, void *lq_p)
+{
+	DepsLazyQueue *lq = (DepsLazyQueue *)lq_p;
+	
+	DEPSNODE_RELATIONS_ITER_BEGIN(node->inlinks.first, rel)
+	{
+		deg_build_lazy_queue_node(lq, rel->from);
+	}
+	DEPSNODE_RELATIONS_ITER_END;
+	
+	DEPSNODE_RELATIONS_ITER_BEGIN(node->outlinks.first, rel)
+	{
+		deg_build_lazy_queue_node(lq, rel->to);
+	}
+	DEPSNODE_RELATIONS_ITER_END;
+}
+
+/* Queue placeholders which object's nodes are linked to, now that it has been built */
+static void deg_build_lazy_queue_linked(DepsLazyQueue *lq, Depsgraph *graph, Object *ob)
+{
+	DepsNode *ob_node = BLI_ghash_lookup(graph->id_hash, ob);
+	
+	if (ob_node) {
+		DEG_node_foreach_owned(ob_node, deg_build_lazy_queue_linked_cb, lq);
+	}
+}
+
+/* Build objects which were left as placeholders, but which have turned out to be needed
+ * NOTE: objects built here may need other placeholders too. Only the placeholders which 
+ *       the objects being built get linked to can become needed though, so these are what 
+ *       get checked after building each one (instead of checking all of them again)
+ *
+ * < built: (LinkData : Object) optional list to add the objects which get built to
+ */
+static void deg_build_lazy_needed_objects(DepsgraphBuildContext *bcx, Scene *scene, ListBase *built)
+{
+	Depsgraph *graph = bcx->graph;
+	DepsLazyPlaceholder *phs;
+	DepsLazyQueue lq = {NULL};
+	LinkData *ld;
+	Scene *sce;
+	Base *base;
+	int num_bases = 0, i = 0;
+	
+	/* find placeholders, queueing the ones which are already needed */
+	for (sce = scene; sce; sce = sce->set) {
+		num_bases += BLI_countlist(&sce->base);
+	}
+	
+	phs = MEM_callocN(sizeof(DepsLazyPlaceholder) * MAX2(num_bases, 1), "DepsLazyPlaceholders");
+	lq.placeholders = BLI_ghash_ptr_new("deg_build_lazy_needed_objects() Placeholders");
+	
+	for (sce = scene; sce; sce = sce->set) {
+		for (base = sce->base.first; base; base = base->next) {
+			DepsNode *ob_node = BLI_ghash_lookup(graph->id_hash, base->object);
+			
+			if (ob_node && (ob_node->flag & DEPSNODE_FLAG_PLACEHOLDER) && 
+			    !BLI_ghash_haskey(lq.placeholders, base->object))
+			{
+				DepsLazyPlaceholder *ph = &phs[i++];
+				
+				ph->scene = sce;
+				ph->base = base;
+				BLI_ghash_insert(lq.placeholders, base->object, ph);
+				
+				deg_build_lazy_queue_node(&lq, ob_node);
+			}
+		}
+	}
+	
+	/* build queued objects, queueing anything else that these turn out to need */
+	while ((ld = lq.queue.first)) {
+		DepsLazyPlaceholder *ph = (DepsLazyPlaceholder *)ld->data;
+		Object *ob = ph->base->object;
+		DepsNode *ob_node = BLI_ghash_lookup(graph->id_hash, ob);
+		
+		BLI_freelinkN(&lq.queue, ld);
+		
+		/* may have been built already (i.e. as another object's proxy) */
+		if ((ob_node == NULL) || !(ob_node->flag & DEPSNODE_FLAG_PLACEHOLDER))
+			continue;
+		
+		deg_build_base_graph(bcx, ph->scene, ph->base);
+		
+		deg_build_lazy_queue_linked(&lq, graph, ob);
+		if (ob->proxy) {
+			deg_build_lazy_queue_linked(&lq, graph, ob->proxy);
+		}
+		
+		if (built) {
+			BLI_addtail(built, BLI_genericNodeN(ob));
+		}
+	}
+	
+	BLI_ghash_free(lq.placeholders, NULL, NULL);
+	MEM_freeN(phs);
+}
+
+/* ************************************************* */
+/* CustomData Masks */
+
+/* Geometry evaluation only needs to provide the CustomData layers that something actually uses.
+ * Things using geometry note which layers they need while the graph is being built. These (along with
+ * the layers needed by the object's modifiers) are then passed back along the chain of geometry
+ * components, so that each one knows what it needs to provide for everything evaluated from it.
+ */
+
+/* Get layers needed by object's modifiers which are enabled for the given type of evaluation */
+static uint64_t deg_build_modifiers_customdata_mask(Object *ob, eEvaluationContextType context_type)
+{
+	const int required_mode = (context_type == DEG_EVALUATION_CONTEXT_VIEWPORT) ? eModifierMode_Realtime : eModifierMode_Render;
+	ModifierData *md;
+	uint64_t mask = 0;
+	
+	for (md = ob->modifiers.first; md; md = md->next) {
+		ModifierTypeInfo *mti = modifierType_getInfo(md->type);
+		
+		if ((md->mode & required_mode) && (mti->requiredDataMask)) {
+			mask |= mti->requiredDataMask(ob, md);
+		}
+	}
+	
+	return mask;
+}
+
+/* Pass layers needed by geometry back along the links that it is evaluated from
+ * > returns: whether the masks of any of the geometry components it depends on changed
+ */
+static bool deg_build_customdata_masks_flush(GeometryComponentDepsNode *geom, LinkData *first_link)
+{
+	bool changed = false;
+	int i;
+	
+	DEPSNODE_RELATIONS_ITER_BEGIN(first_link, rel)
+	{
+		DepsNode *from = (rel->from->class == DEPSNODE_CLASS_OPERATION) ? rel->from->owner : rel->from;
+		GeometryComponentDepsNode *src = (GeometryComponentDepsNode *)from;
+		
+		if ((from == NULL) || (from->type != DEPSNODE_TYPE_GEOMETRY) || (src == geom))
+			continue;
+		
+		for (i = 0; i < DEG_MAX_EVALUATION_CONTEXTS; i++) {
+			if ((src->eval_masks[i] | geom->eval_masks[i]) != src->eval_masks[i]) {
+				src->eval_masks[i] |= geom->eval_masks[i];
+				changed = true;
+			}
+		}
+	}
+	DEPSNODE_RELATIONS_ITER_END;
+	
+	return changed;
+}
+
+/* Work out which CustomData layers each geometry component needs to evaluate */
+void DEG_graph_build_customdata_masks(Depsgraph *graph)
+{
+	GeometryComponentDepsNode **geoms;
+	GHashIterator hashIter;
+	int num_geoms = 0;
+	bool changed;
+	int i;
+	
+	geoms = MEM_mallocN(sizeof(GeometryComponentDepsNode *) * MAX2(BLI_ghash_size(graph->id_hash), 1), 
+	                    "DEG_graph_build_customdata_masks() geoms");
+	
+	/* start with what things using geometry need, along with what its own modifiers need */
+	GHASH_ITER(hashIter, graph->id_hash) {
+		IDDepsNode *id_node = BLI_ghashIterator_getValue(&hashIter);
+		GeometryComponentDepsNode *geom;
+		
+		if (id_node->nd.type != DEPSNODE_TYPE_ID_REF)
+			continue;
+		
+		geom = BLI_ghash_lookup(id_node->component_hash, SET_INT_IN_POINTER(DEPSNODE_TYPE_GEOMETRY));
+		if (geom == NULL)
+			continue;
+		
+		for (i = 0; i < DEG_MAX_EVALUATION_CONTEXTS; i++) {
+			geom->eval_masks[i] = geom->customdata_mask;
+			
+			if (GS(id_node->id->name) == ID_OB) {
+				geom->eval_masks[i] |= deg_build_modifiers_customdata_mask((Object *)id_node->id, (eEvaluationContextType)i);
+			}
+		}
+		
+		geoms[num_geoms++] = geom;
+	}
+	
+	/* pass these back to the geometry that each one is evaluated from, until nothing changes
+	 * NOTE: masks only ever grow, so this will end even if there are cycles
+	 */
+	do {
+		changed = false;
+		
+		for (i = 0; i < num_geoms; i++) {
+			GeometryComponentDepsNode *geom = geoms[i];
+			DepsNode *op;
+			
+			/* links may be attached to the component or to its operations */
+			changed |= deg_build_customdata_masks_flush(geom, geom->nd.inlinks.first);
+			
+			for (op = geom->ops.first; op; op = op->next) {
+				changed |= deg_build_customdata_masks_flush(geom, op->inlinks.first);
+			}
+		}
+	} while (changed);
+	
+	MEM_freeN(geoms);
+}
+
+/* ************************************************* */
+/* Depsgraph Building Entrypoints */
+
+/* Build depsgraph for the given group, and dump results in given graph container 
+ * This is usually used for building subgraphs for groups to use...
+ */
+void DEG_graph_build_from_group(Depsgraph *graph, Main *bmain, Scene *scene, Group *group)
+{
+	DepsgraphBuildContext bcx;
+	GroupObject *go;
+	
+	/* init context for building */
+	deg_build_context_init(&bcx, graph, bmain);
+	
+	/* add group objects */
+	for (go = group->gobject.first; go; go = go->next) {
+		Object *ob = go->ob;
+		
+		/* Each "group object" is effectively a separate instance of the underlying
+		 * object data. When the group is evaluated, the transform results and/or 
+		 * some other attributes end up getting overridden by the group
+		 * (see DEG_subgraph_evaluate_instances())
+		 */
+		// XXX: dupli-groups within groups aren't instanced yet...
+		if (ob && !deg_build_id_visited(&bcx, &ob->id)) {
+			deg_build_object_graph(&bcx, scene, ob);
+		}
+	}
+	
+	/* done with building */
+	deg_build_context_free(&bcx);
+	
+	/* ensure that all implicit constraints between nodes are satisfied */
+	DEG_graph_validate_links(graph);
+	
+	/* geometry only needs to provide the layers that get used */
+	DEG_graph_build_customdata_masks(graph);
+}
+
 /* Build subgraph for group */
-DepsNode *DEG_graph_build_group_subgraph(Depsgraph *graph_main, Main *bmain, Group *group)
+DepsNode *DEG_graph_build_group_subgraph(Depsgraph *graph_main, Main *bmain, Scene *scene, Group *group)
 {
 	Depsgraph *graph;
 	SubgraphDepsNode *subgraph_node;
@@ -1539,9 +2147,15 @@ DepsNode *DEG_graph_build_group_subgraph(Depsgraph *graph_main, Main *bmain, Gro
 	if (ELEM3(NULL, graph_main, bmain, group))
 		return NULL;
 	
+	/* each group only gets built once, with everything which instances it sharing the result */
+	subgraph_node = BLI_ghash_lookup(graph_main->id_hash, &group->id);
+	if (subgraph_node && (subgraph_node->nd.type == DEPSNODE_TYPE_SUBGRAPH)) {
+		return (DepsNode *)subgraph_node;
+	}
+	
 	/* create new subgraph's data */
 	graph = DEG_graph_new();
-	DEG_graph_build_from_group(graph, bmain, group);
+	DEG_graph_build_from_group(graph, bmain, scene, group);
 	
 	/* create a node for representing subgraph */
 	subgraph_node = (SubgraphDepsNode *)DEG_get_node(graph_main, &group->id, NULL,
@@ -1549,6 +2163,7 @@ DepsNode *DEG_graph_build_group_subgraph(Depsgraph *graph_main, Main *bmain, Gro
 	                                                 group->id.name);
 	                                                     
 	subgraph_node->graph = graph;
+	subgraph_node->flag |= SUBGRAPH_FLAG_FIRSTREF; /* graph belongs to this node */
 	
 	/* make a copy of the data this node will need? */
 	// XXX: do we do this now, or later?
@@ -1564,36 +2179,460 @@ DepsNode *DEG_graph_build_group_subgraph(Depsgraph *graph_main, Main *bmain, Gro
 // XXX: assume that this is called from outside, given the current scene as the "main" scene 
 void DEG_graph_build_from_scene(Depsgraph *graph, Main *bmain, Scene *scene)
 {
+	DepsgraphBuildContext bcx;
 	DepsNode *scene_node;
 	
-	/* clear "LIB_DOIT" flag from all materials, etc. 
-	 * to prevent infinite recursion problems later [#32017] 
-	 */
-	tag_main_idcode(bmain, ID_MA, FALSE);
-	tag_main_idcode(bmain, ID_LA, FALSE);
-	tag_main_idcode(bmain, ID_WO, FALSE);
-	tag_main_idcode(bmain, ID_TE, FALSE);
+	/* init context for building */
+	deg_build_context_init(&bcx, graph, bmain);
 	
-	/* create root node for scene first
-	 * - this way it should be the first in the graph,
-	 *   reflecting its role as the entrypoint
-	 */
-	graph->root_node = DEG_get_node(graph, NULL, NULL, DEPSNODE_TYPE_ROOT, "Root (Scene)");
+	deg_build_context_init_lazy(&bcx, scene);
+	
+	/* create root node (and time source) for scene first */
+	deg_build_root_nodes(graph);
+	((RootDepsNode *)graph->root_node)->bmain = bmain;
+	((RootDepsNode *)graph->root_node)->scene = scene;
+	
+	/* objects which don't need to be built yet */
+	if (bcx.lazy) {
+		deg_build_lazy_placeholders(&bcx, scene);
+	}
 	
 	/* build graph for scene and all attached data */
-	scene_node = deg_build_scene_graph(graph, bmain, scene);
+	scene_node = deg_build_scene_graph(&bcx, scene);
+	
+	/* build any of the objects left out which are needed after all */
+	if (bcx.lazy) {
+		deg_build_lazy_needed_objects(&bcx, scene, NULL);
+	}
 	
 	/* hook this up to a "root" node as entrypoint to graph... */
-	DEG_add_new_relation(graph->root_node, scene_node, 
+	DEG_add_new_relation(graph, graph->root_node, scene_node, 
 	                     DEPSREL_TYPE_ROOT_TO_ACTIVE, "Root to Active Scene");
-	                     
+	
+	/* done with building */
+	deg_build_context_free(&bcx);
+	
+	/* groups which only get instanced once don't need to be evaluated separately */
+	DEG_graph_inline_subgraphs(graph);
 	
 	/* ensure that all implicit constraints between nodes are satisfied */
 	DEG_graph_validate_links(graph);
 	
+	/* geometry only needs to provide the layers that get used */
+	DEG_graph_build_customdata_masks(graph);
+	
 	/* sort nodes to determine evaluation order (in most cases) */
 	DEG_graph_sort(graph);
 }
 
 /* ************************************************* */
+/* Rebuilding Entrypoints */
+
+/* Rebuild dependency graph only for a given scene */
+void DEG_scene_relations_rebuild(Depsgraph *graph, Main *bmain, Scene *scene)
+{
+	/* throw away everything, and build again from scratch */
+	DEG_graph_clear(graph);
+	DEG_graph_build_from_scene(graph, bmain, scene);
+}
+
+/* Incremental Rebuilds -------------------------------- */
+
+/* The relations for an ID-block are taken to be the ones which lead into its nodes
+ * (i.e. the things that it depends on), as these are what get added by the builders
+ * when building its nodes. Only the ID-blocks whose relations have changed then
+ * need to be rebuilt, which is done by:
+ *  1) Tagging their nodes as stale, and removing the relations leading into them
+ *  2) Running the builders for them again. Any existing nodes which get requested
+ *     again lose their stale tags, so links from these to other nodes (i.e. the things 
+ *     which depend on them) are preserved.
+ *  3) Removing the nodes which are still stale, as they aren't needed anymore
+ *     (unless something which isn't getting rebuilt still depends on them, i.e. 
+ *     driver targets, as whatever asked for these won't ask for them again)
+ *  4) Re-validating links for the nodes which were rebuilt
+ *
+ * Scene-level builders which add nodes of their own to objects' components (i.e. rigidbody sync)
+ * don't get run again though, so a full rebuild is done instead when these objects are involved.
+ */
+
+/* Add object to the set of objects to rebuild */
+static void deg_rebuild_add_object(GHash *objects, Object *ob)
+{
+	if (BLI_ghash_haskey(objects, ob) == false) {
+		BLI_ghash_insert(objects, ob, ob);
+	}
+}
+
+/* Find the objects which need to be rebuilt for the given ID-block's relations to be rebuilt
+ * < returns: false if the whole graph needs to be rebuilt instead
+ */
+static bool deg_rebuild_collect_objects(Scene *scene, ID *id, GHash *objects)
+{
+	Scene *sce;
+	Base *base;
+	
+	switch (GS(id->name)) {
+		case ID_OB: /* object - this may not be in scene anymore, in which case its nodes just get removed */
+			deg_rebuild_add_object(objects, (Object *)id);
+			return true;
+		
+		case ID_ME: /* object data - this gets built along with the objects which use it */
+		case ID_CU:
+		case ID_MB:
+		case ID_LT:
+		case ID_AR:
+		case ID_LA:
+		case ID_CA:
+			for (sce = scene; sce; sce = sce->set) {
+				for (base = sce->base.first; base; base = base->next) {
+					if (base->object->data == id) {
+						deg_rebuild_add_object(objects, base->object);
+					}
+				}
+			}
+			return true;
+		
+		default: /* scene-level data, or data which may be used in too many places to track down */
+			return false;
+	}
+}
+
+/* Check whether group has any of the given objects in it */
+static bool deg_rebuild_group_has_objects(Group *group, GHash *objects)
+{
+	GroupObject *go;
+	
+	if (group) {
+		for (go = group->gobject.first; go; go = go->next) {
+			if (go->ob && BLI_ghash_haskey(objects, go->ob)) {
+				return true;
+			}
+		}
+	}
+	
+	return false;
+}
+
+/* Check whether any of the objects have nodes added to them by scene-level builders
+ * (these only get run when building the whole scene)
+ */
+static bool deg_rebuild_scene_uses_objects(Scene *scene, GHash *objects)
+{
+	Scene *sce;
+	
+	for (sce = scene; sce; sce = sce->set) {
+		RigidBodyWorld *rbw = sce->rigidbody_world;
+		
+		/* rigidbody sync operations (and their relations) are added to participants' transform components */
+		if (rbw) {
+			if (deg_rebuild_group_has_objects(rbw->group, objects) || 
+			    deg_rebuild_group_has_objects(rbw->constraints, objects))
+			{
+				return true;
+			}
+		}
+	}
+	
+	return false;
+}
+
+/* Tag node as stale, and remove relations leading into it - the ones still needed will get added again */
+static void deg_rebuild_tag_stale_cb(DepsNode *node, void *graph_p)
+{
+	Depsgraph *graph = (Depsgraph *)graph_p;
+	
+	node->flag |= DEPSNODE_FLAG_STALE;
+	
+	DEPSNODE_RELATIONS_ITER_BEGIN(node->inlinks.first, rel)
+	{
+		DEG_remove_relation(graph, rel);
+		DEG_free_relation(rel);
+	}
+	DEPSNODE_RELATIONS_ITER_END;
+}
+
+/* Keep stale nodes which other nodes (that weren't rebuilt) still depend on
+ * NOTE: all links into stale nodes were removed when tagging them, so any links
+ *       which are left from stale nodes must go to nodes outside the rebuilt set
+ */
+static void deg_rebuild_keep_used_cb(DepsNode *node, void *UNUSED(userdata))
+{
+	if ((node->flag & DEPSNODE_FLAG_STALE) && (node->outlinks.first)) {
+		/* nodes owning it are still needed too */
+		for (; node && (node->flag & DEPSNODE_FLAG_STALE); node = node->owner) {
+			node->flag &= ~DEPSNODE_FLAG_STALE;
+		}
+	}
+}
+
+/* Collect nodes which are still stale after rebuilding */
+static void deg_rebuild_collect_stale_cb(DepsNode *node, void *list_p)
+{
+	if (node->flag & DEPSNODE_FLAG_STALE) {
+		BLI_addtail((ListBase *)list_p, BLI_genericNodeN(node));
+	}
+}
+
+/* Tag nodes for ID-block as stale, and note that the ID-block is being rebuilt */
+static void deg_rebuild_tag_id(Depsgraph *graph, ListBase *ids, ID *id)
+{
+	DepsNode *id_node = BLI_ghash_lookup(graph->id_hash, id);
+	
+	/* skip if not in graph (i.e. new object), or if it has been tagged already (i.e. shared obdata) */
+	if ((id_node == NULL) || (id_node->type != DEPSNODE_TYPE_ID_REF) || (id_node->flag & DEPSNODE_FLAG_STALE))
+		return;
+	
+	DEG_node_foreach_owned(id_node, deg_rebuild_tag_stale_cb, graph);
+	BLI_addtail(ids, BLI_genericNodeN(id));
+}
+
+/* Add the ID node owning the given node to the set of ID nodes whose links need validating */
+static void deg_rebuild_add_validate_node(GHash *validate, DepsNode *node)
+{
+	while (node && (node->type != DEPSNODE_TYPE_ID_REF)) {
+		node = node->owner;
+	}
+	
+	if (node && (BLI_ghash_haskey(validate, node) == false)) {
+		BLI_ghash_insert(validate, node, node);
+	}
+}
+
+/* Collect ID nodes which rebuilt node now depends on, as these may have gained new components */
+static void deg_rebuild_collect_validate_cb(DepsNode *node, void *validate_p)
+{
+	DEPSNODE_RELATIONS_ITER_BEGIN(node->inlinks.first, rel)
+	{
+		deg_rebuild_add_validate_node((GHash *)validate_p, rel->from);
+	}
+	DEPSNODE_RELATIONS_ITER_END;
+}
+
+/* Rebuild only the parts of a scene's dependency graph which are for the given ID-blocks */
+void DEG_scene_relations_rebuild_ids(Depsgraph *graph, Main *bmain, Scene *scene, ListBase *ids)
+{
+	DepsgraphBuildContext bcx;
+	ListBase rebuild_ids = {NULL, NULL};
+	ListBase stale_nodes = {NULL, NULL};
+	GHash *objects, *validate;
+	GHashIterator hashIter;
+	LinkData *ld;
+	Scene *sce;
+	Base *base;
+	bool validate_all;
+	
+	/* sanity checks */
+	if (ELEM4(NULL, graph, bmain, scene, ids))
+		return;
+	
+	/* if nothing has been built yet, everything needs to be built anyway */
+	if (graph->root_node == NULL) {
+		DEG_scene_relations_rebuild(graph, bmain, scene);
+		return;
+	}
+	
+	/* find the objects which need to be built again */
+	objects = BLI_ghash_ptr_new("DEG_scene_relations_rebuild_ids() Objects");
+	
+	for (ld = ids->first; ld; ld = ld->next) {
+		if (deg_rebuild_collect_objects(scene, (ID *)ld->data, objects) == false) {
+			BLI_ghash_free(objects, NULL, NULL);
+			DEG_scene_relations_rebuild(graph, bmain, scene);
+			return;
+		}
+	}
+	
+	if (deg_rebuild_scene_uses_objects(scene, objects)) {
+		BLI_ghash_free(objects, NULL, NULL);
+		DEG_scene_relations_rebuild(graph, bmain, scene);
+		return;
+	}
+	
+	/* 1) tag nodes of these objects (and their data) as stale 
+	 *    (instances they make get added again if they still have dupli-groups)
+	 */
+	GHASH_ITER(hashIter, objects) {
+		Object *ob = BLI_ghashIterator_getValue(&hashIter);
+		
+		DEG_graph_remove_instances(graph, ob);
+		deg_rebuild_tag_id(graph, &rebuild_ids, &ob->id);
+		if (ob->data) {
+			deg_rebuild_tag_id(graph, &rebuild_ids, (ID *)ob->data);
+		}
+	}
+	
+	/* 2) build objects again - in the order that they appear in the scene */
+	deg_build_context_init(&bcx, graph, bmain);
+	
+	for (sce = scene; sce; sce = sce->set) {
+		for (base = sce->base.first; base; base = base->next) {
+			if (BLI_ghash_haskey(objects, base->object)) {
+				deg_build_base_graph(&bcx, sce, base);
+				deg_build_dupli_group(&bcx, sce, base->object);
+				
+				/* new objects still need to be validated */
+				if (BLI_findptr(&rebuild_ids, base->object, offsetof(LinkData, data)) == NULL) {
+					BLI_addtail(&rebuild_ids, BLI_genericNodeN(base->object));
+				}
+			}
+		}
+	}
+	
+	deg_build_context_free(&bcx);
+	BLI_ghash_free(objects, NULL, NULL);
+	
+	/* 3) remove nodes which weren't needed again
+	 * NOTE: these are removed in the reverse of the order that they're found in,
+	 *       so that nodes get removed before the nodes which own them
+	 */
+	for (ld = rebuild_ids.first; ld; ld = ld->next) {
+		DepsNode *id_node = BLI_ghash_lookup(graph->id_hash, ld->data);
+		
+		if (id_node) {
+			DEG_node_foreach_owned(id_node, deg_rebuild_keep_used_cb, NULL);
+		}
+	}
+	
+	for (ld = rebuild_ids.first; ld; ld = ld->next) {
+		DepsNode *id_node = BLI_ghash_lookup(graph->id_hash, ld->data);
+		
+		if (id_node) {
+			DEG_node_foreach_owned(id_node, deg_rebuild_collect_stale_cb, &stale_nodes);
+		}
+	}
+	
+	for (ld = stale_nodes.last; ld; ld = ld->prev) {
+		DepsNode *node = (DepsNode *)ld->data;
+		
+		DEG_remove_node(graph, node);
+		DEG_free_node(node);
+		DEG_free_node_mem(node);
+	}
+	BLI_freelistN(&stale_nodes);
+	
+	/* groups which are now only instanced once don't need to be evaluated separately 
+	 * (everything gets validated then, as the contents of these are new to the graph)
+	 */
+	validate_all = DEG_graph_inline_subgraphs(graph);
+	
+	/* 4) validate links for rebuilt nodes, and for anything they depend on which may have gained new components */
+	validate = BLI_ghash_ptr_new("DEG_scene_relations_rebuild_ids() Validate");
+	
+	for (ld = rebuild_ids.first; ld; ld = ld->next) {
+		DepsNode *id_node = BLI_ghash_lookup(graph->id_hash, ld->data);
+		
+		if (id_node) {
+			deg_rebuild_add_validate_node(validate, id_node);
+			DEG_node_foreach_owned(id_node, deg_rebuild_collect_validate_cb, validate);
+		}
+	}
+	BLI_freelistN(&rebuild_ids);
+	
+	if (validate_all) {
+		DEG_graph_validate_links(graph);
+	}
+	else if (BLI_ghash_size(validate)) {
+		DepsNode **id_nodes = MEM_mallocN(sizeof(DepsNode *) * BLI_ghash_size(validate), "DEG_scene_relations_rebuild_ids() Validate Nodes");
+		int num_id_nodes = 0;
+		
+		GHASH_ITER(hashIter, validate) {
+			id_nodes[num_id_nodes++] = BLI_ghashIterator_getValue(&hashIter);
+		}
+		
+		DEG_graph_validate_id_links(graph, id_nodes, num_id_nodes);
+		MEM_freeN(id_nodes);
+	}
+	BLI_ghash_free(validate, NULL, NULL);
+	
+	/* rebuilt objects may use different layers of geometry now */
+	DEG_graph_build_customdata_masks(graph);
+	
+	/* update evaluation order 
+	 * NOTE: nodes which got removed have already been taken out of the 
+	 *       all_opnodes list, while new ones have been appended to it
+	 */
+	DEG_graph_sort(graph);
+}
+
+/* ************************************************* */
+/* Visibility Changes */
+
+/* Set whether graph only gets built for visible objects (and the things they need) */
+void DEG_graph_set_lazy_build(Depsgraph *graph, const bool lazy)
+{
+	if (lazy)
+		graph->flag |= DEPSGRAPH_FLAG_LAZY_BUILD;
+	else
+		graph->flag &= ~DEPSGRAPH_FLAG_LAZY_BUILD;
+}
+
+/* Visible layers or objects have changed
+ * - Objects which only had placeholders built for them (i.e. with lazy building)
+ *   get built now if they have become visible, along with anything they need
+ * < do_time: time-dependent data on these needs to be re-evaluated too
+ */
+void DEG_on_visible_update(Depsgraph *graph, Main *bmain, const bool do_time)
+{
+	DepsgraphBuildContext bcx;
+	RootDepsNode *root_node;
+	ListBase built = {NULL, NULL};
+	LinkData *ld;
+	Scene *scene, *sce;
+	Base *base;
+	
+	/* sanity checks */
+	if (ELEM(NULL, graph, graph->root_node))
+		return;
+	
+	root_node = (RootDepsNode *)graph->root_node;
+	scene = root_node->scene;
+	
+	if (scene == NULL)
+		return;
+	
+	/* build objects which have become visible */
+	deg_build_context_init(&bcx, graph, bmain);
+	deg_build_context_init_lazy(&bcx, scene);
+	
+	for (sce = scene; sce; sce = sce->set) {
+		for (base = sce->base.first; base; base = base->next) {
+			DepsNode *ob_node = BLI_ghash_lookup(graph->id_hash, base->object);
+			
+			if (ob_node && (ob_node->flag & DEPSNODE_FLAG_PLACEHOLDER) && deg_build_base_is_visible(&bcx, base)) {
+				deg_build_base_graph(&bcx, sce, base);
+				BLI_addtail(&built, BLI_genericNodeN(base->object));
+			}
+		}
+	}
+	
+	/* along with anything else they need which wasn't built yet */
+	deg_build_lazy_needed_objects(&bcx, scene, &built);
+	
+	/* objects which are now built fully get their dupli-groups instanced */
+	for (ld = built.first; ld; ld = ld->next) {
+		deg_build_dupli_group(&bcx, scene, (Object *)ld->data);
+	}
+	
+	deg_build_context_free(&bcx);
+	
+	if (built.first) {
+		/* new nodes need to obey the same rules as everything else */
+		DEG_graph_inline_subgraphs(graph);
+		DEG_graph_validate_links(graph);
+		DEG_graph_build_customdata_masks(graph);
+		DEG_graph_sort(graph);
+		
+		/* these haven't been evaluated yet */
+		for (ld = built.first; ld; ld = ld->next) {
+			DEG_id_tag_update(graph, (ID *)ld->data);
+		}
+		BLI_freelistN(&built);
+	}
+	
+	/* time-dependent data may be outdated on the things which have become visible */
+	if (do_time && root_node->time_source) {
+		DEG_node_tag_update(graph, &root_node->time_source->nd);
+	}
+}
 
+/* ************************************************* */
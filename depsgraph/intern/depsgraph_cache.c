@@ -0,0 +1,1536 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2013 Blender Foundation.
+ * All rights reserved.
+ *
+ * Original Author: Joshua Leung
+ * Contributor(s): None Yet
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ *
+ * On-disk cache of built Depsgraphs
+ *
+ * Building the graph for a big scene takes a while, yet most of the time the
+ * relations are exactly the same as the last time the file was opened. So, the
+ * graph gets written out into a compact cache file, which can be loaded again
+ * (instead of running the builders) as long as the data the builders look at
+ * hasn't changed since.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+#include "MEM_guardedalloc.h"
+
+#include "BLI_blenlib.h"
+#include "BLI_fileops.h"
+#include "BLI_ghash.h"
+#include "BLI_string.h"
+#include "BLI_utildefines.h"
+
+#include "DNA_action_types.h"
+#include "DNA_anim_types.h"
+#include "DNA_constraint_types.h"
+#include "DNA_curve_types.h"
+#include "DNA_group_types.h"
+#include "DNA_ID.h"
+#include "DNA_key_types.h"
+#include "DNA_listBase.h"
+#include "DNA_material_types.h"
+#include "DNA_mesh_types.h"
+#include "DNA_modifier_types.h"
+#include "DNA_node_types.h"
+#include "DNA_object_types.h"
+#include "DNA_particle_types.h"
+#include "DNA_rigidbody_types.h"
+#include "DNA_scene_types.h"
+#include "DNA_texture_types.h"
+#include "DNA_world_types.h"
+
+#include "BKE_action.h"
+#include "BKE_animsys.h"
+#include "BKE_constraint.h"
+#include "BKE_depsgraph.h"
+#include "BKE_fcurve.h"
+#include "BKE_key.h"
+#include "BKE_library.h"
+#include "BKE_main.h"
+#include "BKE_material.h"
+#include "BKE_particle.h"
+
+#include "RNA_access.h"
+#include "RNA_types.h"
+
+#include "depsgraph_types.h"
+#include "depsgraph_intern.h"
+
+#include "stubs.h" // XXX: REMOVE THIS INCLUDE ONCE DEPSGRAPH REFACTOR PROJECT IS DONE!!!
+
+/* ************************************************** */
+/* File Format */
+
+/* The cache file consists of a header, followed by several tightly-packed arrays
+ * of fixed-size records (and a table of the strings they use). Nothing in the
+ * file is a pointer - nodes are referred to by their index in the node array,
+ * strings by their offset in the string table, and ID-blocks by their names -
+ * so the file can be used directly after mapping it into memory, wherever it
+ * ends up getting mapped to.
+ *
+ * All offsets are from the start of the file.
+ */
+
+#define DEG_CACHE_MAGIC          "DEGCACHE"
+#define DEG_CACHE_VERSION        3
+
+/* written in native byte order, so that caches written on different machines can be told apart */
+#define DEG_CACHE_ENDIAN_CHECK   0x01020304
+
+/* "no string"/"no node" */
+#define DEG_CACHE_NONE           0xFFFFFFFF
+
+/* Header for cache file */
+typedef struct DepsCacheHeader {
+	char magic[8];               /* DEG_CACHE_MAGIC */
+	uint32_t version;            /* DEG_CACHE_VERSION */
+	uint32_t endian_check;       /* DEG_CACHE_ENDIAN_CHECK */
+	
+	uint32_t header_size;        /* sizeof(DepsCacheHeader) - sizes of records must match what we expect */
+	uint32_t node_size;          /* sizeof(DepsCacheNode) */
+	uint32_t relation_size;      /* sizeof(DepsCacheRelation) */
+	uint32_t file_size;          /* total size of the file (for catching truncated files) */
+	
+	uint64_t dna_hash;           /* hash of the data that the graph was built from (see deg_cache_dna_hash()) */
+	
+	uint32_t strings_offset;     /* (char) string table - NULL-terminated strings */
+	uint32_t strings_size;       /* (bytes) size of string table */
+	
+	uint32_t nodes_offset;       /* (DepsCacheNode) nodes, with nodes always coming before any nodes they own */
+	uint32_t num_nodes;
+	
+	uint32_t relations_offset;   /* (DepsCacheRelation) relations between nodes */
+	uint32_t num_relations;
+	
+	uint32_t order_offset;       /* (uint32_t) indices of nodes in all_opnodes, in evaluation order */
+	uint32_t num_order;
+} DepsCacheHeader;
+
+/* Reference to an ID-block, by name */
+typedef struct DepsCacheIDRef {
+	uint32_t name;               /* (string) name of ID-block, including the ID-code prefix */
+	uint32_t lib;                /* (string) name of library ID-block comes from, or DEG_CACHE_NONE when local */
+} DepsCacheIDRef;
+
+/* Kinds of data that operations can refer to */
+typedef enum eDepsCacheData_Kind {
+	DEG_CACHE_DATA_NONE        = 0,   /* nothing */
+	DEG_CACHE_DATA_ID          = 1,   /* the ID-block itself */
+	DEG_CACHE_DATA_POSE_BONE   = 2,   /* Pose Channel (by name) in an Object's pose */
+	DEG_CACHE_DATA_DRIVER      = 3,   /* Driver F-Curve (by RNA path + array index) in an ID-block's AnimData */
+	DEG_CACHE_DATA_PSYS        = 4,   /* Particle System (by name) on an Object */
+} eDepsCacheData_Kind;
+
+/* Reference to the data an operation works on (i.e. its PointerRNA or key handle) */
+typedef struct DepsCacheDataRef {
+	int32_t kind;                /* (eDepsCacheData_Kind) */
+	int32_t index;               /* array index (drivers only) */
+	DepsCacheIDRef id;           /* ID-block that data belongs to */
+	uint32_t name;               /* (string) name or RNA path of data within its ID-block */
+} DepsCacheDataRef;
+
+/* Node */
+typedef struct DepsCacheNode {
+	int16_t type;                /* (eDepsNode_Type) */
+	int16_t class;               /* (eDepsNode_Class) */
+	int16_t optype;              /* (eDepsOperation_Type) operations only */
+	int16_t opflag;              /* (eDepsOperation_Flag) operations only */
+	int16_t flag;                /* (eDepsNode_Flag) only the flags which aren't just used while evaluating (DEG_CACHE_NODE_FLAGS) */
+	int16_t pad;
+	
+	uint32_t name;               /* (string) name of node */
+	uint32_t subdata;            /* (string) name of bone that node is for, or DEG_CACHE_NONE */
+	uint32_t callback;           /* (string) name of evaluation callback (operations only) */
+	
+	DepsCacheIDRef id;           /* ID-block that node belongs to (id.name = DEG_CACHE_NONE for root-level nodes) */
+	
+	DepsCacheDataRef ptr;        /* data that operation is performed on */
+	DepsCacheDataRef handle;     /* specific data item that operation is for */
+} DepsCacheNode;
+
+/* Node flags which get stored in the cache */
+#define DEG_CACHE_NODE_FLAGS     (DEPSNODE_FLAG_PLACEHOLDER)
+
+/* Relation */
+typedef struct DepsCacheRelation {
+	uint32_t from;               /* (node index) */
+	uint32_t to;                 /* (node index) */
+	int32_t type;                /* (eDepsRelation_Type) */
+	int32_t flag;                /* (eDepsRelation_Flag) */
+	uint32_t name;               /* (string) description */
+} DepsCacheRelation;
+
+/* ************************************************** */
+/* Evaluation Callbacks Registry */
+
+/* Function pointers can't be stored in the file, so the evaluation callbacks
+ * that operations use get stored by name instead, and looked up in this table
+ * again on loading. Operations using a callback which isn't listed here make
+ * the graph impossible to cache.
+ */
+typedef struct DepsCacheCallback {
+	const char *name;
+	DepsEvalOperationCb func;
+} DepsCacheCallback;
+
+#define DEG_CACHE_CALLBACK(func)  {#func, func}
+
+static const DepsCacheCallback deg_cache_callbacks[] = {
+	/* animation */
+	DEG_CACHE_CALLBACK(BKE_animsys_eval_driver),
+	
+	/* transforms */
+	DEG_CACHE_CALLBACK(BKE_object_eval_local_transform),
+	DEG_CACHE_CALLBACK(BKE_object_eval_parent),
+	DEG_CACHE_CALLBACK(BKE_constraints_evaluate),
+	
+	/* rigs */
+	DEG_CACHE_CALLBACK(BKE_pose_rebuild_op),
+	DEG_CACHE_CALLBACK(BKE_pose_eval_init),
+	DEG_CACHE_CALLBACK(BKE_pose_eval_bone),
+	DEG_CACHE_CALLBACK(BKE_pose_eval_flush),
+	DEG_CACHE_CALLBACK(BKE_pose_iktree_evaluate),
+	DEG_CACHE_CALLBACK(BKE_pose_splineik_evaluate),
+	
+	/* geometry */
+	DEG_CACHE_CALLBACK(BKE_mesh_eval_geometry),
+	DEG_CACHE_CALLBACK(BKE_mball_eval_geometry),
+	DEG_CACHE_CALLBACK(BKE_curve_eval_geometry),
+	DEG_CACHE_CALLBACK(BKE_curve_eval_path),
+	DEG_CACHE_CALLBACK(BKE_lattice_eval_geometry),
+	
+	/* simulation */
+	DEG_CACHE_CALLBACK(BKE_particle_system_eval),
+	DEG_CACHE_CALLBACK(BKE_rigidbody_rebuild_sim),
+	DEG_CACHE_CALLBACK(BKE_rigidbody_eval_simulation),
+	DEG_CACHE_CALLBACK(BKE_rigidbody_object_sync_transforms),
+};
+
+#undef DEG_CACHE_CALLBACK
+
+/* Get name that callback is registered with, or NULL if it isn't known */
+static const char *deg_cache_callback_name(DepsEvalOperationCb func)
+{
+	int i;
+	
+	for (i = 0; i < sizeof(deg_cache_callbacks) / sizeof(DepsCacheCallback); i++) {
+		if (deg_cache_callbacks[i].func == func)
+			return deg_cache_callbacks[i].name;
+	}
+	
+	return NULL;
+}
+
+/* Get callback registered with the given name, or NULL if it isn't known */
+static DepsEvalOperationCb deg_cache_callback_find(const char *name)
+{
+	int i;
+	
+	for (i = 0; i < sizeof(deg_cache_callbacks) / sizeof(DepsCacheCallback); i++) {
+		if (STREQ(deg_cache_callbacks[i].name, name))
+			return deg_cache_callbacks[i].func;
+	}
+	
+	return NULL;
+}
+
+/* ************************************************** */
+/* DNA State Hash */
+
+/* A cached graph is only valid while everything the builders look at when
+ * building the graph is still the same. Rather than storing all of that in the
+ * cache, it gets summarised as a hash (64-bit FNV-1a) over the names of the
+ * ID-blocks and data involved, and the settings which decide which relations
+ * get created.
+ *
+ * NOTE: when adding new things to the builders, they'll need to get added here too!
+ */
+
+#define DEG_CACHE_HASH_INIT    0xcbf29ce484222325ULL
+#define DEG_CACHE_HASH_PRIME   0x00000100000001b3ULL
+
+/* Hash bytes */
+static uint64_t deg_cache_hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	size_t i;
+	
+	for (i = 0; i < len; i++) {
+		hash ^= (uint64_t)p[i];
+		hash *= DEG_CACHE_HASH_PRIME;
+	}
+	
+	return hash;
+}
+
+/* Hash string (including terminating NULL, so that "ab" + "c" differs from "a" + "bc") */
+static uint64_t deg_cache_hash_string(uint64_t hash, const char *str)
+{
+	if (str == NULL)
+		str = "";
+	
+	return deg_cache_hash_bytes(hash, str, strlen(str) + 1);
+}
+
+/* Hash integer setting */
+static uint64_t deg_cache_hash_int(uint64_t hash, int value)
+{
+	return deg_cache_hash_bytes(hash, &value, sizeof(value));
+}
+
+/* Hash reference to ID-block (name + library) */
+static uint64_t deg_cache_hash_id(uint64_t hash, const ID *id)
+{
+	if (id == NULL)
+		return deg_cache_hash_string(hash, NULL);
+	
+	hash = deg_cache_hash_string(hash, id->name);
+	hash = deg_cache_hash_string(hash, (id->lib) ? id->lib->name : NULL);
+	
+	return hash;
+}
+
+/* Hash drivers of ID-block - these add relations for their targets */
+static uint64_t deg_cache_hash_drivers(uint64_t hash, ID *id)
+{
+	AnimData *adt = BKE_animdata_from_id(id);
+	FCurve *fcu;
+	
+	if (adt == NULL)
+		return deg_cache_hash_int(hash, 0);
+	
+	hash = deg_cache_hash_id(hash, (ID *)adt->action);
+	
+	for (fcu = adt->drivers.first; fcu; fcu = fcu->next) {
+		ChannelDriver *driver = fcu->driver;
+		DriverVar *dvar;
+		
+		hash = deg_cache_hash_string(hash, fcu->rna_path);
+		hash = deg_cache_hash_int(hash, fcu->array_index);
+		
+		if (driver == NULL)
+			continue;
+		
+		hash = deg_cache_hash_int(hash, driver->type);
+		
+		for (dvar = driver->variables.first; dvar; dvar = dvar->next) {
+			DRIVER_TARGETS_USED_LOOPER(dvar)
+			{
+				hash = deg_cache_hash_id(hash, dtar->id);
+				hash = deg_cache_hash_string(hash, dtar->rna_path);
+				hash = deg_cache_hash_string(hash, dtar->pchan_name);
+				hash = deg_cache_hash_int(hash, dtar->flag);
+			}
+			DRIVER_TARGETS_LOOPER_END
+		}
+	}
+	
+	return hash;
+}
+
+/* Hash constraint stack - the targets used add relations, and solvers add them for their chains */
+static uint64_t deg_cache_hash_constraints(uint64_t hash, ListBase *constraints)
+{
+	bConstraint *con;
+	
+	for (con = constraints->first; con; con = con->next) {
+		bConstraintTypeInfo *cti = BKE_constraint_get_typeinfo(con);
+		bool use_tip;
+		int chainlen;
+		
+		hash = deg_cache_hash_int(hash, con->type);
+		
+		/* IK chains */
+		if (DEG_constraint_solver_chain(con, &use_tip, &chainlen)) {
+			hash = deg_cache_hash_int(hash, use_tip);
+			hash = deg_cache_hash_int(hash, chainlen);
+		}
+		
+		/* camera tracking - these don't use targets */
+		if (con->type == CONSTRAINT_TYPE_FOLLOWTRACK) {
+			bFollowTrackConstraint *data = (bFollowTrackConstraint *)con->data;
+			
+			hash = deg_cache_hash_int(hash, (data->clip != NULL) || (data->flag & FOLLOWTRACK_ACTIVECLIP));
+			hash = deg_cache_hash_int(hash, data->track[0] != '\0');
+			hash = deg_cache_hash_id(hash, (ID *)data->depth_ob);
+		}
+		
+		if (cti && cti->get_constraint_targets) {
+			ListBase targets = {NULL, NULL};
+			bConstraintTarget *ct;
+			
+			cti->get_constraint_targets(con, &targets);
+			
+			for (ct = targets.first; ct; ct = ct->next) {
+				/* target type decides which of its components gets used */
+				hash = deg_cache_hash_id(hash, (ID *)ct->tar);
+				hash = deg_cache_hash_int(hash, (ct->tar) ? ct->tar->type : -1);
+				hash = deg_cache_hash_string(hash, ct->subtarget);
+			}
+			
+			if (cti->flush_constraint_targets)
+				cti->flush_constraint_targets(con, &targets, 1);
+		}
+	}
+	
+	return deg_cache_hash_int(hash, -1);
+}
+
+/* Hash group, along with the objects in it (i.e. dupli-groups, rigidbody groups) */
+static uint64_t deg_cache_hash_group(uint64_t hash, Group *group)
+{
+	GroupObject *go;
+	
+	hash = deg_cache_hash_id(hash, (ID *)group);
+	if (group == NULL)
+		return hash;
+	
+	for (go = group->gobject.first; go; go = go->next) {
+		hash = deg_cache_hash_id(hash, (ID *)go->ob);
+	}
+	
+	return deg_cache_hash_int(hash, -1);
+}
+
+/* Hash shading data (material, texture, world, node-tree), along with the data it uses
+ * < visited: <ID> ID-blocks which have been hashed already - these can refer to each other
+ */
+static uint64_t deg_cache_hash_shading(uint64_t hash, ID *id, GHash *visited)
+{
+	MTex **texture_stack = NULL;
+	bNodeTree *ntree = NULL;
+	int i;
+	
+	hash = deg_cache_hash_id(hash, id);
+	if ((id == NULL) || BLI_ghash_haskey(visited, id))
+		return hash;
+	
+	BLI_ghash_insert(visited, id, id);
+	hash = deg_cache_hash_drivers(hash, id);
+	
+	switch (GS(id->name)) {
+		case ID_MA:
+			texture_stack = ((Material *)id)->mtex;
+			ntree = ((Material *)id)->nodetree;
+			break;
+		case ID_WO:
+			texture_stack = ((World *)id)->mtex;
+			ntree = ((World *)id)->nodetree;
+			break;
+		case ID_TE:
+			ntree = ((Tex *)id)->nodetree;
+			break;
+		case ID_NT:
+		{
+			bNode *node;
+			
+			for (node = ((bNodeTree *)id)->nodes.first; node; node = node->next) {
+				hash = deg_cache_hash_shading(hash, node->id, visited);
+			}
+		}
+		break;
+	}
+	
+	if (texture_stack) {
+		for (i = 0; i < MAX_MTEX; i++) {
+			hash = deg_cache_hash_shading(hash, (texture_stack[i]) ? (ID *)texture_stack[i]->tex : NULL, visited);
+		}
+	}
+	if (ntree) {
+		hash = deg_cache_hash_shading(hash, &ntree->id, visited);
+	}
+	
+	return hash;
+}
+
+/* Hash object that particle system depends on (DEG_ParticleTargetCallback) */
+static void deg_cache_hash_particle_target_cb(void *hash_p, Object *target, eDepsNode_Type type,
+                                              eDepsRelation_Type rel_type, const char *UNUSED(description))
+{
+	uint64_t *hash = (uint64_t *)hash_p;
+	
+	*hash = deg_cache_hash_id(*hash, &target->id);
+	*hash = deg_cache_hash_int(*hash, type);
+	*hash = deg_cache_hash_int(*hash, rel_type);
+}
+
+/* Hash object and the data it uses
+ * < scene: scene that object is being built for (effectors are found in this)
+ */
+static uint64_t deg_cache_hash_object(uint64_t hash, Scene *scene, Object *ob, GHash *visited)
+{
+	ModifierData *md;
+	ParticleSystem *psys;
+	int a;
+	
+	/* object itself */
+	hash = deg_cache_hash_id(hash, &ob->id);
+	hash = deg_cache_hash_int(hash, ob->type);
+	hash = deg_cache_hash_drivers(hash, &ob->id);
+	
+	/* transform */
+	hash = deg_cache_hash_id(hash, (ID *)ob->parent);
+	hash = deg_cache_hash_int(hash, ob->partype);
+	hash = deg_cache_hash_string(hash, ob->parsubstr);
+	hash = deg_cache_hash_id(hash, (ID *)ob->proxy);
+	hash = deg_cache_hash_group(hash, ob->dup_group);
+	
+	hash = deg_cache_hash_constraints(hash, &ob->constraints);
+	
+	/* pose */
+	if (ob->pose) {
+		bPoseChannel *pchan;
+		
+		for (pchan = ob->pose->chanbase.first; pchan; pchan = pchan->next) {
+			hash = deg_cache_hash_string(hash, pchan->name);
+			hash = deg_cache_hash_string(hash, (pchan->parent) ? pchan->parent->name : NULL);
+			hash = deg_cache_hash_constraints(hash, &pchan->constraints);
+		}
+	}
+	
+	/* geometry */
+	hash = deg_cache_hash_id(hash, (ID *)ob->data);
+	if (ob->data) {
+		hash = deg_cache_hash_drivers(hash, (ID *)ob->data);
+	}
+	
+	for (md = ob->modifiers.first; md; md = md->next) {
+		hash = deg_cache_hash_int(hash, md->type);
+		hash = deg_cache_hash_string(hash, md->name);
+	}
+	
+	for (a = 1; a <= ob->totcol; a++) {
+		hash = deg_cache_hash_shading(hash, (ID *)give_current_material(ob, a), visited);
+	}
+	
+	if (ob->type == OB_MESH) {
+		hash = deg_cache_hash_id(hash, (ID *)BKE_key_from_object(ob));
+	}
+	else if (ELEM3(ob->type, OB_CURVE, OB_SURF, OB_FONT)) {
+		Curve *cu = (Curve *)ob->data;
+		
+		hash = deg_cache_hash_id(hash, (ID *)cu->bevobj);
+		hash = deg_cache_hash_id(hash, (ID *)cu->taperobj);
+		hash = deg_cache_hash_id(hash, (ID *)cu->textoncurve);
+		hash = deg_cache_hash_int(hash, cu->flag & CU_PATH);
+	}
+	
+	/* particles */
+	for (psys = ob->particlesystem.first; psys; psys = psys->next) {
+		hash = deg_cache_hash_string(hash, psys->name);
+		hash = deg_cache_hash_id(hash, (ID *)psys->part);
+		
+		if (psys->part) {
+			hash = deg_cache_hash_drivers(hash, (ID *)psys->part);
+			hash = deg_cache_hash_int(hash, psys->part->ren_as);
+			hash = deg_cache_hash_id(hash, (ID *)psys->part->dup_ob);
+			hash = deg_cache_hash_group(hash, psys->part->dup_group);
+			
+			/* effectors (including other objects' force fields) and boid rule targets */
+			hash = deg_cache_hash_int(hash, psys_check_enabled(ob, psys));
+			DEG_particle_system_foreach_target(scene, ob, psys, deg_cache_hash_particle_target_cb, &hash);
+			hash = deg_cache_hash_int(hash, -1);
+		}
+	}
+	
+	return hash;
+}
+
+/* Hash the data that the graph for a scene gets built from
+ * NOTE: lazily built graphs also depend on what is visible (see deg_build_base_is_visible())
+ */
+static uint64_t deg_cache_dna_hash(const Depsgraph *graph, Scene *scene)
+{
+	uint64_t hash = DEG_CACHE_HASH_INIT;
+	GHash *visited = BLI_ghash_ptr_new("deg_cache_dna_hash() visited");
+	Scene *sce;
+	
+	hash = deg_cache_hash_int(hash, DEG_CACHE_VERSION);
+	hash = deg_cache_hash_int(hash, (graph->flag & DEPSGRAPH_FLAG_LAZY_BUILD) != 0);
+	hash = deg_cache_hash_int(hash, scene->lay);
+	
+	/* scene, and all of its sets */
+	for (sce = scene; sce; sce = sce->set) {
+		Base *base;
+		
+		hash = deg_cache_hash_id(hash, &sce->id);
+		hash = deg_cache_hash_id(hash, (ID *)sce->camera);  /* camera tracking constraints */
+		hash = deg_cache_hash_drivers(hash, &sce->id);
+		
+		hash = deg_cache_hash_shading(hash, (ID *)sce->world, visited);
+		hash = deg_cache_hash_shading(hash, (ID *)sce->nodetree, visited);
+		
+		if (sce->rigidbody_world) {
+			hash = deg_cache_hash_group(hash, sce->rigidbody_world->group);
+			hash = deg_cache_hash_group(hash, sce->rigidbody_world->constraints);
+		}
+		
+		for (base = sce->base.first; base; base = base->next) {
+			hash = deg_cache_hash_int(hash, base->lay);
+			hash = deg_cache_hash_int(hash, base->object->restrictflag & OB_RESTRICT_VIEW);
+			hash = deg_cache_hash_object(hash, sce, base->object, visited);
+		}
+		
+		/* end of scene */
+		hash = deg_cache_hash_int(hash, -1);
+	}
+	
+	BLI_ghash_free(visited, NULL, NULL);
+	return hash;
+}
+
+/* ************************************************** */
+/* Writing */
+
+/* State used while writing out the cache */
+typedef struct DepsCacheWriter {
+	/* nodes, in the order they get written */
+	DepsNode **nodes;
+	uint32_t num_nodes, max_nodes;
+	GHash *node_index;           /* <DepsNode, index + 1> */
+	
+	/* string table */
+	char *strings;
+	uint32_t strings_size, strings_max;
+	GHash *string_offsets;       /* <const char *, offset + 1> - keys point into "strings" */
+	
+	/* graph can be represented in cache (i.e. no unsupported data was encountered) */
+	bool ok;
+} DepsCacheWriter;
+
+/* Strings ------------------------------------------- */
+
+/* Get offset of string in string table, adding it if it isn't there yet */
+static uint32_t deg_cache_write_string(DepsCacheWriter *cw, const char *str)
+{
+	void *offset_p;
+	uint32_t len, offset;
+	
+	if (str == NULL)
+		return DEG_CACHE_NONE;
+	
+	/* reuse existing copy */
+	offset_p = BLI_ghash_lookup(cw->string_offsets, str);
+	if (offset_p) {
+		return GET_UINT_FROM_POINTER(offset_p) - 1;
+	}
+	
+	/* make room */
+	len = (uint32_t)strlen(str) + 1;
+	
+	if (cw->strings_size + len > cw->strings_max) {
+		GHashIterator hashIter;
+		char *old_strings = cw->strings;
+		GHash *old_offsets = cw->string_offsets;
+		
+		cw->strings_max = MAX2(cw->strings_max * 2, cw->strings_size + len);
+		cw->strings = MEM_reallocN(cw->strings, cw->strings_max);
+		
+		/* keys point into the old table, so the lookup hash needs rebuilding after moving it */
+		if (cw->strings != old_strings) {
+			cw->string_offsets = BLI_ghash_str_new("DepsCacheWriter Strings");
+			
+			GHASH_ITER(hashIter, old_offsets) {
+				void *value = BLI_ghashIterator_getValue(&hashIter);
+				BLI_ghash_insert(cw->string_offsets, cw->strings + GET_UINT_FROM_POINTER(value) - 1, value);
+			}
+			BLI_ghash_free(old_offsets, NULL, NULL);
+		}
+	}
+	
+	/* add to table */
+	offset = cw->strings_size;
+	memcpy(cw->strings + offset, str, len);
+	cw->strings_size += len;
+	
+	BLI_ghash_insert(cw->string_offsets, cw->strings + offset, SET_UINT_IN_POINTER(offset + 1));
+	
+	return offset;
+}
+
+/* Nodes --------------------------------------------- */
+
+/* Add node to the list of nodes to write, if it isn't there yet */
+static void deg_cache_add_node(DepsCacheWriter *cw, DepsNode *node)
+{
+	if (BLI_ghash_haskey(cw->node_index, node))
+		return;
+	
+	/* subgraphs would need their whole graph storing too, which isn't supported yet */
+	if (node->type == DEPSNODE_TYPE_SUBGRAPH) {
+		cw->ok = false;
+		return;
+	}
+	
+	if (cw->num_nodes == cw->max_nodes) {
+		cw->max_nodes = MAX2(cw->max_nodes * 2, 256);
+		cw->nodes = MEM_reallocN(cw->nodes, sizeof(DepsNode *) * cw->max_nodes);
+	}
+	
+	cw->nodes[cw->num_nodes++] = node;
+	BLI_ghash_insert(cw->node_index, node, SET_UINT_IN_POINTER(cw->num_nodes));
+}
+
+/* DEG_node_foreach_owned() callback for deg_cache_add_node() */
+static void deg_cache_add_node_cb(DepsNode *node, void *userdata)
+{
+	deg_cache_add_node((DepsCacheWriter *)userdata, node);
+}
+
+/* Get index of node in list of nodes to write */
+static uint32_t deg_cache_node_index(DepsCacheWriter *cw, const DepsNode *node)
+{
+	return GET_UINT_FROM_POINTER(BLI_ghash_lookup(cw->node_index, node)) - 1;
+}
+
+/* Get the ID-block that node belongs to (i.e. the one its ID node is for) */
+static ID *deg_cache_node_id(const DepsNode *node)
+{
+	for (; node; node = node->owner) {
+		if (node->type == DEPSNODE_TYPE_ID_REF)
+			return ((IDDepsNode *)node)->id;
+	}
+	
+	return NULL;
+}
+
+/* Get the name of the bone that node is for, if it is a bone component or one of its operations */
+static const char *deg_cache_node_subdata(const DepsNode *node)
+{
+	if (node->type == DEPSNODE_TYPE_BONE)
+		return node->name;
+	else if (node->owner && (node->owner->type == DEPSNODE_TYPE_BONE))
+		return node->owner->name;
+	
+	return NULL;
+}
+
+/* Fill in reference to ID-block */
+static void deg_cache_write_id_ref(DepsCacheWriter *cw, DepsCacheIDRef *ref, const ID *id)
+{
+	ref->name = (id) ? deg_cache_write_string(cw, id->name) : DEG_CACHE_NONE;
+	ref->lib = (id && id->lib) ? deg_cache_write_string(cw, id->lib->name) : DEG_CACHE_NONE;
+}
+
+/* Fill in reference to the data that operation's PointerRNA points to */
+static void deg_cache_write_ptr_ref(DepsCacheWriter *cw, DepsCacheDataRef *ref, const PointerRNA *ptr)
+{
+	ID *id = (ID *)ptr->id.data;
+	
+	ref->kind = DEG_CACHE_DATA_NONE;
+	ref->index = 0;
+	ref->name = DEG_CACHE_NONE;
+	deg_cache_write_id_ref(cw, &ref->id, id);
+	
+	if (ptr->data == NULL) {
+		/* nothing to store */
+	}
+	else if (id && (ptr->data == (void *)id)) {
+		ref->kind = DEG_CACHE_DATA_ID;
+	}
+	else if (id && (ptr->type == &RNA_PoseBone)) {
+		bPoseChannel *pchan = (bPoseChannel *)ptr->data;
+		
+		ref->kind = DEG_CACHE_DATA_POSE_BONE;
+		ref->name = deg_cache_write_string(cw, pchan->name);
+	}
+	else if (id && (ptr->type == &RNA_FCurve)) {
+		FCurve *fcu = (FCurve *)ptr->data;
+		
+		ref->kind = DEG_CACHE_DATA_DRIVER;
+		ref->name = deg_cache_write_string(cw, fcu->rna_path);
+		ref->index = fcu->array_index;
+	}
+	else {
+		/* unknown type of data */
+		cw->ok = false;
+	}
+}
+
+/* Fill in reference to the data item that operation is for */
+static void deg_cache_write_handle_ref(DepsCacheWriter *cw, DepsCacheDataRef *ref,
+                                       const OperationDepsNode *op, ID *id)
+{
+	ref->kind = DEG_CACHE_DATA_NONE;
+	ref->index = 0;
+	ref->name = DEG_CACHE_NONE;
+	deg_cache_write_id_ref(cw, &ref->id, (op->key.handle) ? id : NULL);
+	
+	if (op->key.handle == NULL) {
+		/* nothing to store */
+	}
+	else if (op->nd.type == DEPSNODE_TYPE_OP_DRIVER) {
+		const FCurve *fcu = (const FCurve *)op->key.handle;
+		
+		ref->kind = DEG_CACHE_DATA_DRIVER;
+		ref->name = deg_cache_write_string(cw, fcu->rna_path);
+		ref->index = fcu->array_index;
+	}
+	else if (op->nd.type == DEPSNODE_TYPE_OP_PARTICLE) {
+		const ParticleSystem *psys = (const ParticleSystem *)op->key.handle;
+		
+		ref->kind = DEG_CACHE_DATA_PSYS;
+		ref->name = deg_cache_write_string(cw, psys->name);
+	}
+	else {
+		/* unknown type of data */
+		cw->ok = false;
+	}
+}
+
+/* Fill in record for node */
+static void deg_cache_write_node(DepsCacheWriter *cw, DepsCacheNode *rec, const DepsNode *node)
+{
+	ID *id = deg_cache_node_id(node);
+	
+	memset(rec, 0, sizeof(DepsCacheNode));
+	
+	rec->type = node->type;
+	rec->class = node->class;
+	rec->flag = node->flag & DEG_CACHE_NODE_FLAGS;
+	
+	rec->name = deg_cache_write_string(cw, node->name);
+	rec->subdata = deg_cache_write_string(cw, deg_cache_node_subdata(node));
+	rec->callback = DEG_CACHE_NONE;
+	
+	deg_cache_write_id_ref(cw, &rec->id, id);
+	
+	/* nodes not attached to either an ID node or the root node can't be found again */
+	if ((id == NULL) && !ELEM(node->type, DEPSNODE_TYPE_ROOT, DEPSNODE_TYPE_TIMESOURCE)) {
+		cw->ok = false;
+	}
+	else if ((id == NULL) && (node->type == DEPSNODE_TYPE_TIMESOURCE) && (node->owner == NULL)) {
+		cw->ok = false;
+	}
+	
+	/* operations */
+	if (node->class == DEPSNODE_CLASS_OPERATION) {
+		const OperationDepsNode *op = (const OperationDepsNode *)node;
+		const char *cb_name = deg_cache_callback_name(op->evaluate);
+		
+		rec->optype = op->optype;
+		rec->opflag = op->flag;
+		
+		if (cb_name)
+			rec->callback = deg_cache_write_string(cw, cb_name);
+		else
+			cw->ok = false;
+		
+		deg_cache_write_ptr_ref(cw, &rec->ptr, &op->ptr);
+		deg_cache_write_handle_ref(cw, &rec->handle, op, id);
+	}
+}
+
+/* File ---------------------------------------------- */
+
+/* Write data to file, returning whether this succeeded */
+static bool deg_cache_fwrite(FILE *fp, const void *data, size_t size)
+{
+	return (size == 0) || (fwrite(data, size, 1, fp) == 1);
+}
+
+/* Write out graph to cache file
+ * < returns: whether the cache file could be written. Graphs containing
+ *            things that can't be stored in the cache (i.e. subgraphs,
+ *            unknown evaluation callbacks) aren't written.
+ */
+bool DEG_graph_cache_write(const Depsgraph *graph, Scene *scene, const char *filepath)
+{
+	DepsCacheWriter cw = {NULL};
+	DepsCacheHeader header = {{0}};
+	DepsCacheNode *node_recs = NULL;
+	DepsCacheRelation *rel_recs = NULL;
+	uint32_t *order = NULL;
+	uint32_t num_relations, num_order;
+	GHashIterator hashIter;
+	LinkData *ld;
+	uint32_t i;
+	
+	char tmp_filepath[FILE_MAX];
+	FILE *fp;
+	bool ok;
+	
+	/* sanity checks */
+	if (ELEM3(NULL, graph, scene, filepath) || (graph->root_node == NULL))
+		return false;
+	if (graph->subgraphs.first)
+		return false;
+	
+	/* init writer */
+	cw.node_index = BLI_ghash_ptr_new("DepsCacheWriter Nodes");
+	cw.strings_max = 4096;
+	cw.strings = MEM_mallocN(cw.strings_max, "DepsCacheWriter Strings");
+	cw.string_offsets = BLI_ghash_str_new("DepsCacheWriter Strings");
+	cw.ok = true;
+	
+	/* collect nodes - owners always come before the nodes they own, so that these can be found again when loading */
+	DEG_node_foreach_owned(graph->root_node, deg_cache_add_node_cb, &cw);
+	
+	GHASH_ITER(hashIter, graph->id_hash) {
+		DEG_node_foreach_owned(BLI_ghashIterator_getValue(&hashIter), deg_cache_add_node_cb, &cw);
+	}
+	
+	/* relations - these may lead to nodes not found above, so collect those too */
+	num_relations = (uint32_t)BLI_ghash_size(graph->relations_hash);
+	rel_recs = MEM_callocN(sizeof(DepsCacheRelation) * MAX2(num_relations, 1), "DepsCacheRelations");
+	
+	i = 0;
+	GHASH_ITER(hashIter, graph->relations_hash) {
+		DepsRelation *rel = BLI_ghashIterator_getValue(&hashIter);
+		DepsCacheRelation *rec = &rel_recs[i++];
+		
+		deg_cache_add_node(&cw, rel->from);
+		deg_cache_add_node(&cw, rel->to);
+		
+		rec->from = deg_cache_node_index(&cw, rel->from);
+		rec->to = deg_cache_node_index(&cw, rel->to);
+		rec->type = rel->type;
+		rec->flag = rel->flag & ~DEPSREL_FLAG_TEMP_TAG;
+		rec->name = deg_cache_write_string(&cw, rel->name);
+	}
+	
+	/* evaluation order */
+	num_order = (uint32_t)BLI_countlist(&graph->all_opnodes);
+	order = MEM_callocN(sizeof(uint32_t) * MAX2(num_order, 1), "DepsCacheOrder");
+	
+	for (ld = graph->all_opnodes.first, i = 0; ld; ld = ld->next, i++) {
+		deg_cache_add_node(&cw, (DepsNode *)ld->data);
+		order[i] = deg_cache_node_index(&cw, (DepsNode *)ld->data);
+	}
+	
+	/* node records - all nodes have been collected by now */
+	node_recs = MEM_callocN(sizeof(DepsCacheNode) * MAX2(cw.num_nodes, 1), "DepsCacheNodes");
+	
+	for (i = 0; i < cw.num_nodes; i++) {
+		deg_cache_write_node(&cw, &node_recs[i], cw.nodes[i]);
+	}
+	
+	ok = cw.ok;
+	
+	/* write file - via a temp file, so that partially written caches never get loaded */
+	if (ok) {
+		BLI_snprintf(tmp_filepath, sizeof(tmp_filepath), "%s@", filepath);
+		
+		/* header */
+		memcpy(header.magic, DEG_CACHE_MAGIC, sizeof(header.magic));
+		header.version = DEG_CACHE_VERSION;
+		header.endian_check = DEG_CACHE_ENDIAN_CHECK;
+		
+		header.header_size = sizeof(DepsCacheHeader);
+		header.node_size = sizeof(DepsCacheNode);
+		header.relation_size = sizeof(DepsCacheRelation);
+		
+		header.dna_hash = deg_cache_dna_hash(graph, scene);
+		
+		header.nodes_offset = sizeof(DepsCacheHeader);
+		header.num_nodes = cw.num_nodes;
+		
+		header.relations_offset = header.nodes_offset + sizeof(DepsCacheNode) * cw.num_nodes;
+		header.num_relations = num_relations;
+		
+		header.order_offset = header.relations_offset + sizeof(DepsCacheRelation) * num_relations;
+		header.num_order = num_order;
+		
+		header.strings_offset = header.order_offset + sizeof(uint32_t) * num_order;
+		header.strings_size = cw.strings_size;
+		
+		header.file_size = header.strings_offset + cw.strings_size;
+		
+		/* data */
+		fp = BLI_fopen(tmp_filepath, "wb");
+		
+		if (fp) {
+			ok = deg_cache_fwrite(fp, &header, sizeof(DepsCacheHeader)) &&
+			     deg_cache_fwrite(fp, node_recs, sizeof(DepsCacheNode) * cw.num_nodes) &&
+			     deg_cache_fwrite(fp, rel_recs, sizeof(DepsCacheRelation) * num_relations) &&
+			     deg_cache_fwrite(fp, order, sizeof(uint32_t) * num_order) &&
+			     deg_cache_fwrite(fp, cw.strings, cw.strings_size);
+			
+			if (fclose(fp) != 0)
+				ok = false;
+			
+			if (ok)
+				ok = (BLI_rename(tmp_filepath, filepath) == 0);
+			if (!ok)
+				BLI_delete(tmp_filepath, false, false);
+		}
+		else {
+			ok = false;
+		}
+	}
+	
+	/* free temp data */
+	MEM_freeN(order);
+	MEM_freeN(node_recs);
+	MEM_freeN(rel_recs);
+	
+	if (cw.nodes)
+		MEM_freeN(cw.nodes);
+	BLI_ghash_free(cw.node_index, NULL, NULL);
+	
+	BLI_ghash_free(cw.string_offsets, NULL, NULL);
+	MEM_freeN(cw.strings);
+	
+	return ok;
+}
+
+/* ************************************************** */
+/* Loading */
+
+/* Cache file loaded into memory */
+typedef struct DepsCacheFile {
+	const char *data;            /* contents of the file */
+	size_t size;                 /* (bytes) size of file */
+	bool is_mapped;              /* data is memory-mapped, instead of being read into a buffer */
+	
+	/* the parts of the file (valid once deg_cache_file_check() has succeeded) */
+	const DepsCacheHeader *header;
+	const char *strings;
+	const DepsCacheNode *nodes;
+	const DepsCacheRelation *relations;
+	const uint32_t *order;
+	
+	/* <const char *, ID> ID-blocks in bmain, by name (only valid while loading - see deg_cache_find_id()) */
+	GHash *id_names;
+} DepsCacheFile;
+
+/* Open ---------------------------------------------- */
+
+/* Map cache file into memory (or just read it in, where mapping isn't available) */
+static bool deg_cache_file_open(DepsCacheFile *cf, const char *filepath)
+{
+	memset(cf, 0, sizeof(DepsCacheFile));
+
+#ifndef WIN32
+	{
+		struct stat st;
+		void *data;
+		int fd;
+		
+		fd = BLI_open(filepath, O_RDONLY, 0);
+		if (fd == -1)
+			return false;
+		
+		if ((fstat(fd, &st) == -1) || (st.st_size < (off_t)sizeof(DepsCacheHeader))) {
+			close(fd);
+			return false;
+		}
+		
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		
+		if (data == MAP_FAILED)
+			return false;
+		
+		cf->data = (const char *)data;
+		cf->size = (size_t)st.st_size;
+		cf->is_mapped = true;
+	}
+#else
+	{
+		FILE *fp = BLI_fopen(filepath, "rb");
+		char *data;
+		long size;
+		
+		if (fp == NULL)
+			return false;
+		
+		if ((fseek(fp, 0, SEEK_END) != 0) || ((size = ftell(fp)) < (long)sizeof(DepsCacheHeader)) ||
+		    (fseek(fp, 0, SEEK_SET) != 0))
+		{
+			fclose(fp);
+			return false;
+		}
+		
+		data = MEM_mallocN((size_t)size, "DepsCacheFile");
+		
+		if (fread(data, (size_t)size, 1, fp) != 1) {
+			MEM_freeN(data);
+			fclose(fp);
+			return false;
+		}
+		fclose(fp);
+		
+		cf->data = data;
+		cf->size = (size_t)size;
+		cf->is_mapped = false;
+	}
+#endif
+	
+	return true;
+}
+
+/* Release cache file data */
+static void deg_cache_file_close(DepsCacheFile *cf)
+{
+	if (cf->data == NULL)
+		return;
+
+#ifndef WIN32
+	if (cf->is_mapped) {
+		munmap((void *)cf->data, cf->size);
+	}
+	else
+#endif
+	{
+		MEM_freeN((void *)cf->data);
+	}
+	
+	cf->data = NULL;
+}
+
+/* Validation ---------------------------------------- */
+
+/* Check that array of records lies within the file */
+static bool deg_cache_file_check_array(const DepsCacheFile *cf, uint32_t offset, uint32_t count, size_t size)
+{
+	/* records need to be aligned, as they get used in-place */
+	if (offset % sizeof(uint32_t))
+		return false;
+	if ((size_t)offset > cf->size)
+		return false;
+	
+	return (size_t)count <= (cf->size - (size_t)offset) / size;
+}
+
+/* Check that string reference is valid (strings are known to be terminated, see deg_cache_file_check()) */
+static bool deg_cache_file_check_string(const DepsCacheFile *cf, uint32_t str, bool allow_none)
+{
+	if (str == DEG_CACHE_NONE)
+		return allow_none;
+	
+	return str < cf->header->strings_size;
+}
+
+/* Check that ID-block and data references are valid */
+static bool deg_cache_file_check_data_ref(const DepsCacheFile *cf, const DepsCacheDataRef *ref)
+{
+	if ((ref->kind < DEG_CACHE_DATA_NONE) || (ref->kind > DEG_CACHE_DATA_PSYS))
+		return false;
+	
+	return deg_cache_file_check_string(cf, ref->id.name, true) &&
+	       deg_cache_file_check_string(cf, ref->id.lib, true) &&
+	       deg_cache_file_check_string(cf, ref->name, true);
+}
+
+/* Check that cache file is usable for the given DNA state
+ * Everything that gets used when loading is checked here, so that broken
+ * (or just outdated) files get rejected before anything gets added to the graph.
+ */
+static bool deg_cache_file_check(DepsCacheFile *cf, uint64_t dna_hash)
+{
+	const DepsCacheHeader *header = (const DepsCacheHeader *)cf->data;
+	uint32_t i;
+	
+	/* header */
+	if (memcmp(header->magic, DEG_CACHE_MAGIC, sizeof(header->magic)) != 0)
+		return false;
+	if ((header->version != DEG_CACHE_VERSION) || (header->endian_check != DEG_CACHE_ENDIAN_CHECK))
+		return false;
+	if ((header->header_size != sizeof(DepsCacheHeader)) || (header->node_size != sizeof(DepsCacheNode)) ||
+	    (header->relation_size != sizeof(DepsCacheRelation)))
+	{
+		return false;
+	}
+	if (header->file_size != cf->size)
+		return false;
+	
+	/* outdated */
+	if (header->dna_hash != dna_hash)
+		return false;
+	
+	/* arrays */
+	if (!deg_cache_file_check_array(cf, header->nodes_offset, header->num_nodes, sizeof(DepsCacheNode)) ||
+	    !deg_cache_file_check_array(cf, header->relations_offset, header->num_relations, sizeof(DepsCacheRelation)) ||
+	    !deg_cache_file_check_array(cf, header->order_offset, header->num_order, sizeof(uint32_t)) ||
+	    ((size_t)header->strings_offset > cf->size) ||
+	    ((size_t)header->strings_size > cf->size - (size_t)header->strings_offset))
+	{
+		return false;
+	}
+	
+	cf->header = header;
+	cf->strings = cf->data + header->strings_offset;
+	cf->nodes = (const DepsCacheNode *)(cf->data + header->nodes_offset);
+	cf->relations = (const DepsCacheRelation *)(cf->data + header->relations_offset);
+	cf->order = (const uint32_t *)(cf->data + header->order_offset);
+	
+	/* last string must be terminated, so that all of them are */
+	if ((header->strings_size == 0) || (cf->strings[header->strings_size - 1] != '\0'))
+		return false;
+	
+	/* nodes */
+	for (i = 0; i < header->num_nodes; i++) {
+		const DepsCacheNode *rec = &cf->nodes[i];
+		
+		if (DEG_get_node_typeinfo((eDepsNode_Type)rec->type) == NULL)
+			return false;
+		
+		if (!deg_cache_file_check_string(cf, rec->name, false) ||
+		    !deg_cache_file_check_string(cf, rec->subdata, true) ||
+		    !deg_cache_file_check_string(cf, rec->callback, rec->class != DEPSNODE_CLASS_OPERATION) ||
+		    !deg_cache_file_check_string(cf, rec->id.name, true) ||
+		    !deg_cache_file_check_string(cf, rec->id.lib, true) ||
+		    !deg_cache_file_check_data_ref(cf, &rec->ptr) ||
+		    !deg_cache_file_check_data_ref(cf, &rec->handle))
+		{
+			return false;
+		}
+	}
+	
+	/* relations */
+	for (i = 0; i < header->num_relations; i++) {
+		const DepsCacheRelation *rec = &cf->relations[i];
+		
+		if ((rec->from >= header->num_nodes) || (rec->to >= header->num_nodes) ||
+		    !deg_cache_file_check_string(cf, rec->name, false))
+		{
+			return false;
+		}
+	}
+	
+	/* order */
+	for (i = 0; i < header->num_order; i++) {
+		if (cf->order[i] >= header->num_nodes)
+			return false;
+	}
+	
+	return true;
+}
+
+/* Binding ------------------------------------------- */
+
+/* Get string from string table */
+static const char *deg_cache_file_string(const DepsCacheFile *cf, uint32_t str)
+{
+	return (str != DEG_CACHE_NONE) ? cf->strings + str : NULL;
+}
+
+/* Is ID-block from the given library? */
+static bool deg_cache_id_lib_matches(const ID *id, const char *lib)
+{
+	return (lib == NULL) ? (id->lib == NULL) : (id->lib && STREQ(id->lib->name, lib));
+}
+
+/* Make lookup table for finding ID-blocks by name, so that they don't all need to be searched for each reference 
+ * NOTE: only the first ID-block with each name is included - those with the same name from other libraries are rare
+ */
+static GHash *deg_cache_id_names_new(Main *bmain)
+{
+	GHash *id_names = BLI_ghash_str_new("DepsCacheFile ID Names");
+	ListBase *lbarray[MAX_LIBARRAY];
+	int a = set_listbasepointers(bmain, lbarray);
+	
+	while (a--) {
+		ID *id;
+		
+		for (id = lbarray[a]->first; id; id = id->next) {
+			if (BLI_ghash_haskey(id_names, id->name) == false) {
+				BLI_ghash_insert(id_names, id->name, id);
+			}
+		}
+	}
+	
+	return id_names;
+}
+
+/* Find ID-block that reference refers to */
+static ID *deg_cache_find_id(const DepsCacheFile *cf, Main *bmain, const DepsCacheIDRef *ref)
+{
+	const char *name = deg_cache_file_string(cf, ref->name);
+	const char *lib = deg_cache_file_string(cf, ref->lib);
+	ListBase *lb;
+	ID *id;
+	
+	if ((name == NULL) || (strlen(name) < 2))
+		return NULL;
+	
+	/* usually, the first ID-block with the name is the right one */
+	if (cf->id_names) {
+		id = BLI_ghash_lookup(cf->id_names, name);
+		
+		if (id == NULL)
+			return NULL;
+		else if (deg_cache_id_lib_matches(id, lib))
+			return id;
+	}
+	
+	/* otherwise, it's from one of the other libraries which have ID-blocks with this name */
+	lb = which_libbase(bmain, GS(name));
+	if (lb == NULL)
+		return NULL;
+	
+	for (id = lb->first; id; id = id->next) {
+		if (STREQ(id->name, name) && deg_cache_id_lib_matches(id, lib)) {
+			return id;
+		}
+	}
+	
+	return NULL;
+}
+
+/* Find ID-block that reference refers to, reusing the result of the last lookup where possible
+ * NOTE: the nodes for each ID-block come one after the other, so this saves most of the lookups
+ */
+static ID *deg_cache_find_id_cached(const DepsCacheFile *cf, Main *bmain, const DepsCacheIDRef *ref,
+                                    DepsCacheIDRef *last_ref, ID **last_id)
+{
+	if ((ref->name != last_ref->name) || (ref->lib != last_ref->lib)) {
+		*last_id = deg_cache_find_id(cf, bmain, ref);
+		*last_ref = *ref;
+	}
+	
+	return *last_id;
+}
+
+/* Find the data that data reference refers to
+ * < r_data: (pointer to) data found, or NULL if reference is empty
+ * < returns: whether referenced data could be found
+ */
+static bool deg_cache_find_data(const DepsCacheFile *cf, Main *bmain, const DepsCacheDataRef *ref,
+                                ID **r_id, void **r_data)
+{
+	const char *name = deg_cache_file_string(cf, ref->name);
+	ID *id;
+	
+	*r_id = NULL;
+	*r_data = NULL;
+	
+	if (ref->kind == DEG_CACHE_DATA_NONE)
+		return true;
+	
+	id = deg_cache_find_id(cf, bmain, &ref->id);
+	if (id == NULL)
+		return false;
+	
+	*r_id = id;
+	
+	switch (ref->kind) {
+		case DEG_CACHE_DATA_ID:
+			*r_data = id;
+			break;
+		
+		case DEG_CACHE_DATA_POSE_BONE:
+			if ((GS(id->name) == ID_OB) && ((Object *)id)->pose && name)
+				*r_data = BKE_pose_channel_find_name(((Object *)id)->pose, name);
+			break;
+		
+		case DEG_CACHE_DATA_DRIVER:
+		{
+			AnimData *adt = BKE_animdata_from_id(id);
+			
+			if (adt && name)
+				*r_data = list_find_fcurve(&adt->drivers, name, ref->index);
+		}
+		break;
+		
+		case DEG_CACHE_DATA_PSYS:
+			if ((GS(id->name) == ID_OB) && name)
+				*r_data = BLI_findstring(&((Object *)id)->particlesystem, name, offsetof(ParticleSystem, name));
+			break;
+	}
+	
+	return (*r_data != NULL);
+}
+
+/* Graph --------------------------------------------- */
+
+/* Recreate the graph stored in the cache file
+ * NOTE: nodes are recreated using the same calls as the builders use, so
+ *       ownership and all lookup hashes get set up in the usual way
+ */
+static bool deg_cache_load(Depsgraph *graph, Main *bmain, const DepsCacheFile *cf)
+{
+	const DepsCacheHeader *header = cf->header;
+	DepsNode **nodes;
+	DepsCacheIDRef last_ref = {DEG_CACHE_NONE, DEG_CACHE_NONE};
+	ID *last_id = NULL;
+	uint32_t i;
+	bool ok = true;
+	
+	nodes = MEM_callocN(sizeof(DepsNode *) * MAX2(header->num_nodes, 1), "DepsCacheLoad Nodes");
+	
+	/* nodes */
+	for (i = 0; ok && (i < header->num_nodes); i++) {
+		const DepsCacheNode *rec = &cf->nodes[i];
+		const char *name = deg_cache_file_string(cf, rec->name);
+		const char *subdata = deg_cache_file_string(cf, rec->subdata);
+		ID *id = NULL;
+		
+		/* ID-block */
+		if (rec->id.name != DEG_CACHE_NONE) {
+			id = deg_cache_find_id_cached(cf, bmain, &rec->id, &last_ref, &last_id);
+			
+			if (id == NULL) {
+				ok = false;
+				break;
+			}
+		}
+		
+		if (rec->class == DEPSNODE_CLASS_OPERATION) {
+			DepsEvalOperationCb func = deg_cache_callback_find(deg_cache_file_string(cf, rec->callback));
+			OperationDepsNode *op;
+			ID *ptr_id, *handle_id;
+			void *ptr_data, *handle;
+			
+			if ((func == NULL) || (id == NULL) ||
+			    !deg_cache_find_data(cf, bmain, &rec->ptr, &ptr_id, &ptr_data) ||
+			    !deg_cache_find_data(cf, bmain, &rec->handle, &handle_id, &handle))
+			{
+				ok = false;
+				break;
+			}
+			
+			op = DEG_add_operation_ex(graph, id, subdata, (eDepsNode_Type)rec->type,
+			                          (eDepsOperation_Type)rec->optype, func, name, handle);
+			if (op == NULL) {
+				ok = false;
+				break;
+			}
+			
+			op->flag = rec->opflag;
+			
+			/* data to operate on */
+			switch (rec->ptr.kind) {
+				case DEG_CACHE_DATA_NONE:
+					memset(&op->ptr, 0, sizeof(PointerRNA));
+					break;
+				case DEG_CACHE_DATA_ID:
+					RNA_id_pointer_create(ptr_id, &op->ptr);
+					break;
+				case DEG_CACHE_DATA_POSE_BONE:
+					RNA_pointer_create(ptr_id, &RNA_PoseBone, ptr_data, &op->ptr);
+					break;
+				case DEG_CACHE_DATA_DRIVER:
+					RNA_pointer_create(ptr_id, &RNA_FCurve, ptr_data, &op->ptr);
+					break;
+				default:
+					ok = false;
+					break;
+			}
+			
+			nodes[i] = (DepsNode *)op;
+		}
+		else {
+			nodes[i] = DEG_get_node(graph, id, subdata, (eDepsNode_Type)rec->type, name);
+		}
+		
+		/* node found must be the one that was stored */
+		if ((nodes[i] == NULL) || (nodes[i]->type != rec->type))
+			ok = false;
+		else
+			nodes[i]->flag |= (rec->flag & DEG_CACHE_NODE_FLAGS);
+	}
+	
+	/* relations */
+	for (i = 0; ok && (i < header->num_relations); i++) {
+		const DepsCacheRelation *rec = &cf->relations[i];
+		DepsRelation *rel;
+		
+		rel = DEG_create_new_relation(nodes[rec->from], nodes[rec->to], (eDepsRelation_Type)rec->type,
+		                              deg_cache_file_string(cf, rec->name));
+		rel->flag = rec->flag;
+		
+		DEG_add_relation(graph, rel);
+	}
+	
+	/* evaluation order - this replaces the order that the nodes got created in */
+	if (ok) {
+		if (header->num_order == (uint32_t)BLI_countlist(&graph->all_opnodes)) {
+			BLI_freelistN(&graph->all_opnodes);
+			
+			for (i = 0; i < header->num_order; i++) {
+				BLI_addtail(&graph->all_opnodes, BLI_genericNodeN(nodes[cf->order[i]]));
+			}
+		}
+		else {
+			ok = false;
+		}
+	}
+	
+	MEM_freeN(nodes);
+	return ok;
+}
+
+/* Build graph from cache file, if it is still valid for the given scene
+ * < graph: empty graph to build
+ * < returns: whether the graph was loaded from the cache. When it wasn't
+ *            (i.e. file is missing, outdated, or can't be bound to the
+ *            data in bmain), the graph gets built from the scene instead.
+ */
+bool DEG_graph_build_from_cache(Depsgraph *graph, Main *bmain, Scene *scene, const char *filepath)
+{
+	DepsCacheFile cf;
+	bool ok = false;
+	
+	/* sanity checks */
+	if (ELEM3(NULL, graph, bmain, scene))
+		return false;
+	
+	/* try to load cache */
+	if (filepath && deg_cache_file_open(&cf, filepath)) {
+		if (deg_cache_file_check(&cf, deg_cache_dna_hash(graph, scene))) {
+			cf.id_names = deg_cache_id_names_new(bmain);
+			ok = deg_cache_load(graph, bmain, &cf);
+			
+			BLI_ghash_free(cf.id_names, NULL, NULL);
+			cf.id_names = NULL;
+		}
+		
+		/* the scene the root node is for isn't stored, but lazily built graphs need it to expand later */
+		if (ok && graph->root_node) {
+			RootDepsNode *root_node = (RootDepsNode *)graph->root_node;
+			
+			root_node->bmain = bmain;
+			root_node->scene = scene;
+		}
+		
+		/* layers of geometry which are needed aren't stored either, as they're quick to find again */
+		if (ok) {
+			DEG_graph_build_customdata_masks(graph);
+		}
+		
+		deg_cache_file_close(&cf);
+	}
+	
+	/* fall back to building it the normal way */
+	if (!ok) {
+		DEG_graph_clear(graph);
+		DEG_graph_build_from_scene(graph, bmain, scene);
+	}
+	
+	return ok;
+}
+
+/* ************************************************** */
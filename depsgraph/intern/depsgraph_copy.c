@@ -0,0 +1,514 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2013 Blender Foundation.
+ * All rights reserved.
+ *
+ * Original Author: Joshua Leung
+ * Contributor(s): None Yet
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ *
+ * Snapshots of Depsgraphs
+ *
+ * Some things (e.g. render jobs) need a copy of the graph which they can
+ * hold onto while the original carries on being changed. Copying node by
+ * node (i.e. DEG_copy_node()) is too slow for big graphs, as each node gets
+ * allocated separately, and everything has to be remapped through hashes.
+ *
+ * Instead, the graph's node table (see depsgraph_query_index.c) is used to
+ * work out how much space is needed for all the nodes beforehand, so that
+ * they can all be allocated in one go. Each ID-block's nodes then get copied
+ * into their slots in parallel, after which the relations get recreated using
+ * the indices of the nodes they link in the table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MEM_guardedalloc.h"
+
+#include "BLI_blenlib.h"
+#include "BLI_ghash.h"
+#include "BLI_threads.h"
+#include "BLI_utildefines.h"
+
+#include "DNA_ID.h"
+
+#include "BKE_depsgraph.h"
+#include "BKE_depsgraph_query.h"
+
+#include "depsgraph_types.h"
+#include "depsgraph_intern.h"
+
+/* ************************************************** */
+/* Copying Data */
+
+/* Minimum number of nodes that each worker should get -
+ * copying these is cheap, so it's only worth it for bigger graphs
+ */
+#define DEG_COPY_MIN_NODES_PER_THREAD  1024
+
+/* Space reserved for each node in arena, keeping them aligned for doubles, etc. */
+#define DEG_COPY_ARENA_SIZE(size)      (((size) + 15) & ~((size_t)15))
+
+/* Data shared by all workers */
+typedef struct DepsgraphCopyData {
+	const DepsgraphNodeTable *table;  /* table for graph being copied */
+	const DepsgraphView *view;        /* view that relations must be in to be copied (NULL for everything) */
+	
+	DepsNode **dst_nodes;             /* (table->num_nodes) copy of each node in table (or NULL if it's not being copied) */
+	DepsRelation **dst_rels;          /* (table->num_rels) copy of each relation in table (or NULL if it's not being copied) */
+} DepsgraphCopyData;
+
+/* Work assigned to a worker thread - (only) whole ID-blocks are assigned to each */
+typedef struct DepsgraphCopyChunk {
+	DepsgraphCopyData *data;
+	
+	int start, end;                   /* range of nodes in table to handle */
+	int pass;                         /* (eDepsgraphCopy_Pass) what to do with these */
+} DepsgraphCopyChunk;
+
+/* Steps of copying process, each of which must be done for all nodes before the next can start */
+typedef enum eDepsgraphCopy_Pass {
+	DEG_COPY_PASS_NODES = 0,          /* copy nodes, and hook up the ones they own */
+	DEG_COPY_PASS_OUTLINKS,           /* copy relations out of each node */
+	DEG_COPY_PASS_INLINKS,            /* link copied relations into the nodes they lead to */
+} eDepsgraphCopy_Pass;
+
+/* Get copy of node */
+static DepsNode *deg_copy_map_node(const DepsgraphCopyData *data, const DepsNode *src)
+{
+	int index = (src) ? DEG_node_table_index(data->table, src) : -1;
+	return (index != -1) ? data->dst_nodes[index] : NULL;
+}
+
+/* Should the relation for the given link be copied? */
+static bool deg_copy_link_is_used(const DepsgraphCopyData *data, int from, int link)
+{
+	const DepsgraphNodeTable *table = data->table;
+	const int to = table->out_targets[link];
+	
+	if (ELEM(NULL, data->dst_nodes[from], data->dst_nodes[to]))
+		return false;
+	
+	/* only relations between nodes in the view are kept */
+	if (data->view) {
+		return DEG_BITSET_TEST(data->view->members, from) && DEG_BITSET_TEST(data->view->members, to);
+	}
+	
+	return true;
+}
+
+/* Copy nodes in range
+ * NOTE: this is done in two steps, as the nodes owned by each node
+ *       come after it, and must be copied before they can be linked up
+ */
+static void deg_copy_chunk_nodes(const DepsgraphCopyChunk *chunk)
+{
+	const DepsgraphCopyData *data = chunk->data;
+	const DepsgraphNodeTable *table = data->table;
+	GHashIterator hashIter;
+	int i;
+	
+	/* brute-force copy all the "basic" data */
+	for (i = chunk->start; i < chunk->end; i++) {
+		const DepsNode *src = table->nodes[i];
+		DepsNode *dst = data->dst_nodes[i];
+		
+		if (dst == NULL)
+			continue;
+		
+		memcpy(dst, src, DEG_node_get_typeinfo(src)->size);
+		
+		dst->next = dst->prev = NULL;
+		dst->owner = deg_copy_map_node(data, src->owner);
+		
+		/* relations get hooked up later */
+		dst->inlinks.first = dst->inlinks.last = NULL;
+		dst->outlinks.first = dst->outlinks.last = NULL;
+		
+		/* clear traversal data */
+		dst->valency = 0;
+		dst->lasttime = 0;
+		
+		/* node lives in arena, so mustn't be freed by itself */
+		dst->flag |= DEPSNODE_FLAG_IN_ARENA;
+	}
+	
+	/* hook up nodes owned by each node */
+	for (i = chunk->start; i < chunk->end; i++) {
+		const DepsNode *src = table->nodes[i];
+		DepsNode *dst = data->dst_nodes[i];
+		
+		if (dst == NULL)
+			continue;
+		
+		switch (src->type) {
+			case DEPSNODE_TYPE_ROOT: /* root - time source */
+			{
+				const RootDepsNode *src_root = (const RootDepsNode *)src;
+				RootDepsNode *dst_root = (RootDepsNode *)dst;
+				
+				if (src_root->time_source) {
+					dst_root->time_source = (TimeSourceDepsNode *)deg_copy_map_node(data, &src_root->time_source->nd);
+				}
+			}
+				break;
+			
+			case DEPSNODE_TYPE_ID_REF: /* ID-block - components */
+			{
+				const IDDepsNode *src_node = (const IDDepsNode *)src;
+				IDDepsNode *dst_node = (IDDepsNode *)dst;
+				
+				dst_node->component_hash = BLI_ghash_int_new("IDDepsNode Component Hash Copy");
+				
+				GHASH_ITER(hashIter, src_node->component_hash) {
+					BLI_ghash_insert(dst_node->component_hash, BLI_ghashIterator_getKey(&hashIter),
+					                 deg_copy_map_node(data, BLI_ghashIterator_getValue(&hashIter)));
+				}
+			}
+				break;
+			
+			case DEPSNODE_TYPE_SUBGRAPH: /* subgraph - shared with original (as in dnti_subgraph__copy_data()) */
+			{
+				const SubgraphDepsNode *src_sgn = (const SubgraphDepsNode *)src;
+				SubgraphDepsNode *dst_sgn = (SubgraphDepsNode *)dst;
+				DepsgraphInstance *inst;
+				
+				dst_sgn->flag |= SUBGRAPH_FLAG_SHARED;
+				dst_sgn->flag &= ~SUBGRAPH_FLAG_FIRSTREF;
+				
+				/* copy only needs to know who the instancers are - the evaluations using it keep their own states */
+				dst_sgn->instances.first = dst_sgn->instances.last = NULL;
+				dst_sgn->base_state = NULL;
+				
+				for (inst = src_sgn->instances.first; inst; inst = inst->next) {
+					DepsgraphInstance *dst_inst = MEM_callocN(sizeof(DepsgraphInstance), "DepsgraphInstance (Copy)");
+					
+					dst_inst->instancer = inst->instancer;
+					BLI_addtail(&dst_sgn->instances, dst_inst);
+				}
+			}
+				break;
+			
+			default:
+				break;
+		}
+		
+		if (src->class == DEPSNODE_CLASS_COMPONENT) {
+			const ComponentDepsNode *src_comp = (const ComponentDepsNode *)src;
+			ComponentDepsNode *dst_comp = (ComponentDepsNode *)dst;
+			DepsNode *op;
+			
+			/* operations */
+			dst_comp->op_hash = BLI_ghash_new(DEG_operation_key_hash, DEG_operation_key_cmp, "DepsNode Component - Operations Hash (Copy)");
+			dst_comp->ops.first = dst_comp->ops.last = NULL;
+			
+			for (op = src_comp->ops.first; op; op = op->next) {
+				DepsNode *dst_op = deg_copy_map_node(data, op);
+				
+				BLI_addtail(&dst_comp->ops, dst_op);
+				BLI_ghash_insert(dst_comp->op_hash, &((OperationDepsNode *)dst_op)->key, dst_op);
+			}
+			
+			/* evaluation contexts belong to whichever graph is being evaluated */
+			memset(dst_comp->contexts, 0, sizeof(dst_comp->contexts));
+			
+			/* bones */
+			if (src->type == DEPSNODE_TYPE_EVAL_POSE) {
+				const PoseComponentDepsNode *src_pose = (const PoseComponentDepsNode *)src;
+				PoseComponentDepsNode *dst_pose = (PoseComponentDepsNode *)dst;
+				
+				dst_pose->bone_hash = BLI_ghash_str_new("Pose Component Bone Hash (Copy)");
+				
+				/* NOTE: bones are owned by the pose, so they've been copied already (and their names can be used as keys) */
+				GHASH_ITER(hashIter, src_pose->bone_hash) {
+					DepsNode *dst_bone = deg_copy_map_node(data, BLI_ghashIterator_getValue(&hashIter));
+					BLI_ghash_insert(dst_pose->bone_hash, dst_bone->name, dst_bone);
+				}
+			}
+		}
+	}
+}
+
+/* Copy relations out of nodes in range */
+static void deg_copy_chunk_outlinks(const DepsgraphCopyChunk *chunk)
+{
+	const DepsgraphCopyData *data = chunk->data;
+	const DepsgraphNodeTable *table = data->table;
+	int i, j;
+	
+	for (i = chunk->start; i < chunk->end; i++) {
+		DepsNode *from = data->dst_nodes[i];
+		
+		for (j = table->out_offsets[i]; j < table->out_offsets[i + 1]; j++) {
+			if (deg_copy_link_is_used(data, i, j)) {
+				DepsRelation *rel = DEG_copy_relation(table->out_rels[j]);
+				
+				rel->from = from;
+				rel->to = data->dst_nodes[table->out_targets[j]];
+				
+				BLI_addtail(&from->outlinks, BLI_genericNodeN(rel));
+				data->dst_rels[j] = rel;
+			}
+		}
+	}
+}
+
+/* Link copied relations into the nodes in range */
+static void deg_copy_chunk_inlinks(const DepsgraphCopyChunk *chunk)
+{
+	const DepsgraphCopyData *data = chunk->data;
+	const DepsgraphNodeTable *table = data->table;
+	int i, j;
+	
+	for (i = chunk->start; i < chunk->end; i++) {
+		for (j = table->in_offsets[i]; j < table->in_offsets[i + 1]; j++) {
+			DepsRelation *rel = data->dst_rels[table->in_links[j]];
+			
+			if (rel) {
+				BLI_addtail(&rel->to->inlinks, BLI_genericNodeN(rel));
+			}
+		}
+	}
+}
+
+/* Worker thread callback - performs current pass for a chunk of nodes */
+static void *deg_copy_thread(void *chunk_v)
+{
+	DepsgraphCopyChunk *chunk = (DepsgraphCopyChunk *)chunk_v;
+	
+	switch (chunk->pass) {
+		case DEG_COPY_PASS_NODES:
+			deg_copy_chunk_nodes(chunk);
+			break;
+		case DEG_COPY_PASS_OUTLINKS:
+			deg_copy_chunk_outlinks(chunk);
+			break;
+		case DEG_COPY_PASS_INLINKS:
+			deg_copy_chunk_inlinks(chunk);
+			break;
+	}
+	
+	return NULL;
+}
+
+/* Hand over copies of nodes and relations to caller (if wanted), or free the arrays with these */
+static void deg_copy_data_finish(DepsgraphCopyData *data, DepsNode ***r_nodes, DepsRelation ***r_rels)
+{
+	if (r_nodes)
+		*r_nodes = data->dst_nodes;
+	else
+		MEM_freeN(data->dst_nodes);
+	
+	if (r_rels)
+		*r_rels = data->dst_rels;
+	else
+		MEM_freeN(data->dst_rels);
+}
+
+/* Does node in table start a new ID-block (or the root)? */
+static bool deg_copy_is_outer_node(const DepsNode *node)
+{
+	return ELEM3(node->type, DEPSNODE_TYPE_ROOT, DEPSNODE_TYPE_ID_REF, DEPSNODE_TYPE_SUBGRAPH);
+}
+
+/* ************************************************** */
+/* Internal API */
+
+/* Make a standalone copy of graph, or just the parts of it in a view
+ * NOTE: see DEG_view_materialise() for what gets copied for views
+ */
+Depsgraph *DEG_graph_copy_ex(Depsgraph *graph, const DepsgraphView *view, 
+                             DepsNode ***r_nodes, DepsRelation ***r_rels)
+{
+	const DepsgraphNodeTable *table = (view) ? view->table : DEG_graph_node_table_ensure(graph);
+	DepsgraphCopyData data = {NULL};
+	DepsgraphCopyChunk *chunks;
+	Depsgraph *copy;
+	ListBase threads;
+	LinkData *ld;
+	uint64_t *used_nodes;
+	char *arena;
+	size_t arena_size = 0, mem_used = 0;
+	int tot_thread = MIN2(BLI_system_thread_count(), BLENDER_MAX_THREADS);
+	int num_copied = 0, num_chunks = 0, chunk_size;
+	int start, end, i, pass;
+	
+	copy = DEG_graph_new();
+	copy->flag = graph->flag;
+	
+	data.table = table;
+	data.view = view;
+	data.dst_nodes = MEM_callocN(sizeof(DepsNode *) * MAX2(table->num_nodes, 1), "DepsgraphCopyData dst_nodes");
+	data.dst_rels = MEM_callocN(sizeof(DepsRelation *) * MAX2(table->num_rels, 1), "DepsgraphCopyData dst_rels");
+	used_nodes = MEM_callocN(sizeof(uint64_t) * MAX2(DEG_BITSET_NUM_WORDS(table->num_nodes), 1), "DepsgraphCopy used_nodes");
+	
+	/* figure out which ID-blocks get copied, and where their nodes will go in the arena
+	 * NOTE: each ID-block's nodes come one after the other in the table, starting with the ID node
+	 */
+	for (start = 0; start < table->num_nodes; start = end) {
+		bool used = (view == NULL);
+		
+		for (end = start + 1; (end < table->num_nodes) && !deg_copy_is_outer_node(table->nodes[end]); end++) {
+			/* pass */
+		}
+		
+		for (i = start; (i < end) && !used; i++) {
+			used = DEG_BITSET_TEST(view->members, i);
+		}
+		if (used == false)
+			continue;
+		
+		for (i = start; i < end; i++) {
+			size_t size = DEG_node_get_typeinfo(table->nodes[i])->size;
+			
+			DEG_BITSET_ENABLE(used_nodes, i);
+			
+			arena_size += DEG_COPY_ARENA_SIZE(size);
+			mem_used += size;
+		}
+		num_copied += end - start;
+	}
+	
+	if (num_copied == 0) {
+		deg_copy_data_finish(&data, r_nodes, r_rels);
+		MEM_freeN(used_nodes);
+		
+		return copy;
+	}
+	
+	/* all nodes get allocated in one go, with each one taking the next slot in the arena */
+	arena = MEM_mallocN(arena_size, "Depsgraph Node Arena");
+	BLI_addtail(&copy->node_arenas, BLI_genericNodeN(arena));
+	
+	for (i = 0; i < table->num_nodes; i++) {
+		if (DEG_BITSET_TEST(used_nodes, i)) {
+			data.dst_nodes[i] = (DepsNode *)arena;
+			arena += DEG_COPY_ARENA_SIZE(DEG_node_get_typeinfo(table->nodes[i])->size);
+		}
+	}
+	MEM_freeN(used_nodes);
+	
+	/* split nodes into chunks of roughly the same size - one per thread */
+	tot_thread = MAX2(1, MIN2(tot_thread, num_copied / DEG_COPY_MIN_NODES_PER_THREAD));
+	chunks = MEM_callocN(sizeof(DepsgraphCopyChunk) * tot_thread, "DepsgraphCopyChunks");
+	chunk_size = (num_copied + tot_thread - 1) / tot_thread;
+	
+	for (start = 0; start < table->num_nodes; start = end) {
+		DepsgraphCopyChunk *chunk = &chunks[num_chunks++];
+		int count = 0;
+		
+		for (end = start; end < table->num_nodes; end++) {
+			if (deg_copy_is_outer_node(table->nodes[end]) && (count >= chunk_size) && (num_chunks < tot_thread))
+				break;
+			if (data.dst_nodes[end])
+				count++;
+		}
+		
+		chunk->data = &data;
+		chunk->start = start;
+		chunk->end = end;
+	}
+	
+	/* copy everything */
+	for (pass = DEG_COPY_PASS_NODES; pass <= DEG_COPY_PASS_INLINKS; pass++) {
+		for (i = 0; i < num_chunks; i++) {
+			chunks[i].pass = pass;
+		}
+		
+		if (num_chunks > 1) {
+			BLI_init_threads(&threads, deg_copy_thread, num_chunks);
+			
+			for (i = 0; i < num_chunks; i++) {
+				BLI_insert_thread(&threads, &chunks[i]);
+			}
+			
+			BLI_end_threads(&threads);
+		}
+		else {
+			deg_copy_thread(&chunks[0]);
+		}
+	}
+	
+	MEM_freeN(chunks);
+	
+	/* graph-level data */
+	for (start = 0; start < table->num_nodes; start = end) {
+		DepsNode *node = data.dst_nodes[start];
+		
+		for (end = start + 1; (end < table->num_nodes) && !deg_copy_is_outer_node(table->nodes[end]); end++) {
+			/* pass */
+		}
+		
+		if (node == NULL)
+			continue;
+		
+		if (node->type == DEPSNODE_TYPE_ROOT) {
+			copy->root_node = node;
+		}
+		else if (node->type == DEPSNODE_TYPE_SUBGRAPH) {
+			SubgraphDepsNode *sgn = (SubgraphDepsNode *)node;
+			
+			BLI_addtail(&copy->subgraphs, node);
+			if (sgn->root_id) {
+				BLI_ghash_insert(copy->id_hash, sgn->root_id, node);
+			}
+		}
+		else {
+			BLI_ghash_insert(copy->id_hash, ((IDDepsNode *)node)->id, node);
+		}
+	}
+	
+	for (i = 0; i < table->num_rels; i++) {
+		DepsRelation *rel = data.dst_rels[i];
+		
+		if (rel) {
+			BLI_ghash_insert(copy->relations_hash, rel, rel);
+			mem_used += sizeof(DepsRelation) + 2 * sizeof(LinkData);
+		}
+	}
+	
+	/* operation nodes which got copied, in the same order as before */
+	for (ld = graph->all_opnodes.first; ld; ld = ld->next) {
+		DepsNode *node = deg_copy_map_node(&data, ld->data);
+		
+		if (node) {
+			BLI_addtail(&copy->all_opnodes, BLI_genericNodeN(node));
+			copy->num_nodes++;
+			
+			mem_used += sizeof(LinkData);
+		}
+	}
+	
+	DEG_stats_mem_alloc(copy, mem_used);
+	
+	deg_copy_data_finish(&data, r_nodes, r_rels);
+	
+	return copy;
+}
+
+/* ************************************************** */
+/* Public API */
+
+/* Make an independent copy of graph */
+Depsgraph *DEG_graph_copy(Depsgraph *graph)
+{
+	return DEG_graph_copy_ex(graph, NULL, NULL, NULL);
+}
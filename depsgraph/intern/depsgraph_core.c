@@ -34,7 +34,9 @@
 
 #include "BLI_blenlib.h"
 #include "BLI_ghash.h"
+#include "BLI_mempool.h"
 #include "BLI_string.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
 #include "DNA_defs.h"
@@ -52,12 +54,154 @@
 /* ************************************************** */
 /* Validity + Integrity */
 
+/* Validating an ID node only involves the nodes owned by that ID-block, 
+ * except for the relations it adds (which may link up with nodes from
+ * other ID-blocks) and the graph-level bookkeeping for any new nodes.
+ * So, ID nodes get split up into chunks which are validated in parallel, 
+ * with each worker staging these shared changes until all of them are done.
+ * The staged changes then get applied in the order that the chunks were 
+ * assigned, so that the result is the same as if it had all been done
+ * one after the other.
+ *
+ * Thread-safety notes:
+ * - Each worker gets its own copy of the Depsgraph struct, with "staging" set, 
+ *   so that the graph-level data gets left alone until everything is done.
+ *   All the hashes and lists it refers to are only read from while validating.
+ * - Validation may only add nodes to the ID-block being validated, and only
+ *   using builtin operation names (i.e. which are already interned).
+ * - Relations staged by validating one ID node won't be seen when validating
+ *   the others, even if they're attached to them.
+ */
+
+/* Minimum number of ID nodes that each worker should get - 
+ * validating most of these is quite cheap, so it's only worth it for bigger graphs
+ */
+#define DEG_VALIDATE_MIN_NODES_PER_THREAD  64
+
+/* Work assigned to a worker thread */
+typedef struct DepsgraphValidateChunk {
+	Depsgraph graph;            /* copy of graph being validated, which stages its changes in the chunk's staging area */
+	DepsgraphStaging staging;   /* changes made while validating this chunk */
+	
+	DepsNode **id_nodes;        /* first ID node to validate */
+	int num_nodes;              /* number of nodes (starting from id_nodes) to validate */
+} DepsgraphValidateChunk;
+
+/* Validate links for a single ID node */
+static void deg_graph_validate_id_node(Depsgraph *graph, DepsNode *node)
+{
+	DepsNodeTypeInfo *nti = DEG_node_get_typeinfo(node);
+	
+	if (nti && nti->validate_links) {
+		nti->validate_links(graph, node);
+	}
+}
+
+/* Worker thread callback - validates a chunk of ID nodes */
+static void *deg_graph_validate_links_thread(void *chunk_v)
+{
+	DepsgraphValidateChunk *chunk = (DepsgraphValidateChunk *)chunk_v;
+	int i;
+	
+	for (i = 0; i < chunk->num_nodes; i++) {
+		deg_graph_validate_id_node(&chunk->graph, chunk->id_nodes[i]);
+	}
+	
+	return NULL;
+}
+
+/* Apply changes which were held back while validating */
+static void deg_graph_staging_apply(Depsgraph *graph, DepsgraphStaging *staging)
+{
+	DepsRelation *rel, *rel_next;
+	
+	/* query indices won't know about any of this */
+	DEG_graph_query_index_invalidate(graph);
+	
+	/* new nodes - these come first, as relations might've been added between them */
+	BLI_movelisttolist(&graph->all_opnodes, &staging->opnodes);
+	graph->num_nodes += staging->num_nodes;
+	
+	DEG_stats_mem_alloc(graph, staging->mem_used);
+	
+	/* new relations - in the order they were made, so that they get merged the same way */
+	for (rel = staging->relations.first; rel; rel = rel_next) {
+		rel_next = rel->next;
+		
+		rel->next = rel->prev = NULL;
+		DEG_add_relation(graph, rel);
+	}
+	
+	memset(staging, 0, sizeof(DepsgraphStaging));
+}
+
+/* Ensure that links are valid for the given ID nodes, 
+ * using several threads if there are enough of them
+ */
+void DEG_graph_validate_id_links(Depsgraph *graph, DepsNode **id_nodes, int num_id_nodes)
+{
+	DepsgraphValidateChunk *chunks;
+	ListBase threads;
+	int tot_thread = MIN2(BLI_system_thread_count(), BLENDER_MAX_THREADS);
+	int chunk_size;
+	int i;
+	
+	BLI_assert(graph->staging == NULL);
+	
+	/* not worth the overhead for small graphs, so just do these directly */
+	tot_thread = MIN2(tot_thread, num_id_nodes / DEG_VALIDATE_MIN_NODES_PER_THREAD);
+	
+	if (tot_thread < 2) {
+		for (i = 0; i < num_id_nodes; i++) {
+			deg_graph_validate_id_node(graph, id_nodes[i]);
+		}
+		return;
+	}
+	
+	/* split nodes into (contiguous) chunks - one per thread */
+	chunks = MEM_callocN(sizeof(DepsgraphValidateChunk) * tot_thread, "DepsgraphValidateChunks");
+	chunk_size = (num_id_nodes + tot_thread - 1) / tot_thread;
+	
+	for (i = 0; i < tot_thread; i++) {
+		DepsgraphValidateChunk *chunk = &chunks[i];
+		int start = i * chunk_size;
+		
+		chunk->graph = *graph;
+		chunk->graph.staging = &chunk->staging;
+		
+		chunk->id_nodes = id_nodes + start;
+		chunk->num_nodes = MAX2(0, MIN2(chunk_size, num_id_nodes - start));
+	}
+	
+	/* validate chunks */
+	BLI_init_threads(&threads, deg_graph_validate_links_thread, tot_thread);
+	
+	for (i = 0; i < tot_thread; i++) {
+		BLI_insert_thread(&threads, &chunks[i]);
+	}
+	
+	BLI_end_threads(&threads);
+	
+	/* apply staged changes
+	 * NOTE: this is done in the order that the chunks were assigned, 
+	 *       so that the result doesn't depend on which threads finished first
+	 */
+	for (i = 0; i < tot_thread; i++) {
+		deg_graph_staging_apply(graph, &chunks[i].staging);
+	}
+	
+	MEM_freeN(chunks);
+}
+
 /* Ensure that all implicit constraints between nodes are satisfied 
  * (e.g. components are only allowed to be executed in a certain order)
  */
 void DEG_graph_validate_links(Depsgraph *graph)
 {
 	GHashIterator hashIter;
+	DepsNode **id_nodes;
+	int num_id_nodes;
+	int i = 0;
 	
 	BLI_assert((graph != NULL) && (graph->id_hash != NULL));
 	
@@ -65,14 +209,18 @@ void DEG_graph_validate_links(Depsgraph *graph)
 	 * on it, which should be enough to ensure that all of those
 	 * subtrees are valid
 	 */
+	num_id_nodes = BLI_ghash_size(graph->id_hash);
+	if (num_id_nodes == 0)
+		return;
+	
+	id_nodes = MEM_mallocN(sizeof(DepsNode *) * num_id_nodes, "DEG_graph_validate_links() ID Nodes");
+	
 	GHASH_ITER(hashIter, graph->id_hash) {
-		DepsNode *node = (DepsNode *)BLI_ghashIterator_getValue(&hashIter);
-		DepsNodeTypeInfo *nti = DEG_node_get_typeinfo(node);
-		
-		if (nti && nti->validate_links) {
-			nti->validate_links(graph, node);
-		}
+		id_nodes[i++] = (DepsNode *)BLI_ghashIterator_getValue(&hashIter);
 	}
+	
+	DEG_graph_validate_id_links(graph, id_nodes, num_id_nodes);
+	MEM_freeN(id_nodes);
 }
 
 /* ************************************************** */
@@ -103,6 +251,16 @@ void DEG_graph_sort(Depsgraph *graph)
 
 /* Get Node ----------------------------------------- */
 
+/* Mark node as being needed again, after relations for it were rebuilt
+ * - Nodes owning the node are needed too, so they get updated as well
+ */
+static void deg_node_clear_stale(DepsNode *node)
+{
+	for (; node && (node->flag & DEPSNODE_FLAG_STALE); node = node->owner) {
+		node->flag &= ~DEPSNODE_FLAG_STALE;
+	}
+}
+
 /* Get a matching node, creating one if need be */
 DepsNode *DEG_get_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
                        eDepsNode_Type type, const char name[DEG_MAX_ID_NAME])
@@ -115,6 +273,10 @@ DepsNode *DEG_get_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NA
 		/* nothing exists, so create one instead! */
 		node = DEG_add_new_node(graph, id, subdata, type, name);
 	}
+	else {
+		/* existing node may have been left over from before relations were rebuilt */
+		deg_node_clear_stale(node);
+	}
 	
 	/* return the node - it must exist now... */
 	return node;
@@ -138,8 +300,92 @@ DepsNode *DEG_get_node_from_pointer(Depsgraph *graph, const PointerRNA *ptr, con
 	return node;
 }
 
-/* Get DepsNode referred to by data path */
-DepsNode *DEG_get_node_from_rna_path(Depsgraph *graph, const ID *id, const char path[])
+/* RNA Path Cache ------------------------------------- */
+
+/* Rigs with lots of drivers keep resolving the same few paths over and over again,
+ * so the nodes that these resolve to get cached (per graph), keyed by (ID, path). 
+ * Since these refer to nodes, they get thrown away whenever any nodes are removed,
+ * and at the start and end of each build (so that paths which couldn't be resolved
+ * then get tried again next time).
+ */
+
+/* Cached result of resolving an RNA path 
+ * NOTE: entries act as their own keys in the cache
+ */
+typedef struct DepsRNAPathEntry {
+	const ID *id;            /* ID-block that path is rooted on */
+	const char *path;        /* path (copied, since the one that was passed in may go away) */
+	unsigned int hash;       /* hash of (id, path) - stored so that it only needs to be calculated once */
+	
+	DepsNode *node;          /* node that path resolves to (or NULL if it couldn't be resolved) */
+} DepsRNAPathEntry;
+
+/* hash for RNA path entry */
+static unsigned int deg_rna_path_entry_hash(const void *entry_p)
+{
+	return ((const DepsRNAPathEntry *)entry_p)->hash;
+}
+
+/* compare two RNA path entries - returns 0 when equal */
+static int deg_rna_path_entry_cmp(const void *a_p, const void *b_p)
+{
+	const DepsRNAPathEntry *a = (const DepsRNAPathEntry *)a_p;
+	const DepsRNAPathEntry *b = (const DepsRNAPathEntry *)b_p;
+	
+	return !((a->id == b->id) && STREQ(a->path, b->path));
+}
+
+/* free RNA path entry - used when freeing cache */
+static void deg_rna_path_entry_free(void *entry_p)
+{
+	DepsRNAPathEntry *entry = (DepsRNAPathEntry *)entry_p;
+	
+	MEM_freeN((void *)entry->path);
+	MEM_freeN(entry);
+}
+
+/* Look up cached result for path
+ * > r_key: key used for lookup (for adding a new entry, if there's no match)
+ */
+static DepsRNAPathEntry *deg_rna_path_cache_lookup(Depsgraph *graph, const ID *id, const char path[], 
+                                                   DepsRNAPathEntry *r_key)
+{
+	r_key->id = id;
+	r_key->path = path;
+	r_key->hash = (BLI_ghashutil_ptrhash(id) * 37) ^ BLI_ghashutil_strhash(path);
+	r_key->node = NULL;
+	
+	if (graph->rna_path_cache == NULL)
+		return NULL;
+	
+	return BLI_ghash_lookup(graph->rna_path_cache, r_key);
+}
+
+/* Add result of resolving path to cache */
+static void deg_rna_path_cache_add(Depsgraph *graph, const DepsRNAPathEntry *key, DepsNode *node)
+{
+	DepsRNAPathEntry *entry = MEM_dupallocN(key);
+	
+	entry->path = BLI_strdup(key->path);
+	entry->node = node;
+	
+	if (graph->rna_path_cache == NULL) {
+		graph->rna_path_cache = BLI_ghash_new(deg_rna_path_entry_hash, deg_rna_path_entry_cmp, "Depsgraph RNA Path Cache");
+	}
+	BLI_ghash_insert(graph->rna_path_cache, entry, entry);
+}
+
+/* Throw away all cached paths (i.e. since nodes that they refer to may be gone) */
+void DEG_graph_rna_path_cache_clear(Depsgraph *graph)
+{
+	if (graph->rna_path_cache) {
+		BLI_ghash_free(graph->rna_path_cache, deg_rna_path_entry_free, NULL);
+		graph->rna_path_cache = NULL;
+	}
+}
+
+/* Resolve path to get the node it refers to, creating it if needed */
+static DepsNode *deg_resolve_rna_path(Depsgraph *graph, const ID *id, const char path[], const bool create)
 {
 	PointerRNA id_ptr, ptr;
 	PropertyRNA *prop = NULL;
@@ -151,13 +397,66 @@ DepsNode *DEG_get_node_from_rna_path(Depsgraph *graph, const ID *id, const char
 	/* try to resolve path... */
 	if (RNA_path_resolve(&id_ptr, path, &ptr, &prop)) {
 		/* get matching node... */
-		node = DEG_get_node_from_pointer(graph, &ptr, prop);
+		if (create)
+			node = DEG_get_node_from_pointer(graph, &ptr, prop);
+		else
+			node = DEG_find_node_from_pointer(graph, &ptr, prop);
 	}
 	
 	/* return node found */
 	return node;
 }
 
+/* Get DepsNode referred to by data path */
+DepsNode *DEG_get_node_from_rna_path(Depsgraph *graph, const ID *id, const char path[])
+{
+	DepsRNAPathEntry key, *entry;
+	DepsNode *node;
+	
+	if (ELEM(NULL, id, path))
+		return NULL;
+	
+	/* already resolved? 
+	 * NOTE: node still needs to be marked as being needed again, as it would be by DEG_get_node()
+	 */
+	entry = deg_rna_path_cache_lookup(graph, id, path, &key);
+	if (entry) {
+		deg_node_clear_stale(entry->node);
+		return entry->node;
+	}
+	
+	/* resolve and remember - including failures, as these tend to get repeated too */
+	node = deg_resolve_rna_path(graph, id, path, true);
+	deg_rna_path_cache_add(graph, &key, node);
+	
+	return node;
+}
+
+/* Find DepsNode referred to by data path, without creating it if it doesn't exist */
+DepsNode *DEG_find_node_from_rna_path(Depsgraph *graph, const ID *id, const char path[])
+{
+	DepsRNAPathEntry key, *entry;
+	DepsNode *node;
+	
+	if (ELEM(NULL, id, path))
+		return NULL;
+	
+	/* already resolved? */
+	entry = deg_rna_path_cache_lookup(graph, id, path, &key);
+	if (entry)
+		return entry->node;
+	
+	/* resolve, but only remember this if it worked 
+	 * (the node may just not have been created yet) 
+	 */
+	node = deg_resolve_rna_path(graph, id, path, false);
+	if (node) {
+		deg_rna_path_cache_add(graph, &key, node);
+	}
+	
+	return node;
+}
+
 /* Add ------------------------------------------------ */
 
 /* Create a new node, but don't do anything else with it yet... */
@@ -203,9 +502,10 @@ void DEG_add_node(Depsgraph *graph, DepsNode *node, const ID *id)
 	}
 }
 
-/* Add a new node */
-DepsNode *DEG_add_new_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
-                           eDepsNode_Type type, const char name[DEG_MAX_ID_NAME])
+/* Add a new node - with optional handle for identifying operations */
+static DepsNode *deg_add_new_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
+                                  eDepsNode_Type type, const char name[DEG_MAX_ID_NAME],
+                                  const void *handle)
 {
 	const DepsNodeTypeInfo *nti = DEG_get_node_typeinfo(type);
 	DepsNode *node;
@@ -228,22 +528,51 @@ DepsNode *DEG_add_new_node(Depsgraph *graph, const ID *id, const char subdata[MA
 		nti->init_data(node, id, subdata);
 	}
 	
+	/* operations need their key set before they can be added to their component */
+	if (node->class == DEPSNODE_CLASS_OPERATION) {
+		OperationDepsNode *op_node = (OperationDepsNode *)node;
+		
+		/* NOTE: the builtin names get used when available, so that the fast-path can be used for these */
+		DEG_operation_key_init(&op_node->key, type, (name && name[0]) ? name : node->name, handle);
+	}
+	
 	/* add node to graph 
 	 * NOTE: additional nodes may be created in order to add this node to the graph
 	 *       (i.e. parent/owner nodes) where applicable...
 	 */
 	DEG_add_node(graph, node, id);
+	DEG_stats_mem_alloc(graph, nti->size);
 	
 	/* add node to operation-node list if it plays a part in the evaluation process */
 	if (ELEM(node->class, DEPSNODE_CLASS_GENERIC, DEPSNODE_CLASS_OPERATION)) {
-		BLI_addtail(&graph->all_opnodes, BLI_genericNodeN(node));
-		graph->num_nodes++;
+		if (graph->staging) {
+			BLI_addtail(&graph->staging->opnodes, BLI_genericNodeN(node));
+			graph->staging->num_nodes++;
+		}
+		else {
+			BLI_addtail(&graph->all_opnodes, BLI_genericNodeN(node));
+			graph->num_nodes++;
+		}
+		
+		DEG_stats_mem_alloc(graph, sizeof(LinkData));
+	}
+	
+	/* query indices no longer cover all nodes (these are shared, so leave them alone if staging) */
+	if (graph->staging == NULL) {
+		DEG_graph_query_index_invalidate(graph);
 	}
 	
 	/* return the newly created node matching the description */
 	return node;
 }
 
+/* Add a new node */
+DepsNode *DEG_add_new_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
+                           eDepsNode_Type type, const char name[DEG_MAX_ID_NAME])
+{
+	return deg_add_new_node(graph, id, subdata, type, name, NULL);
+}
+
 /* Remove/Free ---------------------------------------- */
 
 /* Remove node from graph, but don't free any of its data */
@@ -262,12 +591,14 @@ void DEG_remove_node(Depsgraph *graph, DepsNode *node)
 	DEPSNODE_RELATIONS_ITER_BEGIN(node->inlinks.first, rel)
 	{
 		DEG_remove_relation(graph, rel);
+		DEG_free_relation(rel);
 	}
 	DEPSNODE_RELATIONS_ITER_END;
 	
 	DEPSNODE_RELATIONS_ITER_BEGIN(node->outlinks.first, rel)
 	{
 		DEG_remove_relation(graph, rel);
+		DEG_free_relation(rel);
 	}
 	DEPSNODE_RELATIONS_ITER_END;
 	
@@ -275,6 +606,26 @@ void DEG_remove_node(Depsgraph *graph, DepsNode *node)
 	if (nti && nti->remove_from_graph) {
 		nti->remove_from_graph(graph, node);
 	}
+	
+	/* query index and cached paths may still refer to this node */
+	DEG_graph_query_index_invalidate(graph);
+	DEG_graph_rna_path_cache_clear(graph);
+	
+	/* remove from operation-node list */
+	if (ELEM(node->class, DEPSNODE_CLASS_GENERIC, DEPSNODE_CLASS_OPERATION)) {
+		LinkData *ld = BLI_findptr(&graph->all_opnodes, node, offsetof(LinkData, data));
+		
+		if (ld) {
+			BLI_freelinkN(&graph->all_opnodes, ld);
+			graph->num_nodes--;
+			
+			DEG_stats_mem_free(graph, sizeof(LinkData));
+		}
+	}
+	
+	if (nti) {
+		DEG_stats_mem_free(graph, nti->size);
+	}
 }
 
 /* Free node data but not node itself
@@ -297,22 +648,99 @@ void DEG_free_node(DepsNode *node)
 	}
 }
 
+/* Free node itself, once DEG_free_node() has been used to free its data */
+void DEG_free_node_mem(DepsNode *node)
+{
+	/* nodes in snapshots get freed all at once, along with the graph */
+	if ((node->flag & DEPSNODE_FLAG_IN_ARENA) == 0) {
+		MEM_freeN(node);
+	}
+}
+
+/* Iteration ------------------------------------------ */
+
+/* Perform callback on given node, and all the nodes that it owns */
+void DEG_node_foreach_owned(DepsNode *node, DEG_NodeCallback func, void *userdata)
+{
+	GHashIterator hashIter;
+	
+	func(node, userdata);
+	
+	switch (node->type) {
+		case DEPSNODE_TYPE_ROOT: /* root - time source is owned by it */
+		{
+			RootDepsNode *root_node = (RootDepsNode *)node;
+			
+			if (root_node->time_source) {
+				DEG_node_foreach_owned(&root_node->time_source->nd, func, userdata);
+			}
+		}
+			break;
+		
+		case DEPSNODE_TYPE_ID_REF: /* ID-block - components */
+		{
+			IDDepsNode *id_node = (IDDepsNode *)node;
+			
+			GHASH_ITER(hashIter, id_node->component_hash) {
+				DEG_node_foreach_owned(BLI_ghashIterator_getValue(&hashIter), func, userdata);
+			}
+		}
+			break;
+		
+		default:
+			break;
+	}
+	
+	if (node->class == DEPSNODE_CLASS_COMPONENT) {
+		ComponentDepsNode *component = (ComponentDepsNode *)node;
+		DepsNode *op;
+		
+		/* operations */
+		for (op = component->ops.first; op; op = op->next) {
+			DEG_node_foreach_owned(op, func, userdata);
+		}
+		
+		/* bones are owned by the pose component */
+		if (node->type == DEPSNODE_TYPE_EVAL_POSE) {
+			PoseComponentDepsNode *pcomp = (PoseComponentDepsNode *)node;
+			
+			GHASH_ITER(hashIter, pcomp->bone_hash) {
+				DEG_node_foreach_owned(BLI_ghashIterator_getValue(&hashIter), func, userdata);
+			}
+		}
+	}
+}
+
 /* Convenience Functions ---------------------------- */
 
 /* Create a new node for representing an operation and add this to graph */
 OperationDepsNode *DEG_add_operation(Depsgraph *graph, ID *id, const char subdata[MAX_NAME],
                                      eDepsNode_Type type, eDepsOperation_Type optype, 
                                      DepsEvalOperationCb op, const char name[DEG_MAX_ID_NAME])
+{
+	return DEG_add_operation_ex(graph, id, subdata, type, optype, op, name, NULL);
+}
+
+/* Create a new node for representing an operation on a specific data item, and add this to graph */
+OperationDepsNode *DEG_add_operation_ex(Depsgraph *graph, ID *id, const char subdata[MAX_NAME],
+                                        eDepsNode_Type type, eDepsOperation_Type optype, 
+                                        DepsEvalOperationCb op, const char name[DEG_MAX_ID_NAME],
+                                        const void *handle)
 {
 	OperationDepsNode *op_node = NULL;
-	eDepsNode_Type component_type;
 	
 	/* sanity check */
 	if (ELEM3(NULL, graph, id, op))
 		return NULL;
 	
 	/* create operation node (or find an existing but perhaps on partially completed one) */
-	op_node = (OperationDepsNode *)DEG_get_node(graph, id, subdata, type, name);
+	op_node = (OperationDepsNode *)DEG_find_operation(graph, id, subdata, type, name, handle);
+	if (op_node == NULL) {
+		op_node = (OperationDepsNode *)deg_add_new_node(graph, id, subdata, type, name, handle);
+	}
+	else {
+		deg_node_clear_stale((DepsNode *)op_node);
+	}
 	BLI_assert(op_node != NULL);
 	
 	/* attach extra data... */
@@ -323,9 +751,109 @@ OperationDepsNode *DEG_add_operation(Depsgraph *graph, ID *id, const char subdat
 	return op_node;
 }
 
+/* Operation Keys ------------------------------------- */
+
+/* Initialise operation key, interning the name used */
+void DEG_operation_key_init(DepsOperationKey *key, eDepsNode_Type type, 
+                            const char name[DEG_MAX_ID_NAME], const void *handle)
+{
+	key->name = DEG_name_intern(name);
+	key->handle = handle;
+	key->type = type;
+}
+
+/* Hash operation key - since names are interned, only pointers need to be hashed */
+unsigned int DEG_operation_key_hash(const void *key_p)
+{
+	const DepsOperationKey *key = (const DepsOperationKey *)key_p;
+	unsigned int hash;
+	
+	hash  = BLI_ghashutil_ptrhash(key->name);
+	hash  = (hash * 37) ^ BLI_ghashutil_ptrhash(key->handle);
+	hash  = (hash * 37) ^ (unsigned int)key->type;
+	
+	return hash;
+}
+
+/* Compare operation keys - returns 0 when equal */
+int DEG_operation_key_cmp(const void *a_p, const void *b_p)
+{
+	const DepsOperationKey *a = (const DepsOperationKey *)a_p;
+	const DepsOperationKey *b = (const DepsOperationKey *)b_p;
+	
+	return !((a->name == b->name) && (a->handle == b->handle) && (a->type == b->type));
+}
+
 /* ************************************************** */
 /* Relationships Management */
 
+/* Relation Set ------------------------------------- */
+
+/* Relations are stored in a per-graph set, keyed by the nodes they connect and
+ * their type. This way, builders can add relations freely without having to care
+ * whether some other builder (or another constraint target on the same object)
+ * has already done so; duplicate edges would only inflate in-degree counts,
+ * and result in extra scheduling and flushing work during every evaluation.
+ */
+
+/* hash a relation by its (from, to, type) triple */
+static unsigned int deg_relation_hash(const void *rel_p)
+{
+	const DepsRelation *rel = (const DepsRelation *)rel_p;
+	unsigned int hash;
+	
+	hash  = BLI_ghashutil_ptrhash(rel->from);
+	hash  = (hash * 37) ^ BLI_ghashutil_ptrhash(rel->to);
+	hash  = (hash * 37) ^ (unsigned int)rel->type;
+	
+	return hash;
+}
+
+/* compare two relations by their (from, to, type) triples - returns 0 when equal */
+static int deg_relation_cmp(const void *a_p, const void *b_p)
+{
+	const DepsRelation *a = (const DepsRelation *)a_p;
+	const DepsRelation *b = (const DepsRelation *)b_p;
+	
+	return !((a->from == b->from) && (a->to == b->to) && (a->type == b->type));
+}
+
+/* Find relation in graph matching the given description */
+DepsRelation *DEG_find_relation(Depsgraph *graph, DepsNode *from, DepsNode *to, eDepsRelation_Type type)
+{
+	DepsRelation key = {NULL};
+	
+	/* sanity check */
+	if (ELEM3(NULL, graph, from, to) || (graph->relations_hash == NULL))
+		return NULL;
+	
+	key.from = from;
+	key.to = to;
+	key.type = type;
+	
+	return BLI_ghash_lookup(graph->relations_hash, &key);
+}
+
+/* Combine the debug labels of two relations which got merged together */
+static void deg_relation_merge_name(DepsRelation *rel, const char name[DEG_MAX_ID_NAME])
+{
+	size_t len = strlen(rel->name);
+	
+	/* nothing to add? */
+	if ((name == NULL) || (name[0] == '\0') || strstr(rel->name, name))
+		return;
+	
+	if (len == 0) {
+		BLI_strncpy(rel->name, name, DEG_MAX_ID_NAME);
+	}
+	else if (len + 3 < DEG_MAX_ID_NAME) {
+		/* just truncate when we run out of space - this is only for debugging */
+		BLI_snprintf(rel->name + len, DEG_MAX_ID_NAME - len, " | %s", name);
+	}
+}
+
+/* Add/Remove ---------------------------------------- */
+
 /* Create new relationship that between two nodes, but don't link it in */
 DepsRelation *DEG_create_new_relation(DepsNode *from, DepsNode *to,
                                       eDepsRelation_Type type,
@@ -344,30 +872,75 @@ DepsRelation *DEG_create_new_relation(DepsNode *from, DepsNode *to,
 	rel->to = to;
 	
 	rel->type = type;
-	BLI_strncpy(rel->name, description, DEG_MAX_ID_NAME);
+	if (description)
+		BLI_strncpy(rel->name, description, DEG_MAX_ID_NAME);
 	
 	/* return */
 	return rel;
 }
 
-/* Add relationship to graph */
-void DEG_add_relation(DepsRelation *rel)
+/* Add relationship to graph 
+ * < returns: the relation which now represents this link in the graph 
+ *            (i.e. either rel, or an existing one that rel got merged into)
+ */
+DepsRelation *DEG_add_relation(Depsgraph *graph, DepsRelation *rel)
 {
+	DepsRelation *existing;
+	
+	/* just hold onto it for now - any merging happens once it really gets added */
+	if (graph->staging) {
+		BLI_addtail(&graph->staging->relations, rel);
+		return rel;
+	}
+	
+	existing = DEG_find_relation(graph, rel->from, rel->to, rel->type);
+	if (existing) {
+		/* merge into existing relation instead of adding a duplicate link */
+		if (existing != rel) {
+			deg_relation_merge_name(existing, rel->name);
+			existing->flag |= rel->flag;
+			
+			DEG_free_relation(rel);
+		}
+		return existing;
+	}
+	
+	/* add to set of known relations */
+	BLI_ghash_insert(graph->relations_hash, rel, rel);
+	DEG_graph_query_index_invalidate(graph);
+	DEG_stats_mem_alloc(graph, sizeof(DepsRelation) + 2 * sizeof(LinkData));
+	
 	/* hook it up to the nodes which use it */
 	BLI_addtail(&rel->from->outlinks, BLI_genericNodeN(rel));
 	BLI_addtail(&rel->to->inlinks,    BLI_genericNodeN(rel));
+	
+	return rel;
 }
 
 /* Add new relationship between two nodes */
-DepsRelation *DEG_add_new_relation(DepsNode *from, DepsNode *to, 
+DepsRelation *DEG_add_new_relation(Depsgraph *graph, DepsNode *from, DepsNode *to, 
                                    eDepsRelation_Type type, 
                                    const char description[DEG_MAX_ID_NAME])
 {
-	/* create new relation, and add it to the graph */
-	DepsRelation *rel = DEG_create_new_relation(from, to, type, description);
-	DEG_add_relation(rel);
+	DepsRelation *rel;
 	
-	return rel;
+	/* sanity check */
+	if (ELEM3(NULL, graph, from, to))
+		return NULL;
+	
+	/* if there's already such a relation, just note that it was requested again 
+	 * NOTE: when staging, existing relations may be shared with other threads,
+	 *       so merging gets left until the staged relation is actually added
+	 */
+	rel = (graph->staging) ? NULL : DEG_find_relation(graph, from, to, type);
+	if (rel) {
+		deg_relation_merge_name(rel, description);
+		return rel;
+	}
+	
+	/* create new relation, and add it to the graph */
+	rel = DEG_create_new_relation(from, to, type, description);
+	return DEG_add_relation(graph, rel);
 }
 
 /* Remove relationship from graph */
@@ -380,6 +953,16 @@ void DEG_remove_relation(Depsgraph *graph, DepsRelation *rel)
 		return;
 	}
 	
+	/* remove it from the set of known relations (but only if it is the one stored there) */
+	if (graph && graph->relations_hash) {
+		if (BLI_ghash_lookup(graph->relations_hash, rel) == rel) {
+			BLI_ghash_remove(graph->relations_hash, rel, NULL, NULL);
+			DEG_stats_mem_free(graph, sizeof(DepsRelation) + 2 * sizeof(LinkData));
+		}
+		
+		DEG_graph_query_index_invalidate(graph);
+	}
+	
 	/* remove it from the nodes that use it */
 	ld = BLI_findptr(&rel->from->outlinks, rel, offsetof(LinkData, data));
 	if (ld) {
@@ -389,7 +972,7 @@ void DEG_remove_relation(Depsgraph *graph, DepsRelation *rel)
 	
 	ld = BLI_findptr(&rel->to->inlinks, rel, offsetof(LinkData, data));
 	if (ld) {
-		BLI_freelinkN(&rel->to->inlinks, rel);
+		BLI_freelinkN(&rel->to->inlinks, ld);
 		ld = NULL;
 	}
 }
@@ -404,6 +987,430 @@ void DEG_free_relation(DepsRelation *rel)
 	MEM_freeN(rel);
 }
 
+/* ************************************************** */
+/* Graph Merging */
+
+/* Graphs which have been built separately (i.e. on different threads) can be
+ * combined by moving the nodes of one into the other. Nodes which represent
+ * something that the destination already has a node for (i.e. the same ID-block,
+ * component type, or operation key) are replaced by the existing ones, while the
+ * rest are simply moved across. Relations are then re-added with their endpoints
+ * remapped, in the order that they were added to their "from" nodes, so that the
+ * final result only depends on the order in which graphs get merged.
+ */
+
+/* Helpers ------------------------------------------- */
+
+/* Detach relations from node, collecting them in the given list 
+ * NOTE: each relation is collected from the outlinks of its "from" node only,
+ *       and these are taken in the order that they were added
+ */
+static void deg_merge_detach_relations_cb(DepsNode *node, void *relations_p)
+{
+	ListBase *relations = (ListBase *)relations_p;
+	
+	BLI_movelisttolist(relations, &node->outlinks);
+	BLI_freelistN(&node->inlinks);
+}
+
+/* Note memory used by a node which has been moved into graph */
+static void deg_merge_stats_cb(DepsNode *node, void *graph_p)
+{
+	const DepsNodeTypeInfo *nti = DEG_node_get_typeinfo(node);
+	
+	if (nti) {
+		DEG_stats_mem_alloc((Depsgraph *)graph_p, nti->size);
+	}
+}
+
+/* Get list (LinkData) of the values stored in hash
+ * - Used when values may get removed from the hash while we're going over them 
+ */
+static void deg_merge_hash_values(GHash *hash, ListBase *list)
+{
+	GHashIterator hashIter;
+	
+	GHASH_ITER(hashIter, hash) {
+		BLI_addtail(list, BLI_genericNodeN(BLI_ghashIterator_getValue(&hashIter)));
+	}
+}
+
+/* Get the node which now represents the given node from the merged graph */
+static DepsNode *deg_merge_remap_node(GHash *remap, DepsNode *node)
+{
+	DepsNode *new_node = BLI_ghash_lookup(remap, node);
+	return (new_node) ? new_node : node;
+}
+
+/* Nodes --------------------------------------------- */
+
+/* Merge contents of src component into dst 
+ * - Operations which dst doesn't have get moved across, while those it does 
+ *   have are mapped to the existing ones (and are freed along with src)
+ */
+static void deg_merge_component(Depsgraph *graph, GHash *remap, ComponentDepsNode *dst, ComponentDepsNode *src)
+{
+	DepsNode *node, *next;
+	
+	BLI_ghash_insert(remap, src, dst);
+	
+	/* operations */
+	for (node = src->ops.first; node; node = next) {
+		OperationDepsNode *src_op = (OperationDepsNode *)node;
+		OperationDepsNode *dst_op = BLI_ghash_lookup(dst->op_hash, &src_op->key);
+		
+		next = node->next;
+		
+		if (dst_op) {
+			/* existing node may just be a placeholder that was created for linking against */
+			if (dst_op->evaluate == NULL) {
+				dst_op->evaluate = src_op->evaluate;
+				dst_op->ptr = src_op->ptr;
+				dst_op->optype = src_op->optype;
+			}
+			dst_op->flag |= src_op->flag;
+			
+			BLI_ghash_insert(remap, src_op, dst_op);
+		}
+		else {
+			BLI_ghash_remove(src->op_hash, &src_op->key, NULL, NULL);
+			BLI_remlink(&src->ops, node);
+			
+			BLI_ghash_insert(dst->op_hash, &src_op->key, node);
+			BLI_addtail(&dst->ops, node);
+			node->owner = (DepsNode *)dst;
+			
+			deg_merge_stats_cb(node, graph);
+		}
+	}
+	
+	/* layers needed by things using geometry */
+	if (dst->nd.type == DEPSNODE_TYPE_GEOMETRY) {
+		((GeometryComponentDepsNode *)dst)->customdata_mask |= ((GeometryComponentDepsNode *)src)->customdata_mask;
+	}
+	
+	/* bones */
+	if (dst->nd.type == DEPSNODE_TYPE_EVAL_POSE) {
+		PoseComponentDepsNode *dst_pose = (PoseComponentDepsNode *)dst;
+		PoseComponentDepsNode *src_pose = (PoseComponentDepsNode *)src;
+		ListBase bones = {NULL, NULL};
+		LinkData *ld;
+		
+		deg_merge_hash_values(src_pose->bone_hash, &bones);
+		
+		for (ld = bones.first; ld; ld = ld->next) {
+			BoneComponentDepsNode *src_bone = (BoneComponentDepsNode *)ld->data;
+			BoneComponentDepsNode *dst_bone = BLI_ghash_lookup(dst_pose->bone_hash, src_bone->nd.name);
+			
+			if (dst_bone) {
+				deg_merge_component(graph, remap, (ComponentDepsNode *)dst_bone, (ComponentDepsNode *)src_bone);
+			}
+			else {
+				BLI_ghash_remove(src_pose->bone_hash, src_bone->nd.name, NULL, NULL);
+				
+				BLI_ghash_insert(dst_pose->bone_hash, src_bone->nd.name, src_bone);
+				src_bone->nd.owner = (DepsNode *)dst_pose;
+				
+				DEG_node_foreach_owned(&src_bone->nd, deg_merge_stats_cb, graph);
+			}
+		}
+		
+		BLI_freelistN(&bones);
+	}
+}
+
+/* Merge components of src ID node into dst */
+static void deg_merge_id_node(Depsgraph *graph, GHash *remap, IDDepsNode *dst, IDDepsNode *src)
+{
+	ListBase components = {NULL, NULL};
+	LinkData *ld;
+	
+	BLI_ghash_insert(remap, src, dst);
+	
+	deg_merge_hash_values(src->component_hash, &components);
+	
+	for (ld = components.first; ld; ld = ld->next) {
+		ComponentDepsNode *src_comp = (ComponentDepsNode *)ld->data;
+		void *type_key = SET_INT_IN_POINTER(src_comp->nd.type);
+		ComponentDepsNode *dst_comp = BLI_ghash_lookup(dst->component_hash, type_key);
+		
+		if (dst_comp) {
+			deg_merge_component(graph, remap, dst_comp, src_comp);
+		}
+		else {
+			BLI_ghash_remove(src->component_hash, type_key, NULL, NULL);
+			
+			BLI_ghash_insert(dst->component_hash, type_key, src_comp);
+			src_comp->nd.owner = (DepsNode *)dst;
+			
+			DEG_node_foreach_owned(&src_comp->nd, deg_merge_stats_cb, graph);
+		}
+	}
+	
+	BLI_freelistN(&components);
+}
+
+/* API ----------------------------------------------- */
+
+/* Move the contents of one graph into another, and free the emptied graph
+ * < graph: (Depsgraph) graph to merge into. Its root node and time source replace the ones from src
+ * < src: (Depsgraph) graph to merge in. This gets freed, so it cannot be used after this
+ */
+void DEG_graph_merge(Depsgraph *graph, Depsgraph *src)
+{
+	ListBase relations = {NULL, NULL};
+	ListBase id_nodes = {NULL, NULL};
+	LinkData *ld, *next;
+	GHash *remap;
+	
+	/* sanity checks */
+	if (ELEM(NULL, graph, src) || (graph == src))
+		return;
+	
+	/* query indices won't know about any of the nodes getting moved across */
+	DEG_graph_query_index_invalidate(graph);
+	
+	/* <DepsNode (src) : DepsNode (graph)> nodes which have been replaced */
+	remap = BLI_ghash_ptr_new("DEG_graph_merge() Node Remap");
+	
+	/* detach all relations first, as nodes will be moved about */
+	deg_merge_hash_values(src->id_hash, &id_nodes);
+	
+	if (src->root_node) {
+		DEG_node_foreach_owned(src->root_node, deg_merge_detach_relations_cb, &relations);
+	}
+	for (ld = id_nodes.first; ld; ld = ld->next) {
+		DEG_node_foreach_owned((DepsNode *)ld->data, deg_merge_detach_relations_cb, &relations);
+	}
+	
+	/* root node and "official" time source */
+	if (src->root_node) {
+		RootDepsNode *src_root = (RootDepsNode *)src->root_node;
+		
+		BLI_ghash_insert(remap, src_root, DEG_get_node(graph, NULL, NULL, DEPSNODE_TYPE_ROOT, NULL));
+		
+		if (src_root->time_source) {
+			BLI_ghash_insert(remap, src_root->time_source, 
+			                 DEG_get_node(graph, NULL, NULL, DEPSNODE_TYPE_TIMESOURCE, NULL));
+		}
+	}
+	
+	/* ID nodes (and subgraphs) */
+	for (ld = id_nodes.first; ld; ld = ld->next) {
+		DepsNode *src_node = (DepsNode *)ld->data;
+		ID *id = (src_node->type == DEPSNODE_TYPE_ID_REF) ? ((IDDepsNode *)src_node)->id : ((SubgraphDepsNode *)src_node)->root_id;
+		DepsNode *dst_node = BLI_ghash_lookup(graph->id_hash, id);
+		
+		if (dst_node == NULL) {
+			/* nothing there yet, so move across */
+			BLI_ghash_remove(src->id_hash, id, NULL, NULL);
+			BLI_ghash_insert(graph->id_hash, id, src_node);
+			
+			if (src_node->type == DEPSNODE_TYPE_SUBGRAPH) {
+				BLI_remlink(&src->subgraphs, src_node);
+				BLI_addtail(&graph->subgraphs, src_node);
+			}
+			
+			DEG_node_foreach_owned(src_node, deg_merge_stats_cb, graph);
+		}
+		else if ((src_node->type == DEPSNODE_TYPE_ID_REF) && (dst_node->type == DEPSNODE_TYPE_ID_REF)) {
+			deg_merge_id_node(graph, remap, (IDDepsNode *)dst_node, (IDDepsNode *)src_node);
+		}
+		else {
+			// XXX: subgraphs for the same ID should be shared instead...
+			printf("%s(): Cannot merge subgraph for '%s'\n", __func__, id->name);
+			BLI_ghash_insert(remap, src_node, dst_node);
+		}
+	}
+	BLI_freelistN(&id_nodes);
+	
+	/* subgraphs without ID-blocks can be moved as-is */
+	BLI_movelisttolist(&graph->subgraphs, &src->subgraphs);
+	
+	/* nodes which got moved across may live in blocks allocated for src */
+	BLI_movelisttolist(&graph->node_arenas, &src->node_arenas);
+	
+	/* operation nodes which got moved across */
+	for (ld = src->all_opnodes.first; ld; ld = next) {
+		next = ld->next;
+		
+		if (BLI_ghash_haskey(remap, ld->data) == false) {
+			BLI_remlink(&src->all_opnodes, ld);
+			src->num_nodes--;
+			
+			BLI_addtail(&graph->all_opnodes, ld);
+			graph->num_nodes++;
+			
+			DEG_stats_mem_alloc(graph, sizeof(LinkData));
+		}
+	}
+	
+	/* relations - these get merged into existing ones where possible */
+	for (ld = relations.first; ld; ld = ld->next) {
+		DepsRelation *rel = (DepsRelation *)ld->data;
+		
+		/* remove from src first, as the hash depends on the nodes it links */
+		BLI_ghash_remove(src->relations_hash, rel, NULL, NULL);
+		
+		rel->from = deg_merge_remap_node(remap, rel->from);
+		rel->to   = deg_merge_remap_node(remap, rel->to);
+		
+		DEG_add_relation(graph, rel);
+	}
+	BLI_freelistN(&relations);
+	
+	/* free what's left of src - i.e. the nodes which got replaced */
+	BLI_ghash_free(remap, NULL, NULL);
+	DEG_graph_free(src);
+}
+
+/* Subgraph Inlining --------------------------------- */
+
+/* Can subgraph be spliced into the graph which references it? */
+static bool deg_subgraph_can_inline(Depsgraph *graph, const SubgraphDepsNode *sgn)
+{
+	GHashIterator hashIter;
+	
+	/* nothing to inline */
+	if (sgn->graph == NULL)
+		return false;
+	
+	/* graph must belong to this node only, with at most one instance using it
+	 * NOTE: instances normally get evaluated in the space of each instancer (see DEG_subgraph_evaluate_instances()).
+	 *       With only one, the contents can be evaluated in their own space instead, with the instancer's
+	 *       transform getting applied when the dupli-list is made (as for any other dupli)
+	 */
+	if ((sgn->flag & SUBGRAPH_FLAG_SHARED) || (sgn->num_users > 1) || (BLI_countlist(&sgn->instances) > 1))
+		return false;
+	
+	/* contents mustn't be in graph already (i.e. group objects which are also in the scene) - 
+	 * merging these would make them depend on the instancer too, which may depend on them in turn
+	 */
+	GHASH_ITER(hashIter, sgn->graph->id_hash) {
+		if (BLI_ghash_haskey(graph->id_hash, BLI_ghashIterator_getKey(&hashIter)))
+			return false;
+	}
+	
+	return true;
+}
+
+/* Splice single subgraph into the graph, replacing the subgraph node with the nodes for the ID-blocks in it */
+static void deg_graph_inline_subgraph(Depsgraph *graph, SubgraphDepsNode *sgn)
+{
+	Depsgraph *src = sgn->graph;
+	ListBase ids = {NULL, NULL};
+	GHashIterator hashIter;
+	LinkData *ld;
+	
+	/* ID-blocks in subgraph - these may get replaced by nodes which already exist in graph,
+	 * so the nodes need to be looked up again once merging is done
+	 */
+	GHASH_ITER(hashIter, src->id_hash) {
+		BLI_addtail(&ids, BLI_genericNodeN(BLI_ghashIterator_getKey(&hashIter)));
+	}
+	
+	/* subgraph node no longer owns the graph, as its contents are about to become part of this one */
+	sgn->graph = NULL;
+	DEG_graph_merge(graph, src);
+	
+	/* rewire relations - whatever the subgraph depended on (or was needed by) now applies to its contents 
+	 * (i.e. the instance's "Dupli-Group Instance" relation from its instancer's transform)
+	 */
+	for (ld = ids.first; ld; ld = ld->next) {
+		DepsNode *id_node = BLI_ghash_lookup(graph->id_hash, ld->data);
+		
+		if ((id_node == NULL) || (id_node == &sgn->nd))
+			continue;
+		
+		DEPSNODE_RELATIONS_ITER_BEGIN(sgn->nd.inlinks.first, rel)
+		{
+			if (rel->from != id_node) {
+				DEG_add_new_relation(graph, rel->from, id_node, rel->type, rel->name);
+			}
+		}
+		DEPSNODE_RELATIONS_ITER_END;
+		
+		DEPSNODE_RELATIONS_ITER_BEGIN(sgn->nd.outlinks.first, rel)
+		{
+			if (rel->to != id_node) {
+				DEG_add_new_relation(graph, id_node, rel->to, rel->type, rel->name);
+			}
+		}
+		DEPSNODE_RELATIONS_ITER_END;
+	}
+	BLI_freelistN(&ids);
+	
+	/* subgraph node itself isn't needed anymore
+	 * NOTE: only subgraphs with at most one instance get here (see deg_subgraph_can_inline()),
+	 *       whose evaluation state gets freed along with the node
+	 */
+	DEG_remove_node(graph, &sgn->nd);
+	DEG_free_node(&sgn->nd);
+	DEG_free_node_mem(&sgn->nd);
+}
+
+/* API ----------------------------------------------- */
+
+/* Splice subgraphs which are only used once into the graph, so that their operations 
+ * can get scheduled along with everything else, instead of being evaluated as a single block
+ */
+bool DEG_graph_inline_subgraphs(Depsgraph *graph)
+{
+	SubgraphDepsNode *sgn, *prev, *next;
+	bool changed = false;
+	
+	for (sgn = graph->subgraphs.first; sgn; sgn = next) {
+		prev = (SubgraphDepsNode *)sgn->nd.prev;
+		
+		if (deg_subgraph_can_inline(graph, sgn)) {
+			deg_graph_inline_subgraph(graph, sgn);
+			changed = true;
+			
+			/* subgraphs within the one just inlined get added to the end of the list, so they get checked too */
+			next = (prev) ? (SubgraphDepsNode *)prev->nd.next : (SubgraphDepsNode *)graph->subgraphs.first;
+		}
+		else {
+			next = (SubgraphDepsNode *)sgn->nd.next;
+		}
+	}
+	
+	return changed;
+}
+
+/* Subgraph Instances -------------------------------- */
+
+/* Remove instances of subgraphs which are made by the given object
+ * (i.e. when object is being removed from graph, or is being built again)
+ */
+void DEG_graph_remove_instances(Depsgraph *graph, const Object *ob)
+{
+	SubgraphDepsNode *sgn;
+	DepsNode *trans_node = DEG_find_node(graph, &ob->id, NULL, DEPSNODE_TYPE_TRANSFORM, NULL);
+	
+	for (sgn = graph->subgraphs.first; sgn; sgn = (SubgraphDepsNode *)sgn->nd.next) {
+		DepsgraphInstance *inst = BLI_findptr(&sgn->instances, ob, offsetof(DepsgraphInstance, instancer));
+		DepsRelation *rel;
+		
+		if (inst == NULL)
+			continue;
+		
+		/* results of evaluating it */
+		if (inst->state) {
+			DEG_eval_state_free(inst->state);
+		}
+		
+		BLI_freelinkN(&sgn->instances, inst);
+		sgn->num_users--;
+		
+		/* instance doesn't need to wait for object anymore */
+		rel = (trans_node) ? DEG_find_relation(graph, trans_node, &sgn->nd, DEPSREL_TYPE_TRANSFORM) : NULL;
+		if (rel) {
+			DEG_remove_relation(graph, rel);
+			DEG_free_relation(rel);
+		}
+	}
+}
+
 /* ************************************************** */
 /* Update Tagging/Flushing */
 
@@ -412,6 +1419,8 @@ void DEG_free_relation(DepsRelation *rel)
 /* Tag a specific node as needing updates */
 void DEG_node_tag_update(Depsgraph *graph, DepsNode *node)
 {
+	LinkData *ld;
+	
 	/* sanity check */
 	if (ELEM(NULL, graph, node))
 		return;
@@ -422,7 +1431,9 @@ void DEG_node_tag_update(Depsgraph *graph, DepsNode *node)
 	/* add to graph-level set of directly modified nodes to start searching from
 	 * NOTE: this is necessary since we have several thousand nodes to play with...
 	 */
-	BLI_addtail(&graph->entry_tags, BLI_genericNodeN(node));
+	ld = BLI_mempool_alloc(graph->entry_tags_pool);
+	ld->data = node;
+	BLI_addtail(&graph->entry_tags, ld);
 }
 
 /* Data-Based Tagging ------------------------------- */
@@ -443,6 +1454,13 @@ void DEG_data_tag_update(Depsgraph *graph, const PointerRNA *ptr)
 	DEG_node_tag_update(graph, node);
 }
 
+/* Tag nodes related to an RNA path */
+void DEG_rna_path_tag_update(Depsgraph *graph, const ID *id, const char *path)
+{
+	DepsNode *node = DEG_find_node_from_rna_path(graph, id, path);
+	DEG_node_tag_update(graph, node);
+}
+
 /* Tag nodes related to a specific property */
 void DEG_property_tag_update(Depsgraph *graph, const PointerRNA *ptr, const PropertyRNA *prop)
 {
@@ -452,6 +1470,18 @@ void DEG_property_tag_update(Depsgraph *graph, const PointerRNA *ptr, const Prop
 
 /* Update Flushing ---------------------------------- */
 
+/* Clear list of entry tags, keeping the links for reuse */
+static void deg_graph_entry_tags_clear(Depsgraph *graph)
+{
+	LinkData *ld, *next;
+	
+	for (ld = graph->entry_tags.first; ld; ld = next) {
+		next = ld->next;
+		BLI_mempool_free(graph->entry_tags_pool, ld);
+	}
+	graph->entry_tags.first = graph->entry_tags.last = NULL;
+}
+
 /* Flush updates from tagged nodes outwards until all affected nodes are tagged */
 void DEG_graph_flush_updates(Depsgraph *graph)
 {
@@ -479,7 +1509,7 @@ void DEG_graph_flush_updates(Depsgraph *graph)
 	}
 	
 	/* clear entry tags, since all tagged nodes should now be reachable from root */
-	BLI_freelistN(&graph->entry_tags);
+	deg_graph_entry_tags_clear(graph);
 }
 
 /* Clear tags from all operation nodes */
@@ -497,7 +1527,7 @@ void DEG_graph_clear_tags(Depsgraph *graph)
 	}
 	
 	/* clear any entry tags which haven't been flushed */
-	BLI_freelistN(&graph->entry_tags);
+	deg_graph_entry_tags_clear(graph);
 }
 
 /* ************************************************** */
@@ -505,13 +1535,26 @@ void DEG_graph_clear_tags(Depsgraph *graph)
 
 /* Init --------------------------------------------- */
 
+/* Initialise lookup data for a graph with no contents */
+static void deg_graph_init_data(Depsgraph *graph)
+{
+	/* initialise hash used to quickly find node associated with a particular ID block */
+	graph->id_hash = BLI_ghash_ptr_new("Depsgraph ID NodeHash");
+	
+	/* initialise set of relations, used to prevent duplicate links between the same nodes */
+	graph->relations_hash = BLI_ghash_new(deg_relation_hash, deg_relation_cmp, "Depsgraph Relations Set");
+	
+	/* links for tagged nodes get reused, so that tagging doesn't need to allocate each time */
+	graph->entry_tags_pool = BLI_mempool_create(sizeof(LinkData), 64, 64, 0);
+}
+
 /* Initialise a new Depsgraph */
 Depsgraph *DEG_graph_new()
 {
 	Depsgraph *graph = MEM_callocN(sizeof(Depsgraph), "Depsgraph");
 	
-	/* initialise hash used to quickly find node associated with a particular ID block */
-	graph->id_hash = BLI_ghash_ptr_new("Depsgraph ID NodeHash");
+	/* initialise lookup data */
+	deg_graph_init_data(graph);
 	
 	/* return new graph */
 	return graph;
@@ -523,24 +1566,92 @@ Depsgraph *DEG_graph_new()
 static void deg_graph_free__node_wrapper(void *node_p)
 {
 	DEG_free_node((DepsNode *)node_p);
-	MEM_freeN(node_p);
+	DEG_free_node_mem((DepsNode *)node_p);
 }
 
-/* Free graph's contents and graph itself */
-void DEG_graph_free(Depsgraph *graph)
+/* wrapper around DEG_free_relation() so that it can be used to free relations stored in hash... */
+static void deg_graph_free__relation_wrapper(void *rel_p)
 {
+	DEG_free_relation((DepsRelation *)rel_p);
+}
+
+/* Free graph's contents, but not graph itself */
+static void deg_graph_free_data(Depsgraph *graph)
+{
+	LinkData *ld;
+	int i;
+	
+	/* free query indices and cached paths - these refer to the nodes */
+	DEG_graph_query_index_invalidate(graph);
+	DEG_graph_rna_path_cache_clear(graph);
+	
+	/* free relations - the nodes only hold LinkData references to these */
+	BLI_ghash_free(graph->relations_hash, NULL, deg_graph_free__relation_wrapper);
+	graph->relations_hash = NULL;
+	
 	/* free node hash */
 	BLI_ghash_free(graph->id_hash, NULL, deg_graph_free__node_wrapper);
 	graph->id_hash = NULL;
 	
-	/* free root node - it won't have been freed yet... */
+	/* free root node (and its time source) - these won't have been freed yet... */
 	if (graph->root_node) {
+		RootDepsNode *root_node = (RootDepsNode *)graph->root_node;
+		
+		if (root_node->time_source) {
+			DEG_free_node(&root_node->time_source->nd);
+			DEG_free_node_mem(&root_node->time_source->nd);
+		}
+		
 		DEG_free_node(graph->root_node);
+		DEG_free_node_mem(graph->root_node);
 		graph->root_node = NULL;
 	}
 	
 	/* free entrypoint tag cache... */
-	BLI_freelistN(&graph->entry_tags);
+	BLI_mempool_destroy(graph->entry_tags_pool);
+	graph->entry_tags_pool = NULL;
+	graph->entry_tags.first = graph->entry_tags.last = NULL;
+	
+	/* free operation nodes list - nodes themselves were freed along with their owners */
+	BLI_freelistN(&graph->all_opnodes);
+	graph->num_nodes = 0;
+	
+	/* workers' scratch memory */
+	DEG_evaluation_arenas_free(graph);
+	
+	/* shared evaluation info */
+	for (i = 0; i < DEG_MAX_EVALUATION_CONTEXTS; i++) {
+		if (graph->master_contexts[i]) {
+			MEM_freeN(graph->master_contexts[i]);
+			graph->master_contexts[i] = NULL;
+		}
+	}
+	
+	/* free blocks that nodes were allocated from - nothing uses these now */
+	for (ld = graph->node_arenas.first; ld; ld = ld->next) {
+		MEM_freeN(ld->data);
+	}
+	BLI_freelistN(&graph->node_arenas);
+}
+
+/* Remove and free all nodes and relations in graph, leaving it empty and ready to be built again */
+void DEG_graph_clear(Depsgraph *graph)
+{
+	/* settings are for the graph itself, not its contents, so these are kept */
+	int flag = graph->flag;
+	
+	deg_graph_free_data(graph);
+	
+	memset(graph, 0, sizeof(Depsgraph));
+	deg_graph_init_data(graph);
+	
+	graph->flag = flag;
+}
+
+/* Free graph's contents and graph itself */
+void DEG_graph_free(Depsgraph *graph)
+{
+	deg_graph_free_data(graph);
 	
 	/* finally, graph itself */
 	MEM_freeN(graph);
@@ -34,6 +34,8 @@
 
 #include "BLI_blenlib.h"
 #include "BLI_ghash.h"
+#include "BLI_math.h"
+#include "BLI_memarena.h"
 #include "BLI_string.h"
 #include "BLI_threads.h"
 #include "BLI_utildefines.h"
@@ -41,12 +43,14 @@
 #include "PIL_time.h"
 
 #include "DNA_anim_types.h"
+#include "DNA_group_types.h"
 #include "DNA_object_types.h"
 #include "DNA_scene_types.h"
 
 #include "BKE_action.h"
 #include "BKE_animsys.h"
 #include "BKE_constraint.h"
+#include "BKE_customdata.h"
 #include "BKE_DerivedMesh.h"
 #include "BKE_depsgraph.h"
 #include "BKE_main.h"
@@ -83,13 +87,21 @@ void DEG_threaded_exit(void)
 /* *************************************************** */
 /* Evaluation Internals */
 
+static void deg_evaluation_contexts_prepare(Depsgraph *graph, eEvaluationContextType context_type);
+
+/* Scratch memory for the operation being evaluated on the current thread (see DEG_context_scratch_alloc())
+ * NOTE: this can't go in the contexts, as these are shared by operations which may be running on other threads
+ */
+static DEG_THREAD_LOCAL MemArena *deg_thread_arena = NULL;
+
 /* Perform evaluation of a node 
  * < graph: Dependency Graph that operations belong to
  * < node: operation node to evaluate
  * < context_type: the context/purpose that the node is being evaluated for
+ * < thread_id: index of worker that node is being evaluated on
  */
 // NOTE: this is called by the scheduler on a worker thread
-static void deg_exec_node(Depsgraph *graph, DepsNode *node, eEvaluationContextType context_type)
+static void deg_exec_node(Depsgraph *graph, DepsNode *node, eEvaluationContextType context_type, int thread_id)
 {
 	/* get context and dispatch */
 	if (node->class == DEPSNODE_CLASS_OPERATION) {
@@ -97,8 +109,7 @@ static void deg_exec_node(Depsgraph *graph, DepsNode *node, eEvaluationContextTy
 		ComponentDepsNode *com = (ComponentDepsNode *)op->nd.owner; 
 		void *context = NULL, *item = NULL;
 		
-		/* get context */
-		// TODO: who initialises this? "Init" operations aren't able to initialise it!!!
+		/* get context - this was made before evaluation started (see deg_evaluation_contexts_prepare()) */
 		BLI_assert(com != NULL);
 		context = com->contexts[context_type];
 		
@@ -106,15 +117,24 @@ static void deg_exec_node(Depsgraph *graph, DepsNode *node, eEvaluationContextTy
 		// XXX: not everything will use this - some may want something else!
 		item = &op->ptr;
 		
+		/* scratch memory comes from the worker that operation runs on */
+		BLI_assert(thread_id < graph->num_eval_arenas);
+		deg_thread_arena = graph->eval_arenas[thread_id];
+		
 		/* take note of current time */
 		op->start_time = PIL_check_seconds_timer();
 		
 		/* perform operation */
 		op->evaluate(context, item);
+		deg_thread_arena = NULL;
 		
 		/* note how long this took */
 		op->last_time = PIL_check_seconds_timer() - op->start_time;
 	}
+	else if (node->type == DEPSNODE_TYPE_SUBGRAPH) {
+		/* instanced subgraphs get evaluated for each of their instances (which have scratch memory of their own) */
+		DEG_subgraph_evaluate_instances((SubgraphDepsNode *)node, context_type, graph->master_contexts[context_type]);
+	}
 	/* NOTE: "generic" nodes cannot be executed, but will still end up calling this */
 }
 
@@ -128,13 +148,22 @@ static void deg_exec_node(Depsgraph *graph, DepsNode *node, eEvaluationContextTy
 void DEG_evaluate_on_refresh(Depsgraph *graph, eEvaluationContextType context_type)
 {
 	/* generate base evaluation context, upon which all the others are derived... */
-	// TODO: this needs both main and scene access...
+	DEG_evaluation_context_init(graph, context_type);
+	
+	/* contexts for the components which are going to be evaluated */
+	deg_evaluation_contexts_prepare(graph, context_type);
+	
+	/* scratch memory for each worker */
+	DEG_evaluation_arenas_ensure(graph, MIN2(BLI_system_thread_count(), BLENDER_MAX_THREADS));
 	
 	/* from the root node, start queuing up nodes to evaluate */
 	// ... start scheduler, etc.
 	
 	// ...
 	
+	/* nothing uses the scratch memory anymore, but it can be reused next time */
+	DEG_evaluation_arenas_clear(graph);
+	
 	/* clear any uncleared tags - just in case */
 	DEG_graph_clear_tags(graph);
 }
@@ -162,55 +191,236 @@ void DEG_evaluate_on_framechange(Depsgraph *graph, eEvaluationContextType contex
 /* *************************************************** */
 /* Evaluation Context Management */
 
-/* Initialise evaluation context for given node */
-static void deg_node_evaluation_context_init(ComponentDepsNode *comp, eEvaluationContextType context_type)
+/* Get size of evaluation context used by components of the given type */
+static size_t deg_eval_context_size(int type)
+{
+	switch (type) {
+		case DEPSNODE_TYPE_PARAMETERS:
+			return sizeof(DEG_ParametersContext);
+		case DEPSNODE_TYPE_ANIMATION:
+			return sizeof(DEG_AnimationContext);
+		case DEPSNODE_TYPE_TRANSFORM:
+			return sizeof(DEG_TransformContext);
+		case DEPSNODE_TYPE_GEOMETRY:
+			return sizeof(DEG_GeometryContext);
+		case DEPSNODE_TYPE_EVAL_POSE:
+			return sizeof(DEG_PoseContext);
+		default:
+			return sizeof(DEG_OperationsContext);
+	}
+}
+
+/* Copy the info shared by all contexts from the root of the graph being evaluated */
+static void deg_master_context_sync(DEG_OperationsContext *master, const RootDepsNode *root)
+{
+	if (root == NULL)
+		return;
+	
+	master->bmain = root->bmain;
+	master->scene = root->scene;
+	
+	if (root->time_source) {
+		master->cfra = root->time_source->cfra;
+	}
+}
+
+/* Get the data that component's context needs to be set up for
+ * NOTE: when this changes (i.e. object's pose was rebuilt), the context is no longer valid
+ */
+static const void *deg_node_evaluation_context_source(const ComponentDepsNode *comp)
+{
+	const IDDepsNode *id_node = (const IDDepsNode *)comp->nd.owner;
+	ID *id = (id_node) ? id_node->id : NULL;
+	Object *ob = (id && (GS(id->name) == ID_OB)) ? (Object *)id : NULL;
+	
+	switch (comp->nd.type) {
+		case DEPSNODE_TYPE_ANIMATION:
+			return (id) ? (const void *)BKE_animdata_from_id(id) : NULL;
+		case DEPSNODE_TYPE_GEOMETRY:
+			return (ob) ? ob->data : (const void *)id;
+		case DEPSNODE_TYPE_EVAL_POSE:
+			return (ob) ? (const void *)ob->pose : NULL;
+		default:
+			return id;
+	}
+}
+
+/* Set up context for the data that component is evaluating */
+static void deg_node_evaluation_context_setup(ComponentDepsNode *comp, DEG_OperationsContext *context)
+{
+	const IDDepsNode *id_node = (const IDDepsNode *)comp->nd.owner;
+	ID *id = (id_node) ? id_node->id : NULL;
+	Object *ob = (id && (GS(id->name) == ID_OB)) ? (Object *)id : NULL;
+	
+	context->type = comp->nd.type;
+	context->source = deg_node_evaluation_context_source(comp);
+	
+	switch (comp->nd.type) {
+		case DEPSNODE_TYPE_PARAMETERS:
+		{
+			DEG_ParametersContext *pctx = (DEG_ParametersContext *)context;
+			
+			if (id) {
+				RNA_id_pointer_create(id, &pctx->ptr);
+			}
+			break;
+		}
+		case DEPSNODE_TYPE_ANIMATION:
+		{
+			DEG_AnimationContext *actx = (DEG_AnimationContext *)context;
+			
+			actx->id = id;
+			actx->adt = (AnimData *)context->source;
+			break;
+		}
+		case DEPSNODE_TYPE_TRANSFORM:
+		{
+			DEG_TransformContext *tctx = (DEG_TransformContext *)context;
+			
+			tctx->ob = ob;
+			break;
+		}
+		case DEPSNODE_TYPE_GEOMETRY:
+		{
+			DEG_GeometryContext *gctx = (DEG_GeometryContext *)context;
+			
+			gctx->source = (ID *)context->source;
+			break;
+		}
+		case DEPSNODE_TYPE_EVAL_POSE:
+		{
+			DEG_PoseContext *pctx = (DEG_PoseContext *)context;
+			
+			pctx->ob = ob;
+			pctx->pose = (bPose *)context->source;
+			break;
+		}
+	}
+}
+
+/* Get CustomData layers that geometry component needs to provide for the given type of evaluation */
+static uint64_t deg_geometry_context_mask(const ComponentDepsNode *comp, eEvaluationContextType context_type,
+                                          const DEG_OperationsContext *master)
+{
+	const GeometryComponentDepsNode *geom = (const GeometryComponentDepsNode *)comp;
+	const Scene *scene = (master) ? master->scene : NULL;
+	uint64_t mask = geom->eval_masks[context_type] | CD_MASK_BAREMESH;
+	
+	if (context_type == DEG_EVALUATION_CONTEXT_VIEWPORT) {
+		/* whatever the viewport needs to draw at the moment */
+		if (scene) {
+			mask |= scene->customdata_mask | scene->customdata_mask_modal;
+		}
+	}
+	else {
+		/* texture coordinates and colors for materials */
+		mask |= CD_MASK_MTFACE | CD_MASK_MCOL | CD_MASK_ORCO;
+	}
+	
+	return mask;
+}
+
+/* Initialise evaluation context for given node, if it doesn't exist yet (or is no longer valid)
+ * NOTE: this gets called for each of the component's operations which are about to be evaluated.
+ *       Contexts are kept until the component is freed, so in most cases, nothing needs doing here.
+ *
+ * < master: master context for the evaluation that the context gets used for
+ * > returns: (DEG_OperationsContext) component's context for the given evaluation type
+ */
+static void *deg_node_evaluation_context_init(ComponentDepsNode *comp, eEvaluationContextType context_type,
+                                              const DEG_OperationsContext *master)
 {
 	DepsNodeTypeInfo *nti = DEG_node_get_typeinfo((DepsNode *)comp);
+	DEG_OperationsContext *context = comp->contexts[context_type];
+	
+	/* existing context is still usable as long as it is for the same data */
+	if (context && (context->source != deg_node_evaluation_context_source(comp))) {
+		if (nti->eval_context_free) {
+			nti->eval_context_free(comp, context_type);
+		}
+		
+		if (nti->eval_context_init) {
+			/* type-specific contexts need to be made again from scratch */
+			MEM_freeN(context);
+			comp->contexts[context_type] = context = NULL;
+		}
+		else {
+			/* reuse the memory instead */
+			memset(context, 0, deg_eval_context_size(comp->nd.type));
+			deg_node_evaluation_context_setup(comp, context);
+		}
+	}
 	
 	/* check if the requested evaluation context exists already */
-	if (comp->contexts[context_type] == NULL) {
+	if (context == NULL) {
 		/* doesn't exist, so create new evaluation context here */
 		if (nti->eval_context_init) {
 			nti->eval_context_init(comp, context_type);
 		}
 		else {
 			/* initialise using standard techniques */
-			comp->contexts[context_type] = MEM_callocN(sizeof(DEG_OperationsContext), "Evaluation Context");
-			// TODO: init from master context somehow...
+			comp->contexts[context_type] = MEM_callocN(deg_eval_context_size(comp->nd.type), "Evaluation Context");
+		}
+		
+		context = comp->contexts[context_type];
+		if (context) {
+			deg_node_evaluation_context_setup(comp, context);
 		}
 	}
-	else {
-		// TODO: validate existing data, as some parts may no longer exist 
+	
+	/* shared info comes from the master context - this may have been remade since last time */
+	if (context) {
+		context->master = master;
+		
+		/* layers needed may have changed without the geometry itself changing */
+		if (comp->nd.type == DEPSNODE_TYPE_GEOMETRY) {
+			((DEG_GeometryContext *)context)->customdata_mask = deg_geometry_context_mask(comp, context_type, master);
+		}
+	}
+	
+	return context;
+}
+
+/* Make sure that components of the operations which are going to be evaluated have contexts ready
+ * NOTE: this is done before any workers are started, as operations of the same component
+ *       may end up being evaluated on different threads at the same time
+ */
+static void deg_evaluation_contexts_prepare(Depsgraph *graph, eEvaluationContextType context_type)
+{
+	const DEG_OperationsContext *master = graph->master_contexts[context_type];
+	LinkData *ld;
+	
+	for (ld = graph->all_opnodes.first; ld; ld = ld->next) {
+		DepsNode *node = (DepsNode *)ld->data;
+		
+		if ((node->class == DEPSNODE_CLASS_OPERATION) && (node->flag & DEPSNODE_FLAG_NEEDS_UPDATE) && node->owner) {
+			deg_node_evaluation_context_init((ComponentDepsNode *)node->owner, context_type, master);
+		}
 	}
 }
 
-/* Initialise evaluation contexts for all nodes */
+/* Initialise master evaluation context, which all other contexts refer to
+ * NOTE: contexts for components only get made once they are needed
+ */
 void DEG_evaluation_context_init(Depsgraph *graph, eEvaluationContextType context_type)
 {
-	GHashIterator idHashIter;
-	
-	/* initialise master context first... */
-	// ...
+	DEG_OperationsContext *master = graph->master_contexts[context_type];
 	
-	/* loop over components, initialising their contexts */
-	GHASH_ITER(idHashIter, graph->id_hash) {
-		IDDepsNode *id_ref = BLI_ghashIterator_getValue(&idHashIter);
-		GHashIterator compHashIter;
+	if (master == NULL) {
+		master = MEM_callocN(sizeof(DEG_OperationsContext), "Master Evaluation Context");
+		master->type = DEPSNODE_TYPE_ROOT;
 		
-		/* loop over components */
-		GHASH_ITER(compHashIter, id_ref->component_hash) {
-			/* initialise evaluation context */
-			// TODO: we probably need to pass the master context down so that it can be handled properly
-			ComponentDepsNode *comp = BLI_ghashIterator_getValue(&compHashIter); 
-			deg_node_evaluation_context_init(comp, context_type);
-		}
+		graph->master_contexts[context_type] = master;
 	}
+	
+	/* this only changes before evaluation starts, so it can be read without locking while evaluating */
+	deg_master_context_sync(master, (RootDepsNode *)graph->root_node);
 }
 
 /* --------------------------------------------------- */
 
 /* Free evaluation contexts for node */
-static void deg_node_evaluation_contexts_free(ComponentDepsNode *comp)
+void DEG_node_evaluation_contexts_free(ComponentDepsNode *comp)
 {
 	DepsNodeTypeInfo *nti = DEG_node_get_typeinfo((DepsNode *)comp);
 	size_t i;
@@ -232,6 +442,7 @@ static void deg_node_evaluation_contexts_free(ComponentDepsNode *comp)
 void DEG_evaluation_contexts_free(Depsgraph *graph)
 {
 	GHashIterator idHashIter;
+	int i;
 	
 	/* free contexts for components first */
 	GHASH_ITER(idHashIter, graph->id_hash) {
@@ -241,9 +452,677 @@ void DEG_evaluation_contexts_free(Depsgraph *graph)
 		GHASH_ITER(compHashIter, id_ref->component_hash) {
 			/* free evaluation context */
 			ComponentDepsNode *comp = BLI_ghashIterator_getValue(&compHashIter);
-			deg_node_evaluation_contexts_free(comp);
+			DEG_node_evaluation_contexts_free(comp);
+		}
+	}
+	
+	/* master contexts last, as the others refer to these */
+	for (i = 0; i < DEG_MAX_EVALUATION_CONTEXTS; i++) {
+		if (graph->master_contexts[i]) {
+			MEM_freeN(graph->master_contexts[i]);
+			graph->master_contexts[i] = NULL;
 		}
 	}
 }
 
 /* *************************************************** */
+/* Scratch Memory */
+
+/* Operations often need temporary buffers while they work. Instead of each of these going through the
+ * guarded allocator (which all workers have to take turns to use), each worker has its own arena which
+ * these get taken from. The arenas get reset once evaluation is done, but their memory is kept for next time.
+ */
+
+/* Ensure that graph has scratch memory for the given number of workers */
+void DEG_evaluation_arenas_ensure(Depsgraph *graph, int num_workers)
+{
+	int i;
+	
+	if (graph->num_eval_arenas >= num_workers)
+		return;
+	
+	if (graph->eval_arenas) {
+		graph->eval_arenas = MEM_reallocN(graph->eval_arenas, sizeof(MemArena *) * num_workers);
+	}
+	else {
+		graph->eval_arenas = MEM_mallocN(sizeof(MemArena *) * num_workers, "Depsgraph Eval Arenas");
+	}
+	
+	for (i = graph->num_eval_arenas; i < num_workers; i++) {
+		graph->eval_arenas[i] = BLI_memarena_new(BLI_MEMARENA_STD_BUFSIZE, "Depsgraph Worker Scratch");
+	}
+	graph->num_eval_arenas = num_workers;
+}
+
+/* Reset scratch memory of all workers once evaluation is done (memory is kept for next time) */
+void DEG_evaluation_arenas_clear(Depsgraph *graph)
+{
+	int i;
+	
+	for (i = 0; i < graph->num_eval_arenas; i++) {
+		BLI_memarena_clear(graph->eval_arenas[i]);
+	}
+}
+
+/* Free scratch memory of all workers */
+void DEG_evaluation_arenas_free(Depsgraph *graph)
+{
+	int i;
+	
+	for (i = 0; i < graph->num_eval_arenas; i++) {
+		BLI_memarena_free(graph->eval_arenas[i]);
+	}
+	
+	if (graph->eval_arenas) {
+		MEM_freeN(graph->eval_arenas);
+		graph->eval_arenas = NULL;
+	}
+	graph->num_eval_arenas = 0;
+}
+
+/* Get temporary buffer for operation, which stays valid until evaluation is done */
+void *DEG_context_scratch_alloc(void *UNUSED(context), size_t size)
+{
+	BLI_assert(deg_thread_arena != NULL);
+	return BLI_memarena_alloc(deg_thread_arena, size);
+}
+
+/* *************************************************** */
+/* Snapshots */
+
+/* Can the given link (in snapshot's out_targets) be followed when evaluating? */
+static bool deg_eval_state_link_is_used(const DepsgraphSnapshot *snapshot, int link)
+{
+	const DepsRelation *rel = snapshot->rels[link];
+	return (rel != NULL) && ((rel->flag & DEPSREL_FLAG_CYCLIC) == 0);
+}
+
+/* Sort snapshot's nodes in the order they can be evaluated in (i.e. each node comes after everything it depends on)
+ * NOTE: this only depends on the relations, so it only needs doing once for all evaluations of the snapshot.
+ *       Nodes which are part of cycles are left out.
+ */
+static void deg_snapshot_sort(DepsgraphSnapshot *snapshot)
+{
+	const DepsgraphNodeTable *table = snapshot->table;
+	int *valency = MEM_callocN(sizeof(int) * MAX2(table->num_nodes, 1), "deg_snapshot_sort() valency");
+	int *order = MEM_mallocN(sizeof(int) * MAX2(table->num_nodes, 1), "DepsgraphSnapshot order");
+	int head = 0, tail = 0;
+	int i, j;
+	
+	/* count how many nodes each node has to wait for */
+	for (i = 0; i < table->num_nodes; i++) {
+		for (j = table->out_offsets[i]; j < table->out_offsets[i + 1]; j++) {
+			if (deg_eval_state_link_is_used(snapshot, j)) {
+				valency[table->out_targets[j]]++;
+			}
+		}
+	}
+	
+	/* start from nodes which don't depend on anything */
+	for (i = 0; i < table->num_nodes; i++) {
+		if (snapshot->nodes[i] && (valency[i] == 0)) {
+			order[tail++] = i;
+		}
+	}
+	
+	/* nodes can go once everything they depend on is before them */
+	while (head < tail) {
+		const int index = order[head++];
+		
+		for (j = table->out_offsets[index]; j < table->out_offsets[index + 1]; j++) {
+			if (deg_eval_state_link_is_used(snapshot, j) && (--valency[table->out_targets[j]] == 0)) {
+				order[tail++] = table->out_targets[j];
+			}
+		}
+	}
+	
+	snapshot->order = order;
+	snapshot->num_order = tail;
+	
+	MEM_freeN(valency);
+}
+
+/* Get graph's current snapshot, making it first if graph has changed since the last one was made */
+DepsgraphSnapshot *DEG_graph_snapshot_acquire(Depsgraph *graph)
+{
+	DepsgraphSnapshot *snapshot = graph->snapshot;
+	
+	/* NOTE: graph can only be changed from the main thread, so only the user count needs locking */
+	if (snapshot == NULL) {
+		DepsgraphNodeTable *table = DEG_graph_node_table_ensure(graph);
+		int i;
+		
+		snapshot = MEM_callocN(sizeof(DepsgraphSnapshot), "DepsgraphSnapshot");
+		
+		snapshot->table = table;
+		snapshot->graph = DEG_graph_copy_ex(graph, NULL, &snapshot->nodes, &snapshot->rels);
+		
+		/* owners can only be looked up while the nodes in the table still exist */
+		snapshot->owners = MEM_mallocN(sizeof(int) * MAX2(table->num_nodes, 1), "DepsgraphSnapshot owners");
+		
+		for (i = 0; i < table->num_nodes; i++) {
+			DepsNode *owner = table->nodes[i]->owner;
+			snapshot->owners[i] = (owner) ? DEG_node_table_index(table, owner) : -1;
+		}
+		
+		/* evaluation order is the same for all evaluations */
+		deg_snapshot_sort(snapshot);
+		
+		/* graph holds onto it until it changes */
+		snapshot->users = 1;
+		graph->snapshot = snapshot;
+	}
+	
+	BLI_spin_lock(&threaded_update_lock);
+	snapshot->users++;
+	BLI_spin_unlock(&threaded_update_lock);
+	
+	return snapshot;
+}
+
+/* Stop using snapshot, freeing it if nothing else uses it anymore */
+void DEG_graph_snapshot_release(DepsgraphSnapshot *snapshot)
+{
+	int users;
+	
+	BLI_spin_lock(&threaded_update_lock);
+	users = --snapshot->users;
+	BLI_spin_unlock(&threaded_update_lock);
+	
+	if (users == 0) {
+		DEG_graph_free(snapshot->graph);
+		DEG_node_table_free(snapshot->table);
+		
+		MEM_freeN(snapshot->nodes);
+		MEM_freeN(snapshot->rels);
+		MEM_freeN(snapshot->owners);
+		MEM_freeN(snapshot->order);
+		
+		MEM_freeN(snapshot);
+	}
+}
+
+/* Separate Evaluations ------------------------------ */
+
+static void deg_exec_state_subgraph(DepsgraphEvalState *state, int index);
+static void deg_subgraph_eval_free(DepsgraphSubgraphEval *sub);
+
+/* Perform evaluation of a node in snapshot, using evaluation's own contexts
+ * NOTE: timings aren't stored, as the nodes may be shared with other evaluations
+ */
+static void deg_exec_state_node(DepsgraphEvalState *state, int index)
+{
+	const DepsgraphSnapshot *snapshot = state->snapshot;
+	DepsNode *node = snapshot->nodes[index];
+	
+	if (node->class == DEPSNODE_CLASS_OPERATION) {
+		OperationDepsNode *op = (OperationDepsNode *)node;
+		int owner = snapshot->owners[index];
+		void *context = (owner != -1) ? state->contexts[owner] : NULL;
+		
+		/* evaluations run on a single thread, so each only needs one lot of scratch memory 
+		 * NOTE: this may be running within an operation of another graph (i.e. for subgraph instances)
+		 */
+		MemArena *prev_arena = deg_thread_arena;
+		
+		if (op->evaluate) {
+			deg_thread_arena = state->arena;
+			op->evaluate(context, &op->ptr);
+			deg_thread_arena = prev_arena;
+		}
+	}
+	else if (node->type == DEPSNODE_TYPE_SUBGRAPH) {
+		/* instances get evaluated with this evaluation's own states for them */
+		deg_exec_state_subgraph(state, index);
+	}
+}
+
+/* Bring evaluation's contexts up to date, so that snapshot can be evaluated (again)
+ * NOTE: contexts are kept between evaluations of the same snapshot, with only those for data
+ *       which has been replaced since (i.e. object's pose was rebuilt) needing to be set up again
+ *
+ * < master: (optional) master context of the evaluation this is part of, to use instead of the graph's own
+ *           (i.e. subgraphs, which don't have a root to get the scene and frame from)
+ */
+static void deg_eval_state_sync(DepsgraphEvalState *state, const DEG_OperationsContext *master)
+{
+	const DepsgraphSnapshot *snapshot = state->snapshot;
+	const DepsgraphNodeTable *table = snapshot->table;
+	int i;
+	
+	if (master) {
+		state->master->bmain = master->bmain;
+		state->master->scene = master->scene;
+		state->master->cfra = master->cfra;
+	}
+	else {
+		deg_master_context_sync(state->master, (RootDepsNode *)snapshot->graph->root_node);
+	}
+	
+	for (i = 0; i < table->num_nodes; i++) {
+		DEG_OperationsContext *context = state->contexts[i];
+		ComponentDepsNode *comp;
+		
+		if (context == NULL)
+			continue;
+		
+		/* NOTE: the nodes in the table still exist, as the snapshot is still the graph's current one */
+		comp = (ComponentDepsNode *)table->nodes[i];
+		
+		if (context->source != deg_node_evaluation_context_source(comp)) {
+			memset(context, 0, deg_eval_context_size(comp->nd.type));
+			deg_node_evaluation_context_setup(comp, context);
+		}
+		
+		context->master = state->master;
+		
+		if (comp->nd.type == DEPSNODE_TYPE_GEOMETRY) {
+			((DEG_GeometryContext *)context)->customdata_mask = 
+			        deg_geometry_context_mask(comp, state->context_type, state->master);
+		}
+	}
+}
+
+/* Prepare evaluation of graph as it is now
+ * < master: (optional) master context of the evaluation this is part of (see deg_eval_state_sync())
+ */
+static DepsgraphEvalState *deg_eval_state_new_ex(Depsgraph *graph, eEvaluationContextType context_type,
+                                                 const DEG_OperationsContext *master)
+{
+	DepsgraphEvalState *state = MEM_callocN(sizeof(DepsgraphEvalState), "DepsgraphEvalState");
+	const DepsgraphNodeTable *table;
+	int num_nodes, i;
+	
+	state->snapshot = DEG_graph_snapshot_acquire(graph);
+	state->context_type = context_type;
+	
+	table = state->snapshot->table;
+	num_nodes = MAX2(table->num_nodes, 1);
+	
+	state->flag = MEM_callocN(sizeof(short) * num_nodes, "DepsgraphEvalState flag");
+	state->contexts = MEM_callocN(sizeof(void *) * num_nodes, "DepsgraphEvalState contexts");
+	state->subgraphs = MEM_callocN(sizeof(DepsgraphSubgraphEval *) * num_nodes, "DepsgraphEvalState subgraphs");
+	
+	state->master = MEM_callocN(sizeof(DEG_OperationsContext), "DepsgraphEvalState Master Context");
+	state->master->type = DEPSNODE_TYPE_ROOT;
+	
+	state->arena = BLI_memarena_new(BLI_MEMARENA_STD_BUFSIZE, "DepsgraphEvalState Scratch");
+	
+	for (i = 0; i < table->num_nodes; i++) {
+		DepsNode *node = state->snapshot->nodes[i];
+		
+		if (node == NULL)
+			continue;
+		
+		/* tags come from the graph itself, as snapshots are only remade when the relations change 
+		 * (the nodes in the table still exist, as the snapshot is up to date)
+		 */
+		state->flag[i] = table->nodes[i]->flag & (DEPSNODE_FLAG_NEEDS_UPDATE | DEPSNODE_FLAG_DIRECTLY_MODIFIED);
+		
+		/* each evaluation gets its own contexts */
+		if (node->class == DEPSNODE_CLASS_COMPONENT) {
+			DEG_OperationsContext *context = MEM_callocN(deg_eval_context_size(node->type), "Evaluation Context");
+			
+			deg_node_evaluation_context_setup((ComponentDepsNode *)table->nodes[i], context);
+			state->contexts[i] = context;
+		}
+	}
+	
+	/* shared info, and the rest of what the contexts need */
+	deg_eval_state_sync(state, master);
+	
+	return state;
+}
+
+/* Prepare evaluation of graph as it is now */
+DepsgraphEvalState *DEG_eval_state_new(Depsgraph *graph, eEvaluationContextType context_type)
+{
+	return deg_eval_state_new_ex(graph, context_type, NULL);
+}
+
+/* Find the nodes which need to be evaluated before operations of the given type can be
+ * > r_upstream: (table->num_nodes) set for the operations of the given type, and everything they depend on
+ */
+static void deg_snapshot_find_upstream(const DepsgraphSnapshot *snapshot, int type, bool *r_upstream)
+{
+	const DepsgraphNodeTable *table = snapshot->table;
+	int k, j;
+	
+	memset(r_upstream, 0, sizeof(bool) * table->num_nodes);
+	
+	/* going backwards, so that everything which depends on a node has already been checked */
+	for (k = snapshot->num_order - 1; k >= 0; k--) {
+		const int index = snapshot->order[k];
+		
+		if (snapshot->nodes[index]->type == type) {
+			r_upstream[index] = true;
+			continue;
+		}
+		
+		for (j = table->out_offsets[index]; j < table->out_offsets[index + 1]; j++) {
+			if (deg_eval_state_link_is_used(snapshot, j) && r_upstream[table->out_targets[j]]) {
+				r_upstream[index] = true;
+				break;
+			}
+		}
+	}
+}
+
+/* Evaluate nodes which are tagged for updating
+ * < skip_type: (eDepsNode_Type) operations of this type don't get evaluated (or -1 for none)
+ */
+static void deg_evaluate_state_ex(DepsgraphEvalState *state, int skip_type)
+{
+	const DepsgraphSnapshot *snapshot = state->snapshot;
+	const DepsgraphNodeTable *table = snapshot->table;
+	int k, j;
+	
+	/* evaluate nodes once everything they depend on is done (see deg_snapshot_sort()), 
+	 * pushing updates out to the nodes which depend on them as we go
+	 */
+	for (k = 0; k < snapshot->num_order; k++) {
+		const int index = snapshot->order[k];
+		const bool tagged = (state->flag[index] & DEPSNODE_FLAG_NEEDS_UPDATE) != 0;
+		
+		if (tagged && 
+		    ((state->only_nodes == NULL) || state->only_nodes[index]) && 
+		    (snapshot->nodes[index]->type != skip_type))
+		{
+			deg_exec_state_node(state, index);
+		}
+		
+		if (tagged) {
+			for (j = table->out_offsets[index]; j < table->out_offsets[index + 1]; j++) {
+				if (deg_eval_state_link_is_used(snapshot, j)) {
+					state->flag[table->out_targets[j]] |= DEPSNODE_FLAG_NEEDS_UPDATE;
+				}
+			}
+		}
+		
+		state->flag[index] &= ~(DEPSNODE_FLAG_NEEDS_UPDATE | DEPSNODE_FLAG_DIRECTLY_MODIFIED);
+	}
+	
+	/* operations are done with their scratch memory */
+	BLI_memarena_clear(state->arena);
+}
+
+/* Evaluate nodes which were tagged for updating when evaluation was prepared */
+void DEG_evaluate_state(DepsgraphEvalState *state)
+{
+	deg_evaluate_state_ex(state, -1);
+}
+
+/* Free evaluation state */
+void DEG_eval_state_free(DepsgraphEvalState *state)
+{
+	const DepsgraphNodeTable *table = state->snapshot->table;
+	int i;
+	
+	for (i = 0; i < table->num_nodes; i++) {
+		if (state->contexts[i]) {
+			MEM_freeN(state->contexts[i]);
+		}
+		if (state->subgraphs[i]) {
+			deg_subgraph_eval_free(state->subgraphs[i]);
+		}
+	}
+	
+	MEM_freeN(state->flag);
+	MEM_freeN(state->contexts);
+	MEM_freeN(state->subgraphs);
+	MEM_freeN(state->master);
+	BLI_memarena_free(state->arena);
+	
+	if (state->only_nodes) {
+		MEM_freeN(state->only_nodes);
+	}
+	
+	DEG_graph_snapshot_release(state->snapshot);
+	MEM_freeN(state);
+}
+
+/* *************************************************** */
+/* Instanced Subgraphs */
+
+/* Free evaluation of subgraph's instances, made for evaluation of a snapshot */
+static void deg_subgraph_eval_free(DepsgraphSubgraphEval *sub)
+{
+	DepsgraphInstance *inst;
+	
+	for (inst = sub->instances.first; inst; inst = inst->next) {
+		if (inst->state) {
+			DEG_eval_state_free(inst->state);
+		}
+	}
+	BLI_freelistN(&sub->instances);
+	
+	if (sub->base_state) {
+		DEG_eval_state_free(sub->base_state);
+	}
+	
+	MEM_freeN(sub);
+}
+
+/* Transforms of instances are handled in batches, instead of calling the transform operations for each
+ * instance. The operations only get evaluated once (giving the transforms of the objects within the group),
+ * with the instancers' transforms then getting applied to these for all instances at once. 
+ *
+ * The matrices for the whole batch are stored as structure-of-arrays (i.e. one array for each of the 
+ * 16 elements), so that the loops doing the maths are simple enough for the compiler to vectorise.
+ */
+
+/* Multiply each matrix in batch by the same matrix: r[n] = a[n] * b
+ * NOTE: r and a must not be the same arrays
+ */
+static void deg_batch_mul_m4(float *r[16], float *const a[16], float b[4][4], int num)
+{
+	int i, j, n;
+	
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			float *r_ij = r[i * 4 + j];
+			const float *a_0j = a[j], *a_1j = a[4 + j], *a_2j = a[8 + j], *a_3j = a[12 + j];
+			const float b_i0 = b[i][0], b_i1 = b[i][1], b_i2 = b[i][2], b_i3 = b[i][3];
+			
+			for (n = 0; n < num; n++) {
+				r_ij[n] = b_i0 * a_0j[n] + b_i1 * a_1j[n] + b_i2 * a_2j[n] + b_i3 * a_3j[n];
+			}
+		}
+	}
+}
+
+/* Apply instancers' transforms to the transforms of everything in the subgraph, for all instances at once
+ * < base: evaluation of snapshot for the subgraph itself, where the objects' own transforms have been evaluated
+ * < insts: (num_insts) instances, all of which have evaluation states for the same snapshot
+ */
+static void deg_subgraph_batch_transforms(DepsgraphEvalState *base, DepsgraphInstance **insts, int num_insts,
+                                          float ofs_mat[4][4])
+{
+	const DepsgraphSnapshot *snapshot = base->snapshot;
+	const DepsgraphNodeTable *table = snapshot->table;
+	float *buffer = BLI_memarena_alloc(base->arena, sizeof(float) * 16 * 3 * num_insts);
+	float *inst_mat[16], *group_mat[16], *result[16];
+	int e, i, n;
+	
+	for (e = 0; e < 16; e++) {
+		inst_mat[e]  = buffer + (e) * num_insts;
+		group_mat[e] = buffer + (e + 16) * num_insts;
+		result[e]    = buffer + (e + 32) * num_insts;
+	}
+	
+	/* instancers' transforms, with group getting placed relative to its offset */
+	for (n = 0; n < num_insts; n++) {
+		const float *mat = &insts[n]->instancer->obmat[0][0];
+		
+		for (e = 0; e < 16; e++) {
+			inst_mat[e][n] = mat[e];
+		}
+	}
+	
+	deg_batch_mul_m4(group_mat, inst_mat, ofs_mat, num_insts);
+	
+	/* each object's transform, for each instance */
+	for (i = 0; i < table->num_nodes; i++) {
+		const DepsNode *node = snapshot->nodes[i];
+		const IDDepsNode *id_node;
+		Object *ob;
+		
+		if ((node == NULL) || (node->type != DEPSNODE_TYPE_TRANSFORM) || (snapshot->owners[i] == -1))
+			continue;
+		
+		id_node = (const IDDepsNode *)snapshot->nodes[snapshot->owners[i]];
+		if (GS(id_node->id->name) != ID_OB)
+			continue;
+		
+		ob = (Object *)id_node->id;
+		deg_batch_mul_m4(result, group_mat, ob->obmat, num_insts);
+		
+		/* results go into each instance's transform context */
+		for (n = 0; n < num_insts; n++) {
+			DEG_TransformContext *context = insts[n]->state->contexts[i];
+			float *mat = &context->matrix[0][0];
+			
+			for (e = 0; e < 16; e++) {
+				mat[e] = result[e][n];
+			}
+		}
+	}
+}
+
+/* Get evaluation state for subgraph's graph, reusing the existing one if the graph hasn't changed since it was made
+ * < state: existing state (or NULL), which gets freed if it can't be used anymore
+ */
+static DepsgraphEvalState *deg_subgraph_eval_state_ensure(SubgraphDepsNode *sgn, DepsgraphEvalState *state,
+                                                          eEvaluationContextType context_type,
+                                                          const DEG_OperationsContext *master)
+{
+	int i;
+	
+	if (state && ((state->snapshot != sgn->graph->snapshot) || (state->context_type != (int)context_type))) {
+		DEG_eval_state_free(state);
+		state = NULL;
+	}
+	
+	if (state == NULL) {
+		state = deg_eval_state_new_ex(sgn->graph, context_type, master);
+	}
+	else {
+		deg_eval_state_sync(state, master);
+	}
+	
+	/* everything needs evaluating, as it all gets evaluated in a different space than before */
+	for (i = 0; i < state->snapshot->table->num_nodes; i++) {
+		state->flag[i] |= DEPSNODE_FLAG_NEEDS_UPDATE;
+	}
+	
+	return state;
+}
+
+/* Evaluate subgraph once for each of the given instances
+ * < instances: (DepsgraphInstance) instances to evaluate, which hold onto the states for their evaluations
+ * < r_base_state: state for evaluating what is the same for all instances (which gets reused in the same way)
+ */
+static void deg_subgraph_evaluate_ex(SubgraphDepsNode *sgn, ListBase *instances, DepsgraphEvalState **r_base_state,
+                                     eEvaluationContextType context_type, const DEG_OperationsContext *master)
+{
+	DepsgraphInstance *inst, **insts;
+	DepsgraphEvalState *base;
+	Group *group = (sgn->root_id && (GS(sgn->root_id->name) == ID_GR)) ? (Group *)sgn->root_id : NULL;
+	float ofs_mat[4][4];
+	int num_insts, n, i;
+	
+	num_insts = BLI_countlist(instances);
+	if ((sgn->graph == NULL) || (num_insts == 0))
+		return;
+	
+	/* group gets placed relative to its offset */
+	unit_m4(ofs_mat);
+	if (group) {
+		translate_m4(ofs_mat, -group->dupli_ofs[0], -group->dupli_ofs[1], -group->dupli_ofs[2]);
+	}
+	
+	/* evaluate transforms of objects within group - these are the same for all instances
+	 * NOTE: everything the transforms depend on (i.e. animation, drivers, bones, geometry
+	 *       of vertex parents) has to be evaluated first, otherwise they'd be out of date
+	 */
+	base = *r_base_state = deg_subgraph_eval_state_ensure(sgn, *r_base_state, context_type, master);
+	
+	if (base->only_nodes == NULL) {
+		base->only_nodes = MEM_mallocN(sizeof(bool) * MAX2(base->snapshot->table->num_nodes, 1), "Subgraph Upstream");
+		deg_snapshot_find_upstream(base->snapshot, DEPSNODE_TYPE_OP_TRANSFORM, base->only_nodes);
+	}
+	
+	deg_evaluate_state_ex(base, -1);
+	
+	/* prepare evaluation for each instance 
+	 * NOTE: all instances share the same snapshot of the subgraph, so it only gets copied once
+	 */
+	insts = BLI_memarena_alloc(base->arena, sizeof(DepsgraphInstance *) * num_insts);
+	
+	for (inst = instances->first, n = 0; inst; inst = inst->next, n++) {
+		DepsgraphEvalState *state = deg_subgraph_eval_state_ensure(sgn, inst->state, context_type, master);
+		
+		BLI_assert(state->snapshot == base->snapshot);
+		
+		for (i = 0; i < state->snapshot->table->num_nodes; i++) {
+			if (state->contexts[i]) {
+				((DEG_OperationsContext *)state->contexts[i])->flag |= DEG_OPCONTEXT_FLAG_INSTANCE;
+			}
+		}
+		
+		inst->state = state;
+		insts[n] = inst;
+	}
+	
+	/* transforms for all instances */
+	deg_subgraph_batch_transforms(base, insts, num_insts, ofs_mat);
+	
+	/* everything else gets evaluated for each instance in turn 
+	 * (including what the transforms depended on, as other things may depend on it too)
+	 */
+	for (n = 0; n < num_insts; n++) {
+		deg_evaluate_state_ex(insts[n]->state, DEPSNODE_TYPE_OP_TRANSFORM);
+	}
+	
+	/* done with the batch */
+	BLI_memarena_clear(base->arena);
+}
+
+/* Evaluate subgraph once for each of its instances, with their own evaluation contexts
+ * NOTE: the evaluations of each instance are kept until it gets evaluated again (and reused then
+ *       if the subgraph hasn't changed), so that the results can be used to draw/render the instance
+ */
+void DEG_subgraph_evaluate_instances(SubgraphDepsNode *sgn, eEvaluationContextType context_type,
+                                     const DEG_OperationsContext *master)
+{
+	deg_subgraph_evaluate_ex(sgn, &sgn->instances, &sgn->base_state, context_type, master);
+}
+
+/* Evaluation of subgraph node in snapshot
+ * NOTE: the subgraph node may be shared by several evaluations of the snapshot, 
+ *       so each of these keeps its own states for the instances
+ */
+static void deg_exec_state_subgraph(DepsgraphEvalState *state, int index)
+{
+	SubgraphDepsNode *sgn = (SubgraphDepsNode *)state->snapshot->nodes[index];
+	DepsgraphSubgraphEval *sub = state->subgraphs[index];
+	
+	if (sub == NULL) {
+		DepsgraphInstance *inst;
+		
+		sub = MEM_callocN(sizeof(DepsgraphSubgraphEval), "DepsgraphSubgraphEval");
+		
+		for (inst = sgn->instances.first; inst; inst = inst->next) {
+			DepsgraphInstance *sub_inst = MEM_callocN(sizeof(DepsgraphInstance), "DepsgraphInstance (Evaluation)");
+			
+			sub_inst->instancer = inst->instancer;
+			BLI_addtail(&sub->instances, sub_inst);
+		}
+		
+		state->subgraphs[index] = sub;
+	}
+	
+	deg_subgraph_evaluate_ex(sgn, &sub->instances, &sub->base_state, state->context_type, state->master);
+}
+
+/* *************************************************** */
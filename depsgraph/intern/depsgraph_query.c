@@ -42,6 +42,7 @@
 #include "DNA_scene_types.h"
 #include "DNA_sequence_types.h"
 
+#include "BKE_action.h"
 #include "BKE_depsgraph.h"
 #include "BKE_depsgraph_query.h"
 
@@ -115,7 +116,10 @@ void DEG_graph_traverse_from_node(Depsgraph *graph, DepsNode *start_node,
 }
 
 /* ************************************************ */
-/* Filtering API - Basically, making a copy of the existing graph */
+/* Filtering API - Making a copy of the existing graph
+ * NOTE: filtering itself is done using views (see DEG_graph_filter()),
+ *       with this only being needed for making standalone copies of these
+ */
 
 /* Create filtering context */
 // TODO: allow passing in a number of criteria?
@@ -170,6 +174,9 @@ DepsNode *DEG_copy_node(DepsgraphCopyContext *dcc, const DepsNode *src)
 	dst = DEG_create_node(src->type);
 	memcpy(dst, src, nti->size);
 	
+	/* copy gets allocated by itself, even if src wasn't */
+	dst->flag &= ~DEPSNODE_FLAG_IN_ARENA;
+	
 	/* add this node-pair to the hash... */
 	BLI_ghash_insert(dcc->nodes_hash, (DepsNode *)src, dst);
 	
@@ -232,53 +239,104 @@ DepsRelation *DEG_copy_relation(const DepsRelation *src)
  * (i.e. mainly for use when constructing graph)
  */
 
-/* helper for finding inner nodes by their names */
-static DepsNode *deg_find_inner_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
-                                     eDepsNode_Type component_type, eDepsNode_Type type, 
-                                     const char name[DEG_MAX_ID_NAME])
+/* Find operation node within the given component */
+DepsNode *DEG_component_find_operation(const ComponentDepsNode *component, eDepsNode_Type type, 
+                                       const char name[DEG_MAX_ID_NAME], const void *handle)
 {
-	ComponentDepsNode *component = (ComponentDepsNode *)DEG_find_node(graph, id, subdata, component_type, NULL);
+	DepsOperationKey key;
 	
-	if (component) {
-		/* lookup node with matching name... */
-		DepsNode *node = BLI_ghash_lookup(component->op_hash, name);
-		
-		if (node) {
-			/* make sure type matches too... just in case */
-			BLI_assert(node->type == type);
-			return node;
-		}
+	if (component == NULL)
+		return NULL;
+	
+	/* unnamed operations get identified by the name of their type */
+	if ((name == NULL) || (name[0] == '\0')) {
+		const DepsNodeTypeInfo *nti = DEG_get_node_typeinfo(type);
+		name = (nti) ? nti->name : NULL;
 	}
 	
-	/* no match... */
-	return NULL;
+	/* if the name isn't in the registry, there can't be any operations using it 
+	 * NOTE: this doesn't intern the name, to avoid filling up the registry with junk from failed lookups
+	 */
+	key.name = DEG_name_find_interned(name);
+	if (key.name == NULL)
+		return NULL;
+	
+	key.handle = handle;
+	key.type = type;
+	
+	return BLI_ghash_lookup(component->op_hash, &key);
 }
 
 /* helper for finding bone component nodes by their names */
-static DepsNode *deg_find_bone_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
-                                    eDepsNode_Type type, const char name[DEG_MAX_ID_NAME])
+static DepsNode *deg_find_bone_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME])
 {
 	PoseComponentDepsNode *pose_comp;
 	
 	pose_comp = (PoseComponentDepsNode *)DEG_find_node(graph, id, NULL, DEPSNODE_TYPE_EVAL_POSE, NULL);
-	if (pose_comp)  {
-		/* lookup bone component with matching name */
-		BoneComponentDepsNode *bone_node = BLI_ghash_lookup(pose_comp->bone_hash, subdata);
-		
-		if (type == DEPSNODE_TYPE_BONE) {
-			/* bone component is what we want */
-			return (DepsNode *)bone_node;
-		}
-		else if (type == DEPSNODE_TYPE_OP_BONE) {
-			/* now lookup relevant operation node */
-			return BLI_ghash_lookup(bone_node->op_hash, name);
-		}
+	if (pose_comp && subdata) {
+		/* bone components are keyed by the names of the bones they represent */
+		return BLI_ghash_lookup(pose_comp->bone_hash, subdata);
 	}
 	
 	/* no match */
 	return NULL;
 }
 
+/* Find matching operation node */
+DepsNode *DEG_find_operation(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
+                             eDepsNode_Type type, const char name[DEG_MAX_ID_NAME],
+                             const void *handle)
+{
+	DepsNode *component = NULL;
+	
+	/* find component that operation will live in */
+	switch (type) {
+		case DEPSNODE_TYPE_OP_PARAMETER:  /* Parameter Related Ops */
+		case DEPSNODE_TYPE_OP_UPDATE:     /* Updates */
+		case DEPSNODE_TYPE_OP_DRIVER:     /* Drivers */
+			component = DEG_find_node(graph, id, subdata, DEPSNODE_TYPE_PARAMETERS, NULL);
+			break;
+		case DEPSNODE_TYPE_OP_PROXY:      /* Proxy Ops */
+			component = DEG_find_node(graph, id, subdata, DEPSNODE_TYPE_PROXY, NULL);
+			break;
+		case DEPSNODE_TYPE_OP_TRANSFORM:  /* Transform Ops */
+			component = DEG_find_node(graph, id, subdata, DEPSNODE_TYPE_TRANSFORM, NULL);
+			break;
+		case DEPSNODE_TYPE_OP_ANIMATION:  /* Animation Ops */
+			component = DEG_find_node(graph, id, subdata, DEPSNODE_TYPE_ANIMATION, NULL);
+			break;
+		case DEPSNODE_TYPE_OP_GEOMETRY:   /* Geometry Ops */
+			component = DEG_find_node(graph, id, subdata, DEPSNODE_TYPE_GEOMETRY, NULL);
+			break;
+		case DEPSNODE_TYPE_OP_SEQUENCER:  /* Sequencer Ops */
+			component = DEG_find_node(graph, id, subdata, DEPSNODE_TYPE_SEQUENCER, NULL);
+			break;
+			
+		case DEPSNODE_TYPE_OP_POSE:       /* Pose Eval (Non-Bone Operations) */
+			component = DEG_find_node(graph, id, subdata, DEPSNODE_TYPE_EVAL_POSE, NULL);
+			break;
+		case DEPSNODE_TYPE_OP_BONE:       /* Bone */
+			component = deg_find_bone_node(graph, id, subdata);
+			break;
+			
+		case DEPSNODE_TYPE_OP_PARTICLE:  /* Particle System/Step */
+			component = DEG_find_node(graph, id, subdata, DEPSNODE_TYPE_EVAL_PARTICLES, NULL);
+			break;
+			
+		case DEPSNODE_TYPE_OP_RIGIDBODY: /* Rigidbody Sim */
+			component = DEG_find_node(graph, id, subdata, DEPSNODE_TYPE_TRANSFORM, NULL); // XXX: needs review
+			break;
+		
+		default:
+			/* Unhandled... */
+			printf("%s(): Unknown operation type %d\n", __func__, type);
+			break;
+	}
+	
+	/* lookup operation within that component */
+	return DEG_component_find_operation((ComponentDepsNode *)component, type, name, handle);
+}
+
 /* Find matching node */
 DepsNode *DEG_find_node(Depsgraph *graph, const ID *id, const char subdata[MAX_NAME],
                         eDepsNode_Type type, const char name[DEG_MAX_ID_NAME])
@@ -345,51 +403,26 @@ DepsNode *DEG_find_node(Depsgraph *graph, const ID *id, const char subdata[MAX_N
 		case DEPSNODE_TYPE_BONE:       /* Bone Component */
 		{
 			/* this will find the bone component */
-			result = deg_find_bone_node(graph, id, name, type, NULL);
+			result = deg_find_bone_node(graph, id, subdata);
 		}
 			break;
 		
 		/* "Inner" Nodes ---------------------------- */
 		
 		case DEPSNODE_TYPE_OP_PARAMETER:  /* Parameter Related Ops */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_PARAMETERS, type, name);
-			break;
 		case DEPSNODE_TYPE_OP_PROXY:      /* Proxy Ops */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_PROXY, type, name);
-			break;
 		case DEPSNODE_TYPE_OP_TRANSFORM:  /* Transform Ops */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_TRANSFORM, type, name);
-			break;
 		case DEPSNODE_TYPE_OP_ANIMATION:  /* Animation Ops */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_ANIMATION, type, name);
-			break;
 		case DEPSNODE_TYPE_OP_GEOMETRY:   /* Geometry Ops */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_GEOMETRY, type, name);
-			break;
 		case DEPSNODE_TYPE_OP_SEQUENCER:  /* Sequencer Ops */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_SEQUENCER, type, name);
-			break;
-			
 		case DEPSNODE_TYPE_OP_UPDATE:     /* Updates */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_PARAMETERS, type, name);
-			break;
 		case DEPSNODE_TYPE_OP_DRIVER:     /* Drivers */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_PARAMETERS, type, name);
-			break;
-			
 		case DEPSNODE_TYPE_OP_POSE:       /* Pose Eval (Non-Bone Operations) */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_EVAL_POSE, type, name);
-			break;
 		case DEPSNODE_TYPE_OP_BONE:       /* Bone */
-			result = deg_find_bone_node(graph, id, subdata, type, name);
-			break;
-			
-		case DEPSNODE_TYPE_OP_PARTICLE:  /* Particle System/Step */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_EVAL_PARTICLES, type, name);
-			break;
-			
-		case DEPSNODE_TYPE_OP_RIGIDBODY: /* Rigidbody Sim */
-			result = deg_find_inner_node(graph, id, subdata, DEPSNODE_TYPE_TRANSFORM, type, name); // XXX: needs review
+		case DEPSNODE_TYPE_OP_PARTICLE:   /* Particle System/Step */
+		case DEPSNODE_TYPE_OP_RIGIDBODY:  /* Rigidbody Sim */
+			/* operations are looked up using their keys (with no specific data handle) */
+			result = DEG_find_operation(graph, id, subdata, type, name, NULL);
 			break;
 		
 		default:
@@ -454,7 +487,558 @@ DepsNode *DEG_find_node_from_pointer(Depsgraph *graph, const PointerRNA *ptr, co
 	return DEG_find_node(graph, id, subdata, type, name);
 }
 
+/* ************************************************ */
+/* Topology Queries (Direct) */
+
+/* Start going over nodes directly linked to node */
+void DEG_node_relations_iter_begin(DepsNodeRelationsIterator *iter, const DepsNode *node, 
+                                   const bool outgoing, const int type)
+{
+	iter->link = (outgoing) ? node->outlinks.first : node->inlinks.first;
+	iter->outgoing = outgoing;
+	iter->type = type;
+}
+
+/* Get next linked node */
+DepsNode *DEG_node_relations_iter_next(DepsNodeRelationsIterator *iter, DepsRelation **r_rel)
+{
+	while (iter->link) {
+		DepsRelation *rel = (DepsRelation *)iter->link->data;
+		iter->link = iter->link->next;
+		
+		if ((iter->type == DEG_RELATION_TYPE_ANY) || (rel->type == iter->type)) {
+			if (r_rel) *r_rel = rel;
+			return (iter->outgoing) ? rel->to : rel->from;
+		}
+	}
+	
+	if (r_rel) *r_rel = NULL;
+	return NULL;
+}
+
+/* Stop going over linked nodes */
+void DEG_node_relations_iter_end(DepsNodeRelationsIterator *iter)
+{
+	iter->link = NULL;
+}
+
+/* Add all nodes linked to node to list */
+static void deg_node_get_linked(ListBase *result, const DepsNode *node, const bool outgoing)
+{
+	DepsNodeRelationsIterator iter;
+	DepsNode *other;
+	
+	DEG_node_relations_iter_begin(&iter, node, outgoing, DEG_RELATION_TYPE_ANY);
+	while ((other = DEG_node_relations_iter_next(&iter, NULL))) {
+		BLI_addtail(result, BLI_genericNodeN(other));
+	}
+	DEG_node_relations_iter_end(&iter);
+}
+
+/* Get list of nodes which directly depend on given node */
+void DEG_node_get_children(ListBase *result, const DepsNode *node)
+{
+	deg_node_get_linked(result, node, true);
+}
+
+/* Get list of nodes which given node directly depends on */
+void DEG_node_get_dependencies(ListBase *result, const DepsNode *node)
+{
+	deg_node_get_linked(result, node, false);
+}
+
+/* ************************************************ */
+/* Subgraph Views */
+
+/* Create a new (empty) view of the nodes in graph */
+static DepsgraphView *deg_view_new(Depsgraph *graph)
+{
+	DepsgraphView *view = MEM_callocN(sizeof(DepsgraphView), "DepsgraphView");
+	
+	view->graph = graph;
+	view->table = DEG_graph_node_table_ensure(graph);
+	
+	view->num_words = DEG_BITSET_NUM_WORDS(view->table->num_nodes);
+	view->members = MEM_callocN(sizeof(uint64_t) * MAX2(view->num_words, 1), "DepsgraphView members");
+	
+	return view;
+}
+
+/* Create view of all nodes that can be reached from given node, by following its links in one direction
+ * NOTE: cyclic relations aren't followed, as they're also ignored when evaluating
+ */
+static DepsgraphView *deg_view_from_links(Depsgraph *graph, const DepsNode *node, const bool downstream)
+{
+	DepsgraphView *view = deg_view_new(graph);
+	const DepsgraphNodeTable *table = view->table;
+	const int *offsets       = (downstream) ? table->out_offsets : table->in_offsets;
+	const int *targets       = (downstream) ? table->out_targets : table->in_targets;
+	DepsRelation **rels      = (downstream) ? table->out_rels    : table->in_rels;
+	int start = DEG_node_table_index(table, node);
+	int *queue;
+	int head = 0, tail = 0;
+	
+	if (start == -1)
+		return view;
+	
+	/* breadth-first search - each node only gets added to the queue once, so there's room for all of them */
+	queue = MEM_mallocN(sizeof(int) * table->num_nodes, "DepsgraphView queue");
+	queue[tail++] = start;
+	
+	while (head < tail) {
+		int i = queue[head++];
+		int j;
+		
+		for (j = offsets[i]; j < offsets[i + 1]; j++) {
+			int target = targets[j];
+			
+			if ((rels[j]->flag & DEPSREL_FLAG_CYCLIC) == 0 && 
+			    (target != start) && !DEG_BITSET_TEST(view->members, target))
+			{
+				DEG_BITSET_ENABLE(view->members, target);
+				view->num_nodes++;
+				
+				queue[tail++] = target;
+			}
+		}
+	}
+	
+	MEM_freeN(queue);
+	return view;
+}
+
+/* Get all descendents of a node */
+DepsgraphView *DEG_node_get_descendents(Depsgraph *graph, const DepsNode *node)
+{
+	return deg_view_from_links(graph, node, true);
+}
+
+/* Get all ancestors of a node */
+DepsgraphView *DEG_node_get_ancestors(Depsgraph *graph, const DepsNode *node)
+{
+	return deg_view_from_links(graph, node, false);
+}
+
+/* View Access ------------------------------------ */
+
+/* Get number of nodes in view */
+size_t DEG_view_num_nodes(const DepsgraphView *view)
+{
+	return view->num_nodes;
+}
+
+/* Check if node is part of view */
+bool DEG_view_has_node(const DepsgraphView *view, const DepsNode *node)
+{
+	int index = DEG_node_table_index(view->table, node);
+	return (index != -1) && DEG_BITSET_TEST(view->members, index);
+}
+
+/* Start iterating over the nodes in view */
+void DEG_view_iter_init(DepsgraphViewIterator *iter, const DepsgraphView *view)
+{
+	iter->view = view;
+	iter->word = 0;
+	iter->bits = (view->num_words) ? view->members[0] : 0;
+}
+
+/* Get next node in view */
+DepsNode *DEG_view_iter_step(DepsgraphViewIterator *iter)
+{
+	const DepsgraphView *view = iter->view;
+	int index;
+	
+	/* skip over empty parts of the bitset */
+	while (iter->bits == 0) {
+		if (++iter->word >= view->num_words)
+			return NULL;
+		
+		iter->bits = view->members[iter->word];
+	}
+	
+	/* take lowest remaining bit */
+	index = (iter->word * 64) + DEG_bitset_lowest_bit(iter->bits);
+	iter->bits &= iter->bits - 1;
+	
+	return view->table->nodes[index];
+}
+
+/* Check whether the link at the given index in the view's node table can be followed 
+ * NOTE: the node that link comes from must already be known to be in the view
+ */
+static bool deg_view_link_is_used(const DepsgraphView *view, int link)
+{
+	const DepsgraphNodeTable *table = view->table;
+	
+	if (view->links) {
+		return DEG_BITSET_TEST(view->links, link);
+	}
+	else {
+		return ((table->out_rels[link]->flag & DEPSREL_FLAG_CYCLIC) == 0) &&
+		       DEG_BITSET_TEST(view->members, table->out_targets[link]);
+	}
+}
+
+/* Free view */
+void DEG_view_free(DepsgraphView *view)
+{
+	if (view->links) {
+		MEM_freeN(view->links);
+	}
+	MEM_freeN(view->members);
+	MEM_freeN(view);
+}
+
+/* Filtering -------------------------------------- */
+
+/* Filter the given graph, to get the nodes which fulfill the criteria */
+DepsgraphView *DEG_graph_filter(Depsgraph *graph, DEG_FilterPredicate filter, void *userdata)
+{
+	DepsgraphView *view = deg_view_new(graph);
+	const DepsgraphNodeTable *table = view->table;
+	int i, j;
+	
+	/* nodes which match */
+	for (i = 0; i < table->num_nodes; i++) {
+		if ((filter == NULL) || filter(graph, table->nodes[i], userdata)) {
+			DEG_BITSET_ENABLE(view->members, i);
+			view->num_nodes++;
+		}
+	}
+	
+	/* relations between them - worked out once here, so that traversing the view doesn't need to check both ends */
+	view->links = MEM_callocN(sizeof(uint64_t) * MAX2(DEG_BITSET_NUM_WORDS(table->num_rels), 1), "DepsgraphView links");
+	
+	for (i = 0; i < table->num_nodes; i++) {
+		if (DEG_BITSET_TEST(view->members, i) == false)
+			continue;
+		
+		for (j = table->out_offsets[i]; j < table->out_offsets[i + 1]; j++) {
+			if (((table->out_rels[j]->flag & DEPSREL_FLAG_CYCLIC) == 0) &&
+			    DEG_BITSET_TEST(view->members, table->out_targets[j]))
+			{
+				DEG_BITSET_ENABLE(view->links, j);
+			}
+		}
+	}
+	
+	return view;
+}
+
+/* Traversal -------------------------------------- */
+
+/* Traverse nodes in view in evaluation order
+ * NOTE: the number of links each node is still waiting on is stored here instead of 
+ *       in the nodes, so that traversing one view doesn't disturb any others
+ */
+void DEG_view_traverse(const DepsgraphView *view, DEG_NodeOperation op, void *op_data)
+{
+	const DepsgraphNodeTable *table;
+	int *valency, *queue;
+	int head = 0, tail = 0;
+	int i, j;
+	
+	if (ELEM(NULL, view, op) || (view->num_nodes == 0))
+		return;
+	
+	table = view->table;
+	
+	valency = MEM_callocN(sizeof(int) * table->num_nodes, "DEG_view_traverse() valency");
+	queue = MEM_mallocN(sizeof(int) * table->num_nodes, "DEG_view_traverse() queue");
+	
+	/* count links that each node depends on */
+	DEG_VIEW_ITER_BEGIN(view, node)
+	{
+		i = DEG_node_table_index(table, node);
+		
+		for (j = table->out_offsets[i]; j < table->out_offsets[i + 1]; j++) {
+			if (deg_view_link_is_used(view, j)) {
+				valency[table->out_targets[j]]++;
+			}
+		}
+	}
+	DEG_VIEW_ITER_END
+	
+	/* start from nodes which don't depend on anything else in the view */
+	DEG_VIEW_ITER_BEGIN(view, node)
+	{
+		i = DEG_node_table_index(table, node);
+		
+		if (valency[i] == 0) {
+			queue[tail++] = i;
+		}
+	}
+	DEG_VIEW_ITER_END
+	
+	/* visit each node once everything it depends on has been visited */
+	while (head < tail) {
+		i = queue[head++];
+		
+		if (op(view->graph, table->nodes[i], op_data))
+			break;
+		
+		for (j = table->out_offsets[i]; j < table->out_offsets[i + 1]; j++) {
+			if (deg_view_link_is_used(view, j)) {
+				int target = table->out_targets[j];
+				
+				if (--valency[target] == 0) {
+					queue[tail++] = target;
+				}
+			}
+		}
+	}
+	
+	MEM_freeN(valency);
+	MEM_freeN(queue);
+}
+
+/* Traverse nodes in graph which are deemed relevant */
+void DEG_graph_traverse(Depsgraph *graph,
+                        DEG_FilterPredicate filter, void *filter_data,
+                        DEG_NodeOperation op, void *op_data)
+{
+	DepsgraphView *view;
+	
+	/* sanity check - nothing to do without an operation to perform */
+	if (ELEM(NULL, graph, op))
+		return;
+	
+	view = DEG_graph_filter(graph, filter, filter_data);
+	DEG_view_traverse(view, op, op_data);
+	DEG_view_free(view);
+}
+
+/* Materialising ---------------------------------- */
+
+/* Make a standalone copy of the nodes in view */
+Depsgraph *DEG_view_materialise(const DepsgraphView *view)
+{
+	return DEG_graph_copy_ex(view->graph, view, NULL, NULL);
+}
+
 /* ************************************************ */
 /* Querying API */
 
+/* NOTE: these are answered using the graph's reachability index, 
+ * which only needs rebuilding after the relations in the graph change
+ */
+
+/* Add IDs directly linked to the given one to the list */
+static size_t deg_query_direct_ids(const DepsgraphReachability *reach, const int *offsets, const int *targets,
+                                   int index, ListBase *result)
+{
+	int i;
+	
+	for (i = offsets[index]; i < offsets[index + 1]; i++) {
+		BLI_addtail(result, BLI_genericNodeN(DEG_reachability_get_id(reach, targets[i])));
+	}
+	
+	return (size_t)(offsets[index + 1] - offsets[index]);
+}
+
+/* Add IDs which the given one is linked to, either directly or not, to the list
+ * < downstream: whether to look for descendants or ancestors
+ */
+static size_t deg_query_reachable_ids(const DepsgraphReachability *reach, bool downstream, 
+                                      int index, ListBase *result)
+{
+	const int c = reach->comp_of[index];
+	uint64_t *bits = MEM_callocN(sizeof(uint64_t) * MAX2(reach->num_words, 1), "deg_query_reachable_ids bits");
+	size_t count;
+	
+	DEG_reachability_comp_bits(reach, downstream, c, bits);
+	
+	/* other IDs in the same cycle depend on this one as much as it does on them */
+	DEG_BITSET_ENABLE(bits, c);
+	
+	count = DEG_reachability_bits_to_list(reach, bits, index, result);
+	MEM_freeN(bits);
+	
+	return count;
+}
+
+/* Get ID-blocks which would be affected if specified ID is modified */
+size_t DEG_query_affected_ids(Depsgraph *graph, ListBase *result, const ID *id, const bool only_direct)
+{
+	DepsgraphReachability *reach;
+	int index;
+	
+	if (ELEM3(NULL, graph, result, id))
+		return 0;
+	
+	reach = DEG_graph_reachability_ensure(graph);
+	index = DEG_reachability_id_index(reach, id);
+	if (index == -1)
+		return 0;
+	
+	if (only_direct)
+		return deg_query_direct_ids(reach, reach->out_offsets, reach->out_targets, index, result);
+	else
+		return deg_query_reachable_ids(reach, true, index, result);
+}
+
+/* Get ID-blocks which are needed to update/evaluate specified ID */
+size_t DEG_query_required_ids(Depsgraph *graph, ListBase *result, const ID *id, const bool only_direct)
+{
+	DepsgraphReachability *reach;
+	int index;
+	
+	if (ELEM3(NULL, graph, result, id))
+		return 0;
+	
+	reach = DEG_graph_reachability_ensure(graph);
+	index = DEG_reachability_id_index(reach, id);
+	if (index == -1)
+		return 0;
+	
+	if (only_direct)
+		return deg_query_direct_ids(reach, reach->in_offsets, reach->in_targets, index, result);
+	else
+		return deg_query_reachable_ids(reach, false, index, result);
+}
+
+/* Batch Queries ---------------------------------- */
+
+/* Propagate a batch of (up to 64) ID-blocks through the graph at once,
+ * with each bit in a component's label standing for one of the ID-blocks
+ * in the batch. Going over the components in topological order (or the reverse,
+ * when looking upstream), each component passes its label on to the ones 
+ * linked to it, so after one pass, each label says which of the batch's
+ * ID-blocks can reach that component.
+ */
+static void deg_query_batch_propagate(const DepsgraphReachability *reach, uint64_t *labels, const bool downstream)
+{
+	const int *offsets = (downstream) ? reach->out_offsets : reach->in_offsets;
+	const int *targets = (downstream) ? reach->out_targets : reach->in_targets;
+	int n;
+	
+	for (n = 0; n < reach->num_comps; n++) {
+		const int c = (downstream) ? n : (reach->num_comps - 1 - n);
+		const uint64_t label = labels[c];
+		int m, j;
+		
+		if (label == 0)
+			continue;
+		
+		for (m = reach->comp_offsets[c]; m < reach->comp_offsets[c + 1]; m++) {
+			int i = reach->comp_members[m];
+			
+			for (j = offsets[i]; j < offsets[i + 1]; j++) {
+				labels[reach->comp_of[targets[j]]] |= label;
+			}
+		}
+	}
+}
+
+/* Shared implementation for batch queries */
+static void deg_query_ids_batch(Depsgraph *graph, ListBase *results, const ID **ids, const int num_ids,
+                                const bool only_direct, const bool downstream)
+{
+	DepsgraphReachability *reach;
+	int *indices;
+	uint64_t *labels;
+	int start, i;
+	
+	if (ELEM3(NULL, graph, results, ids) || (num_ids <= 0))
+		return;
+	
+	reach = DEG_graph_reachability_ensure(graph);
+	
+	/* look up ID-blocks */
+	indices = MEM_mallocN(sizeof(int) * num_ids, "DEG_query_ids_batch() indices");
+	for (i = 0; i < num_ids; i++) {
+		indices[i] = (ids[i]) ? DEG_reachability_id_index(reach, ids[i]) : -1;
+	}
+	
+	/* direct links can just be read off */
+	if (only_direct) {
+		for (i = 0; i < num_ids; i++) {
+			if (indices[i] != -1) {
+				if (downstream)
+					deg_query_direct_ids(reach, reach->out_offsets, reach->out_targets, indices[i], &results[i]);
+				else
+					deg_query_direct_ids(reach, reach->in_offsets, reach->in_targets, indices[i], &results[i]);
+			}
+		}
+		
+		MEM_freeN(indices);
+		return;
+	}
+	
+	/* everything else gets done 64 at a time */
+	labels = MEM_mallocN(sizeof(uint64_t) * MAX2(reach->num_comps, 1), "DEG_query_ids_batch() labels");
+	
+	for (start = 0; start < num_ids; start += 64) {
+		const int end = MIN2(start + 64, num_ids);
+		int c;
+		
+		memset(labels, 0, sizeof(uint64_t) * reach->num_comps);
+		
+		/* each ID-block starts off in its own component (along with anything else it forms a cycle with) */
+		for (i = start; i < end; i++) {
+			if (indices[i] != -1) {
+				labels[reach->comp_of[indices[i]]] |= ((uint64_t)1 << (i - start));
+			}
+		}
+		
+		deg_query_batch_propagate(reach, labels, downstream);
+		
+		/* write out results - going over components in order, so that each list ends up in evaluation order */
+		for (c = 0; c < reach->num_comps; c++) {
+			uint64_t label = labels[c];
+			
+			while (label) {
+				int s = start + DEG_bitset_lowest_bit(label);
+				int m;
+				
+				for (m = reach->comp_offsets[c]; m < reach->comp_offsets[c + 1]; m++) {
+					int member = reach->comp_members[m];
+					
+					if (member != indices[s]) {
+						BLI_addtail(&results[s], BLI_genericNodeN(DEG_reachability_get_id(reach, member)));
+					}
+				}
+				
+				label &= label - 1;
+			}
+		}
+	}
+	
+	MEM_freeN(labels);
+	MEM_freeN(indices);
+}
+
+/* Get ID-blocks which would be affected if each of the specified ID's is modified */
+void DEG_query_affected_ids_batch(Depsgraph *graph, ListBase *results, const ID **ids, const int num_ids,
+                                  const bool only_direct)
+{
+	deg_query_ids_batch(graph, results, ids, num_ids, only_direct, true);
+}
+
+/* Get ID-blocks which are needed to update/evaluate each of the specified ID's */
+void DEG_query_required_ids_batch(Depsgraph *graph, ListBase *results, const ID **ids, const int num_ids,
+                                  const bool only_direct)
+{
+	deg_query_ids_batch(graph, results, ids, num_ids, only_direct, false);
+}
+
+/* Check whether an ID-block would be affected if another one is modified */
+bool DEG_query_id_is_affected_by(Depsgraph *graph, const ID *id, const ID *modified_id)
+{
+	DepsgraphReachability *reach;
+	int from, to;
+	
+	if (ELEM3(NULL, graph, id, modified_id))
+		return false;
+	
+	reach = DEG_graph_reachability_ensure(graph);
+	from = DEG_reachability_id_index(reach, modified_id);
+	to = DEG_reachability_id_index(reach, id);
+	
+	if ((from == -1) || (to == -1))
+		return false;
+	
+	return DEG_reachability_test(reach, from, to);
+}
+
 /* ************************************************ */
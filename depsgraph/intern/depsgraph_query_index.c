@@ -0,0 +1,749 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2013 Blender Foundation.
+ * All rights reserved.
+ *
+ * Original Author: Joshua Leung
+ * Contributor(s): None Yet
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ *
+ * Indices for Querying Depsgraphs
+ *
+ * Editors keep asking which ID-blocks are affected by (or needed by) some
+ * ID-block, e.g. to figure out what needs redrawing. Instead of traversing
+ * the graph each time, the relations between ID-blocks get boiled down into
+ * an index which can answer these directly, and which only gets rebuilt
+ * (the next time it's needed) after the relations in the graph change.
+ *
+ * Node-level queries (e.g. descendants of a node) are done using a flat 
+ * snapshot of the graph instead, which gets rebuilt in the same way.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MEM_guardedalloc.h"
+
+#include "BLI_blenlib.h"
+#include "BLI_ghash.h"
+#include "BLI_utildefines.h"
+
+#include "DNA_ID.h"
+
+#include "BKE_depsgraph.h"
+
+#include "depsgraph_types.h"
+#include "depsgraph_intern.h"
+
+/* ************************************************** */
+/* Index Building */
+
+/* The index is built in several steps:
+ * 1) The relations between nodes get collapsed down into links between the
+ *    ID nodes (or subgraphs) that they belong to, stored as flat arrays.
+ * 2) ID-blocks which depend on each other (i.e. which are part of a cycle)
+ *    all affect each other, so these get grouped together into "components"
+ *    (the strongly connected components of the ID-level graph), with the
+ *    links between components forming a DAG.
+ * 3) For each component, the set of components downstream/upstream of it
+ *    is worked out (as a bitset), by going over them in topological order.
+ *
+ * NOTE: the bitsets take up (num_comps^2 / 4) bytes in total, so they only get
+ *       built for graphs with up to DEG_REACH_MAX_CLOSURE_COMPONENTS components.
+ *       Above that, queries search the component links instead (which only costs
+ *       as much as the part of the graph that gets visited).
+ */
+
+/* Most components that the transitive closure gets built for (i.e. 16 MB worth of bitsets) */
+#define DEG_REACH_MAX_CLOSURE_COMPONENTS   4096
+
+/* Growable array of ID indices */
+typedef struct DepsReachLinks {
+	int *data;
+	int num, alloc;
+} DepsReachLinks;
+
+/* Data used while collecting the links of an ID node */
+typedef struct DepsReachCollectData {
+	DepsgraphReachability *reach;
+	DepsReachLinks *links;       /* array that links get added to */
+	int *last_seen;              /* (num_ids) index of the last ID to link to each ID - for skipping duplicates */
+	int index;                   /* index of ID whose links are being collected */
+} DepsReachCollectData;
+
+/* Get the ID-block that an ID node (or subgraph) represents */
+static ID *deg_reach_id_node_get_id(const DepsNode *node)
+{
+	if (node->type == DEPSNODE_TYPE_ID_REF)
+		return ((IDDepsNode *)node)->id;
+	else if (node->type == DEPSNODE_TYPE_SUBGRAPH)
+		return ((SubgraphDepsNode *)node)->root_id;
+	else
+		return NULL;
+}
+
+/* Find index of the ID that a node belongs to
+ * > returns: -1 if node isn't part of any ID-block (e.g. root or time source)
+ */
+static int deg_reach_node_index(const DepsgraphReachability *reach, const DepsNode *node)
+{
+	/* walk up to the outermost node */
+	while (node && !ELEM(node->type, DEPSNODE_TYPE_ID_REF, DEPSNODE_TYPE_SUBGRAPH)) {
+		node = node->owner;
+	}
+	
+	if (node) {
+		ID *id = deg_reach_id_node_get_id(node);
+		
+		if (id) {
+			return DEG_reachability_id_index(reach, id);
+		}
+	}
+	
+	return -1;
+}
+
+/* Add a link to the array */
+static void deg_reach_links_add(DepsReachLinks *links, int index)
+{
+	if (links->num == links->alloc) {
+		links->alloc = (links->alloc) ? (links->alloc * 2) : 64;
+		links->data = (links->data) ? MEM_reallocN(links->data, sizeof(int) * links->alloc)
+		                            : MEM_mallocN(sizeof(int) * links->alloc, "DepsReachLinks");
+	}
+	
+	links->data[links->num++] = index;
+}
+
+/* Callback for DEG_node_foreach_owned() - adds the ID-level links for the node's outgoing relations */
+static void deg_reach_collect_links_cb(DepsNode *node, void *userdata)
+{
+	DepsReachCollectData *data = (DepsReachCollectData *)userdata;
+	
+	DEPSNODE_RELATIONS_ITER_BEGIN(node->outlinks.first, rel)
+	{
+		/* cyclic relations are ignored when evaluating, so they don't cause anything to be affected either */
+		if ((rel->flag & DEPSREL_FLAG_CYCLIC) == 0) {
+			int target = deg_reach_node_index(data->reach, rel->to);
+			
+			/* links within the same ID-block don't matter here */
+			if ((target != -1) && (target != data->index) && (data->last_seen[target] != data->index)) {
+				data->last_seen[target] = data->index;
+				deg_reach_links_add(data->links, target);
+			}
+		}
+	}
+	DEPSNODE_RELATIONS_ITER_END;
+}
+
+/* 1) Collect links between ID-blocks */
+static void deg_reach_build_links(DepsgraphReachability *reach)
+{
+	DepsReachCollectData data = {NULL};
+	DepsReachLinks links = {NULL};
+	int *counts;
+	int i, j;
+	
+	data.reach = reach;
+	data.links = &links;
+	data.last_seen = MEM_mallocN(sizeof(int) * MAX2(reach->num_ids, 1), "DepsReach last_seen");
+	
+	for (i = 0; i < reach->num_ids; i++) {
+		data.last_seen[i] = -1;
+	}
+	
+	/* outgoing links - in ID order, so that these can be stored as offsets into the array */
+	reach->out_offsets = MEM_mallocN(sizeof(int) * (reach->num_ids + 1), "DepsReach out_offsets");
+	
+	for (i = 0; i < reach->num_ids; i++) {
+		reach->out_offsets[i] = links.num;
+		
+		data.index = i;
+		DEG_node_foreach_owned(reach->id_nodes[i], deg_reach_collect_links_cb, &data);
+	}
+	reach->out_offsets[reach->num_ids] = links.num;
+	
+	reach->out_targets = (links.data) ? links.data : MEM_callocN(sizeof(int), "DepsReach out_targets");
+	MEM_freeN(data.last_seen);
+	
+	/* incoming links - these are just the outgoing ones, flipped around */
+	reach->in_offsets = MEM_callocN(sizeof(int) * (reach->num_ids + 1), "DepsReach in_offsets");
+	reach->in_targets = MEM_mallocN(sizeof(int) * MAX2(links.num, 1), "DepsReach in_targets");
+	counts = MEM_callocN(sizeof(int) * MAX2(reach->num_ids, 1), "DepsReach counts");
+	
+	for (i = 0; i < links.num; i++) {
+		reach->in_offsets[reach->out_targets[i] + 1]++;
+	}
+	for (i = 0; i < reach->num_ids; i++) {
+		reach->in_offsets[i + 1] += reach->in_offsets[i];
+	}
+	
+	for (i = 0; i < reach->num_ids; i++) {
+		for (j = reach->out_offsets[i]; j < reach->out_offsets[i + 1]; j++) {
+			int target = reach->out_targets[j];
+			reach->in_targets[reach->in_offsets[target] + counts[target]++] = i;
+		}
+	}
+	
+	MEM_freeN(counts);
+}
+
+/* 2) Group ID-blocks into strongly connected components
+ * NOTE: this uses Tarjan's algorithm, with an explicit stack instead of recursion,
+ *       since the chains of dependencies in big scenes can get quite long
+ */
+static void deg_reach_build_components(DepsgraphReachability *reach)
+{
+	const int num_ids = reach->num_ids;
+	const int tot = MAX2(num_ids, 1);
+	int *order    = MEM_mallocN(sizeof(int) * tot, "DepsReach order");
+	int *lowlink  = MEM_mallocN(sizeof(int) * tot, "DepsReach lowlink");
+	int *stack    = MEM_mallocN(sizeof(int) * tot, "DepsReach stack");
+	int *call_id  = MEM_mallocN(sizeof(int) * tot, "DepsReach call_id");
+	int *call_link = MEM_mallocN(sizeof(int) * tot, "DepsReach call_link");
+	bool *on_stack = MEM_callocN(sizeof(bool) * tot, "DepsReach on_stack");
+	int counter = 0, num_comps = 0;
+	int i;
+	
+	reach->comp_of = MEM_mallocN(sizeof(int) * tot, "DepsReach comp_of");
+	
+	for (i = 0; i < num_ids; i++) {
+		order[i] = -1;
+	}
+	
+	for (i = 0; i < num_ids; i++) {
+		int sp = 0, csp = 0;
+		
+		if (order[i] != -1)
+			continue;
+		
+		/* start visiting from this ID */
+		order[i] = lowlink[i] = counter++;
+		stack[sp++] = i;
+		on_stack[i] = true;
+		
+		call_id[csp] = i;
+		call_link[csp] = reach->out_offsets[i];
+		csp++;
+		
+		while (csp) {
+			int v = call_id[csp - 1];
+			
+			if (call_link[csp - 1] < reach->out_offsets[v + 1]) {
+				/* follow next link */
+				int w = reach->out_targets[call_link[csp - 1]++];
+				
+				if (order[w] == -1) {
+					order[w] = lowlink[w] = counter++;
+					stack[sp++] = w;
+					on_stack[w] = true;
+					
+					call_id[csp] = w;
+					call_link[csp] = reach->out_offsets[w];
+					csp++;
+				}
+				else if (on_stack[w]) {
+					lowlink[v] = MIN2(lowlink[v], order[w]);
+				}
+			}
+			else {
+				/* all links followed - if this is the root of a component, pop it off */
+				if (lowlink[v] == order[v]) {
+					int w;
+					
+					do {
+						w = stack[--sp];
+						on_stack[w] = false;
+						reach->comp_of[w] = num_comps;
+					} while (w != v);
+					
+					num_comps++;
+				}
+				
+				csp--;
+				if (csp) {
+					int u = call_id[csp - 1];
+					lowlink[u] = MIN2(lowlink[u], lowlink[v]);
+				}
+			}
+		}
+	}
+	
+	MEM_freeN(order);
+	MEM_freeN(lowlink);
+	MEM_freeN(stack);
+	MEM_freeN(call_id);
+	MEM_freeN(call_link);
+	MEM_freeN(on_stack);
+	
+	/* components get found in reverse topological order - flip that, so that dependencies come first */
+	for (i = 0; i < num_ids; i++) {
+		reach->comp_of[i] = num_comps - 1 - reach->comp_of[i];
+	}
+	reach->num_comps = num_comps;
+	
+	/* members of each component */
+	reach->comp_offsets = MEM_callocN(sizeof(int) * (num_comps + 1), "DepsReach comp_offsets");
+	reach->comp_members = MEM_mallocN(sizeof(int) * tot, "DepsReach comp_members");
+	
+	for (i = 0; i < num_ids; i++) {
+		reach->comp_offsets[reach->comp_of[i] + 1]++;
+	}
+	for (i = 0; i < num_comps; i++) {
+		reach->comp_offsets[i + 1] += reach->comp_offsets[i];
+	}
+	
+	{
+		int *counts = MEM_callocN(sizeof(int) * MAX2(num_comps, 1), "DepsReach counts");
+		
+		for (i = 0; i < num_ids; i++) {
+			int c = reach->comp_of[i];
+			reach->comp_members[reach->comp_offsets[c] + counts[c]++] = i;
+		}
+		
+		MEM_freeN(counts);
+	}
+}
+
+/* 3) Work out which components can be reached from each component (and vice versa) */
+static void deg_reach_build_closure(DepsgraphReachability *reach)
+{
+	const int num_words = DEG_BITSET_NUM_WORDS(reach->num_comps);
+	const size_t size = sizeof(uint64_t) * num_words * MAX2(reach->num_comps, 1);
+	int c, m, j;
+	
+	reach->num_words = num_words;
+	
+	/* too big to store - queries will have to search the links instead */
+	if (reach->num_comps > DEG_REACH_MAX_CLOSURE_COMPONENTS) {
+		return;
+	}
+	
+	reach->descendants = MEM_callocN(size, "DepsReach descendants");
+	reach->ancestors = MEM_callocN(size, "DepsReach ancestors");
+	
+	/* descendants - everything downstream has already been done when going backwards */
+	for (c = reach->num_comps - 1; c >= 0; c--) {
+		uint64_t *bits = DEG_REACH_COMP_BITS(reach, reach->descendants, c);
+		
+		for (m = reach->comp_offsets[c]; m < reach->comp_offsets[c + 1]; m++) {
+			int i = reach->comp_members[m];
+			
+			for (j = reach->out_offsets[i]; j < reach->out_offsets[i + 1]; j++) {
+				int d = reach->comp_of[reach->out_targets[j]];
+				
+				if ((d != c) && !DEG_BITSET_TEST(bits, d)) {
+					const uint64_t *dbits = DEG_REACH_COMP_BITS(reach, reach->descendants, d);
+					int w;
+					
+					for (w = 0; w < num_words; w++) {
+						bits[w] |= dbits[w];
+					}
+					DEG_BITSET_ENABLE(bits, d);
+				}
+			}
+		}
+	}
+	
+	/* ancestors - same again, but the other way around */
+	for (c = 0; c < reach->num_comps; c++) {
+		uint64_t *bits = DEG_REACH_COMP_BITS(reach, reach->ancestors, c);
+		
+		for (m = reach->comp_offsets[c]; m < reach->comp_offsets[c + 1]; m++) {
+			int i = reach->comp_members[m];
+			
+			for (j = reach->in_offsets[i]; j < reach->in_offsets[i + 1]; j++) {
+				int a = reach->comp_of[reach->in_targets[j]];
+				
+				if ((a != c) && !DEG_BITSET_TEST(bits, a)) {
+					const uint64_t *abits = DEG_REACH_COMP_BITS(reach, reach->ancestors, a);
+					int w;
+					
+					for (w = 0; w < num_words; w++) {
+						bits[w] |= abits[w];
+					}
+					DEG_BITSET_ENABLE(bits, a);
+				}
+			}
+		}
+	}
+}
+
+/* Build reachability index for the current state of the graph */
+static DepsgraphReachability *deg_reach_build(Depsgraph *graph)
+{
+	DepsgraphReachability *reach = MEM_callocN(sizeof(DepsgraphReachability), "DepsgraphReachability");
+	GHashIterator hashIter;
+	int i = 0;
+	
+	/* index ID nodes */
+	reach->num_ids = BLI_ghash_size(graph->id_hash);
+	reach->id_nodes = MEM_mallocN(sizeof(DepsNode *) * MAX2(reach->num_ids, 1), "DepsReach id_nodes");
+	reach->id_index = BLI_ghash_ptr_new("DepsReach id_index");
+	
+	GHASH_ITER(hashIter, graph->id_hash) {
+		ID *id = BLI_ghashIterator_getKey(&hashIter);
+		
+		reach->id_nodes[i] = BLI_ghashIterator_getValue(&hashIter);
+		BLI_ghash_insert(reach->id_index, id, SET_INT_IN_POINTER(i + 1));
+		i++;
+	}
+	
+	/* links, components, closure */
+	deg_reach_build_links(reach);
+	deg_reach_build_components(reach);
+	deg_reach_build_closure(reach);
+	
+	return reach;
+}
+
+/* Free reachability index */
+static void deg_reach_free(DepsgraphReachability *reach)
+{
+	BLI_ghash_free(reach->id_index, NULL, NULL);
+	MEM_freeN(reach->id_nodes);
+	
+	MEM_freeN(reach->out_offsets);
+	MEM_freeN(reach->out_targets);
+	MEM_freeN(reach->in_offsets);
+	MEM_freeN(reach->in_targets);
+	
+	MEM_freeN(reach->comp_of);
+	MEM_freeN(reach->comp_offsets);
+	MEM_freeN(reach->comp_members);
+	
+	if (reach->descendants)
+		MEM_freeN(reach->descendants);
+	if (reach->ancestors)
+		MEM_freeN(reach->ancestors);
+	
+	MEM_freeN(reach);
+}
+
+/* ************************************************** */
+/* Node Table Building */
+
+/* Data used while collecting nodes */
+typedef struct DepsNodeTableCollectData {
+	DepsgraphNodeTable *table;
+	int alloc;                   /* number of nodes that there's room for */
+} DepsNodeTableCollectData;
+
+/* Callback for DEG_node_foreach_owned() - adds node to table */
+static void deg_node_table_collect_cb(DepsNode *node, void *userdata)
+{
+	DepsNodeTableCollectData *data = (DepsNodeTableCollectData *)userdata;
+	DepsgraphNodeTable *table = data->table;
+	
+	if (table->num_nodes == data->alloc) {
+		data->alloc = (data->alloc) ? (data->alloc * 2) : 256;
+		table->nodes = (table->nodes) ? MEM_reallocN(table->nodes, sizeof(DepsNode *) * data->alloc)
+		                              : MEM_mallocN(sizeof(DepsNode *) * data->alloc, "DepsgraphNodeTable nodes");
+	}
+	
+	BLI_ghash_insert(table->node_index, node, SET_INT_IN_POINTER(table->num_nodes + 1));
+	table->nodes[table->num_nodes++] = node;
+	
+	table->num_rels += BLI_countlist(&node->outlinks);
+}
+
+/* Build node table for the current state of the graph */
+static DepsgraphNodeTable *deg_node_table_build(Depsgraph *graph)
+{
+	DepsgraphNodeTable *table = MEM_callocN(sizeof(DepsgraphNodeTable), "DepsgraphNodeTable");
+	DepsNodeTableCollectData data = {NULL};
+	GHashIterator hashIter;
+	int *counts;
+	int i, j, k;
+	
+	/* nodes - root (and time source) first, then each ID-block in turn */
+	data.table = table;
+	table->node_index = BLI_ghash_ptr_new("DepsgraphNodeTable node_index");
+	
+	if (graph->root_node) {
+		DEG_node_foreach_owned(graph->root_node, deg_node_table_collect_cb, &data);
+	}
+	GHASH_ITER(hashIter, graph->id_hash) {
+		DEG_node_foreach_owned(BLI_ghashIterator_getValue(&hashIter), deg_node_table_collect_cb, &data);
+	}
+	
+	if (table->nodes == NULL) {
+		table->nodes = MEM_callocN(sizeof(DepsNode *), "DepsgraphNodeTable nodes");
+	}
+	
+	/* outgoing links */
+	table->out_offsets = MEM_mallocN(sizeof(int) * (table->num_nodes + 1), "DepsgraphNodeTable out_offsets");
+	table->out_targets = MEM_mallocN(sizeof(int) * MAX2(table->num_rels, 1), "DepsgraphNodeTable out_targets");
+	table->out_rels = MEM_mallocN(sizeof(DepsRelation *) * MAX2(table->num_rels, 1), "DepsgraphNodeTable out_rels");
+	
+	for (i = 0, k = 0; i < table->num_nodes; i++) {
+		table->out_offsets[i] = k;
+		
+		DEPSNODE_RELATIONS_ITER_BEGIN(table->nodes[i]->outlinks.first, rel)
+		{
+			int target = DEG_node_table_index(table, rel->to);
+			
+			/* relations to nodes outside the graph (i.e. those in subgraphs) can't be followed */
+			if (target != -1) {
+				table->out_targets[k] = target;
+				table->out_rels[k] = rel;
+				k++;
+			}
+		}
+		DEPSNODE_RELATIONS_ITER_END;
+	}
+	table->out_offsets[table->num_nodes] = k;
+	table->num_rels = k;
+	
+	/* incoming links - these are just the outgoing ones, flipped around */
+	table->in_offsets = MEM_callocN(sizeof(int) * (table->num_nodes + 1), "DepsgraphNodeTable in_offsets");
+	table->in_targets = MEM_mallocN(sizeof(int) * MAX2(table->num_rels, 1), "DepsgraphNodeTable in_targets");
+	table->in_rels = MEM_mallocN(sizeof(DepsRelation *) * MAX2(table->num_rels, 1), "DepsgraphNodeTable in_rels");
+	table->in_links = MEM_mallocN(sizeof(int) * MAX2(table->num_rels, 1), "DepsgraphNodeTable in_links");
+	counts = MEM_callocN(sizeof(int) * MAX2(table->num_nodes, 1), "DepsgraphNodeTable counts");
+	
+	for (i = 0; i < table->num_rels; i++) {
+		table->in_offsets[table->out_targets[i] + 1]++;
+	}
+	for (i = 0; i < table->num_nodes; i++) {
+		table->in_offsets[i + 1] += table->in_offsets[i];
+	}
+	
+	for (i = 0; i < table->num_nodes; i++) {
+		for (j = table->out_offsets[i]; j < table->out_offsets[i + 1]; j++) {
+			int target = table->out_targets[j];
+			int slot = table->in_offsets[target] + counts[target]++;
+			
+			table->in_targets[slot] = i;
+			table->in_rels[slot] = table->out_rels[j];
+			table->in_links[slot] = j;
+		}
+	}
+	
+	MEM_freeN(counts);
+	
+	return table;
+}
+
+/* Free node table */
+void DEG_node_table_free(DepsgraphNodeTable *table)
+{
+	BLI_ghash_free(table->node_index, NULL, NULL);
+	MEM_freeN(table->nodes);
+	
+	MEM_freeN(table->out_offsets);
+	MEM_freeN(table->out_targets);
+	MEM_freeN(table->out_rels);
+	MEM_freeN(table->in_offsets);
+	MEM_freeN(table->in_targets);
+	MEM_freeN(table->in_rels);
+	MEM_freeN(table->in_links);
+	
+	MEM_freeN(table);
+}
+
+/* ************************************************** */
+/* Internal API */
+
+/* Get reachability index for graph, (re)building it if the graph has changed since it was last used */
+DepsgraphReachability *DEG_graph_reachability_ensure(Depsgraph *graph)
+{
+	if (graph->reachability == NULL) {
+		graph->reachability = deg_reach_build(graph);
+	}
+	
+	return graph->reachability;
+}
+
+/* Get node table for graph, (re)building it if the graph has changed since it was last used */
+DepsgraphNodeTable *DEG_graph_node_table_ensure(Depsgraph *graph)
+{
+	if (graph->node_table == NULL) {
+		graph->node_table = deg_node_table_build(graph);
+	}
+	
+	return graph->node_table;
+}
+
+/* Tag query indices as being out of date, after relations/nodes have been added or removed */
+void DEG_graph_query_index_invalidate(Depsgraph *graph)
+{
+	if (graph->reachability) {
+		deg_reach_free(graph->reachability);
+		graph->reachability = NULL;
+	}
+	
+	if (graph->node_table) {
+		/* graph's snapshot is indexed using this, so it gets freed along with that */
+		if (graph->snapshot == NULL) {
+			DEG_node_table_free(graph->node_table);
+		}
+		graph->node_table = NULL;
+	}
+	
+	/* snapshot no longer matches graph either */
+	if (graph->snapshot) {
+		DEG_graph_snapshot_release(graph->snapshot);
+		graph->snapshot = NULL;
+	}
+}
+
+/* Get index of node in node table (or -1 if it isn't in the graph) */
+int DEG_node_table_index(const DepsgraphNodeTable *table, const DepsNode *node)
+{
+	return GET_INT_FROM_POINTER(BLI_ghash_lookup(table->node_index, node)) - 1;
+}
+
+/* Get index of ID-block in reachability index
+ * > returns: -1 if ID-block isn't in the graph
+ */
+int DEG_reachability_id_index(const DepsgraphReachability *reach, const ID *id)
+{
+	return GET_INT_FROM_POINTER(BLI_ghash_lookup(reach->id_index, id)) - 1;
+}
+
+/* Get ID-block at given index */
+ID *DEG_reachability_get_id(const DepsgraphReachability *reach, int index)
+{
+	return deg_reach_id_node_get_id(reach->id_nodes[index]);
+}
+
+/* Search the links between components for the ones reachable from component c,
+ * for when there's no transitive closure to look them up in
+ * < bits: (num_words) cleared bitset that the components found get enabled in
+ * < stop: component to stop searching at as soon as it is found (or -1 to find them all)
+ * > returns: whether "stop" was found
+ */
+static bool deg_reach_search_components(const DepsgraphReachability *reach, bool downstream, int c, int stop,
+                                        uint64_t *bits)
+{
+	const int *offsets = (downstream) ? reach->out_offsets : reach->in_offsets;
+	const int *targets = (downstream) ? reach->out_targets : reach->in_targets;
+	int *stack = MEM_mallocN(sizeof(int) * MAX2(reach->num_comps, 1), "DepsReach search stack");
+	bool found = false;
+	int sp = 0;
+	
+	stack[sp++] = c;
+	
+	while (sp && !found) {
+		int cur = stack[--sp];
+		int m, j;
+		
+		for (m = reach->comp_offsets[cur]; m < reach->comp_offsets[cur + 1]; m++) {
+			int i = reach->comp_members[m];
+			
+			for (j = offsets[i]; j < offsets[i + 1]; j++) {
+				int d = reach->comp_of[targets[j]];
+				
+				/* each component only gets pushed once, so the stack can't overflow */
+				if ((d != c) && !DEG_BITSET_TEST(bits, d)) {
+					DEG_BITSET_ENABLE(bits, d);
+					stack[sp++] = d;
+					
+					if (d == stop)
+						found = true;
+				}
+			}
+		}
+	}
+	
+	MEM_freeN(stack);
+	return found;
+}
+
+/* Check if the ID at index "from" affects the ID at index "to" (i.e. there's a chain of links between them) */
+bool DEG_reachability_test(const DepsgraphReachability *reach, int from, int to)
+{
+	int cfrom = reach->comp_of[from];
+	int cto = reach->comp_of[to];
+	
+	/* IDs in the same component all depend on each other, so long as there's more than one of them */
+	if (cfrom == cto) {
+		return (from != to) || ((reach->comp_offsets[cfrom + 1] - reach->comp_offsets[cfrom]) > 1);
+	}
+	
+	if (reach->descendants) {
+		return DEG_BITSET_TEST(DEG_REACH_COMP_BITS(reach, reach->descendants, cfrom), cto);
+	}
+	else {
+		/* components are in topological order, so nothing downstream of "from" can come before it */
+		uint64_t *bits;
+		bool found;
+		
+		if (cto < cfrom)
+			return false;
+		
+		bits = MEM_callocN(sizeof(uint64_t) * MAX2(reach->num_words, 1), "DepsReach test bits");
+		found = deg_reach_search_components(reach, true, cfrom, cto, bits);
+		MEM_freeN(bits);
+		
+		return found;
+	}
+}
+
+/* Enable the components downstream (or upstream) of component c in the given bitset
+ * < bits: (num_words) cleared bitset
+ */
+void DEG_reachability_comp_bits(const DepsgraphReachability *reach, bool downstream, int c, uint64_t *bits)
+{
+	const uint64_t *bitsets = (downstream) ? reach->descendants : reach->ancestors;
+	
+	if (bitsets) {
+		memcpy(bits, DEG_REACH_COMP_BITS(reach, bitsets, c), sizeof(uint64_t) * reach->num_words);
+	}
+	else {
+		deg_reach_search_components(reach, downstream, c, -1, bits);
+	}
+}
+
+/* Add ID-blocks in all the components set in the given bitset to list (in topological order)
+ * < skip: index of ID to leave out (i.e. the one being queried)
+ */
+size_t DEG_reachability_bits_to_list(const DepsgraphReachability *reach, const uint64_t *bits, int skip,
+                                     ListBase *result)
+{
+	size_t count = 0;
+	int w;
+	
+	/* only the non-empty words get looked at, so this is roughly proportional to the number of results */
+	for (w = 0; w < reach->num_words; w++) {
+		uint64_t word = bits[w];
+		
+		while (word) {
+			int c = (w * 64) + DEG_bitset_lowest_bit(word);
+			int m;
+			
+			for (m = reach->comp_offsets[c]; m < reach->comp_offsets[c + 1]; m++) {
+				int i = reach->comp_members[m];
+				
+				if (i != skip) {
+					BLI_addtail(result, BLI_genericNodeN(DEG_reachability_get_id(reach, i)));
+					count++;
+				}
+			}
+			
+			word &= word - 1;
+		}
+	}
+	
+	return count;
+}
+
+/* ************************************************** */
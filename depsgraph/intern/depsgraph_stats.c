@@ -0,0 +1,237 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2013 Blender Foundation.
+ * All rights reserved.
+ *
+ * Original Author: Joshua Leung
+ * Contributor(s): None Yet
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ *
+ * Memory usage statistics for Depsgraph instances
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MEM_guardedalloc.h"
+
+#include "BLI_blenlib.h"
+#include "BLI_ghash.h"
+#include "BLI_utildefines.h"
+
+#include "DNA_ID.h"
+#include "DNA_listBase.h"
+
+#include "BKE_depsgraph.h"
+
+#include "RNA_access.h"
+#include "RNA_types.h"
+
+#include "depsgraph_types.h"
+#include "depsgraph_intern.h"
+
+/* ************************************************** */
+/* Build-Time Tracking */
+
+/* Note that some memory was allocated for graph */
+void DEG_stats_mem_alloc(Depsgraph *graph, size_t size)
+{
+	/* peak only gets updated once staged changes are applied */
+	if (graph->staging) {
+		graph->staging->mem_used += size;
+		return;
+	}
+	
+	graph->mem_used += size;
+	
+	if (graph->mem_used > graph->mem_peak)
+		graph->mem_peak = graph->mem_used;
+}
+
+/* Note that some memory was released from graph */
+void DEG_stats_mem_free(Depsgraph *graph, size_t size)
+{
+	BLI_assert(graph->mem_used >= size);
+	graph->mem_used -= size;
+}
+
+/* ************************************************** */
+/* Memory Statistics Gathering */
+
+/* Estimate of memory used by a GHash
+ * NOTE: GHash internals aren't exposed, so this just assumes one
+ *       bucket pointer plus one 3-pointer entry per item, as the
+ *       bucket array is resized to keep roughly that load factor
+ */
+static size_t deg_stats_ghash_bytes(GHash *gh)
+{
+	const size_t header_size = sizeof(void *) * 4 + sizeof(int) * 4;
+	size_t num_entries;
+	
+	if (gh == NULL)
+		return 0;
+	
+	num_entries = (size_t)BLI_ghash_size(gh);
+	return header_size + num_entries * (sizeof(void *) + sizeof(void *) * 3);
+}
+
+/* Add a single node (but not any of the nodes it owns) to the stats */
+static void deg_stats_add_node(DepsgraphMemoryStats *stats, const DepsNode *node)
+{
+	const DepsNodeTypeInfo *nti = DEG_node_get_typeinfo(node);
+	const size_t size = (nti) ? nti->size : sizeof(DepsNode);
+	
+	if ((node->type >= 0) && (node->type < DEG_STATS_MAX_NODE_TYPES)) {
+		stats->node_count[node->type]++;
+		stats->node_bytes[node->type] += size;
+	}
+	
+	stats->total_nodes++;
+	stats->total_node_bytes += size;
+	
+	/* each relation is referenced by a LinkData at both of its ends */
+	stats->num_links += BLI_countlist(&node->inlinks) + BLI_countlist(&node->outlinks);
+}
+
+/* Add component node, and all its operations to the stats */
+static void deg_stats_add_component(DepsgraphMemoryStats *stats, const ComponentDepsNode *comp)
+{
+	const DepsNode *op;
+	int i;
+	
+	deg_stats_add_node(stats, &comp->nd);
+	stats->ghash_bytes += deg_stats_ghash_bytes(comp->op_hash);
+	
+	/* evaluation contexts */
+	for (i = 0; i < DEG_MAX_EVALUATION_CONTEXTS; i++) {
+		if (comp->contexts[i]) {
+			stats->eval_context_bytes += MEM_allocN_len(comp->contexts[i]);
+		}
+	}
+	
+	/* operations */
+	for (op = comp->ops.first; op; op = op->next) {
+		deg_stats_add_node(stats, op);
+	}
+	
+	/* pose component - bones are stored here instead of in the ID's component hash */
+	if (comp->nd.type == DEPSNODE_TYPE_EVAL_POSE) {
+		const PoseComponentDepsNode *pcomp = (const PoseComponentDepsNode *)comp;
+		GHashIterator hashIter;
+		
+		stats->ghash_bytes += deg_stats_ghash_bytes(pcomp->bone_hash);
+		
+		GHASH_ITER(hashIter, pcomp->bone_hash) {
+			const ComponentDepsNode *bone_comp = BLI_ghashIterator_getValue(&hashIter);
+			deg_stats_add_component(stats, bone_comp);
+		}
+	}
+}
+
+/* Gather statistics about the memory used by the given graph */
+void DEG_graph_memory_stats(const Depsgraph *graph, DepsgraphMemoryStats *stats)
+{
+	GHashIterator idHashIter;
+	
+	/* sanity checks */
+	if (stats == NULL)
+		return;
+	
+	memset(stats, 0, sizeof(DepsgraphMemoryStats));
+	
+	if (graph == NULL)
+		return;
+	
+	/* graph itself */
+	stats->graph_bytes = sizeof(Depsgraph);
+	stats->ghash_bytes += deg_stats_ghash_bytes(graph->id_hash);
+	stats->ghash_bytes += deg_stats_ghash_bytes(graph->relations_hash);
+	
+	/* root node (and its time source) */
+	if (graph->root_node) {
+		const RootDepsNode *root = (const RootDepsNode *)graph->root_node;
+		
+		deg_stats_add_node(stats, graph->root_node);
+		if (root->time_source) {
+			deg_stats_add_node(stats, &root->time_source->nd);
+		}
+	}
+	
+	/* ID nodes and their components */
+	GHASH_ITER(idHashIter, graph->id_hash) {
+		const DepsNode *node = BLI_ghashIterator_getValue(&idHashIter);
+		
+		deg_stats_add_node(stats, node);
+		
+		if (node->type == DEPSNODE_TYPE_ID_REF) {
+			const IDDepsNode *id_node = (const IDDepsNode *)node;
+			GHashIterator compHashIter;
+			
+			stats->ghash_bytes += deg_stats_ghash_bytes(id_node->component_hash);
+			
+			GHASH_ITER(compHashIter, id_node->component_hash) {
+				const ComponentDepsNode *comp = BLI_ghashIterator_getValue(&compHashIter);
+				deg_stats_add_component(stats, comp);
+			}
+		}
+	}
+	
+	/* relations */
+	stats->num_relations  = (size_t)BLI_ghash_size(graph->relations_hash);
+	stats->relation_bytes = stats->num_relations * sizeof(DepsRelation);
+	
+	/* links - node in/out links are counted with the nodes, but there are also graph-level lists */
+	stats->num_links += BLI_countlist(&graph->all_opnodes) + BLI_countlist(&graph->entry_tags);
+	stats->link_bytes = stats->num_links * sizeof(LinkData);
+	
+	/* totals */
+	stats->total_bytes = stats->graph_bytes + stats->total_node_bytes + stats->relation_bytes +
+	                     stats->link_bytes + stats->ghash_bytes + stats->eval_context_bytes;
+	
+	stats->peak_build_bytes = graph->mem_peak;
+}
+
+/* Print summary of memory statistics to the console */
+void DEG_graph_memory_stats_print(const DepsgraphMemoryStats *stats)
+{
+	int type;
+	
+	printf("Depsgraph Memory Usage:\n");
+	
+	for (type = 0; type < DEG_STATS_MAX_NODE_TYPES; type++) {
+		if (stats->node_count[type]) {
+			const DepsNodeTypeInfo *nti = DEG_get_node_typeinfo((eDepsNode_Type)type);
+			
+			printf("  %-32s %8u nodes  %10u bytes\n",
+			       (nti) ? nti->name : "<Unknown Type>",
+			       (unsigned int)stats->node_count[type], (unsigned int)stats->node_bytes[type]);
+		}
+	}
+	
+	printf("  %-32s %8u nodes  %10u bytes\n", "Total Nodes:", (unsigned int)stats->total_nodes, (unsigned int)stats->total_node_bytes);
+	printf("  %-32s %8u rels   %10u bytes\n", "Relations:", (unsigned int)stats->num_relations, (unsigned int)stats->relation_bytes);
+	printf("  %-32s %8u links  %10u bytes\n", "LinkData:", (unsigned int)stats->num_links, (unsigned int)stats->link_bytes);
+	printf("  %-32s %27u bytes\n", "GHash (Estimated):", (unsigned int)stats->ghash_bytes);
+	printf("  %-32s %27u bytes\n", "Evaluation Contexts:", (unsigned int)stats->eval_context_bytes);
+	printf("  %-32s %27u bytes\n", "Total:", (unsigned int)stats->total_bytes);
+	printf("  %-32s %27u bytes\n", "Peak During Build:", (unsigned int)stats->peak_build_bytes);
+}
+
+/* ************************************************** */
@@ -34,6 +34,7 @@
 
 #include "BLI_blenlib.h"
 #include "BLI_ghash.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
 #include "DNA_action_types.h"
@@ -197,6 +198,7 @@ static void dnti_id_ref__init_data(DepsNode *node, const ID *id, const char *UNU
 static void dnti_id_ref__hash_free_component(void *component_p)
 {
 	DEG_free_node((DepsNode *)component_p);
+	DEG_free_node_mem((DepsNode *)component_p);
 }
 
 /* Free 'id' node */
@@ -228,8 +230,10 @@ static void dnti_id_ref__copy_data(DepsgraphCopyContext *dcc, DepsNode *dst, con
 		/* make a copy of component */
 		DepsNode *component     = DEG_copy_node(dcc, old_component);
 		
+		component->owner = dst;
+		
 		/* add new node to hash... */
-		BLI_ghash_insert(dst_node->component_hash, SET_INT_IN_POINTER(c_type), old_component);
+		BLI_ghash_insert(dst_node->component_hash, SET_INT_IN_POINTER(c_type), component);
 	}
 	
 	// TODO: perform a second loop to fix up links?
@@ -247,6 +251,11 @@ static void dnti_id_ref__remove_from_graph(Depsgraph *graph, DepsNode *node)
 {
 	IDDepsNode *id_node = (IDDepsNode *)node;
 	
+	/* instances made by object would be left using it after it has gone */
+	if (GS(id_node->id->name) == ID_OB) {
+		DEG_graph_remove_instances(graph, (Object *)id_node->id);
+	}
+	
 	/* remove toplevel node and hash entry, but don't free... */
 	BLI_ghash_remove(graph->id_hash, id_node->id, NULL, NULL);
 }
@@ -355,6 +364,20 @@ static void dnti_subgraph__init_data(DepsNode *node, const ID *id, const char *U
 static void dnti_subgraph__free_data(DepsNode *node)
 {
 	SubgraphDepsNode *sgn = (SubgraphDepsNode *)node;
+	DepsgraphInstance *inst;
+	
+	/* free results of evaluating instances */
+	for (inst = sgn->instances.first; inst; inst = inst->next) {
+		if (inst->state) {
+			DEG_eval_state_free(inst->state);
+		}
+	}
+	BLI_freelistN(&sgn->instances);
+	
+	if (sgn->base_state) {
+		DEG_eval_state_free(sgn->base_state);
+		sgn->base_state = NULL;
+	}
 	
 	/* only free if graph not shared, of if this node is the first reference to it... */
 	// XXX: prune these flags a bit...
@@ -369,9 +392,16 @@ static void dnti_subgraph__free_data(DepsNode *node)
 static void dnti_subgraph__copy_data(DepsgraphCopyContext *dcc, DepsNode *dst, const DepsNode *src)
 {
 	//const SubgraphDepsNode *src_node = (const SubgraphDepsNode *)src;
-	//SubgraphDepsNode *dst_node       = (SubgraphDepsNode *)dst;
+	SubgraphDepsNode *dst_node       = (SubgraphDepsNode *)dst;
+	
+	/* for now, subgraph itself isn't copied, so the copy just refers to the original's one */
+	dst_node->flag |= SUBGRAPH_FLAG_SHARED;
+	dst_node->flag &= ~SUBGRAPH_FLAG_FIRSTREF;
 	
-	/* for now, subgraph itself isn't copied... */
+	/* instances belong to the graph that the original is in */
+	dst_node->instances.first = dst_node->instances.last = NULL;
+	dst_node->base_state = NULL;
+	dst_node->num_users = 0;
 }
 
 /* Add 'subgraph' node to graph */
@@ -439,7 +469,7 @@ static void dnti_component__init_data(DepsNode *node, const ID *UNUSED(id), cons
 	ComponentDepsNode *component = (ComponentDepsNode *)node;
 	
 	/* create op-node hash */
-	component->op_hash = BLI_ghash_str_new("DepsNode Component - Operations Hash");
+	component->op_hash = BLI_ghash_new(DEG_operation_key_hash, DEG_operation_key_cmp, "DepsNode Component - Operations Hash");
 	
 	/* hook up eval context? */
 	// XXX: maybe this needs a special API?
@@ -454,7 +484,7 @@ static void dnti_component__copy_data(DepsgraphCopyContext *dcc, DepsNode *dst,
 	DepsNode *dst_op, *src_op;
 	
 	/* create new op-node hash (to host the copied data) */
-	dst_node->op_hash = BLI_ghash_str_new("DepsNode Component - Operations Hash (Copy)");
+	dst_node->op_hash = BLI_ghash_new(DEG_operation_key_hash, DEG_operation_key_cmp, "DepsNode Component - Operations Hash (Copy)");
 	
 	/* duplicate list of operation nodes */
 	BLI_duplicatelist(&dst_node->ops, &src_node->ops);
@@ -468,13 +498,24 @@ static void dnti_component__copy_data(DepsgraphCopyContext *dcc, DepsNode *dst,
 		/* recursive copy */
 		if (nti && nti->copy_data)
 			nti->copy_data(dcc, dst_op, src_op);
-			
-		/* fix links... */
-		// ...
+		
+		/* add to hash - key is copied as part of the operation node */
+		BLI_ghash_insert(dst_node->op_hash, &((OperationDepsNode *)dst_op)->key, dst_op);
+		
+		/* fix links... 
+		 * NOTE: relations get copied separately, by whatever is copying the nodes,
+		 *       so just note which node this is a copy of
+		 */
+		dst_op->owner = dst;
+		dst_op->flag &= ~DEPSNODE_FLAG_IN_ARENA;
+		dst_op->inlinks.first = dst_op->inlinks.last = NULL;
+		dst_op->outlinks.first = dst_op->outlinks.last = NULL;
+		
+		BLI_ghash_insert(dcc->nodes_hash, src_op, dst_op);
 	}
 	
-	/* copy evaluation contexts */
-	//
+	/* evaluation contexts aren't shared, so the copy gets its own once it is evaluated */
+	memset(dst_node->contexts, 0, sizeof(dst_node->contexts));
 }
 
 /* Free 'component' node */
@@ -488,12 +529,16 @@ static void dnti_component__free_data(DepsNode *node)
 		next = op->next;
 		
 		DEG_free_node(op);
-		BLI_freelinkN(&component->ops, op);
+		BLI_remlink(&component->ops, op);
+		DEG_free_node_mem(op);
 	}
 	
 	/* free hash too - no need to free as it should be empty now */
 	BLI_ghash_free(component->op_hash, NULL, NULL);
 	component->op_hash = NULL;
+	
+	/* evaluation contexts are kept for as long as the component exists */
+	DEG_node_evaluation_contexts_free(component);
 }
 
 /* Add 'component' node to graph */
@@ -615,7 +660,7 @@ static DepsNodeTypeInfo DNTI_PROXY = {
 /* Geometry */
 static DepsNodeTypeInfo DNTI_GEOMETRY = {
 	/* type */               DEPSNODE_TYPE_GEOMETRY,
-	/* size */               sizeof(ComponentDepsNode),
+	/* size */               sizeof(GeometryComponentDepsNode),
 	/* name */               "Geometry Component",
 	
 	/* init_data() */        dnti_component__init_data,
@@ -663,7 +708,7 @@ static void dnti_pose_eval__init_data(DepsNode *node, const ID *id, const char *
 	dnti_component__init_data(node, id, NULL);
 	
 	/* pose-specific data... */
-	pcomp->bone_hash = BLI_ghash_str_new("Pose Component Bone Hash"); /* <String, BoneNode> */
+	pcomp->bone_hash = BLI_ghash_str_new("Pose Component Bone Hash"); /* <bone name, BoneNode> */
 }
 
 /* Copy 'component' node */
@@ -672,11 +717,27 @@ static void dnti_pose_eval__copy_data(DepsgraphCopyContext *dcc, DepsNode *dst,
 	const PoseComponentDepsNode *src_node = (const PoseComponentDepsNode *)src;
 	PoseComponentDepsNode *dst_node       = (PoseComponentDepsNode *)dst;
 	
+	GHashIterator hashIter;
+	
 	/* generic component node... */
 	dnti_component__copy_data(dcc, dst, src);
 	
 	/* pose-specific data... */
-	// copy bonehash...
+	dst_node->bone_hash = BLI_ghash_str_new("Pose Component Bone Hash (Copy)"); /* <bone name, BoneNode> */
+	
+	GHASH_ITER(hashIter, src_node->bone_hash) {
+		DepsNode *bone_comp = DEG_copy_node(dcc, BLI_ghashIterator_getValue(&hashIter));
+		
+		bone_comp->owner = dst;
+		BLI_ghash_insert(dst_node->bone_hash, bone_comp->name, bone_comp);
+	}
+}
+
+/* Helper for freeing bone components - Used by bone hash to free data... */
+static void dnti_pose_eval__hash_free_bone(void *bone_p)
+{
+	DEG_free_node((DepsNode *)bone_p);
+	DEG_free_node_mem((DepsNode *)bone_p);
 }
 
 /* Free 'component' node */
@@ -685,7 +746,7 @@ static void dnti_pose_eval__free_data(DepsNode *node)
 	PoseComponentDepsNode *pcomp = (PoseComponentDepsNode *)node;
 	
 	/* pose-specific data... */
-	BLI_ghash_free(pcomp->bone_hash, NULL, /*dnti_pose_eval__hash_free_bone*/NULL);
+	BLI_ghash_free(pcomp->bone_hash, NULL, dnti_pose_eval__hash_free_bone);
 	
 	/* generic component node... */
 	dnti_component__free_data(node);
@@ -713,23 +774,23 @@ static void dnti_pose_eval__validate_links(Depsgraph *graph, DepsNode *node)
 		/* create standard pose evaluation start/end hooks */
 		rebuild_op = DEG_add_operation(graph, id, NULL, DEPSNODE_TYPE_OP_POSE,
 		                               DEPSOP_TYPE_REBUILD, BKE_pose_rebuild_op,
-		                               "Rebuild Pose");
+		                               DEG_OPNAME_POSE_REBUILD);
 		RNA_pointer_create(id, &RNA_Pose, ob->pose, &rebuild_op->ptr);
 		
 		init_op = DEG_add_operation(graph, id, NULL, DEPSNODE_TYPE_OP_POSE,
 		                            DEPSOP_TYPE_INIT, BKE_pose_eval_init,
-		                            "Init Pose Eval");
+		                            DEG_OPNAME_POSE_INIT);
 		RNA_pointer_create(id, &RNA_Pose, ob->pose, &init_op->ptr);
 		
 		cleanup_op = DEG_add_operation(graph, id, NULL, DEPSNODE_TYPE_OP_POSE,
 		                               DEPSOP_TYPE_POST, BKE_pose_eval_flush,
-		                               "Flush Pose Eval");
+		                               DEG_OPNAME_POSE_FLUSH);
 		RNA_pointer_create(id, &RNA_Pose, ob->pose, &cleanup_op->ptr);
 		
 		
 		/* attach links between these operations */
-		DEG_add_new_relation(&rebuild_op->nd, &init_op->nd,    DEPSREL_TYPE_COMPONENT_ORDER, "[Pose Rebuild -> Pose Init] DepsRel");
-		DEG_add_new_relation(&init_op->nd,    &cleanup_op->nd, DEPSREL_TYPE_COMPONENT_ORDER, "[Pose Init -> Pose Cleanup] DepsRel");
+		DEG_add_new_relation(graph, &rebuild_op->nd, &init_op->nd,    DEPSREL_TYPE_COMPONENT_ORDER, "[Pose Rebuild -> Pose Init] DepsRel");
+		DEG_add_new_relation(graph, &init_op->nd,    &cleanup_op->nd, DEPSREL_TYPE_COMPONENT_ORDER, "[Pose Init -> Pose Cleanup] DepsRel");
 		
 		/* NOTE: bones will attach themselves to these endpoints */
 	}
@@ -774,17 +835,27 @@ static DepsNodeTypeInfo DNTI_EVAL_POSE = {
 /* Initialise 'bone component' node - from pointer data given */
 static void dnti_bone__init_data(DepsNode *node, const ID *id, const char subdata[MAX_NAME])
 {
-	BoneComponentDepsNode *bone_node = (BoneComponentDepsNode *)node;
-	Object *ob = (Object *)id;
-	
 	/* generic component-node... */
 	dnti_component__init_data(node, id, subdata);
 	
-	/* name of component comes is bone name */
+	/* name of component comes is bone name 
+	 * NOTE: the bone itself is set by the builder, or gets found once it's needed (see dnti_bone__get_pchan())
+	 */
 	BLI_strncpy(node->name, subdata, MAX_NAME);
+}
+
+/* Get the bone that bone component is for, finding it by name if the builder hasn't set it 
+ * (i.e. component was made as the target of a relation, before the rig itself was built)
+ */
+static bPoseChannel *dnti_bone__get_pchan(BoneComponentDepsNode *bone_node)
+{
+	if ((bone_node->pchan == NULL) && bone_node->nd.owner && bone_node->nd.owner->owner) {
+		Object *ob = (Object *)((IDDepsNode *)bone_node->nd.owner->owner)->id;
+		
+		bone_node->pchan = BKE_pose_channel_find_name(ob->pose, bone_node->nd.name);
+	}
 	
-	/* bone-specific node data */
-	bone_node->pchan = BKE_pose_channel_find_name(ob->pose, subdata);
+	return bone_node->pchan;
 }
 
 /* Add 'bone component' node to graph */
@@ -824,29 +895,28 @@ static void dnti_bone__validate_links(Depsgraph *graph, DepsNode *node)
 {
 	PoseComponentDepsNode *pcomp = (PoseComponentDepsNode *)node->owner;
 	BoneComponentDepsNode *bcomp = (BoneComponentDepsNode *)node;
-	bPoseChannel *pchan = bcomp->pchan;
+	bPoseChannel *pchan = dnti_bone__get_pchan(bcomp);
 	
-	DepsNode *btrans_op = BLI_ghash_lookup(bcomp->op_hash, "Bone Transforms");
+	DepsNode *btrans_op = DEG_component_find_operation((ComponentDepsNode *)bcomp, DEPSNODE_TYPE_OP_BONE, 
+	                                                   DEG_OPNAME_BONE_TRANSFORMS, NULL);
 	DepsNode *final_op = NULL;  /* normal final-evaluation operation */
 	DepsNode *ik_op = NULL;     /* IK Solver operation */
 	
 	/* link bone/component to pose "sources" if it doesn't have any obvious dependencies */
 	if (pchan->parent == NULL) {
-		DepsNode *pinit_op = BLI_ghash_lookup(pcomp->op_hash, "Init Pose Eval");
-		DEG_add_new_relation(pinit_op, btrans_op, DEPSREL_TYPE_OPERATION, "PoseEval Source-Bone Link");
+		DepsNode *pinit_op = DEG_component_find_operation((ComponentDepsNode *)pcomp, DEPSNODE_TYPE_OP_POSE,
+		                                                  DEG_OPNAME_POSE_INIT, NULL);
+		DEG_add_new_relation(graph, pinit_op, btrans_op, DEPSREL_TYPE_OPERATION, "PoseEval Source-Bone Link");
 	}
 	
-	/* inlinks destination should all go to the "Bone Transforms" operation */
+	/* inlinks destination should all go to the "Bone Transforms" operation 
+	 * NOTE: new op-level relations are added here instead of redirecting the existing ones, 
+	 *       since the component-level links are still used for querying. Any links which
+	 *       exist already get merged by DEG_add_new_relation().
+	 */
 	DEPSNODE_RELATIONS_ITER_BEGIN(node->inlinks.first, rel)
 	{
-		/* redirect destination pointer */
-		rel->to = btrans_op;
-		
-		/* ensure that transform operation knows it has this link now */
-		/* XXX: for now, we preserve the link to the component, so that querying is easier
-		 *      But, this also ends up making more work when flushing updates...
-		 */
-		DEG_add_relation(rel);
+		DEG_add_new_relation(graph, rel->from, btrans_op, rel->type, rel->name);
 	}
 	DEPSNODE_RELATIONS_ITER_END;
 	
@@ -858,7 +928,8 @@ static void dnti_bone__validate_links(Depsgraph *graph, DepsNode *node)
 	 */
 	if (pchan->constraints.first) {
 		/* find constraint stack operation */
-		final_op = BLI_ghash_lookup(bcomp->op_hash, "Constraint Stack");
+		final_op = DEG_component_find_operation((ComponentDepsNode *)bcomp, DEPSNODE_TYPE_OP_BONE,
+		                                        DEG_OPNAME_CONSTRAINT_STACK, NULL);
 	}
 	else {
 		/* just normal transforms */
@@ -873,47 +944,37 @@ static void dnti_bone__validate_links(Depsgraph *graph, DepsNode *node)
 		 * take the first one that comes (during a first pass)
 		 * (XXX: there's potential here for problems with forked trees) 
 		 */
-		if (strcmp(rel->name, "IK Solver Update") == 0) {
+		if (strstr(rel->name, "IK Solver Update")) {
 			ik_op = rel->to;
 			break;
 		}
 	}
 	DEPSNODE_RELATIONS_ITER_END;
 	
-	/* fix up outlink refs */
+	/* add op-level versions of outlinks */
 	DEPSNODE_RELATIONS_ITER_BEGIN(node->outlinks.first, rel)
 	{
-		if (ik_op) {
-			/* bone is part of IK Chain... */
-			if (rel->to == ik_op) {
-				/* can't have ik to ik, so use final "normal" bone transform 
-				 * as indicator to IK Solver that it is ready to run 
-				 */
-				rel->from = final_op;
-			}
-			else {
-				/* everything which depends on result of this bone needs to know 
-				 * about the IK result too!
-				 */
-				rel->from = ik_op;
-			}
-		}
-		else {
-			/* bone is not part of IK Chains... */
-			rel->from = final_op;
-		}
+		DepsNode *from = final_op;
 		
-		/* XXX: for now, we preserve the link to the component, so that querying is easier
-		 *      But, this also ends up making more work when flushing updates...
+		/* bone is part of IK Chain...
+		 * - can't have ik to ik, so use final "normal" bone transform 
+		 *   as indicator to IK Solver that it is ready to run 
+		 * - everything else which depends on result of this bone needs 
+		 *   to know about the IK result too!
 		 */
-		DEG_add_relation(rel);
+		if (ik_op && (rel->to != ik_op)) {
+			from = ik_op;
+		}
+		
+		DEG_add_new_relation(graph, from, rel->to, rel->type, rel->name);
 	}
 	DEPSNODE_RELATIONS_ITER_END;
 	
 	/* link bone/component to pose "sinks" as final link, unless it has obvious quirks */
 	{
-		DepsNode *ppost_op = BLI_ghash_lookup(pcomp->op_hash, "Cleanup Pose Eval");
-		DEG_add_new_relation(final_op, ppost_op, DEPSREL_TYPE_OPERATION, "PoseEval Sink-Bone Link");
+		DepsNode *ppost_op = DEG_component_find_operation((ComponentDepsNode *)pcomp, DEPSNODE_TYPE_OP_POSE,
+		                                                  DEG_OPNAME_POSE_FLUSH, NULL);
+		DEG_add_new_relation(graph, final_op, ppost_op, DEPSREL_TYPE_OPERATION, "PoseEval Sink-Bone Link");
 	}
 }
 
@@ -952,7 +1013,7 @@ static void dnti_operation__add_to_graph(Depsgraph *graph, DepsNode *node,
 	ComponentDepsNode *component = (ComponentDepsNode *)comp_node;
 	
 	/* add to hash and list */
-	BLI_ghash_insert(component->op_hash, node->name, node);
+	BLI_ghash_insert(component->op_hash, &((OperationDepsNode *)node)->key, node);
 	BLI_addtail(&component->ops, node);
 	
 	/* add backlink to component */
@@ -963,10 +1024,10 @@ static void dnti_operation__add_to_graph(Depsgraph *graph, DepsNode *node,
 static void dnti_operation__remove_from_graph(Depsgraph *UNUSED(graph), DepsNode *node)
 {
 	if (node->owner) {
-		ComponentDepsNode *component = (ComponentDepsNode *)node;
+		ComponentDepsNode *component = (ComponentDepsNode *)node->owner;
 		
 		/* remove node from hash and list */
-		BLI_ghash_remove(component->op_hash, node->name, NULL, NULL);
+		BLI_ghash_remove(component->op_hash, &((OperationDepsNode *)node)->key, NULL, NULL);
 		BLI_remlink(&component->ops, node);
 		
 		/* remove backlink */
@@ -1248,7 +1309,7 @@ static void dnti_op_bone__add_to_graph(Depsgraph *graph, DepsNode *node, const I
 	bone_comp = (BoneComponentDepsNode *)DEG_get_node(graph, id, pchan->name, DEPSNODE_TYPE_BONE, NULL);
 	
 	/* add to hash and list as per usual */
-	BLI_ghash_insert(bone_comp->op_hash, pchan->name, node);
+	BLI_ghash_insert(bone_comp->op_hash, &bone_op->key, node);
 	BLI_addtail(&bone_comp->ops, node);
 	
 	/* add backlink to component */
@@ -1349,6 +1410,177 @@ static DepsNodeTypeInfo DNTI_OP_RIGIDBODY = {
  */
 static GHash *_depsnode_typeinfo_registry = NULL;
 
+/* Global name registry */
+
+/* Well-known operation names */
+const char DEG_OPNAME_CONSTRAINT_STACK[]   = "Constraint Stack";
+const char DEG_OPNAME_IK_SOLVER[]          = "IK Solver";
+const char DEG_OPNAME_SPLINE_IK_SOLVER[]   = "Spline IK Solver";
+const char DEG_OPNAME_BONE_TRANSFORMS[]    = "Bone Transforms";
+
+const char DEG_OPNAME_POSE_REBUILD[]       = "Rebuild Pose";
+const char DEG_OPNAME_POSE_INIT[]          = "Init Pose Eval";
+const char DEG_OPNAME_POSE_FLUSH[]         = "Flush Pose Eval";
+
+const char DEG_OPNAME_LOCAL_TRANSFORM[]    = "BKE_object_eval_local_transform";
+const char DEG_OPNAME_PARENT[]             = "BKE_object_eval_parent";
+const char DEG_OPNAME_GEOMETRY_EVAL[]      = "Geometry Eval";
+const char DEG_OPNAME_PATH[]               = "Path";
+const char DEG_OPNAME_DRIVER[]             = "Driver";
+const char DEG_OPNAME_PSYS_EVAL[]          = "PSys Eval";
+
+const char DEG_OPNAME_RIGIDBODY_REBUILD[]  = "Rigidbody World Rebuild";
+const char DEG_OPNAME_RIGIDBODY_SIM[]      = "Rigidbody World Do Simulation";
+const char DEG_OPNAME_RIGIDBODY_OB_SYNC[]  = "RigidBodyObject Sync";
+
+static const char *_depsgraph_builtin_names[] = {
+	DEG_OPNAME_CONSTRAINT_STACK,
+	DEG_OPNAME_IK_SOLVER,
+	DEG_OPNAME_SPLINE_IK_SOLVER,
+	DEG_OPNAME_BONE_TRANSFORMS,
+	
+	DEG_OPNAME_POSE_REBUILD,
+	DEG_OPNAME_POSE_INIT,
+	DEG_OPNAME_POSE_FLUSH,
+	
+	DEG_OPNAME_LOCAL_TRANSFORM,
+	DEG_OPNAME_PARENT,
+	DEG_OPNAME_GEOMETRY_EVAL,
+	DEG_OPNAME_PATH,
+	DEG_OPNAME_DRIVER,
+	DEG_OPNAME_PSYS_EVAL,
+	
+	DEG_OPNAME_RIGIDBODY_REBUILD,
+	DEG_OPNAME_RIGIDBODY_SIM,
+	DEG_OPNAME_RIGIDBODY_OB_SYNC,
+	
+	NULL
+};
+
+/* NOTE: Names used to identify operations are interned here, so that operation
+ * lookups only need to hash/compare pointers instead of whole strings. There are
+ * two hashes: one from the string to its canonical copy, and a set of the canonical 
+ * copies, which lets names which have already been interned get resolved without
+ * hashing the string again (i.e. the DEG_OPNAME_* names above)
+ *
+ * Canonical copies never change or go away while the registry exists, so each thread
+ * also remembers the ones it has come across. Passing these in again then doesn't
+ * need the lock (which all threads building graphs would otherwise be fighting over).
+ */
+static GHash *_depsgraph_name_registry = NULL;  /* <String, String> name string -> canonical copy of name */
+static GHash *_depsgraph_name_ptrs = NULL;      /* <String, bool> canonical copy of name -> whether it was allocated by us */
+static SpinLock _depsgraph_name_lock;           /* graphs may be built on several threads at once */
+static int _depsgraph_name_generation = 0;      /* bumped when registry is freed, so that threads forget the names they've seen */
+
+/* canonical copies of names which current thread has come across (by address) */
+#define DEG_NAME_THREAD_CACHE_SIZE 256
+static DEG_THREAD_LOCAL const char *deg_name_thread_cache[DEG_NAME_THREAD_CACHE_SIZE];
+static DEG_THREAD_LOCAL int deg_name_thread_generation = 0;
+
+/* Get slot in current thread's cache that name would be in */
+static const char **deg_name_thread_cache_slot(const char *name)
+{
+	const uintptr_t addr = (uintptr_t)name;
+	
+	/* forget names from before registry was last freed */
+	if (deg_name_thread_generation != _depsgraph_name_generation) {
+		memset(deg_name_thread_cache, 0, sizeof(deg_name_thread_cache));
+		deg_name_thread_generation = _depsgraph_name_generation;
+	}
+	
+	return &deg_name_thread_cache[(addr ^ (addr >> 8)) & (DEG_NAME_THREAD_CACHE_SIZE - 1)];
+}
+
+/* Initialise name registry, and add the built-in names */
+static void deg_name_registry_init(void)
+{
+	const char **name;
+	
+	_depsgraph_name_registry = BLI_ghash_str_new("Depsgraph Name Registry");
+	_depsgraph_name_ptrs = BLI_ghash_ptr_new("Depsgraph Name Registry - Pointers");
+	BLI_spin_init(&_depsgraph_name_lock);
+	
+	for (name = _depsgraph_builtin_names; *name; name++) {
+		BLI_ghash_insert(_depsgraph_name_registry, (void *)*name, (void *)*name);
+		BLI_ghash_insert(_depsgraph_name_ptrs, (void *)*name, SET_INT_IN_POINTER(false));
+	}
+}
+
+/* Free name registry, and all names that were added to it */
+static void deg_name_registry_free(void)
+{
+	GHashIterator hashIter;
+	
+	GHASH_ITER(hashIter, _depsgraph_name_ptrs) {
+		if (GET_INT_FROM_POINTER(BLI_ghashIterator_getValue(&hashIter))) {
+			MEM_freeN(BLI_ghashIterator_getKey(&hashIter));
+		}
+	}
+	
+	BLI_ghash_free(_depsgraph_name_ptrs, NULL, NULL);
+	BLI_ghash_free(_depsgraph_name_registry, NULL, NULL);
+	_depsgraph_name_ptrs = NULL;
+	_depsgraph_name_registry = NULL;
+	_depsgraph_name_generation++;
+	
+	BLI_spin_end(&_depsgraph_name_lock);
+}
+
+/* Find canonical copy of name, optionally adding it if it doesn't exist yet */
+static const char *deg_name_registry_lookup(const char *name, const bool add)
+{
+	const char *result = NULL;
+	const char **cached;
+	
+	if (name == NULL)
+		return NULL;
+	
+	/* fastest path: thread has already come across name as the canonical copy */
+	cached = deg_name_thread_cache_slot(name);
+	if (*cached == name)
+		return name;
+	
+	BLI_spin_lock(&_depsgraph_name_lock);
+	
+	/* fast path: name is already the canonical copy */
+	if (BLI_ghash_haskey(_depsgraph_name_ptrs, name)) {
+		result = name;
+	}
+	else {
+		/* slow path: find canonical copy by hashing the string */
+		result = BLI_ghash_lookup(_depsgraph_name_registry, name);
+		
+		if ((result == NULL) && (add)) {
+			char *copy = BLI_strdup(name);
+			
+			BLI_ghash_insert(_depsgraph_name_registry, copy, copy);
+			BLI_ghash_insert(_depsgraph_name_ptrs, copy, SET_INT_IN_POINTER(true));
+			result = copy;
+		}
+	}
+	
+	BLI_spin_unlock(&_depsgraph_name_lock);
+	
+	/* canonical copy can be resolved without locking next time */
+	if (result) {
+		*deg_name_thread_cache_slot(result) = result;
+	}
+	
+	return result;
+}
+
+/* Get the canonical copy of name, adding it to registry if needed */
+const char *DEG_name_intern(const char *name)
+{
+	return deg_name_registry_lookup(name, true);
+}
+
+/* Get the canonical copy of name, but only if it has been registered already */
+const char *DEG_name_find_interned(const char *name)
+{
+	return deg_name_registry_lookup(name, false);
+}
+
 /* Registration ------------------------------------------- */
 
 /* Register node type */
@@ -1364,8 +1596,9 @@ void DEG_register_node_typeinfo(DepsNodeTypeInfo *typeinfo)
 /* Register all node types */
 void DEG_register_node_types(void)
 {
-	/* initialise registry */
+	/* initialise registries */
 	_depsnode_typeinfo_registry = BLI_ghash_int_new("Depsgraph Node Type Registry");
+	deg_name_registry_init();
 	
 	/* register node types */
 	/* GENERIC */
@@ -1410,6 +1643,8 @@ void DEG_register_node_types(void)
 void DEG_free_node_types(void)
 {
 	BLI_ghash_free(_depsnode_typeinfo_registry, NULL, NULL);
+	
+	deg_name_registry_free();
 }
 
 /* Getters ------------------------------------------------- */